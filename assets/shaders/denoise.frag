@@ -0,0 +1,197 @@
+#version 330 core
+// Edge-avoiding a-trous denoiser, the same filter as ATrousDenoiser in
+// Denoiser.cpp. Pass -1 divides the albedo out of the accumulated color and
+// estimates each pixel's noise, the passes after it blend 5x5 taps
+// 2^pass pixels apart. Lighting and its variance travel in rgb and alpha.
+out vec4 FragColor;
+
+uniform int denoisePass;
+uniform bool remodulate; // Multiply the albedo back, on the last pass
+uniform sampler2D accumulationTex; // Accumulated color
+uniform sampler2D momentsTex; // Luminance mean, mean of squares, count
+uniform sampler2D albedoDepthTex; // First-hit albedo, distance (0: miss)
+uniform sampler2D normalTex; // First-hit normal
+uniform sampler2D lightingTex; // Previous pass: lighting, variance
+uniform float colorPhi;
+uniform float normalPhi;
+uniform float depthPhi;
+uniform float minMomentSamples;
+uniform vec2 imageSize; // Pixels traced, from the bottom-left corner
+
+// B3-spline taps of the a-trous kernel, in each direction
+const float c_kernel[5]
+    = float[5](1.0 / 16.0, 1.0 / 4.0, 3.0 / 8.0, 1.0 / 4.0, 1.0 / 16.0);
+const float c_gaussian[2] = float[2](0.25, 0.125);
+// Depth tolerance left when the gradient predicts no change, relative to
+// the depth
+const float c_depthEpsilon = 0.005;
+const float c_superFar = 10000.0;
+
+ivec2 g_size;
+
+float Luminance(vec3 color)
+{
+    return dot(color, vec3(0.2126, 0.7152, 0.0722));
+}
+
+bool Inside(ivec2 p)
+{
+    return all(greaterThanEqual(p, ivec2(0))) && all(lessThan(p, g_size));
+}
+
+// Per-channel factor the albedo divides out, 1 where it is black
+vec3 Demodulation(vec3 albedo)
+{
+    return mix(vec3(1.0), albedo, vec3(greaterThan(albedo, vec3(0.001))));
+}
+
+float Depth(ivec2 p) { return texelFetch(albedoDepthTex, p, 0).w; }
+
+// Depth change per pixel along axis. The smaller one-sided difference is
+// kept so silhouettes do not count as slopes.
+float DepthSlope(ivec2 p, ivec2 axis)
+{
+    float depth = Depth(p);
+    if (depth <= 0.0) {
+        return 0.0;
+    }
+    float slope = c_superFar;
+    for (int side = -1; side <= 1; side += 2) {
+        ivec2 q = p + axis * side;
+        float depthQ = Inside(q) ? Depth(q) : 0.0;
+        if (depthQ > 0.0) {
+            float d = (depthQ - depth) * float(side);
+            slope = abs(d) < abs(slope) ? d : slope;
+        }
+    }
+    return slope == c_superFar ? 0.0 : slope;
+}
+
+// Normal and depth weight of tap q, offset pixels away from p
+float GeometryWeight(ivec2 p, ivec2 q, vec2 gradient)
+{
+    float depthP = Depth(p);
+    float depthQ = Depth(q);
+    // Misses only blend with misses
+    bool missP = depthP <= 0.0;
+    bool missQ = depthQ <= 0.0;
+    if (missP || missQ) {
+        return missP == missQ ? 1.0 : 0.0;
+    }
+
+    float cosNormals = max(0.0,
+        dot(texelFetch(normalTex, p, 0).xyz, texelFetch(normalTex, q, 0).xyz));
+    float tolerance = depthPhi * abs(dot(gradient, vec2(q - p)))
+        + c_depthEpsilon * depthP;
+    return pow(cosNormals, normalPhi) * exp(-abs(depthP - depthQ) / tolerance);
+}
+
+vec3 Lighting(ivec2 p)
+{
+    return texelFetch(accumulationTex, p, 0).rgb
+        / Demodulation(texelFetch(albedoDepthTex, p, 0).rgb);
+}
+
+// Variance of the pixel's mean lighting luminance, from its moments scaled
+// by the albedo divided out, or from its neighborhood on its own surface
+// until it has enough samples
+float EstimateVariance(ivec2 p, vec2 gradient)
+{
+    vec4 moments = texelFetch(momentsTex, p, 0);
+    if (moments.z >= minMomentSamples) {
+        float scale
+            = Luminance(Demodulation(texelFetch(albedoDepthTex, p, 0).rgb));
+        return max(0.0, moments.y - moments.x * moments.x) / moments.z
+            / (scale * scale);
+    }
+    float weightSum = 0.0;
+    float m1 = 0.0;
+    float m2 = 0.0;
+    for (int dy = -2; dy <= 2; dy++) {
+        for (int dx = -2; dx <= 2; dx++) {
+            ivec2 q = p + ivec2(dx, dy);
+            if (!Inside(q)) {
+                continue;
+            }
+            float weight = GeometryWeight(p, q, gradient);
+            float l = Luminance(Lighting(q));
+            weightSum += weight;
+            m1 += weight * l;
+            m2 += weight * l * l;
+        }
+    }
+    m1 /= weightSum;
+    m2 /= weightSum;
+    return max(0.0, m2 - m1 * m1);
+}
+
+// 3x3 Gaussian blur of the previous pass's variance
+float BlurredVariance(ivec2 p)
+{
+    float sum = 0.0;
+    float weightSum = 0.0;
+    for (int dy = -1; dy <= 1; dy++) {
+        for (int dx = -1; dx <= 1; dx++) {
+            ivec2 q = p + ivec2(dx, dy);
+            if (!Inside(q)) {
+                continue;
+            }
+            float weight = c_gaussian[abs(dx)] * c_gaussian[abs(dy)];
+            sum += texelFetch(lightingTex, q, 0).a * weight;
+            weightSum += weight;
+        }
+    }
+    return sum / weightSum;
+}
+
+// One a-trous pass with taps stepWidth pixels apart
+vec4 Filter(ivec2 p, int stepWidth, vec2 gradient)
+{
+    vec4 center = texelFetch(lightingTex, p, 0);
+    float luminanceP = Luminance(center.rgb);
+    float luminanceTolerance = colorPhi * sqrt(BlurredVariance(p)) + 1e-4;
+
+    float centerWeight = c_kernel[2] * c_kernel[2];
+    vec3 sum = center.rgb * centerWeight;
+    float weightSum = centerWeight;
+    float varianceSum = center.a * centerWeight * centerWeight;
+    for (int dy = -2; dy <= 2; dy++) {
+        for (int dx = -2; dx <= 2; dx++) {
+            ivec2 q = p + ivec2(dx, dy) * stepWidth;
+            if ((dx == 0 && dy == 0) || !Inside(q)) {
+                continue;
+            }
+            vec4 tap = texelFetch(lightingTex, q, 0);
+            float weight = c_kernel[dx + 2] * c_kernel[dy + 2]
+                * GeometryWeight(p, q, gradient)
+                * exp(-abs(luminanceP - Luminance(tap.rgb))
+                    / luminanceTolerance);
+            sum += tap.rgb * weight;
+            weightSum += weight;
+            varianceSum += tap.a * weight * weight;
+        }
+    }
+    return vec4(sum / weightSum, varianceSum / (weightSum * weightSum));
+}
+
+void main()
+{
+    g_size = ivec2(imageSize);
+    ivec2 p = ivec2(gl_FragCoord.xy);
+    vec2 gradient
+        = vec2(DepthSlope(p, ivec2(1, 0)), DepthSlope(p, ivec2(0, 1)));
+
+    vec4 result;
+    if (denoisePass < 0) {
+        result = vec4(Lighting(p), EstimateVariance(p, gradient));
+    } else {
+        result = Filter(p, 1 << denoisePass, gradient);
+    }
+
+    if (remodulate) {
+        result = vec4(
+            result.rgb * Demodulation(texelFetch(albedoDepthTex, p, 0).rgb),
+            1.0);
+    }
+    FragColor = result;
+}
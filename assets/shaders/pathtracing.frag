@@ -1,17 +1,36 @@
 #version 330 core
-out vec4 FragColor;
+layout(location = 0) out vec4 FragColor;
+// Luminance moments: mean, mean of squares, sample count, converged flag
+layout(location = 1) out vec4 FragMoments;
+// First surface the pixel's camera rays hit, for the denoiser
+layout(location = 2) out vec4 FragAlbedoDepth; // Albedo, distance (0: miss)
+layout(location = 3) out vec4 FragNormal;
 in vec3 FragPos;
 uniform vec3 viewPos;
 uniform mat3 viewRotationMatrix; // Precomputed rotation matrix from CPU
 uniform float aspectRatio; // width / height
 uniform float focalLength; // Precomputed from FOV on CPU
 uniform int iFrame;
+// Pixels traced, in the bottom-left corner of the accumulation buffers
+uniform vec2 renderSize;
+uniform vec2 previousRenderSize;
 uniform sampler2D previousFrame; // Previous frame's accumulated color
+uniform sampler2D previousMoments; // Previous frame's luminance moments
+uniform sampler2D previousAlbedoDepth; // Previous frame's first-hit albedo
+uniform sampler2D previousNormal; // Previous frame's first-hit normal
+uniform bool adaptiveSampling; // Skip pixels whose noise is low enough
+uniform float noiseThreshold; // Relative standard error counted as converged
+// The camera moved since the previous frame, whose pixels are looked up
+// through these instead of the current camera
+uniform bool reproject;
+uniform vec3 previousViewPos;
+uniform mat3 previousViewRotationMatrix;
+uniform float previousAspectRatio;
+uniform float previousFocalLength;
 uniform sampler2D
     triangleGeomTex; // Geometry: v0, v1, v2, normal (3 pixels per triangle)
-uniform sampler2D triangleMaterialTex; // Materials: color, emissive, specular
-                                       // (3 pixels per triangle)
-uniform int numTriangles;
+uniform sampler2D materialTex; // Mesh materials: color, emissive, specular
+                               // (4 pixels per row)
 
 uniform sampler2D
     sphereGeomTex; // Geometry: center.xyz, radius (1 pixel per sphere)
@@ -26,9 +45,19 @@ uniform sampler2D planeMaterialTex; // Materials: color, emissive, specular (3
 uniform int numPlanes;
 
 // BVH acceleration structure
-uniform sampler2D bvhNodeTex;  // BVH nodes: 2 pixels per node
+uniform usampler2D bvhNodeTex; // Wide BVH nodes: 2 + bvhWidth / 2 pixels per node
 uniform sampler2D bvhPrimTex;  // BVH primitives: 1 pixel per primitive [type, index, 0, 0]
-uniform int numBVHNodes;
+uniform int numBVHNodes;       // Top-level nodes, mesh BLAS nodes follow them
+uniform int bvhWidth;          // Children per BVH node (4 or 8)
+uniform bool bvhStackless;     // Binary nodes with skip links instead
+uniform sampler2D instanceTex; // Mesh instances: 4 pixels per instance
+uniform int sceneTextureWidth; // Line width every scene texture wraps at
+
+// Emissive triangles and spheres in world space, picked in proportion to
+// their power for next-event estimation (see LightTable)
+uniform sampler2D lightTex; // 4 pixels per light
+uniform int numLights;
+uniform float lightTotalPower;
 
 struct SMaterialInfo {
     vec3 albedo;
@@ -44,8 +73,18 @@ struct SRayHitInfo {
     float dist;
     vec3 normal;
     SMaterialInfo material;
+    float lightPdf; // Solid-angle pdf of sampling this point as a light
 };
 
+// Scene textures store rows of rowWidth pixels end to end, wrapped at
+// sceneTextureWidth so primitive counts are not capped by the texture
+// height. Every fetch of scene data goes through this address.
+ivec2 sceneTexel(int row, int rowWidth, int pixel)
+{
+    int index = row * rowWidth + pixel;
+    return ivec2(index % sceneTextureWidth, index / sceneTextureWidth);
+}
+
 // Geometry data - loaded for every intersection test (3 fetches)
 struct TriangleGeom {
     vec3 v0;
@@ -54,7 +93,7 @@ struct TriangleGeom {
     vec3 normal;
 };
 
-// Material data - only loaded for closest hit (4 fetches)
+// Material data - only loaded for closest hit (1 + 4 fetches)
 struct TriangleMaterial {
     vec3 color;
     vec3 emissive;
@@ -106,44 +145,45 @@ TriangleGeom loadTriangleGeom(int triIndex)
 
     // Layout: width=3 pixels per row
     // Pixel 0: [v0.xyz, v1.x]
-    vec4 p0 = texelFetch(triangleGeomTex, ivec2(0, triIndex), 0);
+    vec4 p0 = texelFetch(triangleGeomTex, sceneTexel(triIndex, 3, 0), 0);
     t.v0 = p0.xyz;
 
     // Pixel 1: [v1.yz, v2.xy]
-    vec4 p1 = texelFetch(triangleGeomTex, ivec2(1, triIndex), 0);
+    vec4 p1 = texelFetch(triangleGeomTex, sceneTexel(triIndex, 3, 1), 0);
     t.v1 = vec3(p0.w, p1.xy);
 
     // Pixel 2: [v2.z, normal.xyz]
-    vec4 p2 = texelFetch(triangleGeomTex, ivec2(2, triIndex), 0);
+    vec4 p2 = texelFetch(triangleGeomTex, sceneTexel(triIndex, 3, 2), 0);
     t.v2 = vec3(p1.zw, p2.x);
     t.normal = p2.yzw;
 
     return t;
 }
 
-// Material load - only called for closest hit
-TriangleMaterial loadTriangleMaterial(int triIndex)
+// Material load - only called for closest hit, from the row of the
+// instance hit in the material table
+TriangleMaterial loadTriangleMaterial(int row)
 {
     TriangleMaterial m;
 
     // Layout: width=4 pixels per row
     // Pixel 0: [color.xyz, percentSpecular]
-    vec4 p0 = texelFetch(triangleMaterialTex, ivec2(0, triIndex), 0);
+    vec4 p0 = texelFetch(materialTex, sceneTexel(row, 4, 0), 0);
     m.color = p0.xyz;
     m.percentSpecular = p0.w;
 
     // Pixel 1: [emissive.xyz, roughness]
-    vec4 p1 = texelFetch(triangleMaterialTex, ivec2(1, triIndex), 0);
+    vec4 p1 = texelFetch(materialTex, sceneTexel(row, 4, 1), 0);
     m.emissive = p1.xyz;
     m.roughness = p1.w;
 
     // Pixel 2: [specularColor.xyz, indexOfRefraction]
-    vec4 p2 = texelFetch(triangleMaterialTex, ivec2(2, triIndex), 0);
+    vec4 p2 = texelFetch(materialTex, sceneTexel(row, 4, 2), 0);
     m.specularColor = p2.xyz;
     m.indexOfRefraction = p2.w;
 
     // Pixel 3: [refractionChance, padding, padding, padding]
-    vec4 p3 = texelFetch(triangleMaterialTex, ivec2(3, triIndex), 0);
+    vec4 p3 = texelFetch(materialTex, sceneTexel(row, 4, 3), 0);
     m.refractionChance = p3.x;
 
     return m;
@@ -155,7 +195,7 @@ SphereGeom loadSphereGeom(int sphereIndex)
     SphereGeom s;
     // Layout: width=1 pixel per row
     // Pixel 0: [center.xyz, radius]
-    vec4 p0 = texelFetch(sphereGeomTex, ivec2(0, sphereIndex), 0);
+    vec4 p0 = texelFetch(sphereGeomTex, sceneTexel(sphereIndex, 1, 0), 0);
     s.center = p0.xyz;
     s.radius = p0.w;
     return s;
@@ -168,22 +208,22 @@ SphereMaterial loadSphereMaterial(int sphereIndex)
 
     // Layout: width=4 pixels per row
     // Pixel 0: [color.xyz, percentSpecular]
-    vec4 p0 = texelFetch(sphereMaterialTex, ivec2(0, sphereIndex), 0);
+    vec4 p0 = texelFetch(sphereMaterialTex, sceneTexel(sphereIndex, 4, 0), 0);
     m.color = p0.xyz;
     m.percentSpecular = p0.w;
 
     // Pixel 1: [emissive.xyz, roughness]
-    vec4 p1 = texelFetch(sphereMaterialTex, ivec2(1, sphereIndex), 0);
+    vec4 p1 = texelFetch(sphereMaterialTex, sceneTexel(sphereIndex, 4, 1), 0);
     m.emissive = p1.xyz;
     m.roughness = p1.w;
 
     // Pixel 2: [specularColor.xyz, indexOfRefraction]
-    vec4 p2 = texelFetch(sphereMaterialTex, ivec2(2, sphereIndex), 0);
+    vec4 p2 = texelFetch(sphereMaterialTex, sceneTexel(sphereIndex, 4, 2), 0);
     m.specularColor = p2.xyz;
     m.indexOfRefraction = p2.w;
 
     // Pixel 3: [refractionChance, padding, padding, padding]
-    vec4 p3 = texelFetch(sphereMaterialTex, ivec2(3, sphereIndex), 0);
+    vec4 p3 = texelFetch(sphereMaterialTex, sceneTexel(sphereIndex, 4, 3), 0);
     m.refractionChance = p3.x;
 
     return m;
@@ -195,11 +235,11 @@ PlaneGeom loadPlaneGeom(int planeIndex)
     PlaneGeom p;
     // Layout: width=2 pixels per row
     // Pixel 0: [point.xyz, normal.x]
-    vec4 p0 = texelFetch(planeGeomTex, ivec2(0, planeIndex), 0);
+    vec4 p0 = texelFetch(planeGeomTex, sceneTexel(planeIndex, 2, 0), 0);
     p.point = p0.xyz;
 
     // Pixel 1: [normal.yz, padding, padding]
-    vec4 p1 = texelFetch(planeGeomTex, ivec2(1, planeIndex), 0);
+    vec4 p1 = texelFetch(planeGeomTex, sceneTexel(planeIndex, 2, 1), 0);
     p.normal = vec3(p0.w, p1.xy);
     return p;
 }
@@ -211,70 +251,159 @@ PlaneMaterial loadPlaneMaterial(int planeIndex)
 
     // Layout: width=4 pixels per row
     // Pixel 0: [color.xyz, percentSpecular]
-    vec4 p0 = texelFetch(planeMaterialTex, ivec2(0, planeIndex), 0);
+    vec4 p0 = texelFetch(planeMaterialTex, sceneTexel(planeIndex, 4, 0), 0);
     m.color = p0.xyz;
     m.percentSpecular = p0.w;
 
     // Pixel 1: [emissive.xyz, roughness]
-    vec4 p1 = texelFetch(planeMaterialTex, ivec2(1, planeIndex), 0);
+    vec4 p1 = texelFetch(planeMaterialTex, sceneTexel(planeIndex, 4, 1), 0);
     m.emissive = p1.xyz;
     m.roughness = p1.w;
 
     // Pixel 2: [specularColor.xyz, indexOfRefraction]
-    vec4 p2 = texelFetch(planeMaterialTex, ivec2(2, planeIndex), 0);
+    vec4 p2 = texelFetch(planeMaterialTex, sceneTexel(planeIndex, 4, 2), 0);
     m.specularColor = p2.xyz;
     m.indexOfRefraction = p2.w;
 
     // Pixel 3: [refractionChance, padding, padding, padding]
-    vec4 p3 = texelFetch(planeMaterialTex, ivec2(3, planeIndex), 0);
+    vec4 p3 = texelFetch(planeMaterialTex, sceneTexel(planeIndex, 4, 3), 0);
     m.refractionChance = p3.x;
 
     return m;
 }
 
-// BVH node structure
-struct BVHNode {
+// Wide BVH node header, child boxes are quantized on the grid
+// origin + q * scale
+const uint c_bvhChildEmpty = 0u;
+const uint c_bvhChildInternal = 0x8000u;
+
+struct WideBVHNode {
+    vec3 origin;
+    vec3 scale;
+    int childBase; // Absolute node index of the first internal child
+    int primBase;  // Relative to the owning BVH's primitive range
+};
+
+// Load wide BVH node header from texture
+WideBVHNode loadWideBVHNode(int nodeIndex)
+{
+    WideBVHNode node;
+    // Pixel 0: [origin.xyz as float bits, exponents + 127 packed by 8 bits]
+    int rowWidth = 2 + bvhWidth / 2;
+    uvec4 p0 = texelFetch(bvhNodeTex, sceneTexel(nodeIndex, rowWidth, 0), 0);
+    node.origin = uintBitsToFloat(p0.xyz);
+    node.scale = exp2(vec3(
+        uvec3(p0.w, p0.w >> 8u, p0.w >> 16u) & 0xFFu) - 127.0);
+
+    // Pixel 1: [childBase, primBase, 0, 0]
+    uvec4 p1 = texelFetch(bvhNodeTex, sceneTexel(nodeIndex, rowWidth, 1), 0);
+    node.childBase = int(p1.x);
+    node.primBase = int(p1.y);
+
+    return node;
+}
+
+// Child slot: [qlo.xyz | qhi.x << 24, qhi.yz | meta << 16], two per pixel
+uvec2 loadWideBVHChild(int nodeIndex, int slot)
+{
+    ivec2 texel = sceneTexel(nodeIndex, 2 + bvhWidth / 2, 2 + slot / 2);
+    uvec4 p = texelFetch(bvhNodeTex, texel, 0);
+    return (slot & 1) == 0 ? p.xy : p.zw;
+}
+
+// Stackless BVH node, the left child of an internal node is the next node
+struct SkipBVHNode {
     vec3 boundsMin;
     vec3 boundsMax;
-    int leftChild;  // -1 if leaf
-    int packedData; // rightChild if internal, triStart|(triCount<<16) if leaf
+    int skip;      // Next node once this one is missed or done
+    int primStart; // Relative to the owning BVH's primitive range
+    int primCount; // 0 for internal nodes
 };
 
-// Load BVH node from texture
-BVHNode loadBVHNode(int nodeIndex)
+// Load stackless BVH node from texture
+SkipBVHNode loadSkipBVHNode(int nodeIndex)
 {
-    BVHNode node;
-    // Pixel 0: [bounds.min.xyz, leftChild as float bits]
-    vec4 p0 = texelFetch(bvhNodeTex, ivec2(0, nodeIndex), 0);
-    node.boundsMin = p0.xyz;
-    node.leftChild = floatBitsToInt(p0.w);
-
-    // Pixel 1: [bounds.max.xyz, packedData as float bits]
-    vec4 p1 = texelFetch(bvhNodeTex, ivec2(1, nodeIndex), 0);
-    node.boundsMax = p1.xyz;
-    node.packedData = floatBitsToInt(p1.w);
+    SkipBVHNode node;
+    // Pixel 0: [bounds.min.xyz as float bits, skip]
+    uvec4 p0 = texelFetch(bvhNodeTex, sceneTexel(nodeIndex, 2, 0), 0);
+    node.boundsMin = uintBitsToFloat(p0.xyz);
+    node.skip = int(p0.w);
+
+    // Pixel 1: [bounds.max.xyz as float bits, primStart | primCount << 24]
+    uvec4 p1 = texelFetch(bvhNodeTex, sceneTexel(nodeIndex, 2, 1), 0);
+    node.boundsMax = uintBitsToFloat(p1.xyz);
+    node.primStart = int(p1.w & 0xFFFFFFu);
+    node.primCount = int(p1.w >> 24u);
 
     return node;
 }
 
 // BVH Primitive structure
 struct BVHPrimitive {
-    int type;           // 0 = triangle, 1 = sphere
-    int originalIndex;  // Index in triangle/sphere array
+    int type;           // 0 = triangle, 1 = sphere, 2 = mesh instance
+    int originalIndex;  // Index in triangle/sphere/instance array
 };
 
 // Load BVH primitive from texture
 BVHPrimitive loadBVHPrimitive(int primIndex)
 {
     BVHPrimitive prim;
-    vec4 p = texelFetch(bvhPrimTex, ivec2(0, primIndex), 0);
+    vec4 p = texelFetch(bvhPrimTex, sceneTexel(primIndex, 1, 0), 0);
     prim.type = int(p.x);
     prim.originalIndex = floatBitsToInt(p.y);
     return prim;
 }
 
-// Fast ray-AABB intersection test using slab method
-bool intersectAABB(vec3 rayPos, vec3 invRayDir, vec3 bmin, vec3 bmax,
+// Mesh instance: rows of its affine world-to-object matrix, the
+// location of its bottom-level BVH and its material. Instances of the same
+// geometry share the BLAS and triangles.
+struct Instance {
+    vec4 row0;
+    vec4 row1;
+    vec4 row2;
+    int blasRoot;     // Absolute node index
+    int blasPrimBase; // Leaf primStart is relative to this
+    int materialRow;  // Row in materialTex of all its triangles
+};
+
+Instance loadInstance(int instanceIndex)
+{
+    Instance inst;
+    inst.row0 = texelFetch(instanceTex, sceneTexel(instanceIndex, 4, 0), 0);
+    inst.row1 = texelFetch(instanceTex, sceneTexel(instanceIndex, 4, 1), 0);
+    inst.row2 = texelFetch(instanceTex, sceneTexel(instanceIndex, 4, 2), 0);
+    vec4 p3 = texelFetch(instanceTex, sceneTexel(instanceIndex, 4, 3), 0);
+    inst.blasRoot = floatBitsToInt(p3.x);
+    inst.blasPrimBase = floatBitsToInt(p3.y);
+    inst.materialRow = floatBitsToInt(p3.z);
+    return inst;
+}
+
+// World-space ray origin and direction in the instance's object space
+vec3 instancePointToObject(Instance inst, vec3 p)
+{
+    return vec3(dot(inst.row0.xyz, p) + inst.row0.w,
+        dot(inst.row1.xyz, p) + inst.row1.w,
+        dot(inst.row2.xyz, p) + inst.row2.w);
+}
+
+vec3 instanceDirToObject(Instance inst, vec3 d)
+{
+    return vec3(
+        dot(inst.row0.xyz, d), dot(inst.row1.xyz, d), dot(inst.row2.xyz, d));
+}
+
+// Object-space normals go back to world space with the transpose of the
+// world-to-object matrix
+vec3 instanceNormalToWorld(Instance inst, vec3 n)
+{
+    return normalize(
+        n.x * inst.row0.xyz + n.y * inst.row1.xyz + n.z * inst.row2.xyz);
+}
+
+// Fast ray-AABB intersection test using slab method, returns the entry
+// distance or -1.0 on a miss
+float intersectAABB(vec3 rayPos, vec3 invRayDir, vec3 bmin, vec3 bmax,
     float tMin, float tMax)
 {
     vec3 t0 = (bmin - rayPos) * invRayDir;
@@ -283,7 +412,7 @@ bool intersectAABB(vec3 rayPos, vec3 invRayDir, vec3 bmin, vec3 bmax,
     vec3 tmax = max(t0, t1);
     float enter = max(max(tmin.x, tmin.y), max(tmin.z, tMin));
     float exit = min(min(tmax.x, tmax.y), min(tmax.z, tMax));
-    return enter <= exit && exit > 0.0;
+    return (enter <= exit && exit > 0.0) ? enter : -1.0;
 }
 
 const float c_epsilon = 0.0001f;
@@ -294,6 +423,24 @@ const int c_numBounces = 10;
 const float c_superFar = 10000.0f;
 const float c_minimumRayHitTime = 0.1f;
 const int c_numRendersPerFrame = 1;
+const float c_shadowRayScale = 0.999f;
+// Samples before a pixel's noise estimate is trusted
+const float c_adaptiveMinSamples = 32.0f;
+// Converged pixels are still traced on every such frame, in case their
+// estimate was lucky
+const int c_adaptiveRevisitInterval = 8;
+// Added to the mean in the relative error so black pixels converge
+const float c_noiseLuminanceFloor = 0.05f;
+// History found again after a camera move must be within this share of
+// the expected depth, and its normal within this cosine, to be kept
+const float c_reprojectionDepthTolerance = 0.05f;
+const float c_reprojectionNormalCos = 0.9f;
+// Samples reprojected history counts for at most, so a moving view keeps
+// a moving average of its last frames instead of smearing older ones
+const float c_reprojectedHistory = 16.0f;
+// Samples history traced at a lower resolution counts for at most, it is
+// blurrier than what the new resolution resolves
+const float c_upscaledHistory = 4.0f;
 
 bool TestTriangleTrace(in vec3 rayPos, in vec3 rayDir, inout SRayHitInfo info,
     in vec3 a, in vec3 b, in vec3 c, in vec3 precomputedNormal)
@@ -422,87 +569,367 @@ vec3 RandomUnitVector(inout uint state)
     return p * inversesqrt(lenSq);
 }
 
+// Intersect a BVH leaf primitive. Triangles are in the current instance's
+// object space, spheres in world space. Mesh instances are not entered
+// here, their index is returned for the traversal to do it, else -1.
+int TestBVHPrimitive(BVHPrimitive prim, in vec3 rayPos, in vec3 rayDir,
+    in vec3 curRayPos, in vec3 curRayDir, int curInstance,
+    inout SRayHitInfo hitInfo, inout int closestPrimitiveType,
+    inout int closestIndex, inout int closestInstance)
+{
+    if (prim.type == 0) {
+        TriangleGeom geom = loadTriangleGeom(prim.originalIndex);
+        if (TestTriangleTrace(curRayPos, curRayDir, hitInfo, geom.v0,
+                geom.v1, geom.v2, geom.normal)) {
+            closestPrimitiveType = 0;
+            closestIndex = prim.originalIndex;
+            closestInstance = curInstance;
+        }
+    } else if (prim.type == 1) {
+        SphereGeom geom = loadSphereGeom(prim.originalIndex);
+        if (TestSphereTrace(
+                rayPos, rayDir, hitInfo, geom.center, geom.radius)) {
+            closestPrimitiveType = 1;
+            closestIndex = prim.originalIndex;
+        }
+    } else {
+        return prim.originalIndex;
+    }
+    return -1;
+}
+
+float Luminance(vec3 color)
+{
+    return dot(color, vec3(0.2126, 0.7152, 0.0722));
+}
+
+// 1 - cos of the half-angle of a sphere seen from distance^2 d2, written
+// to stay accurate for far away spheres
+float OneMinusCosMax(float r2, float d2)
+{
+    float x = r2 / d2;
+    return x / (1.0 + sqrt(1.0 - x));
+}
+
+// Solid-angle pdfs of SampleLight reaching an emissive triangle or sphere.
+// A triangle's picking chance over its area leaves the luminance share.
+float TriangleLightPdf(vec3 emissive, float dist, float cosLight)
+{
+    if (cosLight <= 1e-6) {
+        return 0.0;
+    }
+    return Luminance(emissive) / lightTotalPower * dist * dist / cosLight;
+}
+
+float SphereLightPdf(vec3 emissive, vec3 center, float radius, vec3 pos)
+{
+    vec3 toCenter = center - pos;
+    float d2 = dot(toCenter, toCenter);
+    float r2 = radius * radius;
+    if (d2 <= r2) {
+        return 0.0;
+    }
+    float pickPdf = Luminance(emissive) * 4.0 * c_pi * r2 / lightTotalPower;
+    return pickPdf / (c_twopi * OneMinusCosMax(r2, d2));
+}
+
+// Light whose CDF range holds u, by binary search
+int PickLight(float u)
+{
+    int lo = 0;
+    int hi = numLights - 1;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (u < texelFetch(lightTex, sceneTexel(mid, 4, 0), 0).w) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    return lo;
+}
+
+// Direction, distance, emission and pdf of a point picked on a light, pdf
+// 0 when nothing can be sampled
+struct SLightSample {
+    vec3 dir;
+    float dist;
+    vec3 emissive;
+    float pdf;
+};
+
+SLightSample SampleLight(vec3 pos, inout uint rngState)
+{
+    float u0 = RandomFloat01(rngState);
+    float u1 = RandomFloat01(rngState);
+    float u2 = RandomFloat01(rngState);
+
+    int light = PickLight(u0);
+    vec4 p0 = texelFetch(lightTex, sceneTexel(light, 4, 0), 0);
+    vec4 p1 = texelFetch(lightTex, sceneTexel(light, 4, 1), 0);
+    vec4 p3 = texelFetch(lightTex, sceneTexel(light, 4, 3), 0);
+
+    SLightSample s;
+    s.emissive = p3.rgb;
+    s.pdf = 0.0;
+    if (p1.w < 0.5) {
+        // Uniform point on the triangle
+        vec3 v2 = texelFetch(lightTex, sceneTexel(light, 4, 2), 0).xyz;
+        float su = sqrt(u1);
+        vec3 point = (1.0 - su) * p0.xyz + su * (1.0 - u2) * p1.xyz
+            + su * u2 * v2;
+        vec3 toLight = point - pos;
+        s.dist = length(toLight);
+        if (s.dist <= 0.0) {
+            return s;
+        }
+        s.dir = toLight / s.dist;
+        vec3 normal = normalize(cross(p1.xyz - p0.xyz, v2 - p0.xyz));
+        s.pdf = TriangleLightPdf(s.emissive, s.dist, abs(dot(normal, s.dir)));
+        return s;
+    }
+
+    // Uniform direction in the cone the sphere subtends, nothing from
+    // inside
+    vec3 toCenter = p0.xyz - pos;
+    float d2 = dot(toCenter, toCenter);
+    float r2 = p1.x * p1.x;
+    if (d2 <= r2) {
+        return s;
+    }
+    float cosTheta = 1.0 - u1 * OneMinusCosMax(r2, d2);
+    float sinTheta = sqrt(max(0.0, 1.0 - cosTheta * cosTheta));
+    float phi = c_twopi * u2;
+
+    vec3 w = toCenter * inversesqrt(d2);
+    vec3 helper = abs(w.x) > 0.1 ? vec3(0.0, 1.0, 0.0) : vec3(1.0, 0.0, 0.0);
+    vec3 u = normalize(cross(helper, w));
+    vec3 v = cross(w, u);
+    s.dir = u * (cos(phi) * sinTheta) + v * (sin(phi) * sinTheta)
+        + w * cosTheta;
+
+    // Nearest intersection along the direction
+    float b = dot(toCenter, s.dir);
+    s.dist = b - sqrt(max(0.0, r2 - (d2 - b * b)));
+    s.pdf = SphereLightPdf(s.emissive, p0.xyz, p1.x, pos);
+    return s;
+}
+
+// MIS weight of a strategy with pdf a against one with pdf b
+float PowerHeuristic(float a, float b)
+{
+    return a * a / (a * a + b * b);
+}
+
 void TestSceneTrace(in vec3 rayPos, in vec3 rayDir, inout SRayHitInfo hitInfo)
 {
     // Track closest hit: 0=triangle, 1=sphere, 2=plane
     int closestPrimitiveType = -1;
     int closestIndex = -1;
+    int closestInstance = -1;
 
     // Precompute inverse ray direction for AABB tests
     vec3 invRayDir = 1.0 / rayDir;
 
-    // Use BVH traversal for triangles AND spheres
-    if (numBVHNodes > 0) {
-        // Stack-based BVH traversal
-        int stack[64];
+    // Two-level traversal: the top level holds spheres and mesh instances,
+    // each instance is entered with the ray moved into object space. The
+    // object-space direction is left unnormalized so hit distances stay
+    // comparable across levels.
+    vec3 curRayPos = rayPos;
+    vec3 curRayDir = rayDir;
+    vec3 curInvRayDir = invRayDir;
+    int curInstance = -1;
+    int primBase = 0;
+
+    if (numBVHNodes > 0 && bvhStackless) {
+        // Stackless traversal: a hit descends to the next node, a miss or
+        // a finished leaf follows the skip link. Instances are entered one
+        // at a time once their top-level leaf is done, so returning only
+        // needs the rest of that leaf and the node to resume from.
+        int nodeIdx = 0;
+        int nodeEnd = numBVHNodes;
+        int resumeIdx = 0;
+        int leafCursor = 0;
+        int leafEnd = 0;
+
+        while (true) {
+            if (curInstance < 0 && leafCursor < leafEnd) {
+                BVHPrimitive prim = loadBVHPrimitive(leafCursor++);
+                if (prim.type != 2) {
+                    continue;
+                }
+                curInstance = prim.originalIndex;
+                Instance inst = loadInstance(curInstance);
+                curRayPos = instancePointToObject(inst, rayPos);
+                curRayDir = instanceDirToObject(inst, rayDir);
+                curInvRayDir = 1.0 / curRayDir;
+                primBase = inst.blasPrimBase;
+                resumeIdx = nodeIdx;
+                nodeIdx = inst.blasRoot;
+                nodeEnd = loadSkipBVHNode(inst.blasRoot).skip;
+                continue;
+            }
+
+            if (nodeIdx >= nodeEnd) {
+                if (curInstance < 0) {
+                    break;
+                }
+                curRayPos = rayPos;
+                curRayDir = rayDir;
+                curInvRayDir = invRayDir;
+                curInstance = -1;
+                primBase = 0;
+                nodeIdx = resumeIdx;
+                nodeEnd = numBVHNodes;
+                continue;
+            }
+
+            SkipBVHNode node = loadSkipBVHNode(nodeIdx);
+            if (intersectAABB(curRayPos, curInvRayDir, node.boundsMin,
+                    node.boundsMax, c_minimumRayHitTime, hitInfo.dist)
+                < 0.0) {
+                nodeIdx = node.skip;
+                continue;
+            }
+            if (node.primCount == 0) {
+                nodeIdx++;
+                continue;
+            }
+
+            int primStart = primBase + node.primStart;
+            bool hasInstances = false;
+            for (int i = 0; i < node.primCount; i++) {
+                int instanceIdx = TestBVHPrimitive(
+                    loadBVHPrimitive(primStart + i), rayPos, rayDir,
+                    curRayPos, curRayDir, curInstance, hitInfo,
+                    closestPrimitiveType, closestIndex, closestInstance);
+                hasInstances = hasInstances || instanceIdx >= 0;
+            }
+            if (hasInstances) {
+                leafCursor = primStart;
+                leafEnd = primStart + node.primCount;
+            }
+            nodeIdx = node.skip;
+        }
+    } else if (numBVHNodes > 0) {
+        // Stack entries: node index, or c_stackExitInstance to return to
+        // world space, or c_stackEnterInstance - instanceIndex to enter an
+        // instance once the current node is done.
+        const int c_stackExitInstance = -1;
+        const int c_stackEnterInstance = -2;
+
+        // Stack-based BVH traversal. Every node reached already passed
+        // its box test in the parent, up to bvhWidth children are pushed
+        // per node so the stack is deeper than the tree. Should it fill
+        // up, the farthest entries are dropped rather than written past
+        // its end.
+        const int c_stackSize = 96;
+        int stack[c_stackSize];
         int stackPtr = 0;
         stack[stackPtr++] = 0; // Start with root node
 
         while (stackPtr > 0) {
             int nodeIdx = stack[--stackPtr];
-            BVHNode node = loadBVHNode(nodeIdx);
 
-            // Test AABB intersection
-            if (!intersectAABB(rayPos, invRayDir, node.boundsMin, node.boundsMax,
-                    c_minimumRayHitTime, hitInfo.dist)) {
+            if (nodeIdx == c_stackExitInstance) {
+                curRayPos = rayPos;
+                curRayDir = rayDir;
+                curInvRayDir = invRayDir;
+                curInstance = -1;
+                primBase = 0;
+                continue;
+            }
+
+            if (nodeIdx <= c_stackEnterInstance) {
+                if (stackPtr + 2 > c_stackSize) {
+                    continue;
+                }
+                curInstance = c_stackEnterInstance - nodeIdx;
+                Instance inst = loadInstance(curInstance);
+                curRayPos = instancePointToObject(inst, rayPos);
+                curRayDir = instanceDirToObject(inst, rayDir);
+                curInvRayDir = 1.0 / curRayDir;
+                primBase = inst.blasPrimBase;
+                stack[stackPtr++] = c_stackExitInstance;
+                stack[stackPtr++] = inst.blasRoot;
                 continue;
             }
 
-            if (node.leftChild == -1) {
-                // Leaf node: test primitives (triangles or spheres)
-                int primStart = node.packedData & 0xFFFF;
-                int primCount = (node.packedData >> 16) & 0xFFFF;
+            WideBVHNode node = loadWideBVHNode(nodeIdx);
+
+            // Internal children hit by the ray, kept sorted by entry
+            // distance so the nearest one is popped first
+            int hitNodes[8];
+            float hitDists[8];
+            int hitCount = 0;
+            int childRank = 0;
+            int primIndex = primBase + node.primBase;
+
+            for (int slot = 0; slot < bvhWidth; slot++) {
+                uvec2 child = loadWideBVHChild(nodeIdx, slot);
+                uint meta = child.y >> 16u;
+                if (meta == c_bvhChildEmpty) {
+                    continue;
+                }
 
+                vec3 qlo = vec3(
+                    uvec3(child.x, child.x >> 8u, child.x >> 16u) & 0xFFu);
+                vec3 qhi = vec3(
+                    uvec3(child.x >> 24u, child.y, child.y >> 8u) & 0xFFu);
+                float entry = intersectAABB(curRayPos, curInvRayDir,
+                    node.origin + qlo * node.scale,
+                    node.origin + qhi * node.scale, c_minimumRayHitTime,
+                    hitInfo.dist);
+
+                if (meta == c_bvhChildInternal) {
+                    int childIdx = node.childBase + childRank++;
+                    if (entry < 0.0) {
+                        continue;
+                    }
+                    int j = hitCount++;
+                    while (j > 0 && hitDists[j - 1] < entry) {
+                        hitNodes[j] = hitNodes[j - 1];
+                        hitDists[j] = hitDists[j - 1];
+                        j--;
+                    }
+                    hitNodes[j] = childIdx;
+                    hitDists[j] = entry;
+                    continue;
+                }
+
+                // Leaf child: its primitives follow the previous leaves'
+                int primCount = int(meta);
+                if (entry < 0.0) {
+                    primIndex += primCount;
+                    continue;
+                }
                 for (int i = 0; i < primCount; i++) {
-                    BVHPrimitive prim = loadBVHPrimitive(primStart + i);
-
-                    if (prim.type == 0) {
-                        // Triangle
-                        TriangleGeom geom = loadTriangleGeom(prim.originalIndex);
-                        if (TestTriangleTrace(rayPos, rayDir, hitInfo, geom.v0,
-                                geom.v1, geom.v2, geom.normal)) {
-                            closestPrimitiveType = 0;
-                            closestIndex = prim.originalIndex;
-                        }
-                    } else {
-                        // Sphere
-                        SphereGeom geom = loadSphereGeom(prim.originalIndex);
-                        if (TestSphereTrace(rayPos, rayDir, hitInfo,
-                                geom.center, geom.radius)) {
-                            closestPrimitiveType = 1;
-                            closestIndex = prim.originalIndex;
-                        }
+                    int instanceIdx = TestBVHPrimitive(
+                        loadBVHPrimitive(primIndex++), rayPos, rayDir,
+                        curRayPos, curRayDir, curInstance, hitInfo,
+                        closestPrimitiveType, closestIndex, closestInstance);
+                    if (instanceIdx >= 0 && stackPtr < c_stackSize) {
+                        stack[stackPtr++] = c_stackEnterInstance - instanceIdx;
                     }
                 }
-            } else {
-                // Internal node: push children onto stack
-                // Push right child first so left is processed first
-                stack[stackPtr++] = node.packedData; // rightChild
-                stack[stackPtr++] = node.leftChild;
-            }
-        }
-    } else {
-        // Fallback: linear traversal if no BVH
-        for (int triIndex = 0; triIndex < numTriangles; ++triIndex) {
-            TriangleGeom geom = loadTriangleGeom(triIndex);
-            if (TestTriangleTrace(rayPos, rayDir, hitInfo, geom.v0, geom.v1,
-                    geom.v2, geom.normal)) {
-                closestPrimitiveType = 0;
-                closestIndex = triIndex;
             }
-        }
 
-        // Fallback for spheres too
-        for (int sphereIndex = 0; sphereIndex < numSpheres; ++sphereIndex) {
-            SphereGeom geom = loadSphereGeom(sphereIndex);
-            if (TestSphereTrace(
-                    rayPos, rayDir, hitInfo, geom.center, geom.radius)) {
-                closestPrimitiveType = 1;
-                closestIndex = sphereIndex;
+            // Farthest first, so the nearest child is on top
+            int firstPushed = max(0, hitCount - (c_stackSize - stackPtr));
+            for (int i = firstPushed; i < hitCount; i++) {
+                stack[stackPtr++] = hitNodes[i];
             }
         }
     }
 
+    // Triangle normals are stored in object space
+    int materialRow = 0;
+    if (closestPrimitiveType == 0 && closestInstance >= 0) {
+        Instance inst = loadInstance(closestInstance);
+        hitInfo.normal = instanceNormalToWorld(inst, hitInfo.normal);
+        materialRow = inst.materialRow;
+    }
+
     // Test planes (keep linear - typically few planes, infinite extent)
     for (int planeIndex = 0; planeIndex < numPlanes; ++planeIndex) {
         PlaneGeom geom = loadPlaneGeom(planeIndex);
@@ -516,7 +943,7 @@ void TestSceneTrace(in vec3 rayPos, in vec3 rayDir, inout SRayHitInfo hitInfo)
     if (closestIndex >= 0) {
         if (closestPrimitiveType == 0) {
             // Triangle
-            TriangleMaterial mat = loadTriangleMaterial(closestIndex);
+            TriangleMaterial mat = loadTriangleMaterial(materialRow);
             hitInfo.material.albedo = mat.color;
             hitInfo.material.emissive = mat.emissive;
             hitInfo.material.percentSpecular = mat.percentSpecular;
@@ -546,6 +973,43 @@ void TestSceneTrace(in vec3 rayPos, in vec3 rayDir, inout SRayHitInfo hitInfo)
             hitInfo.material.refractionChance = mat.refractionChance;
         }
     }
+
+    // Emissive triangles and spheres are in the light table, planes are not
+    hitInfo.lightPdf = 0.0;
+    if (numLights > 0 && closestIndex >= 0
+        && Luminance(hitInfo.material.emissive) > 0.0) {
+        if (closestPrimitiveType == 0) {
+            hitInfo.lightPdf = TriangleLightPdf(hitInfo.material.emissive,
+                hitInfo.dist, abs(dot(hitInfo.normal, rayDir)));
+        } else if (closestPrimitiveType == 1) {
+            SphereGeom geom = loadSphereGeom(closestIndex);
+            hitInfo.lightPdf = SphereLightPdf(
+                hitInfo.material.emissive, geom.center, geom.radius, rayPos);
+        }
+    }
+}
+
+// Light reaching a diffuse point from one sampled light, MIS weighted and
+// divided by the albedo. Shadow rays stop just short of the light.
+vec3 SampleDirectLight(vec3 pos, vec3 normal, inout uint rngState)
+{
+    SLightSample light = SampleLight(pos, rngState);
+    float cosSurface = dot(normal, light.dir);
+    if (light.pdf <= 0.0 || cosSurface <= 0.0) {
+        return vec3(0.0);
+    }
+
+    SRayHitInfo shadow;
+    shadow.dist = light.dist * c_shadowRayScale;
+    TestSceneTrace(pos, light.dir, shadow);
+    if (shadow.dist < light.dist * c_shadowRayScale) {
+        return vec3(0.0);
+    }
+
+    // Lambert: albedo / pi * cos, with the cosine-weighted pdf cos / pi
+    float bsdfPdf = cosSurface / c_pi;
+    return light.emissive
+        * (bsdfPdf * PowerHeuristic(light.pdf, bsdfPdf) / light.pdf);
 }
 
 // Fresnel-Schlick approximation for reflectance
@@ -556,15 +1020,20 @@ float FresnelSchlick(float cosTheta, float ior1, float ior2)
     return r0 + (1.0 - r0) * pow(1.0 - cosTheta, 5.0);
 }
 
-vec3 GetColorForRay(
-    in vec3 startRayPos, in vec3 startRayDir, inout uint rngState)
+vec3 GetColorForRay(in vec3 startRayPos, in vec3 startRayDir,
+    inout uint rngState, out vec4 albedoDepth, out vec3 firstNormal)
 {
+    albedoDepth = vec4(0.0);
+    firstNormal = vec3(0.0);
+
     // initialize
     vec3 ret = vec3(0.0f, 0.0f, 0.0f);
     vec3 throughput = vec3(1.0f, 1.0f, 1.0f);
     vec3 rayPos = startRayPos;
     vec3 rayDir = startRayDir;
     float currentIOR = 1.0; // Start in air
+    // Pdf of the diffuse bounce that chose rayDir, 0 after any other bounce
+    float bsdfPdf = 0.0;
 
     for (int bounceIndex = 0; bounceIndex <= c_numBounces; ++bounceIndex) {
         // shoot a ray out into the world
@@ -576,9 +1045,19 @@ vec3 GetColorForRay(
         if (hitInfo.dist == c_superFar) {
             break;
         }
+        if (bounceIndex == 0) {
+            albedoDepth = vec4(hitInfo.material.albedo, hitInfo.dist);
+            firstNormal = hitInfo.normal;
+        }
 
-        // add in emissive lighting
-        ret += hitInfo.material.emissive * throughput;
+        // add in emissive lighting, shared with the light sample of the
+        // diffuse bounce that could also have reached it
+        float emissionWeight = 1.0;
+        if (bsdfPdf > 0.0 && hitInfo.lightPdf > 0.0) {
+            emissionWeight = PowerHeuristic(bsdfPdf, hitInfo.lightPdf);
+        }
+        ret += hitInfo.material.emissive * throughput * emissionWeight;
+        bsdfPdf = 0.0;
 
         // Check if this material is refractive
         bool isRefractive = hitInfo.material.refractionChance > 0.0
@@ -659,6 +1138,11 @@ vec3 GetColorForRay(
                 hitInfo.material.roughness * hitInfo.material.roughness));
             rayDir = isSpecular ? specularRayDir : diffuseRayDir;
 
+            if (numLights > 0 && !isSpecular) {
+                ret += throughput * hitInfo.material.albedo
+                    * SampleDirectLight(rayPos, hitInfo.normal, rngState);
+                bsdfPdf = max(0.0, dot(hitInfo.normal, rayDir)) / c_pi;
+            }
             throughput *= isSpecular ? hitInfo.material.specularColor
                                      : hitInfo.material.albedo;
         }
@@ -675,8 +1159,84 @@ vec3 GetColorForRay(
     return ret;
 }
 
+// Standard error of a pixel's mean luminance, relative to the mean
+float RelativeNoise(vec4 moments)
+{
+    float variance = max(0.0, moments.y - moments.x * moments.x);
+    return sqrt(variance / moments.z) / (moments.x + c_noiseLuminanceFloor);
+}
+
+// Where the previous frame saw the surface first hit along rayDir, in its
+// pixels, false where that surface was off screen or hidden there
+bool ReprojectHistory(
+    vec3 rayDir, vec4 albedoDepth, vec3 normal, out vec2 historyPos)
+{
+    // Misses are infinitely far, only their direction moves
+    bool miss = albedoDepth.w <= 0.0;
+    vec3 local = transpose(previousViewRotationMatrix)
+        * (miss ? rayDir : viewPos + rayDir * albedoDepth.w - previousViewPos);
+    if (local.z >= 0.0) {
+        return false;
+    }
+    vec2 point = local.xy * (previousFocalLength / -local.z);
+    point.x /= previousAspectRatio;
+    ivec2 size = ivec2(previousRenderSize);
+    historyPos = (point * 0.5 + 0.5) * previousRenderSize;
+    ivec2 historyTexel = ivec2(floor(historyPos));
+    if (any(lessThan(historyTexel, ivec2(0)))
+        || any(greaterThanEqual(historyTexel, size))) {
+        return false;
+    }
+
+    // Disocclusions show up as a different depth or orientation
+    vec4 history = texelFetch(previousAlbedoDepth, historyTexel, 0);
+    if (miss || history.w <= 0.0) {
+        return miss && history.w <= 0.0;
+    }
+    float expectedDepth = length(local);
+    vec3 historyNormal = texelFetch(previousNormal, historyTexel, 0).xyz;
+    return abs(history.w - expectedDepth)
+        < c_reprojectionDepthTolerance * expectedDepth
+        && dot(historyNormal, normal)
+        > c_reprojectionNormalCos * length(historyNormal) * length(normal);
+}
+
+// The previous frame's value at pos, in its pixels. Bilinear across a
+// resolution change, so a low-resolution history is not stretched into
+// blocks, with taps kept inside the pixels that were traced.
+vec4 FetchHistory(sampler2D history, vec2 pos)
+{
+    if (previousRenderSize == renderSize) {
+        return texelFetch(history, ivec2(floor(pos)), 0);
+    }
+    vec2 corner = pos - 0.5;
+    vec2 t = fract(corner);
+    ivec2 maxTexel = ivec2(previousRenderSize) - 1;
+    ivec2 a = clamp(ivec2(floor(corner)), ivec2(0), maxTexel);
+    ivec2 b = min(a + 1, maxTexel);
+    vec4 bottom = mix(texelFetch(history, a, 0),
+        texelFetch(history, ivec2(b.x, a.y), 0), t.x);
+    vec4 top = mix(texelFetch(history, ivec2(a.x, b.y), 0),
+        texelFetch(history, b, 0), t.x);
+    return mix(bottom, top, t.y);
+}
+
 void main()
 {
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    vec4 moments
+        = iFrame == 0 ? vec4(0.0) : texelFetch(previousMoments, texel, 0);
+
+    // Converged pixels keep what they have, unless the camera moved
+    if (!reproject && adaptiveSampling && moments.w > 0.5
+        && iFrame % c_adaptiveRevisitInterval != 0) {
+        FragColor = vec4(texelFetch(previousFrame, texel, 0).rgb, 1.0);
+        FragMoments = moments;
+        FragAlbedoDepth = texelFetch(previousAlbedoDepth, texel, 0);
+        FragNormal = texelFetch(previousNormal, texel, 0);
+        return;
+    }
+
     vec2 pixelCoord = (vec2(FragPos.x, FragPos.y) + 1.0) * 1000;
     uint rngState = uint(pixelCoord.x) * uint(1973)
         + uint(pixelCoord.y) * uint(9277) + uint(iFrame) * uint(26699);
@@ -686,32 +1246,76 @@ void main()
 
     // Render multiple samples per frame for faster convergence
     vec3 currentColor = vec3(0.0);
+    vec4 currentAlbedoDepth = vec4(0.0);
+    vec3 currentNormal = vec3(0.0);
     for (int i = 0; i < c_numRendersPerFrame; ++i) {
         // Add sub-pixel jitter for anti-aliasing
         vec2 jitter
             = vec2(RandomFloat01(rngState), RandomFloat01(rngState)) - 0.5;
-        vec2 pixelSize = 2.0 / vec2(textureSize(previousFrame, 0));
+        vec2 pixelSize = 2.0 / renderSize;
         vec2 jitteredPos = vec2(FragPos.x, FragPos.y) + jitter * pixelSize;
 
         vec2 pixelTarget2D = vec2(jitteredPos.x * aspectRatio, jitteredPos.y);
         vec3 rayDirLocal = normalize(vec3(pixelTarget2D, -focalLength));
         vec3 rayDir = viewRotationMatrix * rayDirLocal;
 
-        currentColor += GetColorForRay(rayPosition, rayDir, rngState);
+        vec4 albedoDepth;
+        vec3 normal;
+        currentColor += GetColorForRay(
+            rayPosition, rayDir, rngState, albedoDepth, normal);
+        currentAlbedoDepth += albedoDepth;
+        currentNormal += normal;
     }
     currentColor /= float(c_numRendersPerFrame);
+    currentAlbedoDepth /= float(c_numRendersPerFrame);
+    currentNormal /= float(c_numRendersPerFrame);
+
+    // After a camera move the history is wherever the previous camera saw
+    // this pixel's surface, pixels it did not see start over
+    vec2 historyPos = vec2(texel) + 0.5;
+    if (reproject) {
+        vec3 centerDir = viewRotationMatrix
+            * normalize(
+                vec3(FragPos.x * aspectRatio, FragPos.y, -focalLength));
+        if (ReprojectHistory(centerDir, currentAlbedoDepth, currentNormal,
+                historyPos)) {
+            moments = FetchHistory(previousMoments, historyPos);
+            bool upscaled = any(lessThan(previousRenderSize, renderSize));
+            moments.z = min(moments.z,
+                upscaled ? c_upscaledHistory : c_reprojectedHistory);
+        } else {
+            moments = vec4(0.0);
+        }
+    }
 
-    vec2 uv = gl_FragCoord.xy / vec2(textureSize(previousFrame, 0));
-
-    vec3 accumulatedColor;
-    if (iFrame == 0) {
-        accumulatedColor = currentColor;
-    } else {
-        vec3 previousColor = texture(previousFrame, uv).rgb;
-        float weight = float(c_numRendersPerFrame)
-            / float(iFrame * c_numRendersPerFrame + c_numRendersPerFrame);
+    // Pixels skip frames, so each one is averaged over its own count
+    float sampleCount = moments.z + 1.0;
+    float weight = 1.0 / sampleCount;
+    vec3 accumulatedColor = currentColor;
+    vec4 accumulatedAlbedoDepth = currentAlbedoDepth;
+    vec3 accumulatedNormal = currentNormal;
+    if (moments.z > 0.0) {
+        vec3 previousColor = FetchHistory(previousFrame, historyPos).rgb;
         accumulatedColor = mix(previousColor, currentColor, weight);
+        accumulatedAlbedoDepth
+            = mix(FetchHistory(previousAlbedoDepth, historyPos),
+                currentAlbedoDepth, weight);
+        accumulatedNormal
+            = mix(FetchHistory(previousNormal, historyPos).xyz,
+                currentNormal, weight);
     }
 
+    float luminance = Luminance(currentColor);
+    moments.x = mix(moments.x, luminance, weight);
+    moments.y = mix(moments.y, luminance * luminance, weight);
+    moments.z = sampleCount;
+    moments.w = sampleCount >= c_adaptiveMinSamples
+            && RelativeNoise(moments) < noiseThreshold
+        ? 1.0
+        : 0.0;
+
     FragColor = vec4(accumulatedColor, 1.0);
+    FragMoments = moments;
+    FragAlbedoDepth = accumulatedAlbedoDepth;
+    FragNormal = vec4(accumulatedNormal, 0.0);
 }
@@ -0,0 +1,470 @@
+/**
+ * @file bvh_bench.cpp
+ * @brief Banc d'essai de la qualite et du temps de construction du BVH
+ *
+ * Construit le BVH des maillages de assets/objects et de scenes generees
+ * avec chaque mode de construction, puis lance un ensemble fixe de rayons
+ * sur le CPU. Les resultats (temps de construction, nombre de noeuds,
+ * profondeur, histogramme des feuilles, cout SAH, noeuds et triangles
+ * visites par rayon) sont ecrits en JSON pour suivre les regressions.
+ */
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "renderer/BVH.hpp"
+#include "renderer/PathTracingData.hpp"
+#include "renderer/SceneDescription.hpp"
+
+#ifndef SCENELAB_ASSETS_DIR
+#define SCENELAB_ASSETS_DIR "assets"
+#endif
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+    std::filesystem::path assets = SCENELAB_ASSETS_DIR;
+    std::filesystem::path output;
+    int runs = 3;
+    int rays = 100000;
+};
+
+struct Scene {
+    std::string name;
+    std::vector<Triangle> triangles;
+};
+
+struct Ray {
+    glm::vec3 origin;
+    glm::vec3 dir;
+};
+
+struct BuildConfig {
+    const char *name;
+    BVHBuildMode mode;
+    bool optimize;
+};
+
+// The configurations the renderer uses for mesh BLAS builds
+constexpr BuildConfig BUILD_CONFIGS[] = {
+    { "sah", BVHBuildMode::SAH, false },
+    { "sah_optimized", BVHBuildMode::SAH, true },
+    { "lbvh", BVHBuildMode::LBVH, false },
+    { "sbvh", BVHBuildMode::SBVH, false },
+};
+
+struct TreeStats {
+    int nodes = 0;
+    int leaves = 0;
+    int maxDepth = 0;
+    int primitiveReferences = 0;
+    std::vector<int> leafSizes; // Leaves per primitive count
+};
+
+struct TraceStats {
+    double nodesPerRay = 0.0;
+    double trianglesPerRay = 0.0;
+    double hitRatio = 0.0;
+    double milliseconds = 0.0;
+};
+
+double elapsedMs(Clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - start)
+        .count();
+}
+
+double median(std::vector<double> values)
+{
+    std::sort(values.begin(), values.end());
+    return values[values.size() / 2];
+}
+
+Triangle makeTriangle(
+    const glm::vec3 &v0, const glm::vec3 &v1, const glm::vec3 &v2)
+{
+    Triangle tri {};
+    tri.v0 = v0;
+    tri.v1 = v1;
+    tri.v2 = v2;
+    setFaceNormal(tri);
+    return tri;
+}
+
+// Small triangles spread evenly through a cube
+Scene makeUniformScene(int count, unsigned int seed)
+{
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> position(-50.0f, 50.0f);
+    std::uniform_real_distribution<float> offset(-0.5f, 0.5f);
+    Scene scene { "uniform_soup", {} };
+    for (int i = 0; i < count; i++) {
+        glm::vec3 c(position(rng), position(rng), position(rng));
+        scene.triangles.push_back(makeTriangle(
+            c + glm::vec3(offset(rng), offset(rng), offset(rng)),
+            c + glm::vec3(offset(rng), offset(rng), offset(rng)),
+            c + glm::vec3(offset(rng), offset(rng), offset(rng))));
+    }
+    return scene;
+}
+
+// Dense clusters separated by empty space, as in a sparse scene of
+// detailed models
+Scene makeClusteredScene(int clusters, int perCluster, unsigned int seed)
+{
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> position(-200.0f, 200.0f);
+    std::normal_distribution<float> spread(0.0f, 2.0f);
+    std::uniform_real_distribution<float> offset(-0.1f, 0.1f);
+    Scene scene { "clustered", {} };
+    for (int c = 0; c < clusters; c++) {
+        glm::vec3 center(position(rng), position(rng), position(rng));
+        for (int i = 0; i < perCluster; i++) {
+            glm::vec3 p
+                = center + glm::vec3(spread(rng), spread(rng), spread(rng));
+            scene.triangles.push_back(
+                makeTriangle(p + glm::vec3(offset(rng), offset(rng), 0.0f),
+                    p + glm::vec3(offset(rng), 0.0f, offset(rng)),
+                    p + glm::vec3(0.0f, offset(rng), offset(rng))));
+        }
+    }
+    return scene;
+}
+
+// Long slivers crossing the scene, the worst case for object splits
+Scene makeSliverScene(int count, unsigned int seed)
+{
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> position(-50.0f, 50.0f);
+    std::uniform_real_distribution<float> direction(-1.0f, 1.0f);
+    std::uniform_real_distribution<float> offset(-0.2f, 0.2f);
+    Scene scene { "long_slivers", {} };
+    for (int i = 0; i < count; i++) {
+        glm::vec3 v0(position(rng), position(rng), position(rng));
+        glm::vec3 v1 = v0
+            + 60.0f
+                * glm::normalize(glm::vec3(
+                    direction(rng), direction(rng), direction(rng)));
+        glm::vec3 v2 = v1 + glm::vec3(offset(rng), offset(rng), offset(rng));
+        scene.triangles.push_back(makeTriangle(v0, v1, v2));
+    }
+    return scene;
+}
+
+// Rays from a sphere around the scene towards random triangles, so that
+// sparse scenes are hit too. The same set is used for every build of a
+// scene.
+std::vector<Ray> makeRays(
+    const std::vector<Triangle> &triangles, int count, unsigned int seed)
+{
+    AABB bounds;
+    for (const auto &tri : triangles) {
+        bounds.expand(tri.v0);
+        bounds.expand(tri.v1);
+        bounds.expand(tri.v2);
+    }
+    glm::vec3 center = bounds.centroid();
+    float radius = glm::length(bounds.extent());
+
+    std::mt19937 rng(seed);
+    std::normal_distribution<float> gaussian(0.0f, 1.0f);
+    std::uniform_int_distribution<size_t> pick(0, triangles.size() - 1);
+    std::vector<Ray> rays(count);
+    for (auto &ray : rays) {
+        glm::vec3 onSphere(gaussian(rng), gaussian(rng), gaussian(rng));
+        ray.origin = center + radius * glm::normalize(onSphere);
+        const Triangle &tri = triangles[pick(rng)];
+        glm::vec3 target = (tri.v0 + tri.v1 + tri.v2) / 3.0f;
+        ray.dir = glm::normalize(target - ray.origin);
+    }
+    return rays;
+}
+
+TreeStats measureTree(const BVH &bvh)
+{
+    TreeStats stats;
+    const auto &nodes = bvh.getNodes();
+    stats.nodes = bvh.getNodeCount();
+    stats.primitiveReferences = bvh.getPrimitiveCount();
+    if (nodes.empty()) {
+        return stats;
+    }
+
+    std::vector<std::pair<int, int>> stack { { 0, 0 } };
+    while (!stack.empty()) {
+        auto [index, depth] = stack.back();
+        stack.pop_back();
+        stats.maxDepth = std::max(stats.maxDepth, depth);
+        const BVHNode &node = nodes[index];
+        if (node.isLeaf()) {
+            stats.leaves++;
+            if (static_cast<int>(stats.leafSizes.size())
+                <= node.primitiveCount) {
+                stats.leafSizes.resize(node.primitiveCount + 1, 0);
+            }
+            stats.leafSizes[node.primitiveCount]++;
+            continue;
+        }
+        stack.push_back({ node.leftChild, depth + 1 });
+        stack.push_back({ node.rightChild, depth + 1 });
+    }
+    return stats;
+}
+
+// Entry distance into box, or -1 on a miss
+float intersectBox(
+    const Ray &ray, const glm::vec3 &invDir, const AABB &box, float tMax)
+{
+    glm::vec3 t0 = (box.min - ray.origin) * invDir;
+    glm::vec3 t1 = (box.max - ray.origin) * invDir;
+    glm::vec3 tmin = glm::min(t0, t1);
+    glm::vec3 tmax = glm::max(t0, t1);
+    float enter = std::max(std::max(tmin.x, tmin.y), std::max(tmin.z, 0.0f));
+    float exit = std::min(std::min(tmax.x, tmax.y), std::min(tmax.z, tMax));
+    return enter <= exit ? enter : -1.0f;
+}
+
+// Moller-Trumbore, returns the hit distance or infinity
+float intersectTriangle(const Ray &ray, const Triangle &tri)
+{
+    glm::vec3 e1 = tri.v1 - tri.v0;
+    glm::vec3 e2 = tri.v2 - tri.v0;
+    glm::vec3 p = glm::cross(ray.dir, e2);
+    float det = glm::dot(e1, p);
+    if (std::abs(det) < 1e-9f) {
+        return std::numeric_limits<float>::infinity();
+    }
+    float invDet = 1.0f / det;
+    glm::vec3 s = ray.origin - tri.v0;
+    float u = glm::dot(s, p) * invDet;
+    glm::vec3 q = glm::cross(s, e1);
+    float v = glm::dot(ray.dir, q) * invDet;
+    float t = glm::dot(e2, q) * invDet;
+    if (u < 0.0f || v < 0.0f || u + v > 1.0f || t <= 0.0f) {
+        return std::numeric_limits<float>::infinity();
+    }
+    return t;
+}
+
+// Closest-hit traversal visiting the nearer child first, like the shader.
+// A node counts as visited when its bounds are tested.
+TraceStats traceRays(const BVH &bvh, const std::vector<Triangle> &triangles,
+    const std::vector<Ray> &rays)
+{
+    TraceStats stats;
+    const auto &nodes = bvh.getNodes();
+    const auto &primitives = bvh.getPrimitives();
+    if (nodes.empty() || rays.empty()) {
+        return stats;
+    }
+
+    long long nodeVisits = 0;
+    long long triangleTests = 0;
+    int hits = 0;
+    std::vector<int> stack;
+    stack.reserve(128);
+    Clock::time_point start = Clock::now();
+    for (const Ray &ray : rays) {
+        glm::vec3 invDir = 1.0f / ray.dir;
+        float closest = std::numeric_limits<float>::infinity();
+        nodeVisits++;
+        if (intersectBox(ray, invDir, nodes[0].bounds, closest) >= 0.0f) {
+            stack.push_back(0);
+        }
+        while (!stack.empty()) {
+            const BVHNode &node = nodes[stack.back()];
+            stack.pop_back();
+            if (node.isLeaf()) {
+                for (int i = 0; i < node.primitiveCount; i++) {
+                    const BVHPrimitive &prim
+                        = primitives[node.primitiveStart + i];
+                    triangleTests++;
+                    closest = std::min(closest,
+                        intersectTriangle(
+                            ray, triangles[prim.originalIndex]));
+                }
+                continue;
+            }
+            nodeVisits += 2;
+            float left = intersectBox(
+                ray, invDir, nodes[node.leftChild].bounds, closest);
+            float right = intersectBox(
+                ray, invDir, nodes[node.rightChild].bounds, closest);
+            int near = node.leftChild;
+            int far = node.rightChild;
+            if (right >= 0.0f && (left < 0.0f || right < left)) {
+                std::swap(near, far);
+                std::swap(left, right);
+            }
+            if (right >= 0.0f) {
+                stack.push_back(far);
+            }
+            if (left >= 0.0f) {
+                stack.push_back(near);
+            }
+        }
+        if (closest < std::numeric_limits<float>::infinity()) {
+            hits++;
+        }
+    }
+    stats.milliseconds = elapsedMs(start);
+
+    const double rayCount = static_cast<double>(rays.size());
+    stats.nodesPerRay = static_cast<double>(nodeVisits) / rayCount;
+    stats.trianglesPerRay = static_cast<double>(triangleTests) / rayCount;
+    stats.hitRatio = hits / rayCount;
+    return stats;
+}
+
+void writeBuild(std::ostream &out, const Scene &scene,
+    const BuildConfig &config, const std::vector<Ray> &rays, int runs)
+{
+    // Every run builds from the same input order
+    std::vector<double> buildTimes;
+    std::vector<double> optimizeTimes;
+    BVH bvh;
+    std::vector<Triangle> triangles;
+    std::vector<AnalyticalSphereData> noSpheres;
+    for (int run = 0; run < runs; run++) {
+        triangles = scene.triangles;
+        bvh.setBuildMode(config.mode);
+        bvh.setLBVHSAHLevels(2);
+        Clock::time_point start = Clock::now();
+        bvh.build(triangles, noSpheres);
+        buildTimes.push_back(elapsedMs(start));
+        if (config.optimize) {
+            start = Clock::now();
+            bvh.optimize();
+            optimizeTimes.push_back(elapsedMs(start));
+        }
+    }
+
+    TreeStats tree = measureTree(bvh);
+    TraceStats trace = traceRays(bvh, triangles, rays);
+
+    out << "        {\n";
+    out << "          \"mode\": \"" << config.name << "\",\n";
+    out << "          \"buildMs\": " << median(buildTimes) << ",\n";
+    if (config.optimize) {
+        out << "          \"optimizeMs\": " << median(optimizeTimes)
+            << ",\n";
+    }
+    out << "          \"nodes\": " << tree.nodes << ",\n";
+    out << "          \"leaves\": " << tree.leaves << ",\n";
+    out << "          \"maxDepth\": " << tree.maxDepth << ",\n";
+    out << "          \"primitiveReferences\": " << tree.primitiveReferences
+        << ",\n";
+    out << "          \"leafSizeHistogram\": [";
+    for (size_t i = 0; i < tree.leafSizes.size(); i++) {
+        out << (i > 0 ? ", " : "") << tree.leafSizes[i];
+    }
+    out << "],\n";
+    out << "          \"sahCost\": " << bvh.computeSAHCost() << ",\n";
+    out << "          \"nodesPerRay\": " << trace.nodesPerRay << ",\n";
+    out << "          \"trianglesPerRay\": " << trace.trianglesPerRay
+        << ",\n";
+    out << "          \"hitRatio\": " << trace.hitRatio << ",\n";
+    out << "          \"traceMs\": " << trace.milliseconds << "\n";
+    out << "        }";
+
+    std::cerr << scene.name << " / " << config.name << ": "
+              << median(buildTimes) << " ms, " << trace.nodesPerRay
+              << " nodes/ray" << std::endl;
+}
+
+bool parseOptions(int argc, char **argv, Options &options)
+{
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--assets" && hasValue) {
+            options.assets = argv[++i];
+        } else if (arg == "--output" && hasValue) {
+            options.output = argv[++i];
+        } else if (arg == "--runs" && hasValue) {
+            options.runs = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--rays" && hasValue) {
+            options.rays = std::max(1, std::atoi(argv[++i]));
+        } else {
+            std::cerr << "Usage: " << argv[0]
+                      << " [--assets DIR] [--output FILE] [--runs N]"
+                         " [--rays N]"
+                      << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        return 1;
+    }
+
+    std::vector<Scene> scenes;
+    for (const char *name : { "teapot", "suzanne" }) {
+        Scene scene { name, {} };
+        if (!loadOBJTriangles(
+                options.assets / "objects" / (std::string(name) + ".obj"),
+                glm::mat4(1.0f), 0, scene.triangles)
+            || scene.triangles.empty()) {
+            return 1;
+        }
+        scenes.push_back(std::move(scene));
+    }
+    scenes.push_back(makeUniformScene(200000, 1));
+    scenes.push_back(makeClusteredScene(64, 2000, 2));
+    scenes.push_back(makeSliverScene(20000, 3));
+
+    std::ofstream file;
+    if (!options.output.empty()) {
+        file.open(options.output);
+        if (!file.is_open()) {
+            std::cerr << "[ERROR] Failed to open " << options.output.string()
+                      << std::endl;
+            return 1;
+        }
+    }
+    std::ostream &out = options.output.empty() ? std::cout : file;
+    out << std::setprecision(6);
+
+    out << "{\n";
+    out << "  \"sahBuckets\": " << SCENELAB_BVH_SAH_BUCKETS << ",\n";
+    out << "  \"runs\": " << options.runs << ",\n";
+    out << "  \"raysPerScene\": " << options.rays << ",\n";
+    out << "  \"scenes\": [\n";
+    for (size_t s = 0; s < scenes.size(); s++) {
+        const Scene &scene = scenes[s];
+        std::vector<Ray> rays = makeRays(scene.triangles, options.rays, 7);
+        out << "    {\n";
+        out << "      \"name\": \"" << scene.name << "\",\n";
+        out << "      \"triangles\": " << scene.triangles.size() << ",\n";
+        out << "      \"builds\": [\n";
+        for (size_t c = 0; c < std::size(BUILD_CONFIGS); c++) {
+            writeBuild(out, scene, BUILD_CONFIGS[c], rays, options.runs);
+            out << (c + 1 < std::size(BUILD_CONFIGS) ? ",\n" : "\n");
+        }
+        out << "      ]\n";
+        out << "    }" << (s + 1 < scenes.size() ? ",\n" : "\n");
+    }
+    out << "  ]\n";
+    out << "}\n";
+    return 0;
+}
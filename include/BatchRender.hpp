@@ -0,0 +1,32 @@
+#pragma once
+
+#include <filesystem>
+#include <string>
+
+// Headless render of a scene file with the CPU path tracer, for
+// `scenelab --render`. No window, GL context or ImGui UI is created, so
+// renders can be queued on machines without a display. Progress is saved
+// every few samples and a restarted job resumes from its checkpoint.
+class BatchRender {
+public:
+    struct Options {
+        std::filesystem::path scene;
+        std::string camera; // First camera of the scene when empty
+        std::filesystem::path output = "render.png"; // .png or .hdr
+        std::filesystem::path checkpoint; // Output path + .ckpt when empty
+        int width = 1920;
+        int height = 1080;
+        int samples = 256;
+        int checkpointInterval = 16; // Samples between checkpoints, 0 = off
+        int threads = 0; // 0 uses every hardware thread
+        bool denoise = false; // A-trous filter on the final image
+    };
+
+    // True when the command line asks for a batch render
+    static bool isRequested(int argc, char **argv);
+
+    static bool parseOptions(int argc, char **argv, Options &options);
+
+    // Render, then write the output. Returns the process exit code.
+    static int run(const Options &options);
+};
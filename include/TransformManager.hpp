@@ -67,4 +67,7 @@ private:
     std::vector<SceneGraph::Node *> m_selectedNodes;
     GizmoOp m_currentGizmoOperation = GizmoOp::Translate;
     bool m_showAllBoundingBoxes = false;
+    // Duplication budget being dragged, not yet sent to the renderer
+    float m_splitBudget = 0.0f;
+    bool m_editingSplitBudget = false;
 };
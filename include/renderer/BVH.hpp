@@ -1,11 +1,20 @@
 #pragma once
 
 #include <glm/glm.hpp>
+#include <cstdint>
+#include <limits>
 #include <vector>
 
+// Number of SAH bins per axis, override at configure time with
+// -DSCENELAB_BVH_SAH_BUCKETS=<n>
+#ifndef SCENELAB_BVH_SAH_BUCKETS
+#define SCENELAB_BVH_SAH_BUCKETS 12
+#endif
+
 // Forward declarations
 struct Triangle;
 struct AnalyticalSphereData;
+struct InstanceData;
 
 struct AABB {
     glm::vec3 min { std::numeric_limits<float>::max() };
@@ -47,16 +56,32 @@ struct AABB {
 };
 
 // Primitive types for BVH
-enum class BVHPrimitiveType : uint8_t { Triangle = 0, Sphere = 1 };
+enum class BVHPrimitiveType : uint8_t {
+    Triangle = 0,
+    Sphere = 1,
+    Instance = 2
+};
 
-// A primitive reference in the BVH (can be triangle or sphere)
+// A primitive reference in the BVH (triangle, sphere or mesh instance)
 struct BVHPrimitive {
     BVHPrimitiveType type;
-    int originalIndex; // Index in original triangle/sphere array
+    int originalIndex; // Index in original triangle/sphere/instance array
     AABB bounds;
     glm::vec3 centroid;
 };
 
+// Build strategies: full binned SAH, a linear BVH from sorted Morton codes
+// which is much cheaper to build but traces slower, or SAH with spatial
+// splits (SBVH) which clips primitives straddling a split into both
+// children, for meshes with long overlapping triangles
+enum class BVHBuildMode : uint8_t { SAH = 0, LBVH = 1, SBVH = 2 };
+
+// SAH cost of a tree before and after BVH::optimize()
+struct BVHOptimizeResult {
+    float costBefore = 0.0f;
+    float costAfter = 0.0f;
+};
+
 struct BVHNode {
     AABB bounds;
     int leftChild = -1; // -1 if leaf
@@ -67,6 +92,16 @@ struct BVHNode {
     bool isLeaf() const { return primitiveCount > 0; }
 };
 
+// Node of the stackless layout. Nodes are in depth-first order so the
+// left child of an internal node is the next node, and skip is where
+// traversal goes once the node is missed or its subtree is done.
+struct BVHSkipNode {
+    AABB bounds;
+    int skip = 0;
+    int primitiveStart = 0;
+    int primitiveCount = 0; // 0 for internal nodes
+};
+
 class BVH {
 public:
     // Build BVH from triangles and spheres
@@ -74,6 +109,12 @@ public:
     void build(std::vector<Triangle> &triangles,
         std::vector<AnalyticalSphereData> &spheres);
 
+    // Same, with mesh instances referenced by their world-space bounds.
+    // This is how the top level of the scene is built.
+    void build(std::vector<Triangle> &triangles,
+        std::vector<AnalyticalSphereData> &spheres,
+        std::vector<InstanceData> &instances);
+
     const std::vector<BVHNode> &getNodes() const { return m_nodes; }
 
     int getNodeCount() const { return static_cast<int>(m_nodes.size()); }
@@ -89,33 +130,223 @@ public:
         return static_cast<int>(m_primitives.size());
     }
 
+    // Position of each input triangle/sphere after build() reordered the
+    // arrays, indexed by its position before the build
+    const std::vector<int> &getTriangleRemap() const
+    {
+        return m_triangleRemap;
+    }
+
+    const std::vector<int> &getSphereRemap() const { return m_sphereRemap; }
+
+    const std::vector<int> &getInstanceRemap() const
+    {
+        return m_instanceRemap;
+    }
+
+    // Recompute every bound bottom-up after primitives moved, keeping the
+    // topology. Arrays must be in the order produced by build().
+    void refit(const std::vector<Triangle> &triangles,
+        const std::vector<AnalyticalSphereData> &spheres);
+    void refit(const std::vector<Triangle> &triangles,
+        const std::vector<AnalyticalSphereData> &spheres,
+        const std::vector<InstanceData> &instances);
+
+    // SAH cost of the tree normalized by the root area, and the same cost
+    // measured right after the last full build. Refits only ever degrade it.
+    float computeSAHCost() const;
+
+    float getBuildSAHCost() const { return m_buildSAHCost; }
+
+    // Adopt a tree built earlier, e.g. loaded from the on-disk cache.
+    // Primitives must already index the caller's reordered arrays, the
+    // remaps are left empty.
+    void restore(
+        std::vector<BVHNode> nodes, std::vector<BVHPrimitive> primitives);
+
+    // Skip-link layout of the tree for stackless traversal. Leaves with more
+    // than maxLeafPrimitives primitives become a chain of nodes sharing
+    // their bounds.
+    std::vector<BVHSkipNode> buildSkipNodes(int maxLeafPrimitives) const;
+
+    // Lower the SAH cost after build() by giving every treelet of up to
+    // TREELET_LEAVES subtrees its optimal topology, over several passes.
+    // Only internal nodes are rewired, leaves and primitives stay as built
+    // so the reordered input arrays remain valid.
+    BVHOptimizeResult optimize(int passes = 3);
+
+    // Build the two halves of large nodes as parallel tasks. The resulting
+    // node order is identical to a single-threaded build.
+    void setParallelBuild(bool enabled) { m_parallelBuild = enabled; }
+
+    bool isParallelBuild() const { return m_parallelBuild; }
+
+    void setBuildMode(BVHBuildMode mode) { m_buildMode = mode; }
+
+    BVHBuildMode getBuildMode() const { return m_buildMode; }
+
+    // Number of top levels of an LBVH build split with SAH instead of Morton
+    // codes (0 = pure LBVH)
+    void setLBVHSAHLevels(int levels) { m_lbvhSAHLevels = levels; }
+
+    int getLBVHSAHLevels() const { return m_lbvhSAHLevels; }
+
+    // SBVH: spatial splits are only tried where the two children of the
+    // best object split overlap by more than this fraction of the root area
+    void setSpatialSplitOverlap(float overlap)
+    {
+        m_spatialSplitOverlap = overlap;
+    }
+
+    float getSpatialSplitOverlap() const { return m_spatialSplitOverlap; }
+
+    // SBVH: extra primitive references spatial splits may create, as a
+    // fraction of the input primitive count
+    void setSpatialSplitBudget(float budget) { m_spatialSplitBudget = budget; }
+
+    float getSpatialSplitBudget() const { return m_spatialSplitBudget; }
+
     void clear()
     {
         m_nodes.clear();
         m_primitives.clear();
+        m_triangleRemap.clear();
+        m_sphereRemap.clear();
+        m_instanceRemap.clear();
+        m_buildSAHCost = 0.0f;
     }
 
 private:
     std::vector<BVHNode> m_nodes;
     std::vector<BVHPrimitive> m_primitives;
+    std::vector<int> m_triangleRemap;
+    std::vector<int> m_sphereRemap;
+    std::vector<int> m_instanceRemap;
+    float m_buildSAHCost = 0.0f;
+
+    // Structure-of-arrays copy of the primitives, only alive during build.
+    // Kept in the same order as the index array and partitioned alongside
+    // it, so the split finder streams through contiguous memory.
+    struct alignas(16) PackedBounds {
+        float min[4];
+        float max[4];
+    };
+    std::vector<float> m_buildCentroids[3];
+    std::vector<PackedBounds> m_buildBounds;
+
+    bool m_parallelBuild = true;
+    int m_maxTaskDepth = 0;
+    BVHBuildMode m_buildMode = BVHBuildMode::SAH;
+    int m_lbvhSAHLevels = 0;
+    float m_spatialSplitOverlap = 1e-5f;
+    float m_spatialSplitBudget = 0.3f;
+
+    // SBVH build state. A reference is a primitive clipped to the part of
+    // it that lies inside the node holding it.
+    struct SpatialReference {
+        int primitive;
+        AABB bounds;
+    };
+    const std::vector<Triangle> *m_buildTriangles = nullptr;
+    int m_spatialReferencesLeft = 0;
+    float m_spatialRootArea = 0.0f;
 
     static constexpr int MAX_LEAF_PRIMITIVES = 4;
-    static constexpr int SAH_BUCKETS = 12;
+    static constexpr int SAH_BUCKETS = SCENELAB_BVH_SAH_BUCKETS;
+    static_assert(SAH_BUCKETS >= 2 && SAH_BUCKETS <= 256,
+        "SCENELAB_BVH_SAH_BUCKETS must be in [2, 256]");
     static constexpr float TRAVERSAL_COST = 1.0f;
     static constexpr float INTERSECTION_COST = 1.0f;
+    // Subtrees per treelet in optimize(), the search visits 3^n partitions
+    static constexpr int TREELET_LEAVES = 7;
+    // Nodes with fewer primitives than this are never split across tasks
+    static constexpr int PARALLEL_BUILD_CUTOFF = 4096;
+    // Above this many primitives Morton codes use 21 bits per axis (63-bit
+    // codes) instead of 10 (30-bit codes)
+    static constexpr int LBVH_WIDE_CODE_THRESHOLD = 1 << 18;
+
+    static BVHPrimitive makeTrianglePrimitive(const Triangle &tri, int index);
+    static BVHPrimitive makeSpherePrimitive(
+        const AnalyticalSphereData &sphere, int index);
+    static BVHPrimitive makeInstancePrimitive(
+        const InstanceData &instance, int index);
+
+    // Build BVH recursively into the given node arena, returns the node index
+    // inside that arena
+    int buildRecursive(std::vector<int> &indices, int start, int end,
+        int depth, std::vector<BVHNode> &nodes);
+
+    // Build a linear BVH over indices already sorted by Morton code, returns
+    // the node index inside the given arena
+    int buildLinear(std::vector<int> &indices, std::vector<uint64_t> &codes,
+        int start, int end, int depth, std::vector<BVHNode> &nodes);
 
-    // Build BVH recursively, returns node index
-    int buildRecursive(
-        std::vector<int> &indices, int start, int end, int depth);
+    // Build an SBVH over the given references, appending leaf references to
+    // leafRefs. Runs on the calling thread since every node reloads the
+    // build streams. Returns the node index inside the given arena.
+    int buildSpatial(std::vector<SpatialReference> &refs, int depth,
+        std::vector<BVHNode> &nodes,
+        std::vector<SpatialReference> &leafRefs);
 
-    // Find best split using SAH
+    struct SpatialSplit {
+        int axis = -1;
+        float position = 0.0f;
+        float cost = std::numeric_limits<float>::max();
+        AABB leftBounds;
+        AABB rightBounds;
+        int leftCount = 0;
+        int rightCount = 0;
+    };
+
+    // Find the best binned spatial split, chopping references into every
+    // bin they cross
+    SpatialSplit findSpatialSplit(const std::vector<SpatialReference> &refs,
+        const AABB &nodeBounds) const;
+
+    // Bounds of the parts of a reference on each side of a plane
+    void splitReference(const SpatialReference &ref, int axis,
+        float position, AABB &left, AABB &right) const;
+
+    // Replace the treelet under an internal node by the topology with the
+    // lowest SAH cost. costs holds the unnormalized cost of every subtree
+    // and is updated for the rewired nodes.
+    void restructureTreelet(int root, std::vector<float> &costs);
+
+    // Renumber nodes depth-first so every child follows its parent
+    void relayoutNodes();
+
+    // Sort indices by the Morton code of their centroid (parallel LSD radix
+    // sort), returns the sorted codes
+    std::vector<uint64_t> sortByMortonCode(std::vector<int> &indices) const;
+
+    // Append a subtree built in its own arena, returns its root index
+    static int appendSubtree(
+        std::vector<BVHNode> &nodes, const std::vector<BVHNode> &subtree);
+
+    // Find best split using binned SAH over the build streams
     struct SplitResult {
         int axis = -1;
+        int bucket = -1; // Last bucket that goes to the left child
         float position = 0.0f;
         float cost = std::numeric_limits<float>::max();
         int splitIndex = -1;
     };
 
-    SplitResult findBestSplit(const std::vector<int> &indices, int start,
-        int end, const AABB &nodeBounds, const AABB &centroidBounds);
+    SplitResult findBestSplit(int start, int end, const AABB &nodeBounds,
+        const AABB &centroidBounds) const;
+
+    // Partition [start, end) so that primitives in buckets <= split.bucket
+    // come first, returns the first index of the right half
+    int partition(std::vector<int> &indices, int start, int end,
+        const SplitResult &split, const AABB &centroidBounds);
+
+    // Same as partition, but keeps the relative order on both sides so the
+    // Morton codes stay sorted
+    int stablePartition(std::vector<int> &indices,
+        std::vector<uint64_t> &codes, int start, int end,
+        const SplitResult &split, const AABB &centroidBounds);
+
+    // Bounds of the build streams over [start, end)
+    void computeRangeBounds(
+        int start, int end, AABB &bounds, AABB &centroidBounds) const;
 };
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "renderer/BVH.hpp"
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+// Bottom-level BVHs saved between sessions, one file per mesh named after
+// a hash of its object-space geometry and of the build settings. Entries
+// are checked when loaded, so corrupt or stale ones are simply rebuilt.
+// Past maxBytes, the least recently used entries are deleted.
+class BVHCache {
+public:
+    // Bump whenever the layout of BVHNode, BVHPrimitive or Triangle or the
+    // builders' output changes
+    static constexpr uint32_t FORMAT_VERSION = 2;
+
+    static constexpr uint64_t DEFAULT_MAX_BYTES = 512ull << 20;
+
+    explicit BVHCache(std::filesystem::path directory,
+        uint64_t maxBytes = DEFAULT_MAX_BYTES);
+
+    // Key of a mesh, from its vertices and every setting of the configured
+    // (not yet built) BVH that changes the resulting tree
+    static uint64_t computeKey(const std::vector<Triangle> &triangles,
+        const BVH &settings, bool optimized);
+
+    // Replace bvh and triangles (in leaf order) with the entry for key, and
+    // mark it as recently used. Returns false, leaving both untouched, on a
+    // missing, stale or corrupt entry.
+    bool load(uint64_t key, BVH &bvh, std::vector<Triangle> &triangles) const;
+
+    // Write the entry for key, replacing any previous one, then evict old
+    // entries over the size limit. The cache is only an optimization, so
+    // failures are reported and otherwise ignored.
+    bool store(uint64_t key, const BVH &bvh,
+        const std::vector<Triangle> &triangles) const;
+
+    std::filesystem::path getEntryPath(uint64_t key) const;
+
+private:
+    std::filesystem::path m_directory;
+    uint64_t m_maxBytes;
+
+    // Delete entries, least recently used first, until the cache fits in
+    // m_maxBytes. The entry at keep survives even if it alone is too big.
+    void evict(const std::filesystem::path &keep) const;
+};
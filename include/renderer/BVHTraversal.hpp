@@ -0,0 +1,60 @@
+#pragma once
+
+#include "renderer/BVH.hpp"
+#include "renderer/PathTracingData.hpp"
+#include <array>
+#include <glm/glm.hpp>
+#include <vector>
+
+// Packets are as wide as the widest vector unit the build targets:
+// AVX-512, AVX2, then SSE or the scalar fallback
+#if defined(__AVX512F__)
+#define SCENELAB_SIMD_WIDTH 16
+#elif defined(__AVX2__)
+#define SCENELAB_SIMD_WIDTH 8
+#else
+#define SCENELAB_SIMD_WIDTH 4
+#endif
+
+constexpr int RAY_PACKET_SIZE = SCENELAB_SIMD_WIDTH;
+
+// Closest primitive found along a ray, an index into BVH::getPrimitives()
+// or -1 on a miss
+struct BVHHit {
+    float dist = 0.0f;
+    int primitive = -1;
+};
+
+// Rays traced together, one per vector lane. Lanes from count on are
+// padding and never hit anything.
+struct RayPacket {
+    std::array<glm::vec3, RAY_PACKET_SIZE> origins;
+    std::array<glm::vec3, RAY_PACKET_SIZE> directions;
+    int count = 0;
+};
+
+// Closest-hit queries against a BVH built from triangles and spheres (no
+// instances), with the path tracing shader's intersection tests. Hits
+// closer than tMin are ignored, dist starts at tMax and stays there on a
+// miss.
+class BVHTraversal {
+public:
+    static BVHHit traceRay(const BVH &bvh,
+        const std::vector<Triangle> &triangles,
+        const std::vector<AnalyticalSphereData> &spheres,
+        const glm::vec3 &origin, const glm::vec3 &direction, float tMin,
+        float tMax);
+
+    // Same result per ray as traceRay, the packet shares one traversal and
+    // intersects every ray with each node and primitive at once
+    static void tracePacket(const BVH &bvh,
+        const std::vector<Triangle> &triangles,
+        const std::vector<AnalyticalSphereData> &spheres,
+        const RayPacket &packet, float tMin, float tMax,
+        std::array<BVHHit, RAY_PACKET_SIZE> &hits);
+
+    // Whether the rays point the same way closely enough for a shared
+    // traversal to pay off, as primary rays do. Scattered bounces should
+    // be traced one by one.
+    static bool isCoherent(const RayPacket &packet);
+};
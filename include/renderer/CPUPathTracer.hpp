@@ -0,0 +1,139 @@
+#pragma once
+
+#include "renderer/BVH.hpp"
+#include "renderer/BVHTraversal.hpp"
+#include "renderer/Denoiser.hpp"
+#include "renderer/LightTable.hpp"
+#include "renderer/PathTracingData.hpp"
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <vector>
+
+// Camera as the path tracing shader sees it
+struct PathTracingCamera {
+    glm::vec3 position { 0.0f };
+    glm::mat3 rotation { 1.0f };
+    float focalLength = 1.0f; // 1 / tan(fov / 2)
+
+    // From Euler angles in degrees (pitch, yaw, roll) and a vertical FOV
+    static PathTracingCamera fromAngles(
+        const glm::vec3 &position, const glm::vec3 &rotation, float fov);
+
+    // World direction through an image point, both axes in [-1, 1]
+    glm::vec3 rayDirection(const glm::vec2 &point, float aspectRatio) const;
+    // Image point a world position is seen at, false behind the camera.
+    // Temporal reprojection in pathtracing.frag does the same.
+    bool project(const glm::vec3 &position, float aspectRatio,
+        glm::vec2 &point) const;
+};
+
+// CPU implementation of the light transport in pathtracing.frag, for
+// rendering without a GL context. The scene is given in world space and
+// traced through a single BVH. Pixels use the shader's random sequences,
+// so the image does not depend on how tiles are spread over threads.
+class CPUPathTracer {
+public:
+    // Triangles and spheres are reordered by the BVH build. Triangles
+    // index into materials.
+    void setScene(std::vector<Triangle> triangles,
+        std::vector<MaterialData> materials,
+        std::vector<AnalyticalSphereData> spheres,
+        std::vector<AnalyticalPlaneData> planes);
+
+    void setCamera(const PathTracingCamera &camera);
+
+    void resize(int width, int height);
+
+    // 0 uses every hardware thread
+    void setThreadCount(int threads) { m_threadCount = threads; }
+
+    int getThreadCount() const { return m_threadCount; }
+
+    // Trace coherent primary rays as SIMD packets, on by default
+    void setPacketTracing(bool enabled) { m_packetTracing = enabled; }
+
+    bool getPacketTracing() const { return m_packetTracing; }
+
+    // Sample emissive triangles and spheres at diffuse bounces, weighted
+    // against hitting them by chance (MIS), on by default
+    void setLightSampling(bool enabled) { m_lightSampling = enabled; }
+
+    bool getLightSampling() const { return m_lightSampling; }
+
+    void resetAccumulation();
+
+    // Trace one sample per pixel and blend it into the running average,
+    // like one frame of the shader
+    void renderFrame();
+
+    int getFrameCount() const { return m_frame; }
+
+    int getWidth() const { return m_width; }
+
+    int getHeight() const { return m_height; }
+
+    // Accumulated linear color, rows from the bottom like a GL texture
+    const std::vector<glm::vec3> &getImage() const { return m_image; }
+
+    // First-hit albedo, normal and depth, averaged like the image, and
+    // luminance moments (mean, mean of squares, sample count) like the
+    // editor's moments texture, for the denoiser
+    const std::vector<SurfaceAOV> &getAOVs() const { return m_aovs; }
+
+    const std::vector<glm::vec3> &getMoments() const { return m_moments; }
+
+    // Continue from an image, AOVs and moments accumulated over frameCount
+    // frames at the current size, e.g. a saved checkpoint. Later frames
+    // then match an uninterrupted render. Returns false if a size does not
+    // match.
+    bool restoreAccumulation(std::vector<glm::vec3> image,
+        std::vector<SurfaceAOV> aovs, std::vector<glm::vec3> moments,
+        int frameCount);
+
+    // Radiance along one world-space ray, advancing rngState
+    glm::vec3 traceRay(const glm::vec3 &origin, const glm::vec3 &direction,
+        uint32_t &rngState) const;
+
+private:
+    struct HitInfo {
+        float dist;
+        glm::vec3 normal;
+        const Triangle *triangle = nullptr;
+        const AnalyticalSphereData *sphere = nullptr;
+        const AnalyticalPlaneData *plane = nullptr;
+    };
+
+    static constexpr int TILE_SIZE = 16;
+
+    // Closest hit before hit.dist. The BVH part is looked up unless the
+    // packet traversal already found it.
+    void traceScene(const glm::vec3 &origin, const glm::vec3 &direction,
+        const BVHHit *primaryHit, HitInfo &hit) const;
+    // The first hit is written to aov when given
+    glm::vec3 tracePath(const glm::vec3 &origin, const glm::vec3 &direction,
+        const BVHHit *primaryHit, uint32_t &rngState,
+        SurfaceAOV *aov = nullptr) const;
+    // Light reaching a diffuse point from one sampled light, MIS weighted
+    // and divided by the albedo
+    glm::vec3 sampleLight(const glm::vec3 &position, const glm::vec3 &normal,
+        uint32_t &rngState) const;
+    void renderTile(int tile);
+
+    std::vector<Triangle> m_triangles;
+    std::vector<MaterialData> m_materials;
+    std::vector<AnalyticalSphereData> m_spheres;
+    std::vector<AnalyticalPlaneData> m_planes;
+    BVH m_bvh;
+    LightTable m_lights;
+
+    PathTracingCamera m_camera;
+    int m_width = 0;
+    int m_height = 0;
+    int m_threadCount = 0;
+    bool m_packetTracing = true;
+    bool m_lightSampling = true;
+    int m_frame = 0;
+    std::vector<glm::vec3> m_image;
+    std::vector<SurfaceAOV> m_aovs;
+    std::vector<glm::vec3> m_moments;
+};
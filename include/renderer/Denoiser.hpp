@@ -0,0 +1,46 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+
+// First surface a pixel's camera rays hit, averaged over its samples like
+// the color. The denoiser stops at the edges of these.
+struct SurfaceAOV {
+    glm::vec3 albedo { 0.0f };
+    glm::vec3 normal { 0.0f }; // 0 where the rays missed
+    float depth = 0.0f; // Distance along the camera ray, 0 on a miss
+};
+
+// Edge-avoiding a-trous wavelet filter, weighted like SVGF (Schied et al.
+// 2017). Each pass blends a 5x5 B3-spline kernel whose taps are 2^pass
+// pixels apart. Taps are weighted down across normal and depth edges, and
+// by their luminance difference relative to the pixel's noise, taken from
+// its luminance moments (its neighborhood until it has a few samples) and
+// filtered along with the color. Lighting is filtered with the albedo
+// divided out and multiplied back after, so texture detail stays sharp.
+// denoise.frag runs the same passes.
+class ATrousDenoiser {
+public:
+    struct Settings {
+        int iterations = 5;
+        // Luminance difference, in standard deviations of the pixel's
+        // noise, that cuts a tap's weight by e
+        float colorPhi = 4.0f;
+        // Exponent on the cosine between normals
+        float normalPhi = 128.0f;
+        // Depth difference, in multiples of the one the pixel's depth
+        // gradient predicts, that cuts a tap's weight by e
+        float depthPhi = 1.0f;
+    };
+
+    // Pixels with fewer samples get their noise from their neighborhood
+    static constexpr float MIN_MOMENT_SAMPLES = 4.0f;
+
+    // Images are width * height, rows from the bottom like the tracer's.
+    // moments holds each pixel's mean luminance, mean squared luminance
+    // and sample count, or is empty to estimate all noise spatially.
+    static std::vector<glm::vec3> denoise(const std::vector<glm::vec3> &color,
+        const std::vector<glm::vec3> &moments,
+        const std::vector<SurfaceAOV> &aovs, int width, int height,
+        const Settings &settings);
+};
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// 64-bit FNV-1a, for the keys and checksums of files the renderer writes
+// and for matching geometries. Not collision resistant: equal hashes only
+// say the data is very likely equal.
+constexpr uint64_t FNV1A_SEED = 0xcbf29ce484222325ull;
+constexpr uint64_t FNV1A_PRIME = 0x100000001b3ull;
+
+// Fed 8-byte words, then the remaining bytes
+inline uint64_t fnv1aHash(uint64_t hash, const void *data, size_t size)
+{
+    const auto *bytes = static_cast<const unsigned char *>(data);
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        std::memcpy(&word, bytes + i, sizeof(word));
+        hash = (hash ^ word) * FNV1A_PRIME;
+    }
+    for (; i < size; i++) {
+        hash = (hash ^ bytes[i]) * FNV1A_PRIME;
+    }
+    return hash;
+}
+
+template <typename T> uint64_t fnv1aHashValue(uint64_t hash, const T &value)
+{
+    return fnv1aHash(hash, &value, sizeof(T));
+}
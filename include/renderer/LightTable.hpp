@@ -0,0 +1,71 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+
+enum class LightType : int { Triangle = 0, Sphere = 1 };
+
+// An emissive primitive in world space. Spheres keep their center in v0
+// and their radius in v1.x.
+struct LightData {
+    glm::vec3 v0 { 0.0f };
+    glm::vec3 v1 { 0.0f };
+    glm::vec3 v2 { 0.0f };
+    glm::vec3 emissive { 0.0f };
+    LightType type = LightType::Triangle;
+    float cdf = 0.0f; // Chance of picking this light or one before it
+};
+
+// Direction from a shaded point toward a point picked on a light
+struct LightSample {
+    glm::vec3 direction { 0.0f };
+    float distance = 0.0f;
+    glm::vec3 emissive { 0.0f };
+    float pdf = 0.0f; // Solid angle, picking included. 0 if none was found.
+};
+
+// Emissive triangles and spheres for next-event estimation, picked in
+// proportion to their power (luminance times area) through a CDF.
+// Triangles are sampled uniformly over their area, spheres over the cone
+// they subtend. pathtracing.frag samples the uploaded table the same way.
+class LightTable {
+public:
+    void clear();
+
+    // Primitives that emit nothing or have no area are skipped
+    void addTriangle(const glm::vec3 &v0, const glm::vec3 &v1,
+        const glm::vec3 &v2, const glm::vec3 &emissive);
+    void addSphere(
+        const glm::vec3 &center, float radius, const glm::vec3 &emissive);
+
+    // Normalize the CDF, once every light is added
+    void finalize();
+
+    bool empty() const { return m_lights.empty(); }
+
+    const std::vector<LightData> &getLights() const { return m_lights; }
+
+    float getTotalPower() const { return m_totalPower; }
+
+    // Light whose CDF range holds u in [0, 1)
+    int pick(float u) const;
+
+    // Pick a light with u0 and a point on it with u1 and u2
+    LightSample sample(
+        const glm::vec3 &position, float u0, float u1, float u2) const;
+
+    // Solid-angle pdf of sample() reaching a point of an emissive triangle
+    // at distance, whose normal makes cosLight with the direction
+    float trianglePdf(
+        const glm::vec3 &emissive, float distance, float cosLight) const;
+
+    // Solid-angle pdf of sample() reaching an emissive sphere from position
+    float spherePdf(const glm::vec3 &emissive, const glm::vec3 &center,
+        float radius, const glm::vec3 &position) const;
+
+    static float luminance(const glm::vec3 &color);
+
+private:
+    std::vector<LightData> m_lights;
+    float m_totalPower = 0.0f;
+};
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <future>
+#include <vector>
+
+// Run fn(0) .. fn(tasks - 1) concurrently, fn(0) on the calling thread.
+// Returns once all of them are done, rethrowing the first exception.
+template <typename Fn> void runTasks(unsigned int tasks, const Fn &fn)
+{
+    std::vector<std::future<void>> futures;
+    futures.reserve(tasks);
+    for (unsigned int t = 1; t < tasks; t++) {
+        futures.push_back(std::async(std::launch::async, fn, t));
+    }
+    fn(0u);
+    for (auto &future : futures) {
+        future.get();
+    }
+}
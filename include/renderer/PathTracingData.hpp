@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+#include <glm/glm.hpp>
+
+// Plain scene data consumed by the path tracer and its BVH. Kept free of any
+// GL/ImGui dependency so the acceleration structure can be built and tested
+// on its own.
+
+// Surface parameters, one row of the material table per mesh
+struct MaterialData {
+    glm::vec3 color;
+    glm::vec3 emissive;
+    float percentSpecular;
+    float roughness;
+    glm::vec3 specularColor;
+    float indexOfRefraction;
+    float refractionChance;
+};
+
+// Triangles only carry geometry and the row of their material, so a mesh
+// with one material stores it once
+struct Triangle {
+    glm::vec3 v0, v1, v2;
+    glm::vec3 normal;
+    uint32_t materialIndex;
+};
+
+struct AnalyticalSphereData {
+    glm::vec3 center;
+    float radius;
+    glm::vec3 color;
+    glm::vec3 emissive;
+    float percentSpecular;
+    float roughness;
+    glm::vec3 specularColor;
+    float indexOfRefraction;
+    float refractionChance;
+};
+
+struct AnalyticalPlaneData {
+    glm::vec3 point;
+    glm::vec3 normal;
+    glm::vec3 color;
+    glm::vec3 emissive;
+    float percentSpecular;
+    float roughness;
+    glm::vec3 specularColor;
+    float indexOfRefraction;
+    float refractionChance;
+};
+
+// A mesh placed in the scene. Its triangles live in object space under their
+// own bottom-level BVH, the top level only sees the world-space bounds.
+struct InstanceData {
+    glm::mat4 worldToObject { 1.0f };
+    glm::vec3 boundsMin { 0.0f };
+    glm::vec3 boundsMax { 0.0f };
+    int objectId = -1;
+};
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "renderer/CPUPathTracer.hpp"
+#include <cstdint>
+#include <filesystem>
+
+// Progress of a batch render saved to disk, so a killed job resumes from
+// its last checkpoint instead of restarting. The key identifies the scene
+// and settings; a checkpoint written for anything else is ignored.
+class RenderCheckpoint {
+public:
+    static constexpr uint32_t FORMAT_VERSION = 2;
+
+    // Write the tracer's accumulated image, AOVs and moments. The file is
+    // replaced atomically, a crash while saving keeps the previous
+    // checkpoint.
+    static bool save(const std::filesystem::path &path, uint64_t key,
+        const CPUPathTracer &tracer);
+
+    // Restore a checkpoint into a tracer already set to the render's scene
+    // and size. Returns false, leaving the tracer untouched, on a missing,
+    // foreign or corrupt file.
+    static bool load(const std::filesystem::path &path, uint64_t key,
+        CPUPathTracer &tracer);
+};
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+// Share of a path-traced view's resolution it traces at. While the camera
+// or scene moves, the scale follows the measured frame time toward a
+// budget: tracing cost goes with the pixel count, so the scale goes with
+// the square root of the time ratio. Once motion stops for a few frames it
+// goes back to full resolution.
+class ResolutionScaler {
+public:
+    struct Settings {
+        float frameBudgetMs = 16.0f;
+        float minScale = 0.25f;
+        // Scales are multiples of this, so timing jitter does not change
+        // the resolution every frame
+        float step = 0.125f;
+        // Still frames before going back to full resolution
+        int settleFrames = 3;
+    };
+
+    ResolutionScaler() = default;
+    explicit ResolutionScaler(const Settings &settings);
+
+    // Call once per frame before tracing it. frameMs is what the last
+    // measured frame took at the current scale, negative when unknown.
+    float update(bool moving, float frameMs);
+
+    float getScale() const { return m_scale; }
+    // Traced size of a view, at least 1x1
+    glm::ivec2 scaledSize(const glm::ivec2 &size) const;
+
+    const Settings &getSettings() const { return m_settings; }
+    void setSettings(const Settings &settings) { m_settings = settings; }
+
+private:
+    Settings m_settings;
+    float m_scale = 1.0f;
+    int m_stillFrames = 0;
+};
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "renderer/PathTracingData.hpp"
+#include <filesystem>
+#include <string>
+#include <vector>
+
+// Scene for batch renders, read from a line-based text file so it can be
+// rendered without the editor. Lines hold one statement, '#' starts a
+// comment:
+//
+//   camera NAME px py pz pitch yaw roll [fov]     angles in degrees
+//   material NAME [color r g b] [emissive r g b] [specular p]
+//       [roughness r] [specularColor r g b] [ior n] [refraction p]
+//   use NAME                                      material of what follows
+//   sphere cx cy cz radius
+//   plane px py pz nx ny nz
+//   triangle x0 y0 z0 x1 y1 z1 x2 y2 z2
+//   mesh FILE.obj [translate x y z] [rotate pitch yaw roll] [scale s]
+//       [scale sx sy sz]
+//
+// Mesh paths are relative to the scene file. Transforms are applied like
+// GameObject's: scale, then roll, yaw and pitch, then translation.
+struct SceneDescription {
+    struct Camera {
+        std::string name;
+        glm::vec3 position { 0.0f };
+        glm::vec3 rotation { 0.0f }; // Pitch, yaw, roll in degrees
+        float fov = 45.0f;
+    };
+
+    std::vector<Triangle> triangles;
+    std::vector<MaterialData> materials; // Rows the triangles point at
+    std::vector<AnalyticalSphereData> spheres;
+    std::vector<AnalyticalPlaneData> planes;
+    std::vector<Camera> cameras;
+
+    // Replace the contents with the scene in path. Returns false and
+    // reports the offending line on a malformed statement.
+    bool load(const std::filesystem::path &path);
+
+    // Same as load, from text whose mesh paths are relative to baseDir
+    bool parse(const std::string &text, const std::filesystem::path &baseDir,
+        const std::string &sourceName = "<scene>");
+
+    // Camera called name, or the first one when name is empty
+    const Camera *findCamera(const std::string &name) const;
+};
+
+// Normal from the triangle's winding, up when it is degenerate
+void setFaceNormal(Triangle &tri);
+
+// Append the triangles of an OBJ file, moved by transform and using
+// material row materialIndex. Only positions and faces are read, polygons
+// are fanned into triangles.
+bool loadOBJTriangles(const std::filesystem::path &path,
+    const glm::mat4 &transform, uint32_t materialIndex,
+    std::vector<Triangle> &triangles);
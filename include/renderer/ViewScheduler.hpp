@@ -0,0 +1,53 @@
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+
+// Splits a GPU frame-time budget between path-traced camera views. Every
+// frame each visible view earns a share of the budget, weighted by its
+// area, by focus and by how much of it is still noisy, and spends what it
+// has saved on accumulation passes at its measured cost. Views costlier
+// than their share trace every few frames instead, hidden views not at all.
+class ViewScheduler {
+public:
+    struct Settings {
+        float frameBudgetMs = 16.0f;
+        // Weight multiplier of the focused view
+        float focusWeight = 4.0f;
+        // Weight left to a fully converged view, relative to a noisy one
+        float convergedWeight = 0.1f;
+        int maxPassesPerFrame = 8;
+        // Pass cost assumed until a view has been timed
+        float defaultMsPerMegapixel = 8.0f;
+    };
+
+    struct ViewState {
+        int id = 0;
+        bool visible = false;
+        bool focused = false;
+        // Moving views trace every frame, over their share if need be
+        bool moving = false;
+        int pixels = 0;
+        float convergedFraction = 0.0f;
+        float passMs = -1.0f; // Measured cost of a pass, negative if unknown
+    };
+
+    struct Allocation {
+        int passes = 0;
+        float budgetMs = 0.0f; // The view's share of this frame
+    };
+
+    ViewScheduler() = default;
+    explicit ViewScheduler(const Settings &settings);
+
+    // Plans one frame, allocations are in the order of views. Savings are
+    // kept per view id, ids missing from views are forgotten.
+    std::vector<Allocation> schedule(const std::vector<ViewState> &views);
+
+    const Settings &getSettings() const { return m_settings; }
+    void setSettings(const Settings &settings) { m_settings = settings; }
+
+private:
+    Settings m_settings;
+    std::unordered_map<int, float> m_savedMs;
+};
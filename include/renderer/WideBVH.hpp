@@ -0,0 +1,78 @@
+#pragma once
+
+#include "renderer/BVH.hpp"
+#include <array>
+#include <cstdint>
+#include <vector>
+
+// Child slots are sized for the widest collapse
+constexpr int WIDE_BVH_MAX_WIDTH = 8;
+
+// Child slot meta values, anything else is a leaf primitive count
+constexpr uint16_t WIDE_BVH_EMPTY = 0;
+constexpr uint16_t WIDE_BVH_INTERNAL = 0x8000;
+
+// Child bounds quantized to 8 bits per axis on the parent's grid
+struct WideBVHChild {
+    std::array<uint8_t, 3> qlo {};
+    std::array<uint8_t, 3> qhi {};
+    uint16_t meta = WIDE_BVH_EMPTY;
+
+    bool isEmpty() const { return meta == WIDE_BVH_EMPTY; }
+
+    bool isInternal() const { return meta == WIDE_BVH_INTERNAL; }
+};
+
+// Internal children are stored contiguously from childBase in slot order,
+// and the primitives of leaf children contiguously from primBase
+struct WideBVHNode {
+    glm::vec3 origin { 0.0f };
+    std::array<int8_t, 3> exponent {}; // Grid step is 2^exponent per axis
+    int childBase = 0;
+    int primBase = 0;
+    std::array<WideBVHChild, WIDE_BVH_MAX_WIDTH> children {};
+};
+
+// A binary BVH collapsed into nodes of up to 4 or 8 children, which trace
+// with fewer dependent fetches on the GPU
+class WideBVH {
+public:
+    void build(const BVH &bvh, int width);
+
+    void clear()
+    {
+        m_nodes.clear();
+        m_primitiveOrder.clear();
+    }
+
+    const std::vector<WideBVHNode> &getNodes() const { return m_nodes; }
+
+    int getNodeCount() const { return static_cast<int>(m_nodes.size()); }
+
+    // Index in BVH::getPrimitives() of every primitive, in the order leaf
+    // children reference them
+    const std::vector<int> &getPrimitiveOrder() const
+    {
+        return m_primitiveOrder;
+    }
+
+    int getWidth() const { return m_width; }
+
+    // Conservative bounds of a child as the shader decodes them
+    static AABB decodeChildBounds(const WideBVHNode &node, int slot);
+
+private:
+    std::vector<WideBVHNode> m_nodes;
+    std::vector<int> m_primitiveOrder;
+    int m_width = 0;
+
+    // A binary node, or part of a leaf with more primitives than a child
+    // can count. Internal nodes have no primitives.
+    struct Slot {
+        int node = 0;
+        int primitiveStart = 0;
+        int primitiveCount = 0;
+    };
+
+    void collapse(const BVH &bvh, const Slot &slot, int wideIndex);
+};
@@ -8,6 +8,13 @@
 #include "renderer/TextureLibrary.hpp"
 #include "renderer/implementation/RasterizationRenderer.hpp"
 #include "renderer/BVH.hpp"
+#include "renderer/BVHCache.hpp"
+#include "renderer/Denoiser.hpp"
+#include "renderer/LightTable.hpp"
+#include "renderer/WideBVH.hpp"
+#include "renderer/PathTracingData.hpp"
+#include "renderer/ResolutionScaler.hpp"
+#include "renderer/ViewScheduler.hpp"
 #include <array>
 #include <glm/glm.hpp>
 #include <glm/gtc/type_ptr.hpp>
@@ -17,40 +24,10 @@
 
 #include <memory>
 
-struct Triangle {
-    glm::vec3 v0, v1, v2;
-    glm::vec3 normal;
-    glm::vec3 color;
-    glm::vec3 emissive;
-    float percentSpecular;
-    float roughness;
-    glm::vec3 specularColor;
-    float indexOfRefraction;
-    float refractionChance;
-};
-
-struct AnalyticalSphereData {
-    glm::vec3 center;
-    float radius;
-    glm::vec3 color;
-    glm::vec3 emissive;
-    float percentSpecular;
-    float roughness;
-    glm::vec3 specularColor;
-    float indexOfRefraction;
-    float refractionChance;
-};
-
-struct AnalyticalPlaneData {
-    glm::vec3 point;
-    glm::vec3 normal;
-    glm::vec3 color;
-    glm::vec3 emissive;
-    float percentSpecular;
-    float roughness;
-    glm::vec3 specularColor;
-    float indexOfRefraction;
-    float refractionChance;
+// Rows [first, first + count) of a scene data texture
+struct TextureRowRange {
+    int first;
+    int count;
 };
 
 class PathTracingRenderer : public IRenderer {
@@ -64,41 +41,144 @@ private:
         Camera::ProjectionMode::Perspective
     };
 
-    std::vector<float> texData;
+    // Scene data textures store their rows end to end and wrap them at
+    // this width, so primitive counts are not capped by the texture height
+    static constexpr int SCENE_TEXTURE_WIDTH = 4096;
+    int m_sceneTextureWidth = SCENE_TEXTURE_WIDTH;
 
-    std::vector<Triangle> m_triangles;
     GLuint m_triangleGeomTexture = 0;
-    GLuint m_triangleMaterialTexture = 0;
-    int m_lastTriangleTextureHeight = 0;
+    int m_lastTriangleRowCount = 0;
+
+    // One row per mesh object, shared by all of its triangles
+    std::vector<MaterialData> m_materials;
+    GLuint m_materialTexture = 0;
+    int m_lastMaterialRowCount = 0;
 
     std::vector<AnalyticalSphereData> m_spheres;
     GLuint m_sphereGeomTexture = 0;
     GLuint m_sphereMaterialTexture = 0;
-    int m_lastSphereTextureHeight = 0;
+    int m_lastSphereRowCount = 0;
 
     std::vector<AnalyticalPlaneData> m_planes;
     GLuint m_planeGeomTexture = 0;
     GLuint m_planeMaterialTexture = 0;
-    int m_lastPlaneTextureHeight = 0;
+    int m_lastPlaneRowCount = 0;
+
+    std::vector<InstanceData> m_instances;
+    GLuint m_instanceTexture = 0;
+    int m_lastInstanceRowCount = 0;
+
+    // Emissive mesh triangles and spheres in world space, sampled at
+    // diffuse bounces
+    LightTable m_lights;
+    GLuint m_lightTexture = 0;
+    int m_lastLightRowCount = 0;
 
-    // BVH acceleration structure
+    // Top-level BVH over mesh instances and spheres. The node and primitive
+    // textures hold it first, followed by every mesh's bottom-level BVH,
+    // all collapsed to m_bvhWidth children per node.
     BVH m_bvh;
+    WideBVH m_wideTLAS;
+    int m_bvhWidth = 8;
+    // Upload the binary tree with skip links instead, traced without a
+    // stack
+    bool m_stacklessBVH = false;
+    int m_uploadedTLASNodeCount = 0;
+    // Mesh BLAS builds use spatial splits, capped to this many extra
+    // references per triangle
+    bool m_spatialSplits = false;
+    float m_spatialSplitBudget = 0.3f;
+    // Run treelet restructuring after full mesh BLAS builds
+    bool m_optimizeBVH = false;
+    // Mesh BLAS builds saved across sessions, relative to the working
+    // directory and trimmed to BVHCache::DEFAULT_MAX_BYTES
+    BVHCache m_bvhCache { "cache/bvh" };
     GLuint m_bvhNodeTexture = 0;
     GLuint m_bvhPrimTexture = 0; // Primitive type + index for each BVH leaf
-    int m_lastBVHTextureHeight = 0;
-    int m_lastBVHPrimTextureHeight = 0;
+    int m_lastBVHRowCount = 0;
+    int m_lastBVHPrimRowCount = 0;
+
+    // Object-space triangles and bottom-level BVH of one geometry, shared
+    // by every object with the same vertices and indices, like the
+    // instances of a ModelLibrary model
+    struct MeshData {
+        // Triangles are in leaf order
+        BVH blas;
+        WideBVH wideBlas;
+        std::vector<Triangle> blasTriangles;
+        bool blasDirty = true;
+        // BLAS nodes and triangles must be sent again at the next rebuild:
+        // rebuilt, or moved to other texture rows
+        bool uploadDirty = true;
+        // Laid out once per rebuild, by the first object using it
+        bool placed = false;
+        int triangleStartIndex = 0;
+        int triangleCount = 0;
+        int blasNodeBase = 0;
+        int blasPrimitiveBase = 0;
+        // An object using the mesh, whose geometry new users are compared
+        // with. Found again when that object lets go of it.
+        int sourceObject = -1;
+    };
 
     struct ObjectData {
         std::unique_ptr<RenderableObject> renderObject;
         glm::mat4 transform;
-        int triangleStartIndex;
-        int triangleCount;
+        // Slot in m_instances / m_spheres / m_planes
+        int sceneIndex = -1;
+        bool transformDirty = false;
+        // Row in m_materials of a mesh, carried by its instance, -1
+        // otherwise
+        int materialIndex = -1;
+        bool materialDirty = false;
+        // Looked up again at the next rebuild when null
+        std::shared_ptr<MeshData> mesh;
     };
 
     std::vector<ObjectData> m_objects;
+    // Meshes in texture row order, and every live one by geometry key
+    std::vector<std::shared_ptr<MeshData>> m_meshes;
+    std::unordered_map<uint64_t, std::weak_ptr<MeshData>> m_meshesByGeometry;
     bool m_trianglesDirty = false;
+    bool m_transformsDirty = false;
+    bool m_materialsDirty = false;
+
+    // Bytes sent to scene textures, this frame and the last complete one
+    size_t m_uploadBytes = 0;
+    size_t m_lastFrameUploadBytes = 0;
+
+    // Top-level refits whose SAH cost grew past this factor of the last
+    // build fall back to rebuilding it
+    static constexpr float BVH_REFIT_MAX_COST_RATIO = 1.5f;
 
     void rebuildTriangleArray();
+    void refitTriangleArray();
+    void refreshMaterials();
+    void markMaterialDirty(int objectId);
+    // Mesh of the object's geometry, shared with the objects that have the
+    // same vertices and indices
+    std::shared_ptr<MeshData> acquireMesh(int objectId);
+    void buildMeshBLAS(MeshData &mesh, RenderableObject &obj);
+    void buildTLAS();
+    // Packs each mesh's BLAS triangles into its range of texture rows and
+    // sends the ranges that changed
+    void uploadTriangleTextures(size_t triangleCount);
+    // Without rows the whole texture is sent
+    void uploadMaterialTexture(const std::vector<TextureRowRange> &rows = {});
+    void uploadSphereTextures(
+        bool withMaterials, const std::vector<TextureRowRange> &rows = {});
+    void uploadPlaneTextures(
+        bool withMaterials, const std::vector<TextureRowRange> &rows = {});
+    void uploadInstanceTexture(const std::vector<TextureRowRange> &rows = {});
+    // Rebuilds the light table from the placed objects and sends it whole
+    void updateLightTable();
+    void uploadBVHTextures(bool topLevelOnly);
+
+    // Texels per node row of the current layout
+    int getBVHNodeRowWidth() const
+    {
+        return m_stacklessBVH ? 2 : 2 + m_bvhWidth / 2;
+    }
 
     // Main view accumulation buffers
     unsigned int m_accumulationFBO[2] = { 0, 0 };
@@ -112,14 +192,72 @@ private:
     void resetAccumulation();
     bool shouldResetAccumulation(const Camera &cam) const;
 
+    // Frames between readbacks of a view's converged fraction
+    static constexpr int CONVERGENCE_READBACK_INTERVAL = 16;
+
+    // A camera view with the path tracer's own state
+    struct PathTracedView : CameraView {
+        // Per-pixel luminance moments next to each accumulation texture:
+        // mean, mean of squares, sample count, converged flag
+        unsigned int momentsTexture[2] = { 0, 0 };
+        // First-hit albedo and depth, and normal, guiding the denoiser
+        unsigned int albedoDepthTexture[2] = { 0, 0 };
+        unsigned int normalTexture[2] = { 0, 0 };
+
+        // Adaptive sampling: pixels whose relative noise is below the
+        // threshold stop being traced
+        bool adaptiveSampling = true;
+        float noiseThreshold = 0.02f;
+        float convergedFraction = 0.0f; // Read back every few frames
+
+        // A-trous denoiser shown instead of the raw accumulation,
+        // ping-ponging between its two buffers
+        bool denoise = false;
+        unsigned int denoiseFBO[2] = { 0, 0 };
+        unsigned int denoiseTexture[2] = { 0, 0 };
+
+        // Camera moves reproject the accumulation through the previous
+        // frame's camera instead of starting over
+        bool temporalReprojection = true;
+        glm::mat3 lastViewRotationMatrix = glm::mat3(1.0f);
+        float lastFocalLength = 1.0f;
+        float lastAspectRatio = 1.0f;
+
+        // While the camera or scene moves, traces fewer pixels, in the
+        // bottom-left corner of the accumulation buffers, and stretches
+        // them over the view
+        bool dynamicResolution = true;
+        ResolutionScaler resolutionScaler;
+        glm::ivec2 renderSize = { 0, 0 }; // Traced last frame
+        unsigned int timerQuery = 0; // GPU time of a frame of the view
+        bool timerPending = false;
+        float timerScale = 1.0f; // Resolution scale of the timed frame
+        int timerPasses = 0; // Accumulation passes of the timed frame
+        // GPU time of one pass at full resolution, negative until timed
+        float passMs = -1.0f;
+
+        // Its dock window was shown last frame, hidden views are not traced
+        bool visible = true;
+    };
+
     // Per-camera accumulation methods
-    void initCameraAccumulationBuffers(CameraView &view);
-    void cleanupCameraAccumulationBuffers(CameraView &view);
-    void resetCameraAccumulation(CameraView &view);
+    void initCameraAccumulationBuffers(PathTracedView &view);
+    void cleanupCameraAccumulationBuffers(PathTracedView &view);
+    void resetCameraAccumulation(PathTracedView &view);
+    // Share of the view's pixels whose noise is below its threshold
+    void readConvergedFraction(PathTracedView &view);
+    // Filters the view's current accumulation, returns the FBO holding it
+    unsigned int denoiseCameraView(PathTracedView &view);
+    // Updates the view's pass time once its last timed frame's result is
+    // available
+    void updatePassTime(PathTracedView &view);
     bool shouldResetCameraAccumulation(
-        const Camera &cam, CameraView &view) const;
+        const Camera &cam, PathTracedView &view) const;
 
     ShaderProgram m_pathTracingShader;
+    ShaderProgram m_denoiseShader;
+    ViewScheduler m_viewScheduler;
+    ATrousDenoiser::Settings m_denoiseSettings;
 
     std::vector<std::unique_ptr<RenderableObject>> m_renderObjects;
     std::vector<int> m_freeSlots;
@@ -131,13 +269,16 @@ private:
     ToneMappingMode m_toneMappingMode = ToneMappingMode::Reinhard;
     float m_toneMappingExposure = 1.0f;
 
-    std::unordered_map<int, CameraView> m_cameraViews;
+    std::unordered_map<int, PathTracedView> m_cameraViews;
     CameraOverlayCallback m_cameraOverlayCallback;
     BoundingBoxDrawCallback m_bboxDrawCallback;
     bool m_lockCameraWindows = false;
     int m_lockedCameraId = -1;
 
-    void renderCameraViews(const Camera &cam, CameraView &view);
+    void flushSceneChanges();
+    // Traces the passes the scheduler gave the view and shows the result
+    void renderCameraViews(const Camera &cam, PathTracedView &view,
+        const ViewScheduler::Allocation &allocation);
     void renderDockableViews(CameraManager &cameraManager);
 
 public:
@@ -216,6 +357,11 @@ public:
             callback) override;
     GLFWwindow *getWindow() const override;
 
+    bool getAccelerationSettings(
+        AccelerationSettings &settings) const override;
+    void setAccelerationSettings(
+        const AccelerationSettings &settings) override;
+
     // Camera view management
     void createCameraViews(int id, int width = 512, int height = 512) override;
     void destroyCameraViews(int id) override;
@@ -266,4 +412,33 @@ public:
     }
 
     const std::vector<int> &getCubemapHandles() const;
+
+    // Children per BVH node on the GPU, 4 or 8
+    void setBVHWidth(int width);
+
+    int getBVHWidth() const { return m_bvhWidth; }
+
+    // Trace the binary BVH with skip links instead of the wide BVH
+    void setStacklessBVH(bool enabled);
+
+    bool getStacklessBVH() const { return m_stacklessBVH; }
+
+    // Build mesh BVHs as SBVH, for scenes with long overlapping triangles
+    void setSpatialSplits(bool enabled);
+
+    bool getSpatialSplits() const { return m_spatialSplits; }
+
+    void setSpatialSplitBudget(float budget);
+
+    float getSpatialSplitBudget() const { return m_spatialSplitBudget; }
+
+    // Spend extra build time on mesh BVHs for faster rays, for static scenes
+    void setBVHOptimization(bool enabled);
+
+    bool getBVHOptimization() const { return m_optimizeBVH; }
+
+    size_t getUploadedBytesLastFrame() const override
+    {
+        return m_lastFrameUploadBytes;
+    }
 };
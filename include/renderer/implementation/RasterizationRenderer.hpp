@@ -166,6 +166,13 @@ public:
             callback) override;
     GLFWwindow *getWindow() const override;
 
+    bool getAccelerationSettings(AccelerationSettings &) const override
+    {
+        return false;
+    }
+    void setAccelerationSettings(const AccelerationSettings &) override {}
+    size_t getUploadedBytesLastFrame() const override { return 0; }
+
     // Camera view management
     void createCameraViews(int id, int width = 512, int height = 512) override;
     void destroyCameraViews(int id) override;
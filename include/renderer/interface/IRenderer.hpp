@@ -22,6 +22,18 @@
 
 struct ImVec2;
 
+// Acceleration structure settings of renderers that trace rays
+struct AccelerationSettings {
+    // Build mesh BVHs as SBVH, duplicating up to budget times the triangles
+    bool spatialSplits = false;
+    float spatialSplitBudget = 0.3f;
+    // Treelet restructuring after each mesh BVH build
+    bool optimize = false;
+    // Trace the binary BVH with skip links instead of the wide BVH
+    bool stackless = false;
+    int bvhWidth = 8; // Children per wide BVH node, 4 or 8
+};
+
 // Interface for renderers
 class IRenderer {
 public:
@@ -96,6 +108,14 @@ public:
         = 0;
     virtual GLFWwindow *getWindow() const = 0;
 
+    // Acceleration structures, false if the renderer does not trace rays
+    virtual bool getAccelerationSettings(AccelerationSettings &settings) const
+        = 0;
+    virtual void setAccelerationSettings(const AccelerationSettings &settings)
+        = 0;
+    // Scene data sent to the GPU during the last frame
+    virtual size_t getUploadedBytesLastFrame() const = 0;
+
     // Camera View Management
     virtual void createCameraViews(int id, int width = 512, int height = 512)
         = 0;
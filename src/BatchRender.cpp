@@ -0,0 +1,233 @@
+#include "BatchRender.hpp"
+#include "renderer/CPUPathTracer.hpp"
+#include "renderer/Denoiser.hpp"
+#include "renderer/Hash.hpp"
+#include "renderer/RenderCheckpoint.hpp"
+#include "renderer/SceneDescription.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <system_error>
+#include <vector>
+
+#include "stb_image_write.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+template <typename T>
+uint64_t hashVector(uint64_t seed, const std::vector<T> &values)
+{
+    return fnv1aHash(seed, values.data(), values.size() * sizeof(T));
+}
+
+// Identifies what is being rendered, so a checkpoint of another scene or
+// camera is never resumed. Size is checked by the checkpoint itself and
+// the sample count is left out: a longer render continues a shorter one.
+uint64_t checkpointKey(
+    const SceneDescription &scene, const PathTracingCamera &camera)
+{
+    uint64_t key = FNV1A_SEED;
+    key = hashVector(key, scene.triangles);
+    key = hashVector(key, scene.materials);
+    key = hashVector(key, scene.spheres);
+    key = hashVector(key, scene.planes);
+    return fnv1aHashValue(key, camera);
+}
+
+// The tracer's rows start at the bottom, image files at the top. PNG
+// output is clamped like the editor's path tracing view, HDR keeps the
+// linear radiance.
+bool writeImage(const std::filesystem::path &path,
+    const std::vector<glm::vec3> &image, int width, int height)
+{
+    const std::string ext = path.extension().string();
+
+    int result = 0;
+    if (ext == ".hdr") {
+        std::vector<float> pixels(image.size() * 3);
+        for (int y = 0; y < height; y++) {
+            const glm::vec3 *src = &image[static_cast<size_t>(height - 1 - y)
+                * static_cast<size_t>(width)];
+            std::memcpy(&pixels[static_cast<size_t>(y) * width * 3], src,
+                static_cast<size_t>(width) * sizeof(glm::vec3));
+        }
+        result = stbi_write_hdr(
+            path.string().c_str(), width, height, 3, pixels.data());
+    } else if (ext == ".png") {
+        std::vector<unsigned char> pixels(image.size() * 3);
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                const glm::vec3 &c = image[static_cast<size_t>(height - 1 - y)
+                        * static_cast<size_t>(width)
+                    + static_cast<size_t>(x)];
+                const size_t di
+                    = (static_cast<size_t>(y) * static_cast<size_t>(width)
+                          + static_cast<size_t>(x))
+                    * 3u;
+                for (int i = 0; i < 3; i++) {
+                    pixels[di + i] = static_cast<unsigned char>(
+                        std::clamp(c[i], 0.0f, 1.0f) * 255.0f + 0.5f);
+                }
+            }
+        }
+        result = stbi_write_png(path.string().c_str(), width, height, 3,
+            pixels.data(), width * 3);
+    } else {
+        std::cerr << "[ERROR] Unsupported output format: " << path.string()
+                  << " (use .png or .hdr)" << std::endl;
+        return false;
+    }
+
+    if (!result) {
+        std::cerr << "[ERROR] Failed to write " << path.string() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void printUsage(const char *program)
+{
+    std::cerr << "Usage: " << program
+              << " --render SCENE [--camera NAME] [--output FILE.png|.hdr]"
+                 " [--width N] [--height N] [--samples N]"
+                 " [--checkpoint FILE] [--checkpoint-every N]"
+                 " [--threads N] [--denoise]"
+              << std::endl;
+}
+
+} // namespace
+
+bool BatchRender::isRequested(int argc, char **argv)
+{
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--render") == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool BatchRender::parseOptions(int argc, char **argv, Options &options)
+{
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--render" && hasValue) {
+            options.scene = argv[++i];
+        } else if (arg == "--camera" && hasValue) {
+            options.camera = argv[++i];
+        } else if (arg == "--output" && hasValue) {
+            options.output = argv[++i];
+        } else if (arg == "--width" && hasValue) {
+            options.width = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--height" && hasValue) {
+            options.height = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--samples" && hasValue) {
+            options.samples = std::max(1, std::atoi(argv[++i]));
+        } else if (arg == "--checkpoint" && hasValue) {
+            options.checkpoint = argv[++i];
+        } else if (arg == "--checkpoint-every" && hasValue) {
+            options.checkpointInterval = std::max(0, std::atoi(argv[++i]));
+        } else if (arg == "--threads" && hasValue) {
+            options.threads = std::max(0, std::atoi(argv[++i]));
+        } else if (arg == "--denoise") {
+            options.denoise = true;
+        } else {
+            printUsage(argv[0]);
+            return false;
+        }
+    }
+    if (options.scene.empty()) {
+        printUsage(argv[0]);
+        return false;
+    }
+    const std::string ext = options.output.extension().string();
+    if (ext != ".png" && ext != ".hdr") {
+        std::cerr << "[ERROR] Unsupported output format: "
+                  << options.output.string() << " (use .png or .hdr)"
+                  << std::endl;
+        return false;
+    }
+    if (options.checkpoint.empty()) {
+        options.checkpoint = options.output;
+        options.checkpoint += ".ckpt";
+    }
+    return true;
+}
+
+int BatchRender::run(const Options &options)
+{
+    SceneDescription scene;
+    if (!scene.load(options.scene)) {
+        return EXIT_FAILURE;
+    }
+    const SceneDescription::Camera *sceneCamera
+        = scene.findCamera(options.camera);
+    if (!sceneCamera) {
+        std::cerr << "[ERROR] No camera "
+                  << (options.camera.empty() ? "" : options.camera + " ")
+                  << "in " << options.scene.string() << std::endl;
+        return EXIT_FAILURE;
+    }
+    const PathTracingCamera camera = PathTracingCamera::fromAngles(
+        sceneCamera->position, sceneCamera->rotation, sceneCamera->fov);
+    const uint64_t key = checkpointKey(scene, camera);
+
+    CPUPathTracer tracer;
+    tracer.setThreadCount(options.threads);
+    tracer.setScene(std::move(scene.triangles), std::move(scene.materials),
+        std::move(scene.spheres), std::move(scene.planes));
+    tracer.setCamera(camera);
+    tracer.resize(options.width, options.height);
+
+    const bool checkpointing = options.checkpointInterval > 0;
+    if (checkpointing
+        && RenderCheckpoint::load(options.checkpoint, key, tracer)) {
+        std::cout << "Resuming " << options.checkpoint.string() << " at "
+                  << tracer.getFrameCount() << " samples" << std::endl;
+    }
+
+    const Clock::time_point start = Clock::now();
+    const int resumedFrames = tracer.getFrameCount();
+    while (tracer.getFrameCount() < options.samples) {
+        tracer.renderFrame();
+        const int frame = tracer.getFrameCount();
+        if (checkpointing && frame % options.checkpointInterval == 0
+            && frame < options.samples) {
+            RenderCheckpoint::save(options.checkpoint, key, tracer);
+            double seconds
+                = std::chrono::duration<double>(Clock::now() - start).count();
+            std::cout << frame << "/" << options.samples << " samples, "
+                      << seconds / (frame - resumedFrames) << " s/sample"
+                      << std::endl;
+        }
+    }
+
+    const int width = tracer.getWidth();
+    const int height = tracer.getHeight();
+    const bool written = options.denoise
+        ? writeImage(options.output,
+              ATrousDenoiser::denoise(tracer.getImage(), tracer.getMoments(),
+                  tracer.getAOVs(), width, height, ATrousDenoiser::Settings()),
+              width, height)
+        : writeImage(options.output, tracer.getImage(), width, height);
+    if (!written) {
+        // Keep the checkpoint, a rerun only has to write the image
+        if (checkpointing) {
+            RenderCheckpoint::save(options.checkpoint, key, tracer);
+        }
+        return EXIT_FAILURE;
+    }
+    std::cout << "Wrote " << options.output.string() << " ("
+              << tracer.getFrameCount() << " samples)" << std::endl;
+
+    std::error_code error;
+    std::filesystem::remove(options.checkpoint, error);
+    return EXIT_SUCCESS;
+}
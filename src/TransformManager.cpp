@@ -310,6 +310,51 @@ void TransformManager::renderRayTracingUI(bool *p_open)
         return;
     }
 
+    // Scene-wide acceleration structure settings
+    AccelerationSettings acceleration;
+    if (m_renderer->getAccelerationSettings(acceleration)) {
+        ImGui::Text("Acceleration");
+        ImGui::Separator();
+
+        bool changed = ImGui::Checkbox(
+            "Spatial splits (SBVH)", &acceleration.spatialSplits);
+        if (acceleration.spatialSplits) {
+            // Every change rebuilds all mesh BVHs, so the value is only
+            // applied once the slider is released
+            if (!m_editingSplitBudget) {
+                m_splitBudget = acceleration.spatialSplitBudget;
+            }
+            ImGui::SliderFloat(
+                "Duplication budget", &m_splitBudget, 0.0f, 1.0f, "%.2f");
+            m_editingSplitBudget = ImGui::IsItemActive();
+            if (ImGui::IsItemDeactivatedAfterEdit()) {
+                acceleration.spatialSplitBudget = m_splitBudget;
+                changed = true;
+            }
+        }
+        changed = ImGui::Checkbox(
+                      "Treelet optimization", &acceleration.optimize)
+            || changed;
+
+        changed = ImGui::Checkbox(
+                      "Stackless traversal", &acceleration.stackless)
+            || changed;
+        if (!acceleration.stackless) {
+            changed = ImGui::RadioButton("BVH4", &acceleration.bvhWidth, 4)
+                || changed;
+            ImGui::SameLine();
+            changed = ImGui::RadioButton("BVH8", &acceleration.bvhWidth, 8)
+                || changed;
+        }
+        if (changed) {
+            m_renderer->setAccelerationSettings(acceleration);
+        }
+        ImGui::Text("Scene upload: %.1f KB/frame",
+            static_cast<double>(m_renderer->getUploadedBytesLastFrame())
+                / 1024.0);
+        ImGui::Spacing();
+    }
+
     if (m_selectedNodes.empty()) {
         ImGui::Text("Select an object to edit material properties");
         ImGui::End();
@@ -2,10 +2,18 @@
 #include <iostream>
 
 #include "App.hpp"
+#include "BatchRender.hpp"
 
-int main(void)
+int main(int argc, char **argv)
 {
     try {
+        if (BatchRender::isRequested(argc, argv)) {
+            BatchRender::Options options;
+            if (!BatchRender::parseOptions(argc, argv, options)) {
+                return EXIT_FAILURE;
+            }
+            return BatchRender::run(options);
+        }
         App app;
         app.run();
         return EXIT_SUCCESS;
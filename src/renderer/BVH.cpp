@@ -1,14 +1,123 @@
 #include "renderer/BVH.hpp"
-#include "renderer/implementation/PathTracingRenderer.hpp"
+#include "renderer/ParallelTasks.hpp"
+#include "renderer/PathTracingData.hpp"
 #include <algorithm>
+#include <array>
+#include <bit>
+#include <future>
 #include <numeric>
+#include <thread>
+#include <type_traits>
+
+#if defined(__SSE__) || defined(_M_X64) || defined(_M_IX86_FP)
+#include <xmmintrin.h>
+#define SCENELAB_BVH_SSE 1
+#endif
+
+namespace {
+
+// Bucket bounds use the same padded layout as BVH::PackedBounds so min/max
+// can be done four lanes at a time
+struct alignas(16) BinBounds {
+    float min[4] = { std::numeric_limits<float>::max(),
+        std::numeric_limits<float>::max(), std::numeric_limits<float>::max(),
+        0.0f };
+    float max[4] = { std::numeric_limits<float>::lowest(),
+        std::numeric_limits<float>::lowest(),
+        std::numeric_limits<float>::lowest(), 0.0f };
+
+    void grow(const float *otherMin, const float *otherMax)
+    {
+#ifdef SCENELAB_BVH_SSE
+        _mm_store_ps(
+            min, _mm_min_ps(_mm_load_ps(min), _mm_load_ps(otherMin)));
+        _mm_store_ps(
+            max, _mm_max_ps(_mm_load_ps(max), _mm_load_ps(otherMax)));
+#else
+        for (int k = 0; k < 3; k++) {
+            min[k] = std::min(min[k], otherMin[k]);
+            max[k] = std::max(max[k], otherMax[k]);
+        }
+#endif
+    }
+
+    void grow(const BinBounds &other) { grow(other.min, other.max); }
+
+    float surfaceArea() const
+    {
+        float ex = max[0] - min[0];
+        float ey = max[1] - min[1];
+        float ez = max[2] - min[2];
+        return 2.0f * (ex * ey + ey * ez + ez * ex);
+    }
+};
+
+struct Bin {
+    BinBounds bounds;
+    int count = 0;
+};
+
+int bucketIndex(float centroid, float axisMin, float scale, int buckets)
+{
+    int bucket = static_cast<int>((centroid - axisMin) * scale);
+    return std::clamp(bucket, 0, buckets - 1);
+}
+
+// Spread the low 10 bits of v so there are two zero bits between each
+uint64_t expandBits10(uint64_t v)
+{
+    v &= 0x3FF;
+    v = (v | (v << 16)) & 0x030000FF;
+    v = (v | (v << 8)) & 0x0300F00F;
+    v = (v | (v << 4)) & 0x030C30C3;
+    v = (v | (v << 2)) & 0x09249249;
+    return v;
+}
+
+// Spread the low 21 bits of v so there are two zero bits between each
+uint64_t expandBits21(uint64_t v)
+{
+    v &= 0x1FFFFF;
+    v = (v | (v << 32)) & 0x1F00000000FFFFull;
+    v = (v | (v << 16)) & 0x1F0000FF0000FFull;
+    v = (v | (v << 8)) & 0x100F00F00F00F00Full;
+    v = (v | (v << 4)) & 0x10C30C30C30C30C3ull;
+    v = (v | (v << 2)) & 0x1249249249249249ull;
+    return v;
+}
+
+// Overlap of two boxes, inverted (empty) when they are disjoint
+AABB intersectBounds(const AABB &a, const AABB &b)
+{
+    AABB result;
+    result.min = glm::max(a.min, b.min);
+    result.max = glm::min(a.max, b.max);
+    return result;
+}
+
+bool isEmpty(const AABB &bounds)
+{
+    return bounds.min.x > bounds.max.x || bounds.min.y > bounds.max.y
+        || bounds.min.z > bounds.max.z;
+}
+
+} // namespace
 
 void BVH::build(std::vector<Triangle> &triangles,
     std::vector<AnalyticalSphereData> &spheres)
+{
+    std::vector<InstanceData> noInstances;
+    build(triangles, spheres, noInstances);
+}
+
+void BVH::build(std::vector<Triangle> &triangles,
+    std::vector<AnalyticalSphereData> &spheres,
+    std::vector<InstanceData> &instances)
 {
     clear();
 
-    size_t totalPrimitives = triangles.size() + spheres.size();
+    size_t totalPrimitives
+        = triangles.size() + spheres.size() + instances.size();
     if (totalPrimitives == 0) {
         return;
     }
@@ -18,94 +127,510 @@ void BVH::build(std::vector<Triangle> &triangles,
 
     // Add triangles
     for (size_t i = 0; i < triangles.size(); i++) {
-        BVHPrimitive prim;
-        prim.type = BVHPrimitiveType::Triangle;
-        prim.originalIndex = static_cast<int>(i);
-
-        // Compute AABB for triangle
-        const Triangle &tri = triangles[i];
-        prim.bounds.expand(tri.v0);
-        prim.bounds.expand(tri.v1);
-        prim.bounds.expand(tri.v2);
-
-        // Centroid is center of triangle
-        prim.centroid = (tri.v0 + tri.v1 + tri.v2) / 3.0f;
-
-        m_primitives.push_back(prim);
+        m_primitives.push_back(
+            makeTrianglePrimitive(triangles[i], static_cast<int>(i)));
     }
 
     // Add spheres
     for (size_t i = 0; i < spheres.size(); i++) {
-        BVHPrimitive prim;
-        prim.type = BVHPrimitiveType::Sphere;
-        prim.originalIndex = static_cast<int>(i);
-
-        // Compute AABB for sphere (box that contains the sphere)
-        const AnalyticalSphereData &sphere = spheres[i];
-        glm::vec3 radiusVec(sphere.radius);
-        prim.bounds.min = sphere.center - radiusVec;
-        prim.bounds.max = sphere.center + radiusVec;
-
-        // Centroid is center of sphere
-        prim.centroid = sphere.center;
+        m_primitives.push_back(
+            makeSpherePrimitive(spheres[i], static_cast<int>(i)));
+    }
 
-        m_primitives.push_back(prim);
+    // Add mesh instances
+    for (size_t i = 0; i < instances.size(); i++) {
+        m_primitives.push_back(
+            makeInstancePrimitive(instances[i], static_cast<int>(i)));
     }
 
     // Create index array
     std::vector<int> indices(m_primitives.size());
     std::iota(indices.begin(), indices.end(), 0);
 
+    std::vector<uint64_t> mortonCodes;
+    if (m_buildMode == BVHBuildMode::LBVH) {
+        mortonCodes = sortByMortonCode(indices);
+    }
+
+    // Fill the build streams in index order
+    for (auto &stream : m_buildCentroids) {
+        stream.resize(m_primitives.size());
+    }
+    m_buildBounds.resize(m_primitives.size());
+    for (size_t i = 0; i < m_primitives.size(); i++) {
+        const BVHPrimitive &prim = m_primitives[indices[i]];
+        PackedBounds &packed = m_buildBounds[i];
+        for (int axis = 0; axis < 3; axis++) {
+            m_buildCentroids[axis][i] = prim.centroid[axis];
+            packed.min[axis] = prim.bounds.min[axis];
+            packed.max[axis] = prim.bounds.max[axis];
+        }
+        packed.min[3] = 0.0f;
+        packed.max[3] = 0.0f;
+    }
+
     // Reserve space for nodes (roughly 2N-1 for N primitives)
     m_nodes.reserve(2 * m_primitives.size());
 
+    // Spawn tasks down to a depth giving a few tasks per core, so uneven
+    // splits still keep every core busy
+    unsigned int threads = std::max(1u, std::thread::hardware_concurrency());
+    m_maxTaskDepth = m_parallelBuild
+        ? static_cast<int>(std::bit_width(threads - 1)) + 2
+        : 0;
+
     // Build recursively
-    buildRecursive(indices, 0, static_cast<int>(m_primitives.size()), 0);
+    int primitiveCount = static_cast<int>(m_primitives.size());
+    std::vector<SpatialReference> leafRefs;
+    if (m_buildMode == BVHBuildMode::LBVH) {
+        buildLinear(indices, mortonCodes, 0, primitiveCount, 0, m_nodes);
+    } else if (m_buildMode == BVHBuildMode::SBVH) {
+        std::vector<SpatialReference> refs(m_primitives.size());
+        for (size_t i = 0; i < m_primitives.size(); i++) {
+            refs[i] = { static_cast<int>(i), m_primitives[i].bounds };
+        }
+        m_buildTriangles = &triangles;
+        m_spatialReferencesLeft = static_cast<int>(
+            std::max(0.0f, m_spatialSplitBudget)
+            * static_cast<float>(primitiveCount));
+        leafRefs.reserve(refs.size() + m_spatialReferencesLeft);
+        buildSpatial(refs, 0, m_nodes, leafRefs);
+        m_buildTriangles = nullptr;
+
+        // Leaves may list a primitive several times
+        indices.resize(leafRefs.size());
+        for (size_t i = 0; i < leafRefs.size(); i++) {
+            indices[i] = leafRefs[i].primitive;
+        }
+    } else {
+        buildRecursive(indices, 0, primitiveCount, 0, m_nodes);
+    }
 
-    // Reorder primitives according to BVH order
-    std::vector<BVHPrimitive> reorderedPrimitives(m_primitives.size());
+    // Release the build streams
+    for (auto &stream : m_buildCentroids) {
+        std::vector<float>().swap(stream);
+    }
+    std::vector<PackedBounds>().swap(m_buildBounds);
+
+    // Reorder primitives according to BVH order. SBVH leaves keep the
+    // clipped bounds of their references.
+    std::vector<BVHPrimitive> reorderedPrimitives(indices.size());
     for (size_t i = 0; i < indices.size(); i++) {
         reorderedPrimitives[i] = m_primitives[indices[i]];
     }
+    for (size_t i = 0; i < leafRefs.size(); i++) {
+        reorderedPrimitives[i].bounds = leafRefs[i].bounds;
+    }
     m_primitives = std::move(reorderedPrimitives);
 
     // Also reorder the original arrays to match
     // First, build mapping from new index to old index for each type
     std::vector<Triangle> reorderedTriangles;
     std::vector<AnalyticalSphereData> reorderedSpheres;
+    std::vector<InstanceData> reorderedInstances;
     reorderedTriangles.reserve(triangles.size());
     reorderedSpheres.reserve(spheres.size());
+    reorderedInstances.reserve(instances.size());
 
-    // Update originalIndex to point to new positions
-    int newTriIdx = 0;
-    int newSphereIdx = 0;
+    // Update originalIndex to point to new positions. A primitive
+    // referenced by several leaves is placed where it first appears.
+    m_triangleRemap.assign(triangles.size(), -1);
+    m_sphereRemap.assign(spheres.size(), -1);
+    m_instanceRemap.assign(instances.size(), -1);
+    auto place = [](auto &source, auto &reordered, std::vector<int> &remap,
+                     BVHPrimitive &prim) {
+        int &slot = remap[prim.originalIndex];
+        if (slot < 0) {
+            slot = static_cast<int>(reordered.size());
+            reordered.push_back(source[prim.originalIndex]);
+        }
+        prim.originalIndex = slot;
+    };
     for (auto &prim : m_primitives) {
         if (prim.type == BVHPrimitiveType::Triangle) {
-            reorderedTriangles.push_back(triangles[prim.originalIndex]);
-            prim.originalIndex = newTriIdx++;
+            place(triangles, reorderedTriangles, m_triangleRemap, prim);
+        } else if (prim.type == BVHPrimitiveType::Sphere) {
+            place(spheres, reorderedSpheres, m_sphereRemap, prim);
         } else {
-            reorderedSpheres.push_back(spheres[prim.originalIndex]);
-            prim.originalIndex = newSphereIdx++;
+            place(instances, reorderedInstances, m_instanceRemap, prim);
         }
     }
 
     triangles = std::move(reorderedTriangles);
     spheres = std::move(reorderedSpheres);
+    instances = std::move(reorderedInstances);
+
+    m_buildSAHCost = computeSAHCost();
+}
+
+void BVH::refit(const std::vector<Triangle> &triangles,
+    const std::vector<AnalyticalSphereData> &spheres)
+{
+    refit(triangles, spheres, {});
+}
+
+void BVH::refit(const std::vector<Triangle> &triangles,
+    const std::vector<AnalyticalSphereData> &spheres,
+    const std::vector<InstanceData> &instances)
+{
+    for (auto &prim : m_primitives) {
+        if (prim.type == BVHPrimitiveType::Triangle) {
+            prim = makeTrianglePrimitive(
+                triangles[prim.originalIndex], prim.originalIndex);
+        } else if (prim.type == BVHPrimitiveType::Sphere) {
+            prim = makeSpherePrimitive(
+                spheres[prim.originalIndex], prim.originalIndex);
+        } else {
+            prim = makeInstancePrimitive(
+                instances[prim.originalIndex], prim.originalIndex);
+        }
+    }
+
+    // Every builder emits children after their parent, so a reverse sweep
+    // visits children first
+    for (int i = static_cast<int>(m_nodes.size()) - 1; i >= 0; i--) {
+        BVHNode &node = m_nodes[i];
+        node.bounds = AABB {};
+        if (node.isLeaf()) {
+            int end = node.primitiveStart + node.primitiveCount;
+            for (int p = node.primitiveStart; p < end; p++) {
+                node.bounds.expand(m_primitives[p].bounds);
+            }
+        } else {
+            node.bounds.expand(m_nodes[node.leftChild].bounds);
+            node.bounds.expand(m_nodes[node.rightChild].bounds);
+        }
+    }
 }
 
-int BVH::buildRecursive(
-    std::vector<int> &indices, int start, int end, int depth)
+float BVH::computeSAHCost() const
 {
-    int nodeIndex = static_cast<int>(m_nodes.size());
-    m_nodes.push_back(BVHNode {});
-    BVHNode &node = m_nodes[nodeIndex];
+    if (m_nodes.empty()) {
+        return 0.0f;
+    }
+
+    float rootArea = m_nodes[0].bounds.surfaceArea();
+    if (rootArea < 1e-6f) {
+        return 0.0f;
+    }
+
+    float cost = 0.0f;
+    for (const auto &node : m_nodes) {
+        float area = node.bounds.surfaceArea();
+        if (node.isLeaf()) {
+            cost += INTERSECTION_COST
+                * static_cast<float>(node.primitiveCount) * area;
+        } else {
+            cost += TRAVERSAL_COST * area;
+        }
+    }
+    return cost / rootArea;
+}
+
+void BVH::restore(
+    std::vector<BVHNode> nodes, std::vector<BVHPrimitive> primitives)
+{
+    clear();
+    m_nodes = std::move(nodes);
+    m_primitives = std::move(primitives);
+    m_buildSAHCost = computeSAHCost();
+}
+
+std::vector<BVHSkipNode> BVH::buildSkipNodes(int maxLeafPrimitives) const
+{
+    std::vector<BVHSkipNode> skipNodes;
+    if (m_nodes.empty()) {
+        return skipNodes;
+    }
+    skipNodes.reserve(m_nodes.size());
+    maxLeafPrimitives = std::max(1, maxLeafPrimitives);
+
+    // A node's skip link is the first node after its subtree
+    auto emit = [&](auto &self, int nodeIndex) -> void {
+        const BVHNode &node = m_nodes[nodeIndex];
+        if (node.isLeaf()) {
+            for (int offset = 0; offset < node.primitiveCount;
+                offset += maxLeafPrimitives) {
+                BVHSkipNode chunk;
+                chunk.bounds = node.bounds;
+                chunk.primitiveStart = node.primitiveStart + offset;
+                chunk.primitiveCount = std::min(
+                    maxLeafPrimitives, node.primitiveCount - offset);
+                chunk.skip = static_cast<int>(skipNodes.size()) + 1;
+                skipNodes.push_back(chunk);
+            }
+            return;
+        }
+
+        int index = static_cast<int>(skipNodes.size());
+        skipNodes.push_back(BVHSkipNode { node.bounds, 0, 0, 0 });
+        self(self, node.leftChild);
+        self(self, node.rightChild);
+        skipNodes[index].skip = static_cast<int>(skipNodes.size());
+    };
+    emit(emit, 0);
+    return skipNodes;
+}
+
+BVHOptimizeResult BVH::optimize(int passes)
+{
+    BVHOptimizeResult result;
+    result.costBefore = computeSAHCost();
+    result.costAfter = result.costBefore;
+    if (m_nodes.size() < 3) {
+        return result;
+    }
+
+    const int nodeCount = static_cast<int>(m_nodes.size());
+    std::vector<float> costs(nodeCount);
+    std::vector<int> depths(nodeCount);
+    for (int pass = 0; pass < passes; pass++) {
+        // Nodes are in depth-first order here, so parents come first for
+        // depths and children first for costs
+        depths[0] = 0;
+        std::vector<std::vector<int>> levels;
+        for (int i = 0; i < nodeCount; i++) {
+            const BVHNode &node = m_nodes[i];
+            if (node.isLeaf()) {
+                continue;
+            }
+            depths[node.leftChild] = depths[i] + 1;
+            depths[node.rightChild] = depths[i] + 1;
+            if (static_cast<int>(levels.size()) <= depths[i]) {
+                levels.resize(depths[i] + 1);
+            }
+            levels[depths[i]].push_back(i);
+        }
+        for (int i = nodeCount - 1; i >= 0; i--) {
+            const BVHNode &node = m_nodes[i];
+            float area = node.bounds.surfaceArea();
+            costs[i] = node.isLeaf()
+                ? INTERSECTION_COST * static_cast<float>(node.primitiveCount)
+                    * area
+                : TRAVERSAL_COST * area + costs[node.leftChild]
+                    + costs[node.rightChild];
+        }
+
+        // Treelets rooted at the same depth are disjoint and their roots
+        // keep their bounds, so a level can be restructured in parallel.
+        // Deeper levels go first so their costs are final when the levels
+        // above read them.
+        unsigned int threads = m_parallelBuild
+            ? std::max(1u, std::thread::hardware_concurrency())
+            : 1u;
+        for (int depth = static_cast<int>(levels.size()) - 1; depth >= 0;
+            depth--) {
+            const std::vector<int> &roots = levels[depth];
+            unsigned int tasks = std::clamp(
+                static_cast<unsigned int>(roots.size() / 64), 1u, threads);
+            runTasks(tasks, [&](unsigned int t) {
+                size_t begin = roots.size() * t / tasks;
+                size_t end = roots.size() * (t + 1) / tasks;
+                for (size_t i = begin; i < end; i++) {
+                    restructureTreelet(roots[i], costs);
+                }
+            });
+        }
+
+        relayoutNodes();
+        float cost = computeSAHCost();
+        bool improved = cost < result.costAfter;
+        result.costAfter = cost;
+        if (!improved) {
+            break;
+        }
+    }
+
+    // Refits compare against the optimized tree from now on
+    m_buildSAHCost = result.costAfter;
+    return result;
+}
+
+void BVH::restructureTreelet(int root, std::vector<float> &costs)
+{
+    // Grow the treelet by opening the internal subtree with the largest
+    // area, the one whose topology matters most
+    std::array<int, TREELET_LEAVES> leaves {};
+    std::array<int, TREELET_LEAVES - 1> internals {};
+    int leafCount = 0;
+    int internalCount = 0;
+    internals[internalCount++] = root;
+    leaves[leafCount++] = m_nodes[root].leftChild;
+    leaves[leafCount++] = m_nodes[root].rightChild;
+    while (leafCount < TREELET_LEAVES) {
+        int best = -1;
+        float bestArea = -1.0f;
+        for (int i = 0; i < leafCount; i++) {
+            const BVHNode &node = m_nodes[leaves[i]];
+            if (!node.isLeaf() && node.bounds.surfaceArea() > bestArea) {
+                best = i;
+                bestArea = node.bounds.surfaceArea();
+            }
+        }
+        if (best < 0) {
+            break;
+        }
+        int opened = leaves[best];
+        internals[internalCount++] = opened;
+        leaves[best] = m_nodes[opened].leftChild;
+        leaves[leafCount++] = m_nodes[opened].rightChild;
+    }
+    if (leafCount < 3) {
+        return;
+    }
+
+    // Optimal cost of every subset of treelet leaves, built from the best
+    // split of each subset into two smaller ones
+    constexpr int SUBSETS = 1 << TREELET_LEAVES;
+    const int full = (1 << leafCount) - 1;
+    std::array<AABB, SUBSETS> bounds;
+    std::array<float, SUBSETS> bestCost;
+    std::array<int, SUBSETS> bestSplit {};
+    for (int subset = 1; subset <= full; subset++) {
+        int lowest = std::countr_zero(static_cast<unsigned int>(subset));
+        int rest = subset & (subset - 1);
+        bounds[subset] = m_nodes[leaves[lowest]].bounds;
+        if (rest == 0) {
+            bestCost[subset] = costs[leaves[lowest]];
+            continue;
+        }
+        bounds[subset].expand(bounds[rest]);
+
+        // Only the halves holding the lowest leaf, each split once
+        float best = std::numeric_limits<float>::max();
+        int lowBit = subset & -subset;
+        for (int part = (subset - 1) & subset; part > 0;
+            part = (part - 1) & subset) {
+            if ((part & lowBit) == 0) {
+                continue;
+            }
+            float cost = bestCost[part] + bestCost[subset ^ part];
+            if (cost < best) {
+                best = cost;
+                bestSplit[subset] = part;
+            }
+        }
+        bestCost[subset]
+            = TRAVERSAL_COST * bounds[subset].surfaceArea() + best;
+    }
+
+    // Keep the current topology unless the gain is clear of rounding
+    if (bestCost[full] >= costs[root] * (1.0f - 1e-5f)) {
+        return;
+    }
+
+    // Rebuild top-down, reusing the treelet's internal nodes
+    int nextInternal = 1;
+    auto assign = [&](auto &self, int nodeIndex, int subset) -> void {
+        int part = bestSplit[subset];
+        int halves[2] = { part, subset ^ part };
+        int children[2];
+        for (int side = 0; side < 2; side++) {
+            if ((halves[side] & (halves[side] - 1)) == 0) {
+                children[side] = leaves[std::countr_zero(
+                    static_cast<unsigned int>(halves[side]))];
+            } else {
+                children[side] = internals[nextInternal++];
+                self(self, children[side], halves[side]);
+            }
+        }
+        BVHNode &node = m_nodes[nodeIndex];
+        node.leftChild = children[0];
+        node.rightChild = children[1];
+        node.bounds = bounds[subset];
+        costs[nodeIndex] = bestCost[subset];
+    };
+    assign(assign, root, full);
+}
+
+void BVH::relayoutNodes()
+{
+    struct Pending {
+        int oldIndex;
+        int parent; // New index of the parent, -1 for the root
+        bool isRight;
+    };
+
+    std::vector<BVHNode> ordered;
+    ordered.reserve(m_nodes.size());
+    std::vector<Pending> stack { { 0, -1, false } };
+    while (!stack.empty()) {
+        Pending pending = stack.back();
+        stack.pop_back();
+
+        int newIndex = static_cast<int>(ordered.size());
+        ordered.push_back(m_nodes[pending.oldIndex]);
+        if (pending.parent >= 0) {
+            BVHNode &parent = ordered[pending.parent];
+            (pending.isRight ? parent.rightChild : parent.leftChild)
+                = newIndex;
+        }
+
+        const BVHNode &node = m_nodes[pending.oldIndex];
+        if (!node.isLeaf()) {
+            // Right first so the left subtree is laid out first
+            stack.push_back({ node.rightChild, newIndex, true });
+            stack.push_back({ node.leftChild, newIndex, false });
+        }
+    }
+    m_nodes = std::move(ordered);
+}
+
+BVHPrimitive BVH::makeTrianglePrimitive(const Triangle &tri, int index)
+{
+    BVHPrimitive prim;
+    prim.type = BVHPrimitiveType::Triangle;
+    prim.originalIndex = index;
+
+    // Compute AABB for triangle
+    prim.bounds.expand(tri.v0);
+    prim.bounds.expand(tri.v1);
+    prim.bounds.expand(tri.v2);
+
+    // Centroid is center of triangle
+    prim.centroid = (tri.v0 + tri.v1 + tri.v2) / 3.0f;
+    return prim;
+}
+
+BVHPrimitive BVH::makeSpherePrimitive(
+    const AnalyticalSphereData &sphere, int index)
+{
+    BVHPrimitive prim;
+    prim.type = BVHPrimitiveType::Sphere;
+    prim.originalIndex = index;
+
+    // Compute AABB for sphere (box that contains the sphere)
+    glm::vec3 radiusVec(sphere.radius);
+    prim.bounds.min = sphere.center - radiusVec;
+    prim.bounds.max = sphere.center + radiusVec;
+
+    // Centroid is center of sphere
+    prim.centroid = sphere.center;
+    return prim;
+}
+
+BVHPrimitive BVH::makeInstancePrimitive(
+    const InstanceData &instance, int index)
+{
+    BVHPrimitive prim;
+    prim.type = BVHPrimitiveType::Instance;
+    prim.originalIndex = index;
+    prim.bounds.min = instance.boundsMin;
+    prim.bounds.max = instance.boundsMax;
+    prim.centroid = prim.bounds.centroid();
+    return prim;
+}
+
+int BVH::buildRecursive(std::vector<int> &indices, int start, int end,
+    int depth, std::vector<BVHNode> &nodes)
+{
+    int nodeIndex = static_cast<int>(nodes.size());
+    nodes.push_back(BVHNode {});
+    BVHNode &node = nodes[nodeIndex];
 
     // Compute bounds for this node
     AABB centroidBounds;
-    for (int i = start; i < end; i++) {
-        node.bounds.expand(m_primitives[indices[i]].bounds);
-        centroidBounds.expand(m_primitives[indices[i]].centroid);
-    }
+    computeRangeBounds(start, end, node.bounds, centroidBounds);
 
     int numPrimitives = end - start;
 
@@ -118,7 +643,7 @@ int BVH::buildRecursive(
 
     // Find best split using SAH
     SplitResult split
-        = findBestSplit(indices, start, end, node.bounds, centroidBounds);
+        = findBestSplit(start, end, node.bounds, centroidBounds);
 
     // If no good split found, create leaf
     if (split.axis == -1 || split.splitIndex == start
@@ -128,105 +653,617 @@ int BVH::buildRecursive(
         return nodeIndex;
     }
 
-    // Partition primitives
-    int mid = split.splitIndex;
+    // Partition primitives by bucket along the split axis
+    int mid = partition(indices, start, end, split, centroidBounds);
+
+    if (numPrimitives >= PARALLEL_BUILD_CUTOFF && depth < m_maxTaskDepth) {
+        // Both halves work on disjoint index ranges, so they can be built
+        // concurrently into private arenas. Appending left then right
+        // reproduces the depth-first order of the serial build.
+        std::vector<BVHNode> leftNodes;
+        std::vector<BVHNode> rightNodes;
+        leftNodes.reserve(2 * (mid - start));
+        rightNodes.reserve(2 * (end - mid));
 
-    // Sort indices by centroid along split axis
-    std::nth_element(indices.begin() + start, indices.begin() + mid,
-        indices.begin() + end, [this, axis = split.axis](int a, int b) {
-            return m_primitives[a].centroid[axis]
-                < m_primitives[b].centroid[axis];
+        auto leftTask = std::async(std::launch::async, [&]() {
+            buildRecursive(indices, start, mid, depth + 1, leftNodes);
         });
+        buildRecursive(indices, mid, end, depth + 1, rightNodes);
+        leftTask.get();
+
+        int leftChild = appendSubtree(nodes, leftNodes);
+        int rightChild = appendSubtree(nodes, rightNodes);
+        nodes[nodeIndex].leftChild = leftChild;
+        nodes[nodeIndex].rightChild = rightChild;
+        return nodeIndex;
+    }
 
     // Recursively build children
-    node.leftChild = buildRecursive(indices, start, mid, depth + 1);
+    int leftChild = buildRecursive(indices, start, mid, depth + 1, nodes);
     // Need to re-get reference after potential reallocation
-    m_nodes[nodeIndex].rightChild
-        = buildRecursive(indices, mid, end, depth + 1);
+    nodes[nodeIndex].leftChild = leftChild;
+    nodes[nodeIndex].rightChild
+        = buildRecursive(indices, mid, end, depth + 1, nodes);
 
     return nodeIndex;
 }
 
-BVH::SplitResult BVH::findBestSplit(const std::vector<int> &indices, int start,
-    int end, const AABB &nodeBounds, const AABB &centroidBounds)
+int BVH::buildLinear(std::vector<int> &indices, std::vector<uint64_t> &codes,
+    int start, int end, int depth, std::vector<BVHNode> &nodes)
 {
-    SplitResult best;
+    int nodeIndex = static_cast<int>(nodes.size());
+    nodes.push_back(BVHNode {});
+
     int numPrimitives = end - start;
+    if (numPrimitives <= MAX_LEAF_PRIMITIVES || depth > 32) {
+        AABB centroidBounds;
+        computeRangeBounds(
+            start, end, nodes[nodeIndex].bounds, centroidBounds);
+        nodes[nodeIndex].primitiveStart = start;
+        nodes[nodeIndex].primitiveCount = numPrimitives;
+        return nodeIndex;
+    }
 
-    // Cost of not splitting (making a leaf)
-    float leafCost = static_cast<float>(numPrimitives) * INTERSECTION_COST;
+    int mid = -1;
 
-    // Try each axis
-    for (int axis = 0; axis < 3; axis++) {
-        // Skip if extent is zero
-        if (centroidBounds.extent()[axis] < 1e-6f) {
-            continue;
+    // Optional SAH split on the top levels. The stable partition keeps each
+    // half sorted by Morton code for the levels below.
+    if (depth < m_lbvhSAHLevels) {
+        AABB bounds;
+        AABB centroidBounds;
+        computeRangeBounds(start, end, bounds, centroidBounds);
+        SplitResult split = findBestSplit(start, end, bounds, centroidBounds);
+        if (split.axis != -1 && split.splitIndex != start
+            && split.splitIndex != end) {
+            mid = stablePartition(
+                indices, codes, start, end, split, centroidBounds);
         }
+    }
+
+    // Split where the highest differing Morton bit flips. Codes in the
+    // range share every bit above it, so the range is 0...0 1...1 there.
+    if (mid == -1) {
+        uint64_t first = codes[start];
+        uint64_t last = codes[end - 1];
+        if (first == last) {
+            mid = start + numPrimitives / 2;
+        } else {
+            int bit = 63 - std::countl_zero(first ^ last);
+            uint64_t mask = uint64_t(1) << bit;
+            auto splitIt = std::partition_point(codes.begin() + start,
+                codes.begin() + end,
+                [mask](uint64_t code) { return (code & mask) == 0; });
+            mid = static_cast<int>(splitIt - codes.begin());
+        }
+    }
+
+    int leftChild;
+    int rightChild;
+    if (numPrimitives >= PARALLEL_BUILD_CUTOFF && depth < m_maxTaskDepth) {
+        std::vector<BVHNode> leftNodes;
+        std::vector<BVHNode> rightNodes;
+        leftNodes.reserve(2 * (mid - start));
+        rightNodes.reserve(2 * (end - mid));
 
-        // Initialize buckets
-        struct Bucket {
-            int count = 0;
-            AABB bounds;
-        };
+        auto leftTask = std::async(std::launch::async, [&]() {
+            buildLinear(indices, codes, start, mid, depth + 1, leftNodes);
+        });
+        buildLinear(indices, codes, mid, end, depth + 1, rightNodes);
+        leftTask.get();
+
+        leftChild = appendSubtree(nodes, leftNodes);
+        rightChild = appendSubtree(nodes, rightNodes);
+    } else {
+        leftChild = buildLinear(indices, codes, start, mid, depth + 1, nodes);
+        rightChild = buildLinear(indices, codes, mid, end, depth + 1, nodes);
+    }
+
+    // Bounds are assembled bottom-up from the children
+    BVHNode &node = nodes[nodeIndex];
+    node.leftChild = leftChild;
+    node.rightChild = rightChild;
+    node.bounds = nodes[leftChild].bounds;
+    node.bounds.expand(nodes[rightChild].bounds);
+    return nodeIndex;
+}
+
+int BVH::buildSpatial(std::vector<SpatialReference> &refs, int depth,
+    std::vector<BVHNode> &nodes, std::vector<SpatialReference> &leafRefs)
+{
+    int nodeIndex = static_cast<int>(nodes.size());
+    nodes.push_back(BVHNode {});
+
+    // Load this node's references into the build streams so object splits
+    // go through the same binned SAH kernel as the plain build
+    const int count = static_cast<int>(refs.size());
+    for (auto &stream : m_buildCentroids) {
+        stream.resize(count);
+    }
+    m_buildBounds.resize(count);
+    for (int i = 0; i < count; i++) {
+        glm::vec3 centroid = refs[i].bounds.centroid();
+        PackedBounds &packed = m_buildBounds[i];
+        for (int axis = 0; axis < 3; axis++) {
+            m_buildCentroids[axis][i] = centroid[axis];
+            packed.min[axis] = refs[i].bounds.min[axis];
+            packed.max[axis] = refs[i].bounds.max[axis];
+        }
+        packed.min[3] = 0.0f;
+        packed.max[3] = 0.0f;
+    }
+
+    AABB bounds;
+    AABB centroidBounds;
+    computeRangeBounds(0, count, bounds, centroidBounds);
+    nodes[nodeIndex].bounds = bounds;
+    if (depth == 0) {
+        m_spatialRootArea = bounds.surfaceArea();
+    }
 
-        std::vector<Bucket> buckets(SAH_BUCKETS);
+    auto makeLeaf = [&]() {
+        nodes[nodeIndex].primitiveStart = static_cast<int>(leafRefs.size());
+        nodes[nodeIndex].primitiveCount = count;
+        leafRefs.insert(leafRefs.end(), refs.begin(), refs.end());
+        return nodeIndex;
+    };
 
-        float axisMin = centroidBounds.min[axis];
-        float axisExtent = centroidBounds.extent()[axis];
+    if (count <= MAX_LEAF_PRIMITIVES || depth > 32) {
+        return makeLeaf();
+    }
 
-        // Assign primitives to buckets
-        for (int i = start; i < end; i++) {
-            int primIdx = indices[i];
-            float centroid = m_primitives[primIdx].centroid[axis];
-            int bucketIdx = static_cast<int>(
-                SAH_BUCKETS * (centroid - axisMin) / axisExtent);
-            bucketIdx = std::clamp(bucketIdx, 0, SAH_BUCKETS - 1);
-            buckets[bucketIdx].count++;
-            buckets[bucketIdx].bounds.expand(m_primitives[primIdx].bounds);
+    // Best object split, partitioned right away to measure its overlap
+    SplitResult objectSplit
+        = findBestSplit(0, count, bounds, centroidBounds);
+    std::vector<SpatialReference> left;
+    std::vector<SpatialReference> right;
+    AABB objectOverlap;
+    if (objectSplit.axis != -1) {
+        const int axis = objectSplit.axis;
+        const float scale = static_cast<float>(SAH_BUCKETS)
+            / centroidBounds.extent()[axis];
+        AABB leftBounds;
+        AABB rightBounds;
+        for (int i = 0; i < count; i++) {
+            int bucket = bucketIndex(m_buildCentroids[axis][i],
+                centroidBounds.min[axis], scale, SAH_BUCKETS);
+            if (bucket <= objectSplit.bucket) {
+                left.push_back(refs[i]);
+                leftBounds.expand(refs[i].bounds);
+            } else {
+                right.push_back(refs[i]);
+                rightBounds.expand(refs[i].bounds);
+            }
         }
+        objectOverlap = intersectBounds(leftBounds, rightBounds);
+    }
+
+    // Spatial splits only pay off where object split children overlap
+    bool trySpatial = m_spatialReferencesLeft > 0;
+    if (trySpatial && objectSplit.axis != -1) {
+        trySpatial = !isEmpty(objectOverlap)
+            && objectOverlap.surfaceArea()
+                > m_spatialSplitOverlap * m_spatialRootArea;
+    }
+    if (trySpatial) {
+        SpatialSplit spatial = findSpatialSplit(refs, bounds);
+        if (spatial.axis != -1 && spatial.cost < objectSplit.cost) {
+            const int axis = spatial.axis;
+            std::vector<SpatialReference> spatialLeft;
+            std::vector<SpatialReference> spatialRight;
+            AABB &leftBounds = spatial.leftBounds;
+            AABB &rightBounds = spatial.rightBounds;
+            int leftCount = spatial.leftCount;
+            int rightCount = spatial.rightCount;
+
+            for (const auto &ref : refs) {
+                if (ref.bounds.max[axis] <= spatial.position) {
+                    spatialLeft.push_back(ref);
+                    continue;
+                }
+                if (ref.bounds.min[axis] >= spatial.position) {
+                    spatialRight.push_back(ref);
+                    continue;
+                }
+
+                // Straddling reference: keep it whole on one side when
+                // that is cheaper than duplicating it, or when the budget
+                // is spent
+                AABB leftWith = leftBounds;
+                leftWith.expand(ref.bounds);
+                AABB rightWith = rightBounds;
+                rightWith.expand(ref.bounds);
+                float leftArea = leftBounds.surfaceArea();
+                float rightArea = rightBounds.surfaceArea();
+                float splitCost = leftArea * static_cast<float>(leftCount)
+                    + rightArea * static_cast<float>(rightCount);
+                float leftOnlyCost
+                    = leftWith.surfaceArea() * static_cast<float>(leftCount)
+                    + rightArea * static_cast<float>(rightCount - 1);
+                float rightOnlyCost
+                    = leftArea * static_cast<float>(leftCount - 1)
+                    + rightWith.surfaceArea() * static_cast<float>(rightCount);
+
+                bool canSplit = m_spatialReferencesLeft > 0;
+                if (leftOnlyCost <= rightOnlyCost
+                    && (!canSplit || leftOnlyCost < splitCost)) {
+                    spatialLeft.push_back(ref);
+                    leftBounds = leftWith;
+                    rightCount--;
+                    continue;
+                }
+                if (!canSplit || rightOnlyCost < splitCost) {
+                    spatialRight.push_back(ref);
+                    rightBounds = rightWith;
+                    leftCount--;
+                    continue;
+                }
+
+                SpatialReference leftPart { ref.primitive, AABB {} };
+                SpatialReference rightPart { ref.primitive, AABB {} };
+                splitReference(ref, axis, spatial.position, leftPart.bounds,
+                    rightPart.bounds);
+                if (isEmpty(leftPart.bounds)) {
+                    spatialRight.push_back(ref);
+                } else if (isEmpty(rightPart.bounds)) {
+                    spatialLeft.push_back(ref);
+                } else {
+                    spatialLeft.push_back(leftPart);
+                    spatialRight.push_back(rightPart);
+                    m_spatialReferencesLeft--;
+                }
+            }
 
-        // Compute costs for each split
-        // Precompute prefix sums from left
-        std::vector<int> countLeft(SAH_BUCKETS);
-        std::vector<AABB> boundsLeft(SAH_BUCKETS);
-        countLeft[0] = buckets[0].count;
-        boundsLeft[0] = buckets[0].bounds;
-        for (int i = 1; i < SAH_BUCKETS; i++) {
-            countLeft[i] = countLeft[i - 1] + buckets[i].count;
-            boundsLeft[i] = boundsLeft[i - 1];
-            boundsLeft[i].expand(buckets[i].bounds);
+            // Unsplitting may empty a side, keep the object split then
+            if (!spatialLeft.empty() && !spatialRight.empty()) {
+                left = std::move(spatialLeft);
+                right = std::move(spatialRight);
+            }
         }
+    }
 
-        // Compute costs sweeping from right
+    if (left.empty() || right.empty()) {
+        return makeLeaf();
+    }
+
+    // The children reload the streams, this node's list is no longer
+    // needed
+    std::vector<SpatialReference>().swap(refs);
+    int leftChild = buildSpatial(left, depth + 1, nodes, leafRefs);
+    nodes[nodeIndex].leftChild = leftChild;
+    nodes[nodeIndex].rightChild
+        = buildSpatial(right, depth + 1, nodes, leafRefs);
+    return nodeIndex;
+}
+
+BVH::SpatialSplit BVH::findSpatialSplit(
+    const std::vector<SpatialReference> &refs, const AABB &nodeBounds) const
+{
+    SpatialSplit best;
+
+    float saParent = nodeBounds.surfaceArea();
+    if (saParent < 1e-6f) {
+        return best;
+    }
+    float leafCost = static_cast<float>(refs.size()) * INTERSECTION_COST;
+
+    struct SpatialBin {
+        AABB bounds;
+        int entries = 0;
+        int exits = 0;
+    };
+
+    for (int axis = 0; axis < 3; axis++) {
+        float axisMin = nodeBounds.min[axis];
+        float extent = nodeBounds.extent()[axis];
+        if (extent < 1e-6f) {
+            continue;
+        }
+        float binWidth = extent / static_cast<float>(SAH_BUCKETS);
+        float scale = static_cast<float>(SAH_BUCKETS) / extent;
+
+        // Chop every reference at each bin boundary it crosses
+        SpatialBin bins[SAH_BUCKETS];
+        for (const auto &ref : refs) {
+            int first = bucketIndex(
+                ref.bounds.min[axis], axisMin, scale, SAH_BUCKETS);
+            int last = bucketIndex(
+                ref.bounds.max[axis], axisMin, scale, SAH_BUCKETS);
+            SpatialReference rest = ref;
+            for (int bin = first; bin < last; bin++) {
+                float plane
+                    = axisMin + binWidth * static_cast<float>(bin + 1);
+                AABB part;
+                AABB remainder;
+                splitReference(rest, axis, plane, part, remainder);
+                bins[bin].bounds.expand(part);
+                rest.bounds = remainder;
+            }
+            bins[last].bounds.expand(rest.bounds);
+            bins[first].entries++;
+            bins[last].exits++;
+        }
+
+        // Prefix sums from the left
+        int countLeft[SAH_BUCKETS];
+        AABB boundsLeft[SAH_BUCKETS];
+        AABB running;
+        int runningCount = 0;
+        for (int i = 0; i < SAH_BUCKETS; i++) {
+            runningCount += bins[i].entries;
+            running.expand(bins[i].bounds);
+            countLeft[i] = runningCount;
+            boundsLeft[i] = running;
+        }
+
+        // Sweep from the right
         int countRight = 0;
         AABB boundsRight;
-
         for (int i = SAH_BUCKETS - 1; i > 0; i--) {
-            countRight += buckets[i].count;
-            boundsRight.expand(buckets[i].bounds);
+            countRight += bins[i].exits;
+            boundsRight.expand(bins[i].bounds);
 
             int countL = countLeft[i - 1];
             if (countL == 0 || countRight == 0) {
                 continue;
             }
 
-            float saLeft = boundsLeft[i - 1].surfaceArea();
-            float saRight = boundsRight.surfaceArea();
-            float saParent = nodeBounds.surfaceArea();
+            float cost = TRAVERSAL_COST
+                + INTERSECTION_COST
+                    * (static_cast<float>(countL)
+                            * boundsLeft[i - 1].surfaceArea()
+                        + static_cast<float>(countRight)
+                            * boundsRight.surfaceArea())
+                    / saParent;
+
+            if (cost < best.cost && cost < leafCost) {
+                best.cost = cost;
+                best.axis = axis;
+                best.position = axisMin + binWidth * static_cast<float>(i);
+                best.leftBounds = boundsLeft[i - 1];
+                best.rightBounds = boundsRight;
+                best.leftCount = countL;
+                best.rightCount = countRight;
+            }
+        }
+    }
+
+    return best;
+}
+
+void BVH::splitReference(const SpatialReference &ref, int axis,
+    float position, AABB &left, AABB &right) const
+{
+    left = AABB {};
+    right = AABB {};
+
+    const BVHPrimitive &prim = m_primitives[ref.primitive];
+    if (prim.type == BVHPrimitiveType::Triangle && m_buildTriangles) {
+        // Walk the edges, each vertex goes to its side and each crossing
+        // edge adds its intersection with the plane to both
+        const Triangle &tri = (*m_buildTriangles)[prim.originalIndex];
+        const glm::vec3 vertices[3] = { tri.v0, tri.v1, tri.v2 };
+        for (int e = 0; e < 3; e++) {
+            const glm::vec3 &a = vertices[e];
+            const glm::vec3 &b = vertices[(e + 1) % 3];
+            if (a[axis] <= position) {
+                left.expand(a);
+            }
+            if (a[axis] >= position) {
+                right.expand(a);
+            }
+            if ((a[axis] < position && b[axis] > position)
+                || (a[axis] > position && b[axis] < position)) {
+                float t = (position - a[axis]) / (b[axis] - a[axis]);
+                glm::vec3 crossing = glm::mix(a, b, t);
+                crossing[axis] = position;
+                left.expand(crossing);
+                right.expand(crossing);
+            }
+        }
+        // Stay within what earlier splits kept of the primitive
+        left = intersectBounds(left, ref.bounds);
+        right = intersectBounds(right, ref.bounds);
+    } else {
+        // Spheres and instances are clipped as boxes
+        left = ref.bounds;
+        right = ref.bounds;
+    }
+    left.max[axis] = std::min(left.max[axis], position);
+    right.min[axis] = std::max(right.min[axis], position);
+}
+
+std::vector<uint64_t> BVH::sortByMortonCode(std::vector<int> &indices) const
+{
+    const size_t count = indices.size();
+
+    AABB centroidBounds;
+    for (const auto &prim : m_primitives) {
+        centroidBounds.expand(prim.centroid);
+    }
+
+    // Quantize centroids on a 2^bits grid per axis
+    const bool wideCodes
+        = count > static_cast<size_t>(LBVH_WIDE_CODE_THRESHOLD);
+    const int bitsPerAxis = wideCodes ? 21 : 10;
+    const float cells = static_cast<float>(1u << bitsPerAxis);
+    const uint32_t maxCell = (1u << bitsPerAxis) - 1;
+    glm::vec3 extent = centroidBounds.extent();
+    glm::vec3 scale;
+    for (int axis = 0; axis < 3; axis++) {
+        scale[axis] = extent[axis] > 1e-6f ? cells / extent[axis] : 0.0f;
+    }
 
-            if (saParent < 1e-6f) {
+    std::vector<uint64_t> codes(count);
+    for (size_t i = 0; i < count; i++) {
+        glm::vec3 cell
+            = (m_primitives[indices[i]].centroid - centroidBounds.min) * scale;
+        uint64_t q[3];
+        for (int axis = 0; axis < 3; axis++) {
+            q[axis] = std::min(
+                static_cast<uint32_t>(std::max(cell[axis], 0.0f)), maxCell);
+        }
+        if (wideCodes) {
+            codes[i] = (expandBits21(q[0]) << 2) | (expandBits21(q[1]) << 1)
+                | expandBits21(q[2]);
+        } else {
+            codes[i] = (expandBits10(q[0]) << 2) | (expandBits10(q[1]) << 1)
+                | expandBits10(q[2]);
+        }
+    }
+
+    // LSD radix sort, 8 bits per pass. Each task histograms and scatters
+    // its own contiguous chunk, which keeps the sort stable.
+    constexpr size_t RADIX_CHUNK = 16384;
+    unsigned int tasks = 1;
+    if (m_parallelBuild) {
+        tasks = std::clamp(static_cast<unsigned int>(count / RADIX_CHUNK), 1u,
+            std::max(1u, std::thread::hardware_concurrency()));
+    }
+    auto chunkBegin = [&](unsigned int t) {
+        return count * t / static_cast<size_t>(tasks);
+    };
+
+    std::vector<uint64_t> codesScratch(count);
+    std::vector<int> indicesScratch(count);
+    std::vector<std::array<size_t, 256>> offsets(tasks);
+
+    const int passes = (3 * bitsPerAxis + 7) / 8;
+    for (int pass = 0; pass < passes; pass++) {
+        const int shift = pass * 8;
+
+        runTasks(tasks, [&](unsigned int t) {
+            offsets[t].fill(0);
+            for (size_t i = chunkBegin(t); i < chunkBegin(t + 1); i++) {
+                offsets[t][(codes[i] >> shift) & 0xFF]++;
+            }
+        });
+
+        // Exclusive prefix over (digit, task); skip passes where every key
+        // has the same digit
+        size_t running = 0;
+        bool trivialPass = false;
+        for (int digit = 0; digit < 256; digit++) {
+            size_t digitStart = running;
+            for (unsigned int t = 0; t < tasks; t++) {
+                size_t digitCount = offsets[t][digit];
+                offsets[t][digit] = running;
+                running += digitCount;
+            }
+            trivialPass = trivialPass || (running - digitStart == count);
+        }
+        if (trivialPass) {
+            continue;
+        }
+
+        runTasks(tasks, [&](unsigned int t) {
+            auto &taskOffsets = offsets[t];
+            for (size_t i = chunkBegin(t); i < chunkBegin(t + 1); i++) {
+                size_t dst = taskOffsets[(codes[i] >> shift) & 0xFF]++;
+                codesScratch[dst] = codes[i];
+                indicesScratch[dst] = indices[i];
+            }
+        });
+        codes.swap(codesScratch);
+        indices.swap(indicesScratch);
+    }
+
+    return codes;
+}
+
+int BVH::appendSubtree(
+    std::vector<BVHNode> &nodes, const std::vector<BVHNode> &subtree)
+{
+    int offset = static_cast<int>(nodes.size());
+    nodes.reserve(nodes.size() + subtree.size());
+    for (BVHNode node : subtree) {
+        if (!node.isLeaf()) {
+            node.leftChild += offset;
+            node.rightChild += offset;
+        }
+        nodes.push_back(node);
+    }
+    return offset;
+}
+
+BVH::SplitResult BVH::findBestSplit(int start, int end,
+    const AABB &nodeBounds, const AABB &centroidBounds) const
+{
+    SplitResult best;
+    int numPrimitives = end - start;
+
+    float saParent = nodeBounds.surfaceArea();
+    if (saParent < 1e-6f) {
+        return best;
+    }
+
+    // Cost of not splitting (making a leaf)
+    float leafCost = static_cast<float>(numPrimitives) * INTERSECTION_COST;
+
+    // Degenerate axes get a zero scale and are skipped in the sweep
+    glm::vec3 extent = centroidBounds.extent();
+    float scale[3];
+    for (int axis = 0; axis < 3; axis++) {
+        scale[axis] = extent[axis] < 1e-6f
+            ? 0.0f
+            : static_cast<float>(SAH_BUCKETS) / extent[axis];
+    }
+
+    // Bin all three axes in a single pass over the streams
+    Bin bins[3][SAH_BUCKETS];
+    const float *centroids[3] = { m_buildCentroids[0].data(),
+        m_buildCentroids[1].data(), m_buildCentroids[2].data() };
+    for (int i = start; i < end; i++) {
+        const PackedBounds &primBounds = m_buildBounds[i];
+        for (int axis = 0; axis < 3; axis++) {
+            int bucket = bucketIndex(centroids[axis][i],
+                centroidBounds.min[axis], scale[axis], SAH_BUCKETS);
+            bins[axis][bucket].count++;
+            bins[axis][bucket].bounds.grow(primBounds.min, primBounds.max);
+        }
+    }
+
+    for (int axis = 0; axis < 3; axis++) {
+        if (scale[axis] == 0.0f) {
+            continue;
+        }
+
+        // Prefix sums from the left
+        int countLeft[SAH_BUCKETS];
+        float areaLeft[SAH_BUCKETS];
+        BinBounds boundsLeft;
+        int runningCount = 0;
+        for (int i = 0; i < SAH_BUCKETS; i++) {
+            runningCount += bins[axis][i].count;
+            boundsLeft.grow(bins[axis][i].bounds);
+            countLeft[i] = runningCount;
+            areaLeft[i] = boundsLeft.surfaceArea();
+        }
+
+        // Compute costs sweeping from right
+        int countRight = 0;
+        BinBounds boundsRight;
+        for (int i = SAH_BUCKETS - 1; i > 0; i--) {
+            countRight += bins[axis][i].count;
+            boundsRight.grow(bins[axis][i].bounds);
+
+            int countL = countLeft[i - 1];
+            if (countL == 0 || countRight == 0) {
                 continue;
             }
 
             float cost = TRAVERSAL_COST
-                + INTERSECTION_COST * (countL * saLeft + countRight * saRight)
+                + INTERSECTION_COST
+                    * (static_cast<float>(countL) * areaLeft[i - 1]
+                        + static_cast<float>(countRight)
+                            * boundsRight.surfaceArea())
                     / saParent;
 
             if (cost < best.cost && cost < leafCost) {
                 best.cost = cost;
                 best.axis = axis;
-                best.position = axisMin
-                    + axisExtent * static_cast<float>(i) / SAH_BUCKETS;
+                best.bucket = i - 1;
+                best.position = centroidBounds.min[axis]
+                    + extent[axis] * static_cast<float>(i) / SAH_BUCKETS;
                 best.splitIndex = start + countL;
             }
         }
@@ -234,3 +1271,93 @@ BVH::SplitResult BVH::findBestSplit(const std::vector<int> &indices, int start,
 
     return best;
 }
+
+int BVH::partition(std::vector<int> &indices, int start, int end,
+    const SplitResult &split, const AABB &centroidBounds)
+{
+    const int axis = split.axis;
+    const float axisMin = centroidBounds.min[axis];
+    const float scale = static_cast<float>(SAH_BUCKETS)
+        / centroidBounds.extent()[axis];
+    std::vector<float> &keys = m_buildCentroids[axis];
+
+    auto goesLeft = [&](int i) {
+        return bucketIndex(keys[i], axisMin, scale, SAH_BUCKETS)
+            <= split.bucket;
+    };
+
+    int left = start;
+    int right = end - 1;
+    while (left <= right) {
+        if (goesLeft(left)) {
+            left++;
+            continue;
+        }
+        std::swap(indices[left], indices[right]);
+        std::swap(m_buildBounds[left], m_buildBounds[right]);
+        for (auto &stream : m_buildCentroids) {
+            std::swap(stream[left], stream[right]);
+        }
+        right--;
+    }
+    return left;
+}
+
+int BVH::stablePartition(std::vector<int> &indices,
+    std::vector<uint64_t> &codes, int start, int end, const SplitResult &split,
+    const AABB &centroidBounds)
+{
+    const int axis = split.axis;
+    const float axisMin = centroidBounds.min[axis];
+    const float scale = static_cast<float>(SAH_BUCKETS)
+        / centroidBounds.extent()[axis];
+    const std::vector<float> &keys = m_buildCentroids[axis];
+
+    auto goesLeft = [&](int i) {
+        return bucketIndex(keys[i], axisMin, scale, SAH_BUCKETS)
+            <= split.bucket;
+    };
+
+    // Source position of every slot, left half first
+    const int count = end - start;
+    int leftCount = 0;
+    for (int i = start; i < end; i++) {
+        leftCount += goesLeft(i) ? 1 : 0;
+    }
+    std::vector<int> order(count);
+    int nextLeft = 0;
+    int nextRight = leftCount;
+    for (int i = start; i < end; i++) {
+        order[goesLeft(i) ? nextLeft++ : nextRight++] = i;
+    }
+
+    auto gather = [&](auto &stream) {
+        using Value = typename std::decay_t<decltype(stream)>::value_type;
+        std::vector<Value> moved(count);
+        for (int k = 0; k < count; k++) {
+            moved[k] = stream[order[k]];
+        }
+        std::copy(moved.begin(), moved.end(), stream.begin() + start);
+    };
+    gather(indices);
+    gather(codes);
+    gather(m_buildBounds);
+    for (auto &stream : m_buildCentroids) {
+        gather(stream);
+    }
+
+    return start + leftCount;
+}
+
+void BVH::computeRangeBounds(
+    int start, int end, AABB &bounds, AABB &centroidBounds) const
+{
+    BinBounds packed;
+    for (int i = start; i < end; i++) {
+        packed.grow(m_buildBounds[i].min, m_buildBounds[i].max);
+        centroidBounds.expand(glm::vec3(m_buildCentroids[0][i],
+            m_buildCentroids[1][i], m_buildCentroids[2][i]));
+    }
+    bounds.min = glm::vec3(packed.min[0], packed.min[1], packed.min[2]);
+    bounds.max = glm::vec3(packed.max[0], packed.max[1], packed.max[2]);
+}
@@ -0,0 +1,385 @@
+#include "renderer/BVHCache.hpp"
+#include "renderer/Hash.hpp"
+#include "renderer/PathTracingData.hpp"
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <span>
+#include <sstream>
+#include <type_traits>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define SCENELAB_BVH_CACHE_MMAP 1
+#endif
+
+namespace {
+
+constexpr std::array<char, 8> CACHE_MAGIC = { 'S', 'L', 'B', 'V', 'H', 'C',
+    '\0', '\0' };
+
+static_assert(std::is_trivially_copyable_v<BVHNode>);
+static_assert(std::is_trivially_copyable_v<BVHPrimitive>);
+static_assert(std::is_trivially_copyable_v<Triangle>);
+// Checksums cover the raw bytes, so every struct written as is must be
+// free of padding. BVHPrimitive is not and goes through packPrimitives().
+static_assert(sizeof(AABB) == 6 * sizeof(float));
+static_assert(sizeof(BVHNode) == sizeof(AABB) + 4 * sizeof(int));
+static_assert(sizeof(Triangle) == 12 * sizeof(float) + sizeof(uint32_t));
+
+// Written as is, followed by the node, primitive and triangle arrays. The
+// struct sizes catch entries written by a build with another layout.
+struct CacheHeader {
+    std::array<char, 8> magic;
+    uint32_t version;
+    uint32_t nodeSize;
+    uint32_t primitiveSize;
+    uint32_t triangleSize;
+    uint64_t key;
+    uint64_t nodeCount;
+    uint64_t primitiveCount;
+    uint64_t triangleCount;
+    uint64_t checksum; // Of everything after the header
+};
+
+// Read-only view of a whole file, mapped where the platform allows it
+class MappedFile {
+public:
+    explicit MappedFile(const std::filesystem::path &path)
+    {
+#ifdef SCENELAB_BVH_CACHE_MMAP
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return;
+        }
+        struct stat info {};
+        if (::fstat(fd, &info) == 0 && info.st_size > 0) {
+            void *mapped = ::mmap(nullptr, static_cast<size_t>(info.st_size),
+                PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped != MAP_FAILED) {
+                m_mapped = mapped;
+                m_data = static_cast<const unsigned char *>(mapped);
+                m_size = static_cast<size_t>(info.st_size);
+            }
+        }
+        ::close(fd);
+#else
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        if (!file) {
+            return;
+        }
+        m_buffer.resize(static_cast<size_t>(file.tellg()));
+        file.seekg(0);
+        if (!file.read(reinterpret_cast<char *>(m_buffer.data()),
+                static_cast<std::streamsize>(m_buffer.size()))) {
+            m_buffer.clear();
+        }
+        m_data = m_buffer.data();
+        m_size = m_buffer.size();
+#endif
+    }
+
+    ~MappedFile()
+    {
+#ifdef SCENELAB_BVH_CACHE_MMAP
+        if (m_mapped) {
+            ::munmap(m_mapped, m_size);
+        }
+#endif
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    std::span<const unsigned char> bytes() const { return { m_data, m_size }; }
+
+private:
+    const unsigned char *m_data = nullptr;
+    size_t m_size = 0;
+#ifdef SCENELAB_BVH_CACHE_MMAP
+    void *m_mapped = nullptr;
+#else
+    std::vector<unsigned char> m_buffer;
+#endif
+};
+
+// Primitives as written to disk, field by field over zeroed bytes so the
+// padding after the type never reaches the file or its checksum
+std::vector<unsigned char> packPrimitives(
+    const std::vector<BVHPrimitive> &primitives)
+{
+    std::vector<unsigned char> bytes(primitives.size() * sizeof(BVHPrimitive));
+    auto put = [&bytes](size_t offset, const auto &field) {
+        std::memcpy(bytes.data() + offset, &field, sizeof(field));
+    };
+    for (size_t i = 0; i < primitives.size(); i++) {
+        const BVHPrimitive &prim = primitives[i];
+        const size_t base = i * sizeof(BVHPrimitive);
+        put(base + offsetof(BVHPrimitive, type), prim.type);
+        put(base + offsetof(BVHPrimitive, originalIndex), prim.originalIndex);
+        put(base + offsetof(BVHPrimitive, bounds), prim.bounds);
+        put(base + offsetof(BVHPrimitive, centroid), prim.centroid);
+    }
+    return bytes;
+}
+
+// Copy count elements of T starting at offset, which must be in range
+template <typename T>
+std::vector<T> readArray(
+    std::span<const unsigned char> bytes, size_t offset, size_t count)
+{
+    std::vector<T> values(count);
+    if (count > 0) {
+        std::memcpy(values.data(), bytes.data() + offset, count * sizeof(T));
+    }
+    return values;
+}
+
+// Links and ranges must stay inside the arrays before anything trusts them
+bool isConsistent(const std::vector<BVHNode> &nodes,
+    const std::vector<BVHPrimitive> &primitives, size_t triangleCount)
+{
+    const int nodeCount = static_cast<int>(nodes.size());
+    const int primitiveCount = static_cast<int>(primitives.size());
+    for (int i = 0; i < nodeCount; i++) {
+        const BVHNode &node = nodes[i];
+        if (node.isLeaf()) {
+            int end = primitiveCount - node.primitiveCount;
+            if (node.primitiveStart < 0 || node.primitiveStart > end) {
+                return false;
+            }
+        } else if (node.primitiveCount != 0 || node.leftChild <= i
+            || node.rightChild <= i || node.leftChild >= nodeCount
+            || node.rightChild >= nodeCount) {
+            return false;
+        }
+    }
+    for (const auto &prim : primitives) {
+        if (prim.type != BVHPrimitiveType::Triangle || prim.originalIndex < 0
+            || static_cast<size_t>(prim.originalIndex) >= triangleCount) {
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+BVHCache::BVHCache(std::filesystem::path directory, uint64_t maxBytes) :
+    m_directory(std::move(directory)), m_maxBytes(maxBytes)
+{
+}
+
+uint64_t BVHCache::computeKey(const std::vector<Triangle> &triangles,
+    const BVH &settings, bool optimized)
+{
+    uint64_t hash = fnv1aHashValue(FNV1A_SEED, FORMAT_VERSION);
+    hash = fnv1aHashValue(
+        hash, static_cast<uint32_t>(SCENELAB_BVH_SAH_BUCKETS));
+    hash = fnv1aHashValue(hash, settings.getBuildMode());
+    hash = fnv1aHashValue(hash, settings.getLBVHSAHLevels());
+    if (settings.getBuildMode() == BVHBuildMode::SBVH) {
+        hash = fnv1aHashValue(hash, settings.getSpatialSplitOverlap());
+        hash = fnv1aHashValue(hash, settings.getSpatialSplitBudget());
+    }
+    hash = fnv1aHashValue(hash, optimized);
+
+    // Normals and materials follow from the rest, only vertices matter
+    hash = fnv1aHashValue(hash, triangles.size());
+    for (const auto &tri : triangles) {
+        const float vertices[9] = { tri.v0.x, tri.v0.y, tri.v0.z, tri.v1.x,
+            tri.v1.y, tri.v1.z, tri.v2.x, tri.v2.y, tri.v2.z };
+        hash = fnv1aHash(hash, vertices, sizeof(vertices));
+    }
+    return hash;
+}
+
+std::filesystem::path BVHCache::getEntryPath(uint64_t key) const
+{
+    std::ostringstream name;
+    name << std::hex << key << ".bvh";
+    return m_directory / name.str();
+}
+
+bool BVHCache::load(
+    uint64_t key, BVH &bvh, std::vector<Triangle> &triangles) const
+{
+    std::filesystem::path path = getEntryPath(key);
+    std::error_code error;
+    if (!std::filesystem::is_regular_file(path, error)) {
+        return false;
+    }
+
+    MappedFile file(path);
+    std::span<const unsigned char> bytes = file.bytes();
+    auto reject = [&path](const char *reason) {
+        std::cerr << "[WARN] Ignoring BVH cache entry " << path.string()
+                  << ": " << reason << '\n';
+        return false;
+    };
+
+    CacheHeader header;
+    if (bytes.size() < sizeof(header)) {
+        return reject("truncated header");
+    }
+    std::memcpy(&header, bytes.data(), sizeof(header));
+    if (header.magic != CACHE_MAGIC || header.version != FORMAT_VERSION
+        || header.nodeSize != sizeof(BVHNode)
+        || header.primitiveSize != sizeof(BVHPrimitive)
+        || header.triangleSize != sizeof(Triangle)) {
+        return reject("written by another version");
+    }
+    if (header.key != key) {
+        return reject("key mismatch");
+    }
+
+    // Sizes come from the file, check them before multiplying
+    const uint64_t limit = bytes.size();
+    if (header.nodeCount > limit / sizeof(BVHNode)
+        || header.primitiveCount > limit / sizeof(BVHPrimitive)
+        || header.triangleCount > limit / sizeof(Triangle)) {
+        return reject("bad array sizes");
+    }
+    const size_t nodeBytes = header.nodeCount * sizeof(BVHNode);
+    const size_t primitiveBytes
+        = header.primitiveCount * sizeof(BVHPrimitive);
+    const size_t triangleBytes = header.triangleCount * sizeof(Triangle);
+    if (bytes.size()
+        != sizeof(header) + nodeBytes + primitiveBytes + triangleBytes) {
+        return reject("size mismatch");
+    }
+    std::span<const unsigned char> payload = bytes.subspan(sizeof(header));
+    if (fnv1aHash(FNV1A_SEED, payload.data(), payload.size())
+        != header.checksum) {
+        return reject("checksum mismatch");
+    }
+
+    size_t offset = sizeof(header);
+    auto nodes = readArray<BVHNode>(bytes, offset, header.nodeCount);
+    offset += nodeBytes;
+    auto primitives
+        = readArray<BVHPrimitive>(bytes, offset, header.primitiveCount);
+    offset += primitiveBytes;
+    auto cachedTriangles
+        = readArray<Triangle>(bytes, offset, header.triangleCount);
+    if (!isConsistent(nodes, primitives, cachedTriangles.size())) {
+        return reject("inconsistent tree");
+    }
+
+    bvh.restore(std::move(nodes), std::move(primitives));
+    triangles = std::move(cachedTriangles);
+
+    // The modification time doubles as the last use, for eviction
+    std::filesystem::last_write_time(
+        path, std::filesystem::file_time_type::clock::now(), error);
+    return true;
+}
+
+bool BVHCache::store(uint64_t key, const BVH &bvh,
+    const std::vector<Triangle> &triangles) const
+{
+    const auto &nodes = bvh.getNodes();
+    const auto &primitives = bvh.getPrimitives();
+    const size_t nodeBytes = nodes.size() * sizeof(BVHNode);
+    const std::vector<unsigned char> primitiveData
+        = packPrimitives(primitives);
+    const size_t primitiveBytes = primitiveData.size();
+    const size_t triangleBytes = triangles.size() * sizeof(Triangle);
+
+    CacheHeader header {};
+    header.magic = CACHE_MAGIC;
+    header.version = FORMAT_VERSION;
+    header.nodeSize = sizeof(BVHNode);
+    header.primitiveSize = sizeof(BVHPrimitive);
+    header.triangleSize = sizeof(Triangle);
+    header.key = key;
+    header.nodeCount = nodes.size();
+    header.primitiveCount = primitives.size();
+    header.triangleCount = triangles.size();
+    header.checksum = fnv1aHash(FNV1A_SEED, nodes.data(), nodeBytes);
+    header.checksum
+        = fnv1aHash(header.checksum, primitiveData.data(), primitiveBytes);
+    header.checksum
+        = fnv1aHash(header.checksum, triangles.data(), triangleBytes);
+
+    // Write next to the entry and rename, so readers never see a partial
+    // file
+    std::error_code error;
+    std::filesystem::create_directories(m_directory, error);
+    std::filesystem::path path = getEntryPath(key);
+    std::filesystem::path temporary = path;
+    temporary += ".tmp";
+    {
+        std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char *>(nodes.data()),
+            static_cast<std::streamsize>(nodeBytes));
+        file.write(reinterpret_cast<const char *>(primitiveData.data()),
+            static_cast<std::streamsize>(primitiveBytes));
+        file.write(reinterpret_cast<const char *>(triangles.data()),
+            static_cast<std::streamsize>(triangleBytes));
+        if (!file) {
+            std::cerr << "[WARN] Failed to write BVH cache entry "
+                      << temporary.string() << '\n';
+            std::filesystem::remove(temporary, error);
+            return false;
+        }
+    }
+    std::filesystem::rename(temporary, path, error);
+    if (error) {
+        std::cerr << "[WARN] Failed to write BVH cache entry "
+                  << path.string() << ": " << error.message() << '\n';
+        std::filesystem::remove(temporary, error);
+        return false;
+    }
+    evict(path);
+    return true;
+}
+
+void BVHCache::evict(const std::filesystem::path &keep) const
+{
+    struct Entry {
+        std::filesystem::path path;
+        std::filesystem::file_time_type lastUse;
+        uint64_t size;
+    };
+    std::vector<Entry> entries;
+    uint64_t totalBytes = 0;
+    std::error_code error;
+    for (const auto &file :
+        std::filesystem::directory_iterator(m_directory, error)) {
+        if (!file.is_regular_file(error)
+            || file.path().extension() != ".bvh") {
+            continue;
+        }
+        Entry entry { file.path(), file.last_write_time(error),
+            file.file_size(error) };
+        if (error) {
+            continue;
+        }
+        totalBytes += entry.size;
+        if (file.path() != keep) {
+            entries.push_back(std::move(entry));
+        }
+    }
+    if (totalBytes <= m_maxBytes) {
+        return;
+    }
+
+    std::sort(entries.begin(), entries.end(),
+        [](const Entry &a, const Entry &b) { return a.lastUse < b.lastUse; });
+    for (const auto &entry : entries) {
+        if (totalBytes <= m_maxBytes) {
+            break;
+        }
+        if (std::filesystem::remove(entry.path, error)) {
+            totalBytes -= entry.size;
+        }
+    }
+}
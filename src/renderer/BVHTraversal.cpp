@@ -0,0 +1,729 @@
+#include "renderer/BVHTraversal.hpp"
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <vector>
+
+#if SCENELAB_SIMD_WIDTH > 4 || defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#define SCENELAB_SIMD_INTRINSICS 1
+#endif
+
+namespace {
+
+// Same constants as pathtracing.frag
+constexpr float EPSILON = 0.0001f;
+
+// Packets whose rays stray further than this from the first one are
+// traced ray by ray
+constexpr float COHERENT_MIN_COSINE = 0.9f;
+
+// Node indices left to visit. Builders stop splitting past depth 32, so
+// the inline part is enough for them; deeper trees, e.g. after treelet
+// restructuring, spill to the heap instead of overflowing.
+class NodeStack {
+public:
+    bool empty() const { return m_size == 0; }
+
+    void push(int node)
+    {
+        if (m_size < INLINE_SIZE) {
+            m_inline[m_size] = node;
+        } else {
+            m_spill.push_back(node);
+        }
+        m_size++;
+    }
+
+    int pop()
+    {
+        m_size--;
+        if (m_size < INLINE_SIZE) {
+            return m_inline[m_size];
+        }
+        int node = m_spill.back();
+        m_spill.pop_back();
+        return node;
+    }
+
+private:
+    static constexpr int INLINE_SIZE = 96;
+    int m_inline[INLINE_SIZE];
+    int m_size = 0;
+    std::vector<int> m_spill;
+};
+
+// One float per ray of a packet. min/max follow std::min/std::max (and
+// glm) operand order so NaNs resolve the same way as the scalar tests.
+#if SCENELAB_SIMD_WIDTH == 16
+struct SimdMask {
+    __mmask16 m;
+    bool any() const { return m != 0; }
+    int bits() const { return m; }
+};
+struct SimdFloat {
+    __m512 v;
+    static SimdFloat broadcast(float s) { return { _mm512_set1_ps(s) }; }
+    static SimdFloat load(const float *p) { return { _mm512_loadu_ps(p) }; }
+};
+inline SimdFloat operator+(SimdFloat a, SimdFloat b)
+{
+    return { _mm512_add_ps(a.v, b.v) };
+}
+inline SimdFloat operator-(SimdFloat a, SimdFloat b)
+{
+    return { _mm512_sub_ps(a.v, b.v) };
+}
+inline SimdFloat operator*(SimdFloat a, SimdFloat b)
+{
+    return { _mm512_mul_ps(a.v, b.v) };
+}
+inline SimdFloat operator/(SimdFloat a, SimdFloat b)
+{
+    return { _mm512_div_ps(a.v, b.v) };
+}
+inline SimdFloat vmin(SimdFloat a, SimdFloat b)
+{
+    return { _mm512_min_ps(b.v, a.v) };
+}
+inline SimdFloat vmax(SimdFloat a, SimdFloat b)
+{
+    return { _mm512_max_ps(b.v, a.v) };
+}
+inline SimdFloat vsqrt(SimdFloat a) { return { _mm512_sqrt_ps(a.v) }; }
+inline SimdMask operator<(SimdFloat a, SimdFloat b)
+{
+    return { _mm512_cmp_ps_mask(a.v, b.v, _CMP_LT_OQ) };
+}
+inline SimdMask operator<=(SimdFloat a, SimdFloat b)
+{
+    return { _mm512_cmp_ps_mask(a.v, b.v, _CMP_LE_OQ) };
+}
+inline SimdMask operator>(SimdFloat a, SimdFloat b)
+{
+    return { _mm512_cmp_ps_mask(a.v, b.v, _CMP_GT_OQ) };
+}
+inline SimdMask operator>=(SimdFloat a, SimdFloat b)
+{
+    return { _mm512_cmp_ps_mask(a.v, b.v, _CMP_GE_OQ) };
+}
+inline SimdMask operator&(SimdMask a, SimdMask b)
+{
+    return { static_cast<__mmask16>(a.m & b.m) };
+}
+inline SimdMask operator|(SimdMask a, SimdMask b)
+{
+    return { static_cast<__mmask16>(a.m | b.m) };
+}
+inline SimdMask andNot(SimdMask a, SimdMask b)
+{
+    return { static_cast<__mmask16>(a.m & ~b.m) };
+}
+inline SimdFloat select(SimdMask m, SimdFloat a, SimdFloat b)
+{
+    return { _mm512_mask_blend_ps(m.m, b.v, a.v) };
+}
+inline SimdMask firstLanes(int count)
+{
+    return { static_cast<__mmask16>((1u << count) - 1u) };
+}
+#elif SCENELAB_SIMD_WIDTH == 8
+struct SimdMask {
+    __m256 m;
+    bool any() const { return _mm256_movemask_ps(m) != 0; }
+    int bits() const { return _mm256_movemask_ps(m); }
+};
+struct SimdFloat {
+    __m256 v;
+    static SimdFloat broadcast(float s) { return { _mm256_set1_ps(s) }; }
+    static SimdFloat load(const float *p) { return { _mm256_loadu_ps(p) }; }
+};
+inline SimdFloat operator+(SimdFloat a, SimdFloat b)
+{
+    return { _mm256_add_ps(a.v, b.v) };
+}
+inline SimdFloat operator-(SimdFloat a, SimdFloat b)
+{
+    return { _mm256_sub_ps(a.v, b.v) };
+}
+inline SimdFloat operator*(SimdFloat a, SimdFloat b)
+{
+    return { _mm256_mul_ps(a.v, b.v) };
+}
+inline SimdFloat operator/(SimdFloat a, SimdFloat b)
+{
+    return { _mm256_div_ps(a.v, b.v) };
+}
+inline SimdFloat vmin(SimdFloat a, SimdFloat b)
+{
+    return { _mm256_min_ps(b.v, a.v) };
+}
+inline SimdFloat vmax(SimdFloat a, SimdFloat b)
+{
+    return { _mm256_max_ps(b.v, a.v) };
+}
+inline SimdFloat vsqrt(SimdFloat a) { return { _mm256_sqrt_ps(a.v) }; }
+inline SimdMask operator<(SimdFloat a, SimdFloat b)
+{
+    return { _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ) };
+}
+inline SimdMask operator<=(SimdFloat a, SimdFloat b)
+{
+    return { _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ) };
+}
+inline SimdMask operator>(SimdFloat a, SimdFloat b)
+{
+    return { _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ) };
+}
+inline SimdMask operator>=(SimdFloat a, SimdFloat b)
+{
+    return { _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ) };
+}
+inline SimdMask operator&(SimdMask a, SimdMask b)
+{
+    return { _mm256_and_ps(a.m, b.m) };
+}
+inline SimdMask operator|(SimdMask a, SimdMask b)
+{
+    return { _mm256_or_ps(a.m, b.m) };
+}
+inline SimdMask andNot(SimdMask a, SimdMask b)
+{
+    return { _mm256_andnot_ps(b.m, a.m) };
+}
+inline SimdFloat select(SimdMask m, SimdFloat a, SimdFloat b)
+{
+    return { _mm256_blendv_ps(b.v, a.v, m.m) };
+}
+inline SimdMask firstLanes(int count)
+{
+    const __m256 lanes = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+    return { _mm256_cmp_ps(
+        lanes, _mm256_set1_ps(static_cast<float>(count)), _CMP_LT_OQ) };
+}
+#elif defined(SCENELAB_SIMD_INTRINSICS)
+struct SimdMask {
+    __m128 m;
+    bool any() const { return _mm_movemask_ps(m) != 0; }
+    int bits() const { return _mm_movemask_ps(m); }
+};
+struct SimdFloat {
+    __m128 v;
+    static SimdFloat broadcast(float s) { return { _mm_set1_ps(s) }; }
+    static SimdFloat load(const float *p) { return { _mm_loadu_ps(p) }; }
+};
+inline SimdFloat operator+(SimdFloat a, SimdFloat b)
+{
+    return { _mm_add_ps(a.v, b.v) };
+}
+inline SimdFloat operator-(SimdFloat a, SimdFloat b)
+{
+    return { _mm_sub_ps(a.v, b.v) };
+}
+inline SimdFloat operator*(SimdFloat a, SimdFloat b)
+{
+    return { _mm_mul_ps(a.v, b.v) };
+}
+inline SimdFloat operator/(SimdFloat a, SimdFloat b)
+{
+    return { _mm_div_ps(a.v, b.v) };
+}
+inline SimdFloat vmin(SimdFloat a, SimdFloat b)
+{
+    return { _mm_min_ps(b.v, a.v) };
+}
+inline SimdFloat vmax(SimdFloat a, SimdFloat b)
+{
+    return { _mm_max_ps(b.v, a.v) };
+}
+inline SimdFloat vsqrt(SimdFloat a) { return { _mm_sqrt_ps(a.v) }; }
+inline SimdMask operator<(SimdFloat a, SimdFloat b)
+{
+    return { _mm_cmplt_ps(a.v, b.v) };
+}
+inline SimdMask operator<=(SimdFloat a, SimdFloat b)
+{
+    return { _mm_cmple_ps(a.v, b.v) };
+}
+inline SimdMask operator>(SimdFloat a, SimdFloat b)
+{
+    return { _mm_cmpgt_ps(a.v, b.v) };
+}
+inline SimdMask operator>=(SimdFloat a, SimdFloat b)
+{
+    return { _mm_cmpge_ps(a.v, b.v) };
+}
+inline SimdMask operator&(SimdMask a, SimdMask b)
+{
+    return { _mm_and_ps(a.m, b.m) };
+}
+inline SimdMask operator|(SimdMask a, SimdMask b)
+{
+    return { _mm_or_ps(a.m, b.m) };
+}
+inline SimdMask andNot(SimdMask a, SimdMask b)
+{
+    return { _mm_andnot_ps(b.m, a.m) };
+}
+inline SimdFloat select(SimdMask m, SimdFloat a, SimdFloat b)
+{
+    return { _mm_or_ps(_mm_and_ps(m.m, a.v), _mm_andnot_ps(m.m, b.v)) };
+}
+inline SimdMask firstLanes(int count)
+{
+    const __m128 lanes = _mm_setr_ps(0, 1, 2, 3);
+    return { _mm_cmplt_ps(lanes, _mm_set1_ps(static_cast<float>(count))) };
+}
+#else
+// Plain loops, still four rays per traversal step
+struct SimdMask {
+    std::array<bool, 4> m;
+    bool any() const { return m[0] || m[1] || m[2] || m[3]; }
+    int bits() const { return m[0] | m[1] << 1 | m[2] << 2 | m[3] << 3; }
+};
+struct SimdFloat {
+    std::array<float, 4> v;
+    static SimdFloat broadcast(float s) { return { { s, s, s, s } }; }
+    static SimdFloat load(const float *p)
+    {
+        return { { p[0], p[1], p[2], p[3] } };
+    }
+};
+template <typename Op> SimdFloat lanewise(SimdFloat a, SimdFloat b, Op op)
+{
+    SimdFloat r;
+    for (int i = 0; i < 4; i++) {
+        r.v[i] = op(a.v[i], b.v[i]);
+    }
+    return r;
+}
+template <typename Op> SimdMask compare(SimdFloat a, SimdFloat b, Op op)
+{
+    SimdMask r;
+    for (int i = 0; i < 4; i++) {
+        r.m[i] = op(a.v[i], b.v[i]);
+    }
+    return r;
+}
+inline SimdFloat operator+(SimdFloat a, SimdFloat b)
+{
+    return lanewise(a, b, [](float x, float y) { return x + y; });
+}
+inline SimdFloat operator-(SimdFloat a, SimdFloat b)
+{
+    return lanewise(a, b, [](float x, float y) { return x - y; });
+}
+inline SimdFloat operator*(SimdFloat a, SimdFloat b)
+{
+    return lanewise(a, b, [](float x, float y) { return x * y; });
+}
+inline SimdFloat operator/(SimdFloat a, SimdFloat b)
+{
+    return lanewise(a, b, [](float x, float y) { return x / y; });
+}
+inline SimdFloat vmin(SimdFloat a, SimdFloat b)
+{
+    return lanewise(a, b, [](float x, float y) { return std::min(x, y); });
+}
+inline SimdFloat vmax(SimdFloat a, SimdFloat b)
+{
+    return lanewise(a, b, [](float x, float y) { return std::max(x, y); });
+}
+inline SimdFloat vsqrt(SimdFloat a)
+{
+    return lanewise(a, a, [](float x, float) { return std::sqrt(x); });
+}
+inline SimdMask operator<(SimdFloat a, SimdFloat b)
+{
+    return compare(a, b, [](float x, float y) { return x < y; });
+}
+inline SimdMask operator<=(SimdFloat a, SimdFloat b)
+{
+    return compare(a, b, [](float x, float y) { return x <= y; });
+}
+inline SimdMask operator>(SimdFloat a, SimdFloat b)
+{
+    return compare(a, b, [](float x, float y) { return x > y; });
+}
+inline SimdMask operator>=(SimdFloat a, SimdFloat b)
+{
+    return compare(a, b, [](float x, float y) { return x >= y; });
+}
+inline SimdMask operator&(SimdMask a, SimdMask b)
+{
+    return { { a.m[0] && b.m[0], a.m[1] && b.m[1], a.m[2] && b.m[2],
+        a.m[3] && b.m[3] } };
+}
+inline SimdMask operator|(SimdMask a, SimdMask b)
+{
+    return { { a.m[0] || b.m[0], a.m[1] || b.m[1], a.m[2] || b.m[2],
+        a.m[3] || b.m[3] } };
+}
+inline SimdMask andNot(SimdMask a, SimdMask b)
+{
+    return { { a.m[0] && !b.m[0], a.m[1] && !b.m[1], a.m[2] && !b.m[2],
+        a.m[3] && !b.m[3] } };
+}
+inline SimdFloat select(SimdMask m, SimdFloat a, SimdFloat b)
+{
+    SimdFloat r;
+    for (int i = 0; i < 4; i++) {
+        r.v[i] = m.m[i] ? a.v[i] : b.v[i];
+    }
+    return r;
+}
+inline SimdMask firstLanes(int count)
+{
+    return { { count > 0, count > 1, count > 2, count > 3 } };
+}
+#endif
+
+struct SimdVec3 {
+    SimdFloat x, y, z;
+
+    static SimdVec3 broadcast(const glm::vec3 &v)
+    {
+        return { SimdFloat::broadcast(v.x), SimdFloat::broadcast(v.y),
+            SimdFloat::broadcast(v.z) };
+    }
+};
+
+inline SimdVec3 operator-(const SimdVec3 &a, const SimdVec3 &b)
+{
+    return { a.x - b.x, a.y - b.y, a.z - b.z };
+}
+
+inline SimdVec3 operator*(SimdFloat s, const SimdVec3 &v)
+{
+    return { s * v.x, s * v.y, s * v.z };
+}
+
+// Same association as glm::dot and glm::cross
+inline SimdFloat dot(const SimdVec3 &a, const SimdVec3 &b)
+{
+    return (a.x * b.x + a.y * b.y) + a.z * b.z;
+}
+
+inline SimdVec3 cross(const SimdVec3 &a, const SimdVec3 &b)
+{
+    return { a.y * b.z - b.y * a.z, a.z * b.x - b.z * a.x,
+        a.x * b.y - b.x * a.y };
+}
+
+// The packet's rays in structure-of-arrays form
+struct PacketRays {
+    SimdVec3 origin;
+    SimdVec3 dir;
+    SimdVec3 invDir;
+    SimdMask active;
+};
+
+PacketRays loadPacket(const RayPacket &packet)
+{
+    // Padding lanes repeat the first ray so they stay finite
+    float lanes[9][RAY_PACKET_SIZE];
+    for (int i = 0; i < RAY_PACKET_SIZE; i++) {
+        int source = i < packet.count ? i : 0;
+        const glm::vec3 &o = packet.origins[source];
+        const glm::vec3 &d = packet.directions[source];
+        glm::vec3 inv = 1.0f / d;
+        const float values[9]
+            = { o.x, o.y, o.z, d.x, d.y, d.z, inv.x, inv.y, inv.z };
+        for (int c = 0; c < 9; c++) {
+            lanes[c][i] = values[c];
+        }
+    }
+    auto vec = [&](int c) {
+        return SimdVec3 { SimdFloat::load(lanes[c]),
+            SimdFloat::load(lanes[c + 1]), SimdFloat::load(lanes[c + 2]) };
+    };
+    return { vec(0), vec(3), vec(6), firstLanes(packet.count) };
+}
+
+SimdMask intersectAABB(const PacketRays &rays, const AABB &box,
+    SimdFloat tMin, SimdFloat tMax)
+{
+    SimdVec3 t0 = { (SimdFloat::broadcast(box.min.x) - rays.origin.x)
+            * rays.invDir.x,
+        (SimdFloat::broadcast(box.min.y) - rays.origin.y) * rays.invDir.y,
+        (SimdFloat::broadcast(box.min.z) - rays.origin.z) * rays.invDir.z };
+    SimdVec3 t1 = { (SimdFloat::broadcast(box.max.x) - rays.origin.x)
+            * rays.invDir.x,
+        (SimdFloat::broadcast(box.max.y) - rays.origin.y) * rays.invDir.y,
+        (SimdFloat::broadcast(box.max.z) - rays.origin.z) * rays.invDir.z };
+    SimdFloat enter = vmax(vmax(vmin(t0.x, t1.x), vmin(t0.y, t1.y)),
+        vmax(vmin(t0.z, t1.z), tMin));
+    SimdFloat exit = vmin(vmin(vmax(t0.x, t1.x), vmax(t0.y, t1.y)),
+        vmin(vmax(t0.z, t1.z), tMax));
+    return (enter <= exit) & (exit > SimdFloat::broadcast(0.0f));
+}
+
+SimdMask intersectTriangle(const PacketRays &rays, const Triangle &tri,
+    SimdFloat tMin, SimdFloat &tMax)
+{
+    glm::vec3 e0 = tri.v1 - tri.v0;
+    glm::vec3 e1 = tri.v0 - tri.v2;
+    glm::vec3 normal = glm::cross(e1, e0);
+    SimdVec3 n = SimdVec3::broadcast(normal);
+
+    SimdFloat valueDot = SimdFloat::broadcast(1.0f) / dot(n, rays.dir);
+    SimdVec3 e2 = valueDot * (SimdVec3::broadcast(tri.v0) - rays.origin);
+    SimdVec3 i = cross(rays.dir, e2);
+
+    SimdFloat y = dot(i, SimdVec3::broadcast(e1));
+    SimdFloat z = dot(i, SimdVec3::broadcast(e0));
+    SimdFloat x = SimdFloat::broadcast(1.0f) - (z + y);
+    SimdFloat hit = dot(n, e2);
+
+    const SimdFloat zero = SimdFloat::broadcast(0.0f);
+    SimdMask mask = rays.active & (hit > SimdFloat::broadcast(EPSILON))
+        & (x > zero) & (y > zero) & (z > zero) & (hit > tMin)
+        & (hit < tMax);
+    tMax = select(mask, hit, tMax);
+    return mask;
+}
+
+SimdMask intersectSphere(const PacketRays &rays,
+    const AnalyticalSphereData &sphere, SimdFloat tMin, SimdFloat &tMax)
+{
+    SimdVec3 oc = rays.origin - SimdVec3::broadcast(sphere.center);
+    SimdFloat a = dot(rays.dir, rays.dir);
+    SimdFloat b = SimdFloat::broadcast(2.0f) * dot(oc, rays.dir);
+    SimdFloat c = dot(oc, oc)
+        - SimdFloat::broadcast(sphere.radius * sphere.radius);
+    SimdFloat discriminant = b * b - SimdFloat::broadcast(4.0f) * a * c;
+    SimdMask valid = rays.active
+        & (discriminant >= SimdFloat::broadcast(0.0f));
+    if (!valid.any()) {
+        return valid;
+    }
+
+    const SimdFloat zero = SimdFloat::broadcast(0.0f);
+    SimdFloat sqrtDisc = vsqrt(vmax(discriminant, zero));
+    SimdFloat twoA = SimdFloat::broadcast(2.0f) * a;
+    SimdFloat t = ((zero - b) - sqrtDisc) / twoA;
+    SimdMask outside = (t < tMin) | (t >= tMax);
+    t = select(outside, ((zero - b) + sqrtDisc) / twoA, t);
+    outside = (t < tMin) | (t >= tMax);
+
+    SimdMask mask = andNot(valid, outside);
+    tMax = select(mask, t, tMax);
+    return mask;
+}
+
+float intersectAABB(const glm::vec3 &rayPos, const glm::vec3 &invRayDir,
+    const AABB &box, float tMin, float tMax)
+{
+    glm::vec3 t0 = (box.min - rayPos) * invRayDir;
+    glm::vec3 t1 = (box.max - rayPos) * invRayDir;
+    glm::vec3 tmin = glm::min(t0, t1);
+    glm::vec3 tmax = glm::max(t0, t1);
+    float enter = std::max(std::max(tmin.x, tmin.y), std::max(tmin.z, tMin));
+    float exit = std::min(std::min(tmax.x, tmax.y), std::min(tmax.z, tMax));
+    return (enter <= exit && exit > 0.0f) ? enter : -1.0f;
+}
+
+bool intersectTriangle(const glm::vec3 &rayPos, const glm::vec3 &rayDir,
+    const Triangle &tri, float tMin, float &tMax)
+{
+    glm::vec3 e0 = tri.v1 - tri.v0;
+    glm::vec3 e1 = tri.v0 - tri.v2;
+    glm::vec3 unnormalizedNormal = glm::cross(e1, e0);
+    float valueDot = 1.0f / glm::dot(unnormalizedNormal, rayDir);
+
+    glm::vec3 e2 = valueDot * (tri.v0 - rayPos);
+    glm::vec3 i = glm::cross(rayDir, e2);
+
+    float y = glm::dot(i, e1);
+    float z = glm::dot(i, e0);
+    float x = 1.0f - (z + y);
+    float hit = glm::dot(unnormalizedNormal, e2);
+
+    if (hit > EPSILON && x > 0.0f && y > 0.0f && z > 0.0f && hit > tMin
+        && hit < tMax) {
+        tMax = hit;
+        return true;
+    }
+    return false;
+}
+
+bool intersectSphere(const glm::vec3 &rayPos, const glm::vec3 &rayDir,
+    const AnalyticalSphereData &sphere, float tMin, float &tMax)
+{
+    glm::vec3 oc = rayPos - sphere.center;
+    float a = glm::dot(rayDir, rayDir);
+    float b = 2.0f * glm::dot(oc, rayDir);
+    float c = glm::dot(oc, oc) - sphere.radius * sphere.radius;
+    float discriminant = b * b - 4.0f * a * c;
+    if (discriminant < 0.0f) {
+        return false;
+    }
+
+    float sqrtDisc = std::sqrt(discriminant);
+    float t = (-b - sqrtDisc) / (2.0f * a);
+    if (t < tMin || t >= tMax) {
+        t = (-b + sqrtDisc) / (2.0f * a);
+        if (t < tMin || t >= tMax) {
+            return false;
+        }
+    }
+    tMax = t;
+    return true;
+}
+
+} // namespace
+
+BVHHit BVHTraversal::traceRay(const BVH &bvh,
+    const std::vector<Triangle> &triangles,
+    const std::vector<AnalyticalSphereData> &spheres,
+    const glm::vec3 &origin, const glm::vec3 &direction, float tMin,
+    float tMax)
+{
+    const auto &nodes = bvh.getNodes();
+    const auto &primitives = bvh.getPrimitives();
+    glm::vec3 invDir = 1.0f / direction;
+    BVHHit hit { tMax, -1 };
+
+    // Nearest child first, as the shader pops it first
+    NodeStack stack;
+    if (!nodes.empty()) {
+        stack.push(0);
+    }
+    while (!stack.empty()) {
+        const BVHNode &node = nodes[stack.pop()];
+        if (intersectAABB(origin, invDir, node.bounds, tMin, hit.dist)
+            < 0.0f) {
+            continue;
+        }
+        if (node.isLeaf()) {
+            for (int i = 0; i < node.primitiveCount; i++) {
+                int index = node.primitiveStart + i;
+                const BVHPrimitive &prim = primitives[index];
+                bool found = prim.type == BVHPrimitiveType::Triangle
+                    ? intersectTriangle(origin, direction,
+                          triangles[prim.originalIndex], tMin, hit.dist)
+                    : intersectSphere(origin, direction,
+                          spheres[prim.originalIndex], tMin, hit.dist);
+                if (found) {
+                    hit.primitive = index;
+                }
+            }
+            continue;
+        }
+
+        float leftEntry = intersectAABB(origin, invDir,
+            nodes[node.leftChild].bounds, tMin, hit.dist);
+        float rightEntry = intersectAABB(origin, invDir,
+            nodes[node.rightChild].bounds, tMin, hit.dist);
+        bool rightFirst = rightEntry >= 0.0f
+            && (leftEntry < 0.0f || rightEntry < leftEntry);
+        if (rightFirst) {
+            std::swap(leftEntry, rightEntry);
+        }
+        int nearChild = rightFirst ? node.rightChild : node.leftChild;
+        int farChild = rightFirst ? node.leftChild : node.rightChild;
+        if (rightEntry >= 0.0f) {
+            stack.push(farChild);
+        }
+        if (leftEntry >= 0.0f) {
+            stack.push(nearChild);
+        }
+    }
+    return hit;
+}
+
+void BVHTraversal::tracePacket(const BVH &bvh,
+    const std::vector<Triangle> &triangles,
+    const std::vector<AnalyticalSphereData> &spheres,
+    const RayPacket &packet, float tMin, float tMax,
+    std::array<BVHHit, RAY_PACKET_SIZE> &hits)
+{
+    hits.fill(BVHHit { tMax, -1 });
+    const auto &nodes = bvh.getNodes();
+    const auto &primitives = bvh.getPrimitives();
+    if (nodes.empty() || packet.count <= 0) {
+        return;
+    }
+
+    PacketRays rays = loadPacket(packet);
+    SimdFloat minDist = SimdFloat::broadcast(tMin);
+    SimdFloat maxDist = SimdFloat::broadcast(tMax);
+    const glm::vec3 &leadDir = packet.directions[0];
+
+    // A node is entered while any ray still hits it. Children are pushed
+    // in the order the first ray would meet them, which suits the whole
+    // packet as long as it is coherent.
+    NodeStack stack;
+    stack.push(0);
+    while (!stack.empty()) {
+        const BVHNode &node = nodes[stack.pop()];
+        SimdMask mask
+            = rays.active & intersectAABB(rays, node.bounds, minDist, maxDist);
+        if (!mask.any()) {
+            continue;
+        }
+        if (node.isLeaf()) {
+            PacketRays leafRays = rays;
+            leafRays.active = mask;
+            for (int i = 0; i < node.primitiveCount; i++) {
+                int index = node.primitiveStart + i;
+                const BVHPrimitive &prim = primitives[index];
+                SimdMask found = prim.type == BVHPrimitiveType::Triangle
+                    ? intersectTriangle(leafRays,
+                          triangles[prim.originalIndex], minDist, maxDist)
+                    : intersectSphere(leafRays, spheres[prim.originalIndex],
+                          minDist, maxDist);
+                for (int bits = found.bits(); bits != 0; bits &= bits - 1) {
+                    hits[std::countr_zero(static_cast<unsigned int>(bits))]
+                        .primitive
+                        = index;
+                }
+            }
+            continue;
+        }
+
+        glm::vec3 split = nodes[node.rightChild].bounds.centroid()
+            - nodes[node.leftChild].bounds.centroid();
+        glm::vec3 extent = glm::abs(split);
+        int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2)
+                                       : (extent.y > extent.z ? 1 : 2);
+        bool leftFirst = (split[axis] >= 0.0f) == (leadDir[axis] >= 0.0f);
+        stack.push(leftFirst ? node.rightChild : node.leftChild);
+        stack.push(leftFirst ? node.leftChild : node.rightChild);
+    }
+
+    float dists[RAY_PACKET_SIZE];
+#if SCENELAB_SIMD_WIDTH == 16
+    _mm512_storeu_ps(dists, maxDist.v);
+#elif SCENELAB_SIMD_WIDTH == 8
+    _mm256_storeu_ps(dists, maxDist.v);
+#elif defined(SCENELAB_SIMD_INTRINSICS)
+    _mm_storeu_ps(dists, maxDist.v);
+#else
+    std::copy(maxDist.v.begin(), maxDist.v.end(), dists);
+#endif
+    for (int i = 0; i < packet.count; i++) {
+        hits[i].dist = dists[i];
+    }
+}
+
+bool BVHTraversal::isCoherent(const RayPacket &packet)
+{
+    if (packet.count <= 0) {
+        return false;
+    }
+    const glm::vec3 &lead = packet.directions[0];
+    float leadLength = glm::length(lead);
+    for (int i = 1; i < packet.count; i++) {
+        const glm::vec3 &dir = packet.directions[i];
+        bool sameOctant = (dir.x < 0.0f) == (lead.x < 0.0f)
+            && (dir.y < 0.0f) == (lead.y < 0.0f)
+            && (dir.z < 0.0f) == (lead.z < 0.0f);
+        if (!sameOctant
+            || glm::dot(dir, lead)
+                < COHERENT_MIN_COSINE * leadLength * glm::length(dir)) {
+            return false;
+        }
+    }
+    return true;
+}
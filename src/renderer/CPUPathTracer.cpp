@@ -0,0 +1,506 @@
+#include "renderer/CPUPathTracer.hpp"
+#include "renderer/ParallelTasks.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <thread>
+
+// Everything below mirrors pathtracing.frag, constants and operation order
+// included, so both converge to the same image
+namespace {
+
+constexpr float EPSILON = 0.0001f;
+constexpr float RAY_POS_NORMAL_NUDGE = 0.01f;
+constexpr int NUM_BOUNCES = 10;
+constexpr float SUPER_FAR = 10000.0f;
+constexpr float MINIMUM_RAY_HIT_TIME = 0.1f;
+constexpr float PI = 3.14159265359f;
+// Shadow rays stop this much short of the light they aim at
+constexpr float SHADOW_RAY_SCALE = 0.999f;
+
+struct MaterialInfo {
+    glm::vec3 albedo { 0.0f };
+    glm::vec3 emissive { 0.0f };
+    float percentSpecular = 0.0f;
+    float roughness = 0.0f;
+    glm::vec3 specularColor { 0.0f };
+    float indexOfRefraction = 1.0f;
+    float refractionChance = 0.0f;
+};
+
+// Material rows, spheres and planes share their material fields
+template <typename T> MaterialInfo materialOf(const T &primitive)
+{
+    MaterialInfo m;
+    m.albedo = primitive.color;
+    m.emissive = primitive.emissive;
+    m.percentSpecular = primitive.percentSpecular;
+    m.roughness = primitive.roughness;
+    m.specularColor = primitive.specularColor;
+    m.indexOfRefraction = primitive.indexOfRefraction;
+    m.refractionChance = primitive.refractionChance;
+    return m;
+}
+
+uint32_t wangHash(uint32_t &seed)
+{
+    seed = (seed ^ 61u) ^ (seed >> 16u);
+    seed *= 9u;
+    seed = seed ^ (seed >> 4u);
+    seed *= 0x27d4eb2du;
+    seed = seed ^ (seed >> 15u);
+    return seed;
+}
+
+float randomFloat01(uint32_t &state)
+{
+    return static_cast<float>(wangHash(state)) / 4294967296.0f;
+}
+
+glm::vec3 randomUnitVector(uint32_t &state)
+{
+    glm::vec3 p;
+    float lenSq = 0.0f;
+    for (int i = 0; i < 5; ++i) {
+        float x = randomFloat01(state) * 2.0f - 1.0f;
+        float y = randomFloat01(state) * 2.0f - 1.0f;
+        float z = randomFloat01(state) * 2.0f - 1.0f;
+        p = glm::vec3(x, y, z);
+        lenSq = glm::dot(p, p);
+        if (lenSq <= 1.0f && lenSq > 0.0001f) {
+            break;
+        }
+    }
+    return p / std::sqrt(lenSq);
+}
+
+bool testPlane(const glm::vec3 &rayPos, const glm::vec3 &rayDir, float &dist,
+    const AnalyticalPlaneData &plane)
+{
+    float denom = glm::dot(plane.normal, rayDir);
+    if (std::abs(denom) < EPSILON) {
+        return false;
+    }
+    float t = glm::dot(plane.point - rayPos, plane.normal) / denom;
+    if (t < MINIMUM_RAY_HIT_TIME || t >= dist) {
+        return false;
+    }
+    dist = t;
+    return true;
+}
+
+float fresnelSchlick(float cosTheta, float ior1, float ior2)
+{
+    float r0 = (ior1 - ior2) / (ior1 + ior2);
+    r0 = r0 * r0;
+    return r0 + (1.0f - r0) * std::pow(1.0f - cosTheta, 5.0f);
+}
+
+// MIS weight of a strategy with pdf a against one with pdf b
+float powerHeuristic(float a, float b)
+{
+    return a * a / (a * a + b * b);
+}
+
+} // namespace
+
+PathTracingCamera PathTracingCamera::fromAngles(
+    const glm::vec3 &position, const glm::vec3 &rotation, float fov)
+{
+    glm::vec3 rot = glm::radians(rotation);
+    float cp = std::cos(rot.x), sp = std::sin(rot.x); // pitch
+    float cy = std::cos(rot.y), sy = std::sin(rot.y); // yaw
+    float cr = std::cos(rot.z), sr = std::sin(rot.z); // roll
+    glm::mat3 rotX(1, 0, 0, 0, cp, -sp, 0, sp, cp);
+    glm::mat3 rotY(cy, 0, sy, 0, 1, 0, -sy, 0, cy);
+    glm::mat3 rotZ(cr, -sr, 0, sr, cr, 0, 0, 0, 1);
+
+    PathTracingCamera camera;
+    camera.position = position;
+    camera.rotation = rotZ * rotY * rotX;
+    camera.focalLength = 1.0f / std::tan(glm::radians(fov) * 0.5f);
+    return camera;
+}
+
+glm::vec3 PathTracingCamera::rayDirection(
+    const glm::vec2 &point, float aspectRatio) const
+{
+    return rotation
+        * glm::normalize(
+            glm::vec3(point.x * aspectRatio, point.y, -focalLength));
+}
+
+bool PathTracingCamera::project(
+    const glm::vec3 &position, float aspectRatio, glm::vec2 &point) const
+{
+    glm::vec3 local = glm::transpose(rotation) * (position - this->position);
+    if (local.z >= 0.0f) {
+        return false;
+    }
+    float scale = focalLength / -local.z;
+    point = glm::vec2(local.x * scale / aspectRatio, local.y * scale);
+    return true;
+}
+
+void CPUPathTracer::setScene(std::vector<Triangle> triangles,
+    std::vector<MaterialData> materials,
+    std::vector<AnalyticalSphereData> spheres,
+    std::vector<AnalyticalPlaneData> planes)
+{
+    m_triangles = std::move(triangles);
+    m_materials = std::move(materials);
+    m_spheres = std::move(spheres);
+    m_planes = std::move(planes);
+    m_bvh.build(m_triangles, m_spheres);
+
+    m_lights.clear();
+    for (const auto &tri : m_triangles) {
+        if (tri.materialIndex < m_materials.size()) {
+            m_lights.addTriangle(tri.v0, tri.v1, tri.v2,
+                m_materials[tri.materialIndex].emissive);
+        }
+    }
+    for (const auto &sphere : m_spheres) {
+        m_lights.addSphere(sphere.center, sphere.radius, sphere.emissive);
+    }
+    m_lights.finalize();
+    resetAccumulation();
+}
+
+void CPUPathTracer::setCamera(const PathTracingCamera &camera)
+{
+    m_camera = camera;
+    resetAccumulation();
+}
+
+void CPUPathTracer::resize(int width, int height)
+{
+    m_width = std::max(0, width);
+    m_height = std::max(0, height);
+    m_image.assign(static_cast<size_t>(m_width) * m_height, glm::vec3(0.0f));
+    m_aovs.assign(m_image.size(), SurfaceAOV());
+    m_moments.assign(m_image.size(), glm::vec3(0.0f));
+    resetAccumulation();
+}
+
+void CPUPathTracer::resetAccumulation()
+{
+    m_frame = 0;
+}
+
+bool CPUPathTracer::restoreAccumulation(std::vector<glm::vec3> image,
+    std::vector<SurfaceAOV> aovs, std::vector<glm::vec3> moments,
+    int frameCount)
+{
+    if (image.size() != m_image.size() || aovs.size() != m_image.size()
+        || moments.size() != m_image.size() || frameCount < 0) {
+        return false;
+    }
+    m_image = std::move(image);
+    m_aovs = std::move(aovs);
+    m_moments = std::move(moments);
+    m_frame = frameCount;
+    return true;
+}
+
+void CPUPathTracer::traceScene(const glm::vec3 &origin,
+    const glm::vec3 &direction, const BVHHit *primaryHit, HitInfo &hit) const
+{
+    BVHHit found = primaryHit
+        ? *primaryHit
+        : BVHTraversal::traceRay(m_bvh, m_triangles, m_spheres, origin,
+              direction, MINIMUM_RAY_HIT_TIME, hit.dist);
+    hit.dist = found.dist;
+    if (found.primitive >= 0) {
+        const BVHPrimitive &prim = m_bvh.getPrimitives()[found.primitive];
+        if (prim.type == BVHPrimitiveType::Triangle) {
+            hit.triangle = &m_triangles[prim.originalIndex];
+            hit.normal = hit.triangle->normal;
+        } else {
+            hit.sphere = &m_spheres[prim.originalIndex];
+            glm::vec3 point = origin + hit.dist * direction;
+            hit.normal = glm::normalize(point - hit.sphere->center);
+        }
+    }
+
+    for (const auto &plane : m_planes) {
+        if (testPlane(origin, direction, hit.dist, plane)) {
+            float denom = glm::dot(plane.normal, direction);
+            hit = { hit.dist, denom > 0.0f ? -plane.normal : plane.normal,
+                nullptr, nullptr, &plane };
+        }
+    }
+}
+
+glm::vec3 CPUPathTracer::traceRay(const glm::vec3 &origin,
+    const glm::vec3 &direction, uint32_t &rngState) const
+{
+    return tracePath(origin, direction, nullptr, rngState);
+}
+
+glm::vec3 CPUPathTracer::sampleLight(const glm::vec3 &position,
+    const glm::vec3 &normal, uint32_t &rngState) const
+{
+    float u0 = randomFloat01(rngState);
+    float u1 = randomFloat01(rngState);
+    float u2 = randomFloat01(rngState);
+    LightSample light = m_lights.sample(position, u0, u1, u2);
+    float cosSurface = glm::dot(normal, light.direction);
+    if (light.pdf <= 0.0f || cosSurface <= 0.0f) {
+        return glm::vec3(0.0f);
+    }
+
+    HitInfo shadow;
+    shadow.dist = light.distance * SHADOW_RAY_SCALE;
+    traceScene(position, light.direction, nullptr, shadow);
+    if (shadow.dist < light.distance * SHADOW_RAY_SCALE) {
+        return glm::vec3(0.0f);
+    }
+
+    // Lambert: albedo / pi * cos, with the cosine-weighted pdf cos / pi
+    float bsdfPdf = cosSurface / PI;
+    return light.emissive
+        * (bsdfPdf * powerHeuristic(light.pdf, bsdfPdf) / light.pdf);
+}
+
+glm::vec3 CPUPathTracer::tracePath(const glm::vec3 &origin,
+    const glm::vec3 &direction, const BVHHit *primaryHit, uint32_t &rngState,
+    SurfaceAOV *aov) const
+{
+    glm::vec3 ret(0.0f);
+    glm::vec3 throughput(1.0f);
+    glm::vec3 rayPos = origin;
+    glm::vec3 rayDir = direction;
+    float currentIOR = 1.0f;
+    const bool sampleLights = m_lightSampling && !m_lights.empty();
+    // Pdf of the diffuse bounce that chose rayDir, 0 after any other bounce
+    float bsdfPdf = 0.0f;
+
+    for (int bounceIndex = 0; bounceIndex <= NUM_BOUNCES; ++bounceIndex) {
+        HitInfo hit;
+        hit.dist = SUPER_FAR;
+        traceScene(
+            rayPos, rayDir, bounceIndex == 0 ? primaryHit : nullptr, hit);
+        if (hit.dist == SUPER_FAR) {
+            break;
+        }
+
+        MaterialInfo material;
+        if (hit.triangle) {
+            // A missing material row reads as black
+            const uint32_t row = hit.triangle->materialIndex;
+            if (row < m_materials.size()) {
+                material = materialOf(m_materials[row]);
+            }
+        } else if (hit.sphere) {
+            material = materialOf(*hit.sphere);
+        } else if (hit.plane) {
+            material = materialOf(*hit.plane);
+        }
+        if (bounceIndex == 0 && aov) {
+            aov->albedo = material.albedo;
+            aov->normal = hit.normal;
+            aov->depth = hit.dist;
+        }
+
+        // Lights a diffuse bounce could also have sampled share the
+        // contribution with that sample
+        float emissionWeight = 1.0f;
+        if (bsdfPdf > 0.0f && (hit.triangle || hit.sphere)) {
+            float lightPdf = hit.triangle
+                ? m_lights.trianglePdf(material.emissive, hit.dist,
+                      std::abs(glm::dot(hit.normal, rayDir)))
+                : m_lights.spherePdf(material.emissive, hit.sphere->center,
+                      hit.sphere->radius, rayPos);
+            if (lightPdf > 0.0f) {
+                emissionWeight = powerHeuristic(bsdfPdf, lightPdf);
+            }
+        }
+        ret += material.emissive * throughput * emissionWeight;
+        bsdfPdf = 0.0f;
+
+        bool isRefractive = material.refractionChance > 0.0f
+            && material.indexOfRefraction > 1.0f;
+
+        if (isRefractive) {
+            bool entering = glm::dot(rayDir, hit.normal) < 0.0f;
+            glm::vec3 normal = entering ? hit.normal : -hit.normal;
+
+            float n1 = entering ? currentIOR : material.indexOfRefraction;
+            float n2 = entering ? material.indexOfRefraction : 1.0f;
+            float eta = n1 / n2;
+
+            float cosTheta = std::abs(glm::dot(-rayDir, normal));
+            float sinTheta2 = eta * eta * (1.0f - cosTheta * cosTheta);
+            float reflectance = fresnelSchlick(cosTheta, n1, n2);
+            bool totalInternalReflection = sinTheta2 > 1.0f;
+
+            float rand = randomFloat01(rngState);
+            float refractionProb
+                = material.refractionChance * (1.0f - reflectance);
+
+            if (totalInternalReflection || rand > refractionProb) {
+                bool isSpecular
+                    = randomFloat01(rngState) < material.percentSpecular;
+
+                glm::vec3 diffuseRayDir
+                    = glm::normalize(normal + randomUnitVector(rngState));
+                glm::vec3 specularRayDir = glm::reflect(rayDir, normal);
+                specularRayDir = glm::normalize(glm::mix(specularRayDir,
+                    diffuseRayDir, material.roughness * material.roughness));
+
+                rayPos = (rayPos + rayDir * hit.dist)
+                    + normal * RAY_POS_NORMAL_NUDGE;
+                rayDir = isSpecular ? specularRayDir : diffuseRayDir;
+                throughput
+                    *= isSpecular ? material.specularColor : material.albedo;
+            } else {
+                float cosRefracted
+                    = std::sqrt(std::max(0.0f, 1.0f - sinTheta2));
+                glm::vec3 refractDir
+                    = eta * rayDir + (eta * cosTheta - cosRefracted) * normal;
+                refractDir = glm::normalize(refractDir);
+
+                rayPos = (rayPos + rayDir * hit.dist)
+                    - normal * RAY_POS_NORMAL_NUDGE;
+                rayDir = refractDir;
+                currentIOR = entering ? material.indexOfRefraction : 1.0f;
+                throughput *= material.albedo;
+            }
+        } else {
+            rayPos = (rayPos + rayDir * hit.dist)
+                + hit.normal * RAY_POS_NORMAL_NUDGE;
+
+            bool isSpecular
+                = randomFloat01(rngState) < material.percentSpecular;
+
+            glm::vec3 diffuseRayDir
+                = glm::normalize(hit.normal + randomUnitVector(rngState));
+            glm::vec3 specularRayDir = glm::reflect(rayDir, hit.normal);
+            specularRayDir = glm::normalize(glm::mix(specularRayDir,
+                diffuseRayDir, material.roughness * material.roughness));
+            rayDir = isSpecular ? specularRayDir : diffuseRayDir;
+
+            if (sampleLights && !isSpecular) {
+                ret += throughput * material.albedo
+                    * sampleLight(rayPos, hit.normal, rngState);
+                bsdfPdf = std::max(0.0f, glm::dot(hit.normal, rayDir)) / PI;
+            }
+            throughput
+                *= isSpecular ? material.specularColor : material.albedo;
+        }
+
+        // Russian roulette
+        float maxThroughput
+            = std::max(throughput.r, std::max(throughput.g, throughput.b));
+        if (maxThroughput < 0.01f) {
+            break;
+        }
+    }
+    return ret;
+}
+
+void CPUPathTracer::renderTile(int tile)
+{
+    const int tilesX = (m_width + TILE_SIZE - 1) / TILE_SIZE;
+    const int x0 = (tile % tilesX) * TILE_SIZE;
+    const int y0 = (tile / tilesX) * TILE_SIZE;
+    const int x1 = std::min(x0 + TILE_SIZE, m_width);
+    const int y1 = std::min(y0 + TILE_SIZE, m_height);
+
+    const glm::vec2 size(static_cast<float>(m_width),
+        static_cast<float>(m_height));
+    const glm::vec2 pixelSize = 2.0f / size;
+    const float aspectRatio = size.x / size.y;
+    const float weight = 1.0f / static_cast<float>(m_frame + 1);
+
+    // Primary rays of a block of pixels start as one packet, every path
+    // then goes on alone
+    constexpr int blockWidth = RAY_PACKET_SIZE >= 8 ? 4 : 2;
+    constexpr int blockHeight = RAY_PACKET_SIZE / blockWidth;
+    for (int by = y0; by < y1; by += blockHeight) {
+        for (int bx = x0; bx < x1; bx += blockWidth) {
+            RayPacket packet;
+            std::array<int, RAY_PACKET_SIZE> pixels;
+            std::array<uint32_t, RAY_PACKET_SIZE> rngStates;
+            for (int y = by; y < std::min(by + blockHeight, y1); y++) {
+                for (int x = bx; x < std::min(bx + blockWidth, x1); x++) {
+                    // Fragment position of the pixel center on the
+                    // full-screen quad
+                    glm::vec2 fragPos
+                        = (glm::vec2(x, y) + 0.5f) / size * 2.0f - 1.0f;
+                    glm::vec2 pixelCoord = (fragPos + 1.0f) * 1000.0f;
+                    uint32_t rngState
+                        = static_cast<uint32_t>(pixelCoord.x) * 1973u
+                        + static_cast<uint32_t>(pixelCoord.y) * 9277u
+                        + static_cast<uint32_t>(m_frame) * 26699u;
+                    rngState |= 1u;
+
+                    float jitterX = randomFloat01(rngState);
+                    float jitterY = randomFloat01(rngState);
+                    glm::vec2 jitter = glm::vec2(jitterX, jitterY) - 0.5f;
+                    glm::vec2 jitteredPos = fragPos + jitter * pixelSize;
+
+                    int lane = packet.count++;
+                    packet.origins[lane] = m_camera.position;
+                    packet.directions[lane]
+                        = m_camera.rayDirection(jitteredPos, aspectRatio);
+                    pixels[lane] = y * m_width + x;
+                    rngStates[lane] = rngState;
+                }
+            }
+
+            std::array<BVHHit, RAY_PACKET_SIZE> hits;
+            bool usePacket
+                = m_packetTracing && BVHTraversal::isCoherent(packet);
+            if (usePacket) {
+                BVHTraversal::tracePacket(m_bvh, m_triangles, m_spheres,
+                    packet, MINIMUM_RAY_HIT_TIME, SUPER_FAR, hits);
+            }
+            for (int lane = 0; lane < packet.count; lane++) {
+                SurfaceAOV aov;
+                glm::vec3 color = tracePath(packet.origins[lane],
+                    packet.directions[lane], usePacket ? &hits[lane] : nullptr,
+                    rngStates[lane], &aov);
+                glm::vec3 &pixel = m_image[pixels[lane]];
+                pixel = m_frame == 0 ? color : glm::mix(pixel, color, weight);
+
+                SurfaceAOV &average = m_aovs[pixels[lane]];
+                average.albedo = glm::mix(average.albedo, aov.albedo, weight);
+                average.normal = glm::mix(average.normal, aov.normal, weight);
+                average.depth
+                    = average.depth + (aov.depth - average.depth) * weight;
+
+                glm::vec3 &moments = m_moments[pixels[lane]];
+                float luminance = LightTable::luminance(color);
+                moments.x += (luminance - moments.x) * weight;
+                moments.y += (luminance * luminance - moments.y) * weight;
+                moments.z = static_cast<float>(m_frame + 1);
+            }
+        }
+    }
+}
+
+void CPUPathTracer::renderFrame()
+{
+    if (m_width == 0 || m_height == 0) {
+        return;
+    }
+
+    const int tiles = ((m_width + TILE_SIZE - 1) / TILE_SIZE)
+        * ((m_height + TILE_SIZE - 1) / TILE_SIZE);
+    unsigned int threads = m_threadCount > 0
+        ? static_cast<unsigned int>(m_threadCount)
+        : std::max(1u, std::thread::hardware_concurrency());
+    threads = std::min(threads, static_cast<unsigned int>(tiles));
+
+    // Workers pull tiles until none are left, the calling thread included
+    std::atomic<int> nextTile { 0 };
+    auto worker = [&]() {
+        for (int tile = nextTile++; tile < tiles; tile = nextTile++) {
+            renderTile(tile);
+        }
+    };
+    runTasks(threads, [&](unsigned int) { worker(); });
+    m_frame++;
+}
@@ -0,0 +1,260 @@
+#include "renderer/Denoiser.hpp"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <utility>
+
+namespace {
+
+// B3-spline taps of the a-trous kernel, in each direction
+constexpr float KERNEL[5] = { 1.0f / 16.0f, 1.0f / 4.0f, 3.0f / 8.0f,
+    1.0f / 4.0f, 1.0f / 16.0f };
+
+// Depth tolerance left when the gradient predicts no change, relative to
+// the depth
+constexpr float DEPTH_EPSILON = 0.005f;
+
+float luminance(const glm::vec3 &color)
+{
+    return glm::dot(color, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+}
+
+// Per-channel factor the albedo divides out, 1 where it is black
+glm::vec3 demodulation(const glm::vec3 &albedo)
+{
+    return glm::vec3(albedo.r > 0.001f ? albedo.r : 1.0f,
+        albedo.g > 0.001f ? albedo.g : 1.0f,
+        albedo.b > 0.001f ? albedo.b : 1.0f);
+}
+
+class Filter {
+public:
+    Filter(const std::vector<SurfaceAOV> &aovs, int width, int height,
+        const ATrousDenoiser::Settings &settings)
+        : m_aovs(aovs)
+        , m_width(width)
+        , m_height(height)
+        , m_settings(settings)
+        , m_gradients(aovs.size())
+    {
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                m_gradients[index(x, y)] = glm::vec2(
+                    depthSlope(x, y, 1, 0), depthSlope(x, y, 0, 1));
+            }
+        }
+    }
+
+    size_t index(int x, int y) const
+    {
+        return static_cast<size_t>(y) * static_cast<size_t>(m_width)
+            + static_cast<size_t>(x);
+    }
+
+    bool inside(int x, int y) const
+    {
+        return x >= 0 && x < m_width && y >= 0 && y < m_height;
+    }
+
+    // Normal and depth weight of tap q, offset pixels away from p
+    float geometryWeight(size_t p, size_t q, const glm::vec2 &offset) const
+    {
+        const SurfaceAOV &a = m_aovs[p];
+        const SurfaceAOV &b = m_aovs[q];
+        // Misses only blend with misses
+        bool missA = a.depth <= 0.0f;
+        bool missB = b.depth <= 0.0f;
+        if (missA || missB) {
+            return missA == missB ? 1.0f : 0.0f;
+        }
+
+        float cosNormals = std::max(0.0f, glm::dot(a.normal, b.normal));
+        float weight = std::pow(cosNormals, m_settings.normalPhi);
+
+        float tolerance = m_settings.depthPhi
+                * std::abs(glm::dot(m_gradients[p], offset))
+            + DEPTH_EPSILON * a.depth;
+        return weight * std::exp(-std::abs(a.depth - b.depth) / tolerance);
+    }
+
+    // Variance of each pixel's mean illumination luminance. The color
+    // moments are scaled by the albedo divided out, pixels without enough
+    // samples use the spread of their neighborhood on their own surface.
+    std::vector<float> estimateVariance(
+        const std::vector<glm::vec3> &illumination,
+        const std::vector<glm::vec3> &moments) const
+    {
+        std::vector<float> variance(illumination.size());
+        for (int y = 0; y < m_height; y++) {
+            for (int x = 0; x < m_width; x++) {
+                const size_t p = index(x, y);
+                if (!moments.empty()
+                    && moments[p].z >= ATrousDenoiser::MIN_MOMENT_SAMPLES) {
+                    const glm::vec3 &m = moments[p];
+                    float scale = luminance(demodulation(m_aovs[p].albedo));
+                    variance[p] = std::max(0.0f, m.y - m.x * m.x) / m.z
+                        / (scale * scale);
+                    continue;
+                }
+                float weightSum = 0.0f;
+                float m1 = 0.0f;
+                float m2 = 0.0f;
+                for (int dy = -2; dy <= 2; dy++) {
+                    for (int dx = -2; dx <= 2; dx++) {
+                        if (!inside(x + dx, y + dy)) {
+                            continue;
+                        }
+                        const size_t q = index(x + dx, y + dy);
+                        float weight = geometryWeight(p, q,
+                            glm::vec2(static_cast<float>(dx),
+                                static_cast<float>(dy)));
+                        float l = luminance(illumination[q]);
+                        weightSum += weight;
+                        m1 += weight * l;
+                        m2 += weight * l * l;
+                    }
+                }
+                m1 /= weightSum;
+                m2 /= weightSum;
+                variance[p] = std::max(0.0f, m2 - m1 * m1);
+            }
+        }
+        return variance;
+    }
+
+    // 3x3 Gaussian blur of the variance, the weights then do not hinge on
+    // single noisy estimates
+    std::vector<float> blurVariance(const std::vector<float> &variance) const
+    {
+        static constexpr float GAUSSIAN[2] = { 0.25f, 0.125f };
+        std::vector<float> blurred(variance.size());
+        for (int y = 0; y < m_height; y++) {
+            for (int x = 0; x < m_width; x++) {
+                float sum = 0.0f;
+                float weightSum = 0.0f;
+                for (int dy = -1; dy <= 1; dy++) {
+                    for (int dx = -1; dx <= 1; dx++) {
+                        if (!inside(x + dx, y + dy)) {
+                            continue;
+                        }
+                        float weight
+                            = GAUSSIAN[std::abs(dx)] * GAUSSIAN[std::abs(dy)];
+                        sum += variance[index(x + dx, y + dy)] * weight;
+                        weightSum += weight;
+                    }
+                }
+                blurred[index(x, y)] = sum / weightSum;
+            }
+        }
+        return blurred;
+    }
+
+    // One a-trous pass with taps step pixels apart
+    void pass(int step, const std::vector<glm::vec3> &illumination,
+        const std::vector<float> &variance, std::vector<glm::vec3> &outColor,
+        std::vector<float> &outVariance) const
+    {
+        const float center = KERNEL[2] * KERNEL[2];
+        const std::vector<float> blurred = blurVariance(variance);
+        for (int y = 0; y < m_height; y++) {
+            for (int x = 0; x < m_width; x++) {
+                const size_t p = index(x, y);
+                const float luminanceP = luminance(illumination[p]);
+                const float luminanceTolerance
+                    = m_settings.colorPhi * std::sqrt(blurred[p]) + 1e-4f;
+
+                glm::vec3 sum = illumination[p] * center;
+                float weightSum = center;
+                float varianceSum = variance[p] * center * center;
+                for (int dy = -2; dy <= 2; dy++) {
+                    for (int dx = -2; dx <= 2; dx++) {
+                        const int qx = x + dx * step;
+                        const int qy = y + dy * step;
+                        if ((dx == 0 && dy == 0) || !inside(qx, qy)) {
+                            continue;
+                        }
+                        const size_t q = index(qx, qy);
+                        const glm::vec2 offset(static_cast<float>(dx * step),
+                            static_cast<float>(dy * step));
+                        float weight = KERNEL[dx + 2] * KERNEL[dy + 2]
+                            * geometryWeight(p, q, offset)
+                            * std::exp(-std::abs(luminanceP
+                                           - luminance(illumination[q]))
+                                / luminanceTolerance);
+                        sum += illumination[q] * weight;
+                        weightSum += weight;
+                        varianceSum += variance[q] * weight * weight;
+                    }
+                }
+                outColor[p] = sum / weightSum;
+                outVariance[p] = varianceSum / (weightSum * weightSum);
+            }
+        }
+    }
+
+private:
+    // Depth change per pixel along (dx, dy). The smaller one-sided
+    // difference is kept so silhouettes do not count as slopes.
+    float depthSlope(int x, int y, int dx, int dy) const
+    {
+        const float depth = m_aovs[index(x, y)].depth;
+        if (depth <= 0.0f) {
+            return 0.0f;
+        }
+        float slope = std::numeric_limits<float>::max();
+        for (int side : { -1, 1 }) {
+            int qx = x + dx * side;
+            int qy = y + dy * side;
+            if (inside(qx, qy) && m_aovs[index(qx, qy)].depth > 0.0f) {
+                float d = (m_aovs[index(qx, qy)].depth - depth) * side;
+                if (std::abs(d) < std::abs(slope)) {
+                    slope = d;
+                }
+            }
+        }
+        return slope == std::numeric_limits<float>::max() ? 0.0f : slope;
+    }
+
+    const std::vector<SurfaceAOV> &m_aovs;
+    int m_width;
+    int m_height;
+    const ATrousDenoiser::Settings &m_settings;
+    std::vector<glm::vec2> m_gradients;
+};
+
+} // namespace
+
+std::vector<glm::vec3> ATrousDenoiser::denoise(
+    const std::vector<glm::vec3> &color, const std::vector<glm::vec3> &moments,
+    const std::vector<SurfaceAOV> &aovs, int width, int height,
+    const Settings &settings)
+{
+    const size_t pixelCount
+        = static_cast<size_t>(width) * static_cast<size_t>(height);
+    if (color.size() != pixelCount || aovs.size() != pixelCount
+        || (!moments.empty() && moments.size() != pixelCount)) {
+        return color;
+    }
+
+    std::vector<glm::vec3> illumination(pixelCount);
+    for (size_t i = 0; i < pixelCount; i++) {
+        illumination[i] = color[i] / demodulation(aovs[i].albedo);
+    }
+
+    Filter filter(aovs, width, height, settings);
+    std::vector<float> variance
+        = filter.estimateVariance(illumination, moments);
+    std::vector<glm::vec3> nextIllumination(pixelCount);
+    std::vector<float> nextVariance(pixelCount);
+    for (int i = 0; i < settings.iterations; i++) {
+        filter.pass(1 << i, illumination, variance, nextIllumination,
+            nextVariance);
+        std::swap(illumination, nextIllumination);
+        std::swap(variance, nextVariance);
+    }
+
+    for (size_t i = 0; i < pixelCount; i++) {
+        illumination[i] *= demodulation(aovs[i].albedo);
+    }
+    return illumination;
+}
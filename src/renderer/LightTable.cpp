@@ -0,0 +1,166 @@
+#include "renderer/LightTable.hpp"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+constexpr float PI = 3.14159265359f;
+
+// 1 - cos of the half-angle of a sphere seen from distance^2 d2, written
+// to stay accurate for far away spheres
+float oneMinusCosMax(float r2, float d2)
+{
+    float x = r2 / d2;
+    return x / (1.0f + std::sqrt(1.0f - x));
+}
+
+} // namespace
+
+void LightTable::clear()
+{
+    m_lights.clear();
+    m_totalPower = 0.0f;
+}
+
+void LightTable::addTriangle(const glm::vec3 &v0, const glm::vec3 &v1,
+    const glm::vec3 &v2, const glm::vec3 &emissive)
+{
+    float area = 0.5f * glm::length(glm::cross(v1 - v0, v2 - v0));
+    float power = luminance(emissive) * area;
+    if (!(power > 0.0f)) {
+        return;
+    }
+    m_totalPower += power;
+
+    LightData light;
+    light.v0 = v0;
+    light.v1 = v1;
+    light.v2 = v2;
+    light.emissive = emissive;
+    light.type = LightType::Triangle;
+    light.cdf = m_totalPower;
+    m_lights.push_back(light);
+}
+
+void LightTable::addSphere(
+    const glm::vec3 &center, float radius, const glm::vec3 &emissive)
+{
+    float power = luminance(emissive) * 4.0f * PI * radius * radius;
+    if (!(power > 0.0f)) {
+        return;
+    }
+    m_totalPower += power;
+
+    LightData light;
+    light.v0 = center;
+    light.v1 = glm::vec3(radius, 0.0f, 0.0f);
+    light.emissive = emissive;
+    light.type = LightType::Sphere;
+    light.cdf = m_totalPower;
+    m_lights.push_back(light);
+}
+
+void LightTable::finalize()
+{
+    for (auto &light : m_lights) {
+        light.cdf /= m_totalPower;
+    }
+    // Rounding must not leave a gap at the top
+    if (!m_lights.empty()) {
+        m_lights.back().cdf = 1.0f;
+    }
+}
+
+int LightTable::pick(float u) const
+{
+    auto it = std::upper_bound(m_lights.begin(), m_lights.end(), u,
+        [](float value, const LightData &light) { return value < light.cdf; });
+    int index = static_cast<int>(it - m_lights.begin());
+    return std::min(index, static_cast<int>(m_lights.size()) - 1);
+}
+
+LightSample LightTable::sample(
+    const glm::vec3 &position, float u0, float u1, float u2) const
+{
+    LightSample result;
+    if (m_lights.empty()) {
+        return result;
+    }
+    const LightData &light = m_lights[pick(u0)];
+    result.emissive = light.emissive;
+
+    if (light.type == LightType::Triangle) {
+        // Uniform point on the triangle
+        float su = std::sqrt(u1);
+        glm::vec3 point = (1.0f - su) * light.v0 + su * (1.0f - u2) * light.v1
+            + su * u2 * light.v2;
+        glm::vec3 toLight = point - position;
+        result.distance = glm::length(toLight);
+        if (result.distance <= 0.0f) {
+            return result;
+        }
+        result.direction = toLight / result.distance;
+        glm::vec3 normal = glm::normalize(
+            glm::cross(light.v1 - light.v0, light.v2 - light.v0));
+        float cosLight = std::abs(glm::dot(normal, result.direction));
+        result.pdf = trianglePdf(light.emissive, result.distance, cosLight);
+        return result;
+    }
+
+    // Uniform direction in the cone the sphere subtends, nothing from inside
+    const glm::vec3 center = light.v0;
+    const float radius = light.v1.x;
+    glm::vec3 toCenter = center - position;
+    float d2 = glm::dot(toCenter, toCenter);
+    float r2 = radius * radius;
+    if (d2 <= r2) {
+        return result;
+    }
+    float cosTheta = 1.0f - u1 * oneMinusCosMax(r2, d2);
+    float sinTheta = std::sqrt(std::max(0.0f, 1.0f - cosTheta * cosTheta));
+    float phi = 2.0f * PI * u2;
+
+    glm::vec3 w = toCenter / std::sqrt(d2);
+    glm::vec3 helper = std::abs(w.x) > 0.1f ? glm::vec3(0.0f, 1.0f, 0.0f)
+                                            : glm::vec3(1.0f, 0.0f, 0.0f);
+    glm::vec3 u = glm::normalize(glm::cross(helper, w));
+    glm::vec3 v = glm::cross(w, u);
+    result.direction = u * (std::cos(phi) * sinTheta)
+        + v * (std::sin(phi) * sinTheta) + w * cosTheta;
+
+    // Nearest intersection along the direction
+    float b = glm::dot(toCenter, result.direction);
+    float disc = r2 - (d2 - b * b);
+    result.distance = b - std::sqrt(std::max(0.0f, disc));
+    result.pdf = spherePdf(light.emissive, center, radius, position);
+    return result;
+}
+
+float LightTable::trianglePdf(
+    const glm::vec3 &emissive, float distance, float cosLight) const
+{
+    // Picking chance over area: the area cancels out
+    if (m_totalPower <= 0.0f || cosLight <= 1e-6f) {
+        return 0.0f;
+    }
+    float areaPdf = luminance(emissive) / m_totalPower;
+    return areaPdf * distance * distance / cosLight;
+}
+
+float LightTable::spherePdf(const glm::vec3 &emissive,
+    const glm::vec3 &center, float radius, const glm::vec3 &position) const
+{
+    glm::vec3 toCenter = center - position;
+    float d2 = glm::dot(toCenter, toCenter);
+    float r2 = radius * radius;
+    if (m_totalPower <= 0.0f || d2 <= r2) {
+        return 0.0f;
+    }
+    float pickPdf = luminance(emissive) * 4.0f * PI * r2 / m_totalPower;
+    return pickPdf / (2.0f * PI * oneMinusCosMax(r2, d2));
+}
+
+float LightTable::luminance(const glm::vec3 &color)
+{
+    return glm::dot(color, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+}
@@ -1,5 +1,8 @@
 #include "renderer/implementation/PathTracingRenderer.hpp"
 #include "ShaderProgram.hpp"
+#include "renderer/CPUPathTracer.hpp"
+#include "renderer/ParallelTasks.hpp"
+#include "renderer/Hash.hpp"
 #include "backends/imgui_impl_glfw.h"
 #include "backends/imgui_impl_opengl3.h"
 
@@ -8,8 +11,10 @@
 #include "renderer/interface/IRenderer.hpp"
 
 #include <algorithm>
+#include <cstdio>
 #include <cstring>
 #include <iostream>
+#include <thread>
 #include <vector>
 
 #include <glm/gtc/matrix_transform.hpp>
@@ -30,6 +35,13 @@ PathTracingRenderer::PathTracingRenderer(Window &window) : m_window(window)
     m_pathTracingShader.setMat4("projection", identity);
     m_pathTracingShader.setVec3("viewPos", glm::vec3(0.0f, 0.0f, 4.0f));
 
+    m_denoiseShader.init(
+        "../assets/shaders/shader.vert", "../assets/shaders/denoise.frag");
+    m_denoiseShader.use();
+    m_denoiseShader.setMat4("model", identity);
+    m_denoiseShader.setMat4("view", identity);
+    m_denoiseShader.setMat4("projection", identity);
+
     // Initialize view and projection matrices
     m_viewMatrix = glm::mat4(1.0f);
     m_viewMatrix = glm::translate(m_viewMatrix, glm::vec3(0.0f, 0.0f, -4.0f));
@@ -62,26 +74,9 @@ PathTracingRenderer::PathTracingRenderer(Window &window) : m_window(window)
 
     initAccumulationBuffers();
 
-    m_triangles = {};
-
-    texData.reserve(m_triangles.size() * 3 * 4);
-
-    for (const auto &t : m_triangles) {
-        texData.push_back(t.v0.x);
-        texData.push_back(t.v0.y);
-        texData.push_back(t.v0.z);
-        texData.push_back(0.0f);
-
-        texData.push_back(t.v1.x);
-        texData.push_back(t.v1.y);
-        texData.push_back(t.v1.z);
-        texData.push_back(0.0f);
-
-        texData.push_back(t.v2.x);
-        texData.push_back(t.v2.y);
-        texData.push_back(t.v2.z);
-        texData.push_back(0.0f);
-    }
+    GLint maxTextureSize = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
+    m_sceneTextureWidth = std::min(SCENE_TEXTURE_WIDTH, maxTextureSize);
 
     // Create geometry texture (width=3: v0, v1, v2, normal)
     glGenTextures(1, &m_triangleGeomTexture);
@@ -93,10 +88,10 @@ PathTracingRenderer::PathTracingRenderer(Window &window) : m_window(window)
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
-    // Create material texture (width=4: color, emissive, specular+ior,
-    // refraction)
-    glGenTextures(1, &m_triangleMaterialTexture);
-    glBindTexture(GL_TEXTURE_2D, m_triangleMaterialTexture);
+    // Create material table texture (width=4: color, emissive,
+    // specular+ior, refraction)
+    glGenTextures(1, &m_materialTexture);
+    glBindTexture(GL_TEXTURE_2D, m_materialTexture);
     glTexImage2D(
         GL_TEXTURE_2D, 0, GL_RGBA32F, 4, 1, 0, GL_RGBA, GL_FLOAT, nullptr);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
@@ -146,11 +141,12 @@ PathTracingRenderer::PathTracingRenderer(Window &window) : m_window(window)
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
-    // Create BVH node texture (width=2: min+leftChild, max+rightChild/data)
+    // Create wide BVH node texture (one row of 2 + width / 2 texels per
+    // node, integer so packed bits reach the shader untouched)
     glGenTextures(1, &m_bvhNodeTexture);
     glBindTexture(GL_TEXTURE_2D, m_bvhNodeTexture);
-    glTexImage2D(
-        GL_TEXTURE_2D, 0, GL_RGBA32F, 2, 1, 0, GL_RGBA, GL_FLOAT, nullptr);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32UI, getBVHNodeRowWidth(), 1, 0,
+        GL_RGBA_INTEGER, GL_UNSIGNED_INT, nullptr);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
@@ -166,10 +162,31 @@ PathTracingRenderer::PathTracingRenderer(Window &window) : m_window(window)
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
+    // Create instance texture (width=4: world-to-object rows + BLAS bases)
+    glGenTextures(1, &m_instanceTexture);
+    glBindTexture(GL_TEXTURE_2D, m_instanceTexture);
+    glTexImage2D(
+        GL_TEXTURE_2D, 0, GL_RGBA32F, 4, 1, 0, GL_RGBA, GL_FLOAT, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    // Create light texture (width=4: corners or sphere, CDF, emission)
+    glGenTextures(1, &m_lightTexture);
+    glBindTexture(GL_TEXTURE_2D, m_lightTexture);
+    glTexImage2D(
+        GL_TEXTURE_2D, 0, GL_RGBA32F, 4, 1, 0, GL_RGBA, GL_FLOAT, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
     m_pathTracingShader.use();
     m_pathTracingShader.setInt("triangleGeomTex", 1);
-    m_pathTracingShader.setInt("triangleMaterialTex", 2);
-    m_pathTracingShader.setInt("numTriangles", 0);
+    m_pathTracingShader.setInt("materialTex", 2);
+    m_pathTracingShader.setInt("lightTex", 11);
+    m_pathTracingShader.setInt("numLights", 0);
     m_pathTracingShader.setInt("sphereGeomTex", 3);
     m_pathTracingShader.setInt("sphereMaterialTex", 4);
     m_pathTracingShader.setInt("numSpheres", 0);
@@ -179,6 +196,9 @@ PathTracingRenderer::PathTracingRenderer(Window &window) : m_window(window)
     m_pathTracingShader.setInt("bvhNodeTex", 7);
     m_pathTracingShader.setInt("bvhPrimTex", 8);
     m_pathTracingShader.setInt("numBVHNodes", 0);
+    m_pathTracingShader.setInt("bvhWidth", m_bvhWidth);
+    m_pathTracingShader.setBool("bvhStackless", m_stacklessBVH);
+    m_pathTracingShader.setInt("sceneTextureWidth", m_sceneTextureWidth);
 }
 
 PathTracingRenderer::~PathTracingRenderer()
@@ -187,8 +207,8 @@ PathTracingRenderer::~PathTracingRenderer()
     if (m_triangleGeomTexture != 0) {
         glDeleteTextures(1, &m_triangleGeomTexture);
     }
-    if (m_triangleMaterialTexture != 0) {
-        glDeleteTextures(1, &m_triangleMaterialTexture);
+    if (m_materialTexture != 0) {
+        glDeleteTextures(1, &m_materialTexture);
     }
     if (m_sphereGeomTexture != 0) {
         glDeleteTextures(1, &m_sphereGeomTexture);
@@ -208,6 +228,12 @@ PathTracingRenderer::~PathTracingRenderer()
     if (m_bvhPrimTexture != 0) {
         glDeleteTextures(1, &m_bvhPrimTexture);
     }
+    if (m_instanceTexture != 0) {
+        glDeleteTextures(1, &m_instanceTexture);
+    }
+    if (m_lightTexture != 0) {
+        glDeleteTextures(1, &m_lightTexture);
+    }
 }
 
 int PathTracingRenderer::registerObject(std::unique_ptr<RenderableObject> obj)
@@ -239,8 +265,7 @@ int PathTracingRenderer::registerObject(
 
     m_objects[objectId].renderObject = std::move(obj);
     m_objects[objectId].transform = glm::mat4(1.0f);
-    m_objects[objectId].triangleStartIndex = 0;
-    m_objects[objectId].triangleCount = 0;
+    m_objects[objectId].mesh.reset();
 
     m_trianglesDirty = true;
 
@@ -267,7 +292,9 @@ void PathTracingRenderer::updateTransform(
 
     m_objects[objectId].transform = modelMatrix;
 
-    m_trianglesDirty = true;
+    // Moving an object keeps the BVH topology, refit instead of rebuilding
+    m_objects[objectId].transformDirty = true;
+    m_transformsDirty = true;
 }
 
 void PathTracingRenderer::updateGeometry(
@@ -278,7 +305,9 @@ void PathTracingRenderer::updateGeometry(
     }
 
     if (m_objects[objectId].renderObject) {
+        // Other objects sharing the old geometry keep it
         m_objects[objectId].renderObject->updateGeometry(vertices);
+        m_objects[objectId].mesh.reset();
         m_trianglesDirty = true;
     }
 }
@@ -294,8 +323,7 @@ void PathTracingRenderer::removeObject(const int objectId)
     }
 
     m_objects[objectId].renderObject.reset();
-    m_objects[objectId].triangleStartIndex = 0;
-    m_objects[objectId].triangleCount = 0;
+    m_objects[objectId].mesh.reset();
 
     m_freeSlots.push_back(objectId);
 
@@ -315,8 +343,9 @@ PathTracingRenderer::extractAllObjects()
     }
 
     m_objects.clear();
+    m_meshes.clear();
+    m_meshesByGeometry.clear();
     m_freeSlots.clear();
-    m_triangles.clear();
     m_trianglesDirty = true;
 
     return objects;
@@ -332,7 +361,7 @@ void PathTracingRenderer::setObjectColor(int objectId, const glm::vec3 &color)
     }
 
     m_objects[objectId].renderObject->setColor(color);
-    m_trianglesDirty = true;
+    markMaterialDirty(objectId);
 }
 
 glm::vec3 PathTracingRenderer::getObjectColor(int objectId) const
@@ -358,7 +387,7 @@ void PathTracingRenderer::setObjectEmissive(
     }
 
     m_objects[objectId].renderObject->setEmissive(emissive);
-    m_trianglesDirty = true;
+    markMaterialDirty(objectId);
 }
 
 glm::vec3 PathTracingRenderer::getObjectEmissive(int objectId) const
@@ -383,7 +412,7 @@ void PathTracingRenderer::setObjectPercentSpecular(int objectId, float percent)
     }
 
     m_objects[objectId].renderObject->setPercentSpecular(percent);
-    m_trianglesDirty = true;
+    markMaterialDirty(objectId);
 }
 
 float PathTracingRenderer::getObjectPercentSpecular(int objectId) const
@@ -408,7 +437,7 @@ void PathTracingRenderer::setObjectRoughness(int objectId, float roughness)
     }
 
     m_objects[objectId].renderObject->setRoughness(roughness);
-    m_trianglesDirty = true;
+    markMaterialDirty(objectId);
 }
 
 float PathTracingRenderer::getObjectRoughness(int objectId) const
@@ -434,7 +463,7 @@ void PathTracingRenderer::setObjectSpecularColor(
     }
 
     m_objects[objectId].renderObject->setSpecularColor(color);
-    m_trianglesDirty = true;
+    markMaterialDirty(objectId);
 }
 
 glm::vec3 PathTracingRenderer::getObjectSpecularColor(int objectId) const
@@ -459,7 +488,7 @@ void PathTracingRenderer::setObjectIndexOfRefraction(int objectId, float ior)
     }
 
     m_objects[objectId].renderObject->setIndexOfRefraction(ior);
-    m_trianglesDirty = true;
+    markMaterialDirty(objectId);
 }
 
 float PathTracingRenderer::getObjectIndexOfRefraction(int objectId) const
@@ -484,7 +513,7 @@ void PathTracingRenderer::setObjectRefractionChance(int objectId, float chance)
     }
 
     m_objects[objectId].renderObject->setRefractionChance(chance);
-    m_trianglesDirty = true;
+    markMaterialDirty(objectId);
 }
 
 float PathTracingRenderer::getObjectRefractionChance(int objectId) const
@@ -507,6 +536,9 @@ void PathTracingRenderer::beginFrame()
     glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
+    m_lastFrameUploadBytes = m_uploadBytes;
+    m_uploadBytes = 0;
+
     m_pathTracingShader.use();
 
     ImGui_ImplOpenGL3_NewFrame();
@@ -594,11 +626,48 @@ void PathTracingRenderer::setCameraOverlayCallback(
 
 void PathTracingRenderer::renderAllViews(CameraManager &cameraManager)
 {
+    // The fast LBVH is only meant for dragging, refine with SAH once idle
+    if (!ImGuizmo::IsUsing()) {
+        for (auto &mesh : m_meshes) {
+            if (!mesh->blasDirty
+                && mesh->blas.getBuildMode() == BVHBuildMode::LBVH) {
+                mesh->blasDirty = true;
+                m_trianglesDirty = true;
+            }
+        }
+    }
+
+    flushSceneChanges();
+
+    // Split the frame budget between the views, from their visibility in
+    // the last frame's dock and their measured pass times
+    std::vector<ViewScheduler::ViewState> states;
+    std::vector<std::pair<const Camera *, PathTracedView *>> scheduled;
+    const Camera *focusedCamera = cameraManager.getFocusedCamera();
     for (auto &[id, view] : m_cameraViews) {
-        if (auto *cam = cameraManager.getCamera(id)) {
-            renderCameraViews(*cam, view);
+        if (const auto *cam = cameraManager.getCamera(id)) {
+            updatePassTime(view);
+            float scale = view.resolutionScaler.getScale();
+            ViewScheduler::ViewState state;
+            state.id = id;
+            state.visible = view.visible;
+            state.focused = cam == focusedCamera;
+            state.moving = view.iFrame == 0
+                || shouldResetCameraAccumulation(*cam, view);
+            state.pixels = view.size.x * view.size.y;
+            state.convergedFraction = view.convergedFraction;
+            state.passMs
+                = view.passMs > 0.0f ? view.passMs * scale * scale : -1.0f;
+            states.push_back(state);
+            scheduled.emplace_back(cam, &view);
         }
     }
+    const std::vector<ViewScheduler::Allocation> allocations
+        = m_viewScheduler.schedule(states);
+    for (size_t i = 0; i < scheduled.size(); i++) {
+        renderCameraViews(*scheduled[i].first, *scheduled[i].second,
+            allocations[i]);
+    }
     renderDockableViews(cameraManager);
     // Unlock when mouse released
     if (!ImGui::IsMouseDown(ImGuiMouseButton_Left)) {
@@ -611,7 +680,7 @@ void PathTracingRenderer::createCameraViews(
     const int id, int width, int height)
 {
     if (!m_cameraViews.contains(id)) {
-        CameraView view;
+        PathTracedView view;
         view.size = { width, height };
 
         // Create and bind framebuffer
@@ -656,23 +725,47 @@ void PathTracingRenderer::destroyCameraViews(const int id)
         glDeleteFramebuffers(1, &view.fbo);
         glDeleteTextures(1, &view.colorTex);
         glDeleteRenderbuffers(1, &view.depthRBO);
+        if (view.timerQuery != 0) {
+            glDeleteQueries(1, &view.timerQuery);
+        }
         cleanupCameraAccumulationBuffers(view);
         m_cameraViews.erase(it);
     }
 }
 
-void PathTracingRenderer::renderCameraViews(
-    const Camera &cam, CameraView &view)
+void PathTracingRenderer::flushSceneChanges()
 {
-    // Flush deferred triangle rebuild if needed
-    if (m_trianglesDirty) {
-        rebuildTriangleArray();
+    // Flush deferred scene changes: objects added, removed or edited need a
+    // full rebuild, objects that only moved are refitted in place and
+    // material edits only rewrite their own rows
+    if (m_trianglesDirty || m_transformsDirty || m_materialsDirty) {
+        if (m_trianglesDirty) {
+            rebuildTriangleArray();
+        } else {
+            if (m_transformsDirty) {
+                refitTriangleArray();
+            }
+            if (m_materialsDirty) {
+                refreshMaterials();
+            }
+        }
         m_trianglesDirty = false;
+        m_transformsDirty = false;
+        m_materialsDirty = false;
         // Reset accumulation for all camera views since scene geometry changed
         for (auto &[id, cameraView] : m_cameraViews) {
             resetCameraAccumulation(cameraView);
         }
     }
+}
+
+void PathTracingRenderer::renderCameraViews(const Camera &cam,
+    PathTracedView &view, const ViewScheduler::Allocation &allocation)
+{
+    // Views the scheduler skipped keep showing their last image
+    if (allocation.passes <= 0) {
+        return;
+    }
 
     // Save current state
     GLint previousFBO;
@@ -680,57 +773,90 @@ void PathTracingRenderer::renderCameraViews(
     GLint previousViewport[4];
     glGetIntegerv(GL_VIEWPORT, previousViewport);
 
-    // Check if we need to reset accumulation (camera moved)
-    if (shouldResetCameraAccumulation(cam, view)) {
-        resetCameraAccumulation(view);
-        view.lastViewPos = cam.getPosition();
-        view.lastViewRotation = cam.getRotation();
+    // Precompute rotation matrix and focal length on CPU (avoids sin/cos
+    // and tan per pixel in shader), shared with the CPU path tracer
+    PathTracingCamera camera = PathTracingCamera::fromAngles(
+        cam.getPosition(), cam.getRotation(), cam.getFov());
+    float aspectRatio = (view.size.y > 0)
+        ? (static_cast<float>(view.size.x) / static_cast<float>(view.size.y))
+        : 1.0f;
+
+    // Trace fewer pixels while the camera moves or the accumulation keeps
+    // restarting (scene edits), to keep a pass within the view's share of
+    // the frame budget
+    bool cameraMoved = shouldResetCameraAccumulation(cam, view);
+    glm::ivec2 renderSize = view.size;
+    if (view.dynamicResolution) {
+        ResolutionScaler::Settings settings
+            = view.resolutionScaler.getSettings();
+        settings.frameBudgetMs = allocation.budgetMs;
+        view.resolutionScaler.setSettings(settings);
+        float scale = view.resolutionScaler.getScale();
+        view.resolutionScaler.update(cameraMoved || view.iFrame == 0,
+            view.passMs > 0.0f ? view.passMs * scale * scale : -1.0f);
+        renderSize = view.resolutionScaler.scaledSize(view.size);
+    }
+
+    // A moved camera or a new resolution reprojects what it has, or starts
+    // over
+    bool reproject = false;
+    if (cameraMoved || renderSize != view.renderSize) {
+        reproject = view.temporalReprojection && view.iFrame > 0;
+        if (!reproject) {
+            resetCameraAccumulation(view);
+        }
     }
+    const glm::ivec2 previousRenderSize = view.renderSize;
+    view.renderSize = renderSize;
 
-    // Bind the current accumulation FBO to render to
-    glBindFramebuffer(
-        GL_FRAMEBUFFER, view.accumulationFBO[view.currentAccumulationBuffer]);
-    glViewport(0, 0, view.size.x, view.size.y);
+    const bool timed = !view.timerPending;
+    if (timed) {
+        if (view.timerQuery == 0) {
+            glGenQueries(1, &view.timerQuery);
+        }
+        view.timerScale = view.resolutionScaler.getScale();
+        view.timerPasses = allocation.passes;
+        glBeginQuery(GL_TIME_ELAPSED, view.timerQuery);
+    }
 
     // Render pathtraced content
+    glViewport(0, 0, renderSize.x, renderSize.y);
     m_pathTracingShader.use();
     m_pathTracingShader.setVec3("viewPos", cam.getPosition());
-
-    // Precompute rotation matrix on CPU (avoids sin/cos per pixel in shader)
-    glm::vec3 rot = glm::radians(cam.getRotation());
-    float cp = std::cos(rot.x), sp = std::sin(rot.x); // pitch
-    float cy = std::cos(rot.y), sy = std::sin(rot.y); // yaw
-    float cr = std::cos(rot.z), sr = std::sin(rot.z); // roll
-    glm::mat3 rotX(1, 0, 0, 0, cp, -sp, 0, sp, cp);
-    glm::mat3 rotY(cy, 0, sy, 0, 1, 0, -sy, 0, cy);
-    glm::mat3 rotZ(cr, -sr, 0, sr, cr, 0, 0, 0, 1);
-    glm::mat3 viewRotMat = rotZ * rotY * rotX;
-    m_pathTracingShader.setMat3("viewRotationMatrix", viewRotMat);
-    float aspectRatio = (view.size.y > 0)
-        ? (static_cast<float>(view.size.x) / static_cast<float>(view.size.y))
-        : 1.0f;
+    m_pathTracingShader.setMat3("viewRotationMatrix", camera.rotation);
     m_pathTracingShader.setFloat("aspectRatio", aspectRatio);
-    // Precompute focalLength on CPU (avoids radians/tan per pixel in shader)
-    float fovRadians = glm::radians(cam.getFov());
-    float focalLength = 1.0f / std::tan(fovRadians * 0.5f);
-    m_pathTracingShader.setFloat("focalLength", focalLength);
-    m_pathTracingShader.setInt("iFrame", view.iFrame);
-
-    // Bind the previous frame texture for accumulation
-    int previousBuffer = 1 - view.currentAccumulationBuffer;
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, view.accumulationTexture[previousBuffer]);
+    m_pathTracingShader.setFloat("focalLength", camera.focalLength);
+    m_pathTracingShader.setVec2("renderSize", glm::vec2(renderSize));
+    m_pathTracingShader.setVec2(
+        "previousRenderSize", glm::vec2(previousRenderSize));
+
+    m_pathTracingShader.setVec3("previousViewPos", view.lastViewPos);
+    m_pathTracingShader.setMat3(
+        "previousViewRotationMatrix", view.lastViewRotationMatrix);
+    m_pathTracingShader.setFloat("previousAspectRatio", view.lastAspectRatio);
+    m_pathTracingShader.setFloat("previousFocalLength", view.lastFocalLength);
+    view.lastViewPos = camera.position;
+    view.lastViewRotation = cam.getRotation();
+    view.lastViewRotationMatrix = camera.rotation;
+    view.lastFocalLength = camera.focalLength;
+    view.lastAspectRatio = aspectRatio;
+
     m_pathTracingShader.setInt("previousFrame", 0);
+    m_pathTracingShader.setInt("previousMoments", 12);
+    m_pathTracingShader.setInt("previousAlbedoDepth", 13);
+    m_pathTracingShader.setInt("previousNormal", 14);
+    m_pathTracingShader.setBool("adaptiveSampling", view.adaptiveSampling);
+    m_pathTracingShader.setFloat("noiseThreshold", view.noiseThreshold);
 
     // Bind geometry texture to texture unit 1
     glActiveTexture(GL_TEXTURE1);
     glBindTexture(GL_TEXTURE_2D, m_triangleGeomTexture);
     m_pathTracingShader.setInt("triangleGeomTex", 1);
 
-    // Bind material texture to texture unit 2
+    // Bind material table texture to texture unit 2
     glActiveTexture(GL_TEXTURE2);
-    glBindTexture(GL_TEXTURE_2D, m_triangleMaterialTexture);
-    m_pathTracingShader.setInt("triangleMaterialTex", 2);
+    glBindTexture(GL_TEXTURE_2D, m_materialTexture);
+    m_pathTracingShader.setInt("materialTex", 2);
 
     // Bind sphere geometry texture to texture unit 3
     glActiveTexture(GL_TEXTURE3);
@@ -762,29 +888,86 @@ void PathTracingRenderer::renderCameraViews(
     glBindTexture(GL_TEXTURE_2D, m_bvhPrimTexture);
     m_pathTracingShader.setInt("bvhPrimTex", 8);
 
-    m_pathTracingShader.setInt(
-        "numTriangles", static_cast<int>(m_triangles.size()));
+    // Bind instance texture to texture unit 9
+    glActiveTexture(GL_TEXTURE9);
+    glBindTexture(GL_TEXTURE_2D, m_instanceTexture);
+    m_pathTracingShader.setInt("instanceTex", 9);
+
+    // Bind light table texture to texture unit 11
+    glActiveTexture(GL_TEXTURE11);
+    glBindTexture(GL_TEXTURE_2D, m_lightTexture);
+    m_pathTracingShader.setInt("lightTex", 11);
+
     m_pathTracingShader.setInt(
         "numSpheres", static_cast<int>(m_spheres.size()));
     m_pathTracingShader.setInt("numPlanes", static_cast<int>(m_planes.size()));
-    m_pathTracingShader.setInt("numBVHNodes", m_bvh.getNodeCount());
+    m_pathTracingShader.setInt("numBVHNodes", m_uploadedTLASNodeCount);
+    m_pathTracingShader.setInt("bvhWidth", m_bvhWidth);
+    m_pathTracingShader.setBool("bvhStackless", m_stacklessBVH);
+    m_pathTracingShader.setInt("sceneTextureWidth", m_sceneTextureWidth);
 
+    // Each pass accumulates one more sample into the other buffer
+    const int firstFrame = view.iFrame;
     glBindVertexArray(m_quadVAO);
-    glDrawArrays(GL_TRIANGLES, 0, 6);
-    glBindVertexArray(0);
+    for (int pass = 0; pass < allocation.passes; pass++) {
+        if (pass > 0) {
+            view.currentAccumulationBuffer
+                = 1 - view.currentAccumulationBuffer;
+            view.iFrame++;
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER,
+            view.accumulationFBO[view.currentAccumulationBuffer]);
+        m_pathTracingShader.setInt("iFrame", view.iFrame);
+        // Only the first pass comes from another camera or resolution
+        m_pathTracingShader.setBool("reproject", reproject && pass == 0);
+        if (pass == 1) {
+            m_pathTracingShader.setVec2(
+                "previousRenderSize", glm::vec2(renderSize));
+        }
 
-    // Now copy to the display framebuffer
-    glBindFramebuffer(GL_FRAMEBUFFER, view.fbo);
-    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        // Bind the previous frame's color, luminance moments and first-hit
+        // AOVs to texture units 0, 12, 13 and 14
+        int previousBuffer = 1 - view.currentAccumulationBuffer;
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, view.accumulationTexture[previousBuffer]);
+        glActiveTexture(GL_TEXTURE12);
+        glBindTexture(GL_TEXTURE_2D, view.momentsTexture[previousBuffer]);
+        glActiveTexture(GL_TEXTURE13);
+        glBindTexture(GL_TEXTURE_2D, view.albedoDepthTexture[previousBuffer]);
+        glActiveTexture(GL_TEXTURE14);
+        glBindTexture(GL_TEXTURE_2D, view.normalTexture[previousBuffer]);
 
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D,
-        view.accumulationTexture[view.currentAccumulationBuffer]);
-    glBindVertexArray(m_quadVAO);
-    glDrawArrays(GL_TRIANGLES, 0, 6);
+        glDrawArrays(GL_TRIANGLES, 0, 6);
+    }
     glBindVertexArray(0);
 
+    // Now copy to the display framebuffer. A blit, drawing the quad again
+    // would trace every pixel a second time.
+    unsigned int displayFBO = view.denoise
+        ? denoiseCameraView(view)
+        : view.accumulationFBO[view.currentAccumulationBuffer];
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, displayFBO);
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, view.fbo);
+    glClear(GL_DEPTH_BUFFER_BIT);
+    const bool scaled = renderSize != view.size;
+    glBlitFramebuffer(0, 0, renderSize.x, renderSize.y, 0, 0, view.size.x,
+        view.size.y, GL_COLOR_BUFFER_BIT, scaled ? GL_LINEAR : GL_NEAREST);
+
+    if (timed) {
+        glEndQuery(GL_TIME_ELAPSED);
+        view.timerPending = true;
+    }
+
+    // The mip chain would average in pixels left over from larger frames.
+    // Passes advance several frames at once, read back when they crossed
+    // a multiple of the interval.
+    const int readbackFrame
+        = view.iFrame - view.iFrame % CONVERGENCE_READBACK_INTERVAL;
+    if (!scaled && readbackFrame >= firstFrame) {
+        readConvergedFraction(view);
+    }
+
     // Swap buffers for next frame
     view.currentAccumulationBuffer = 1 - view.currentAccumulationBuffer;
     view.iFrame++;
@@ -813,7 +996,8 @@ void PathTracingRenderer::renderDockableViews(CameraManager &cameraManager)
             }
         }
 
-        ImGui::Begin(name.c_str(), nullptr, windowFlags);
+        // Collapsed windows and hidden dock tabs get no samples next frame
+        view.visible = ImGui::Begin(name.c_str(), nullptr, windowFlags);
 
         // Controls toolbar for this camera
         if (auto *cam = cameraManager.getCamera(id)) {
@@ -821,7 +1005,7 @@ void PathTracingRenderer::renderDockableViews(CameraManager &cameraManager)
             const std::string tableId
                 = std::string("cam_ctl_") + std::to_string(id);
             if (ImGui::BeginTable(
-                    tableId.c_str(), 5, ImGuiTableFlags_SizingFixedFit)) {
+                    tableId.c_str(), 8, ImGuiTableFlags_SizingFixedFit)) {
                 ImGui::TableNextColumn();
                 bool isPerspective = cam->getProjectionMode()
                     == Camera::ProjectionMode::Perspective;
@@ -847,6 +1031,23 @@ void PathTracingRenderer::renderDockableViews(CameraManager &cameraManager)
                 }
 
                 ImGui::TableNextColumn();
+                ImGui::Checkbox("Adaptive##adaptive", &view.adaptiveSampling);
+
+                ImGui::TableNextColumn();
+                ImGui::SetNextItemWidth(80.0f);
+                ImGui::DragFloat("Noise##noise", &view.noiseThreshold, 0.001f,
+                    0.001f, 0.5f, "%.3f");
+
+                ImGui::TableNextColumn();
+                ImGui::Checkbox("Denoise##denoise", &view.denoise);
+
+                ImGui::TableNextColumn();
+                ImGui::Checkbox(
+                    "Reproject##reproject", &view.temporalReprojection);
+
+                ImGui::TableNextColumn();
+                ImGui::Checkbox(
+                    "Dynamic Res##dynres", &view.dynamicResolution);
 
                 ImGui::TableNextColumn();
                 if (ImGui::SmallButton("Reset Pose##reset")) {
@@ -895,6 +1096,22 @@ void PathTracingRenderer::renderDockableViews(CameraManager &cameraManager)
         ImGui::Image((void *)(intptr_t)view.colorTex, avail, ImVec2(0, 1),
             ImVec2(1, 0));
 
+        // Convergence of the adaptive sampler, in the image's corner, and
+        // the traced resolution while it is reduced
+        char convergence[64];
+        if (view.renderSize != view.size) {
+            std::snprintf(convergence, sizeof(convergence),
+                "%d frames, %dx%d", view.iFrame, view.renderSize.x,
+                view.renderSize.y);
+        } else {
+            std::snprintf(convergence, sizeof(convergence),
+                "%d frames, %.1f%% converged", view.iFrame,
+                view.convergedFraction * 100.0f);
+        }
+        ImGui::GetWindowDrawList()->AddText(
+            ImVec2(imagePos.x + 6.0f, imagePos.y + 6.0f),
+            IM_COL32(255, 255, 255, 200), convergence);
+
         // Auto focus this camera when user clicks on its image/window
         if (ImGui::IsItemClicked(ImGuiMouseButton_Left)
             || (ImGui::IsWindowHovered()
@@ -1013,7 +1230,7 @@ bool PathTracingRenderer::shouldResetAccumulation(const Camera &cam) const
     return false;
 }
 
-void PathTracingRenderer::initCameraAccumulationBuffers(CameraView &view)
+void PathTracingRenderer::initCameraAccumulationBuffers(PathTracedView &view)
 {
     int width = view.size.x;
     int height = view.size.y;
@@ -1026,6 +1243,18 @@ void PathTracingRenderer::initCameraAccumulationBuffers(CameraView &view)
     // Create two framebuffers and textures for ping-pong
     glGenFramebuffers(2, view.accumulationFBO);
     glGenTextures(2, view.accumulationTexture);
+    glGenTextures(2, view.momentsTexture);
+    glGenTextures(2, view.albedoDepthTexture);
+    glGenTextures(2, view.normalTexture);
+    glGenFramebuffers(2, view.denoiseFBO);
+    glGenTextures(2, view.denoiseTexture);
+
+    // Moments get a full mip chain: its last level averages the converged
+    // flags of the whole image
+    int momentsLevels = 1;
+    while ((std::max(width, height) >> momentsLevels) > 0) {
+        momentsLevels++;
+    }
 
     for (int i = 0; i < 2; i++) {
         // Setup texture
@@ -1037,31 +1266,71 @@ void PathTracingRenderer::initCameraAccumulationBuffers(CameraView &view)
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
-        // Setup framebuffer
+        glBindTexture(GL_TEXTURE_2D, view.momentsTexture[i]);
+        for (int level = 0; level < momentsLevels; level++) {
+            glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA32F,
+                std::max(1, width >> level), std::max(1, height >> level), 0,
+                GL_RGBA, GL_FLOAT, nullptr);
+        }
+        glTexParameteri(
+            GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, momentsLevels - 1);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+        // First-hit AOVs and the denoiser's buffers are read texel by
+        // texel
+        for (unsigned int texture : { view.albedoDepthTexture[i],
+                 view.normalTexture[i], view.denoiseTexture[i] }) {
+            glBindTexture(GL_TEXTURE_2D, texture);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width, height, 0,
+                GL_RGBA, GL_FLOAT, nullptr);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexParameteri(
+                GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(
+                GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        }
+
+        // Setup framebuffer, color, moments and AOVs are written together
         glBindFramebuffer(GL_FRAMEBUFFER, view.accumulationFBO[i]);
         glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
             GL_TEXTURE_2D, view.accumulationTexture[i], 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1,
+            GL_TEXTURE_2D, view.momentsTexture[i], 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2,
+            GL_TEXTURE_2D, view.albedoDepthTexture[i], 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT3,
+            GL_TEXTURE_2D, view.normalTexture[i], 0);
+        const GLenum drawBuffers[4] = { GL_COLOR_ATTACHMENT0,
+            GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2, GL_COLOR_ATTACHMENT3 };
+        glDrawBuffers(4, drawBuffers);
 
         if (glCheckFramebufferStatus(GL_FRAMEBUFFER)
             != GL_FRAMEBUFFER_COMPLETE) {
             std::cerr << "Camera accumulation framebuffer " << i
                       << " is incomplete!" << std::endl;
         }
-    }
 
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-    // Clear both textures to black
-    for (int i = 0; i < 2; i++) {
-        glBindFramebuffer(GL_FRAMEBUFFER, view.accumulationFBO[i]);
-        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT);
+        glBindFramebuffer(GL_FRAMEBUFFER, view.denoiseFBO[i]);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+            GL_TEXTURE_2D, view.denoiseTexture[i], 0);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER)
+            != GL_FRAMEBUFFER_COMPLETE) {
+            std::cerr << "Camera denoise framebuffer " << i
+                      << " is incomplete!" << std::endl;
+        }
     }
 
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    resetCameraAccumulation(view);
 }
 
-void PathTracingRenderer::cleanupCameraAccumulationBuffers(CameraView &view)
+void PathTracingRenderer::cleanupCameraAccumulationBuffers(
+    PathTracedView &view)
 {
     if (view.accumulationFBO[0] != 0 || view.accumulationFBO[1] != 0) {
         glDeleteFramebuffers(2, view.accumulationFBO);
@@ -1073,24 +1342,134 @@ void PathTracingRenderer::cleanupCameraAccumulationBuffers(CameraView &view)
         view.accumulationTexture[0] = 0;
         view.accumulationTexture[1] = 0;
     }
+    if (view.momentsTexture[0] != 0 || view.momentsTexture[1] != 0) {
+        glDeleteTextures(2, view.momentsTexture);
+        view.momentsTexture[0] = 0;
+        view.momentsTexture[1] = 0;
+    }
+    if (view.albedoDepthTexture[0] != 0 || view.albedoDepthTexture[1] != 0) {
+        glDeleteTextures(2, view.albedoDepthTexture);
+        view.albedoDepthTexture[0] = 0;
+        view.albedoDepthTexture[1] = 0;
+    }
+    if (view.normalTexture[0] != 0 || view.normalTexture[1] != 0) {
+        glDeleteTextures(2, view.normalTexture);
+        view.normalTexture[0] = 0;
+        view.normalTexture[1] = 0;
+    }
+    if (view.denoiseFBO[0] != 0 || view.denoiseFBO[1] != 0) {
+        glDeleteFramebuffers(2, view.denoiseFBO);
+        view.denoiseFBO[0] = 0;
+        view.denoiseFBO[1] = 0;
+    }
+    if (view.denoiseTexture[0] != 0 || view.denoiseTexture[1] != 0) {
+        glDeleteTextures(2, view.denoiseTexture);
+        view.denoiseTexture[0] = 0;
+        view.denoiseTexture[1] = 0;
+    }
 }
 
-void PathTracingRenderer::resetCameraAccumulation(CameraView &view)
+void PathTracingRenderer::resetCameraAccumulation(PathTracedView &view)
 {
     view.iFrame = 0;
+    view.convergedFraction = 0.0f;
 
-    // Clear both accumulation buffers
+    // Clear both accumulation buffers, moments and AOVs to no samples
+    const GLfloat black[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
+    const GLfloat zero[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
     for (int i = 0; i < 2; i++) {
         glBindFramebuffer(GL_FRAMEBUFFER, view.accumulationFBO[i]);
-        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT);
+        glClearBufferfv(GL_COLOR, 0, black);
+        glClearBufferfv(GL_COLOR, 1, zero);
+        glClearBufferfv(GL_COLOR, 2, zero);
+        glClearBufferfv(GL_COLOR, 3, zero);
     }
 
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
+void PathTracingRenderer::readConvergedFraction(PathTracedView &view)
+{
+    // Average the converged flags down the mip chain and read back the
+    // single texel left. This stalls on the frame, hence only every
+    // CONVERGENCE_READBACK_INTERVAL frames.
+    glBindTexture(
+        GL_TEXTURE_2D, view.momentsTexture[view.currentAccumulationBuffer]);
+    glGenerateMipmap(GL_TEXTURE_2D);
+    GLint lastLevel = 0;
+    glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, &lastLevel);
+    GLfloat average[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    glGetTexImage(GL_TEXTURE_2D, lastLevel, GL_RGBA, GL_FLOAT, average);
+    view.convergedFraction = average[3];
+}
+
+unsigned int PathTracingRenderer::denoiseCameraView(PathTracedView &view)
+{
+    // Inputs stay bound for every pass, only the filtered lighting moves
+    // between the two denoise buffers
+    const int current = view.currentAccumulationBuffer;
+    m_denoiseShader.use();
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, view.accumulationTexture[current]);
+    m_denoiseShader.setInt("accumulationTex", 1);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, view.momentsTexture[current]);
+    m_denoiseShader.setInt("momentsTex", 2);
+    glActiveTexture(GL_TEXTURE3);
+    glBindTexture(GL_TEXTURE_2D, view.albedoDepthTexture[current]);
+    m_denoiseShader.setInt("albedoDepthTex", 3);
+    glActiveTexture(GL_TEXTURE4);
+    glBindTexture(GL_TEXTURE_2D, view.normalTexture[current]);
+    m_denoiseShader.setInt("normalTex", 4);
+    m_denoiseShader.setInt("lightingTex", 0);
+    m_denoiseShader.setFloat("colorPhi", m_denoiseSettings.colorPhi);
+    m_denoiseShader.setFloat("normalPhi", m_denoiseSettings.normalPhi);
+    m_denoiseShader.setFloat("depthPhi", m_denoiseSettings.depthPhi);
+    m_denoiseShader.setFloat(
+        "minMomentSamples", ATrousDenoiser::MIN_MOMENT_SAMPLES);
+    m_denoiseShader.setVec2("imageSize", glm::vec2(view.renderSize));
+
+    // Pass -1 divides the albedo out and estimates the noise, the last
+    // one multiplies the albedo back
+    glBindVertexArray(m_quadVAO);
+    int target = 0;
+    for (int pass = -1; pass < m_denoiseSettings.iterations; pass++) {
+        glBindFramebuffer(GL_FRAMEBUFFER, view.denoiseFBO[target]);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, view.denoiseTexture[1 - target]);
+        m_denoiseShader.setInt("denoisePass", pass);
+        m_denoiseShader.setBool(
+            "remodulate", pass == m_denoiseSettings.iterations - 1);
+        glDrawArrays(GL_TRIANGLES, 0, 6);
+        target = 1 - target;
+    }
+    glBindVertexArray(0);
+    return view.denoiseFBO[1 - target];
+}
+
+void PathTracingRenderer::updatePassTime(PathTracedView &view)
+{
+    if (!view.timerPending) {
+        return;
+    }
+    GLint available = 0;
+    glGetQueryObjectiv(view.timerQuery, GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available) {
+        return;
+    }
+    GLuint64 elapsed = 0;
+    glGetQueryObjectui64v(view.timerQuery, GL_QUERY_RESULT, &elapsed);
+    view.timerPending = false;
+
+    // Per pass and at full resolution, the result is a few frames old and
+    // the scale may have changed since
+    float frameMs = static_cast<float>(elapsed) * 1e-6f;
+    view.passMs = frameMs / static_cast<float>(view.timerPasses)
+        / (view.timerScale * view.timerScale);
+}
+
 bool PathTracingRenderer::shouldResetCameraAccumulation(
-    const Camera &cam, CameraView &view) const
+    const Camera &cam, PathTracedView &view) const
 {
     const float epsilon = 0.0001f;
 
@@ -1109,283 +1488,786 @@ bool PathTracingRenderer::shouldResetCameraAccumulation(
     return false;
 }
 
+namespace {
+
+// Vertices are in format: x,y,z, u,v, nx,ny,nz, tx,ty,tz, bx,by,bz
+// per vertex (14 floats)
+constexpr size_t VERTEX_STRIDE = 14; // position (3) + texcoord (2)
+                                     // + normal (3) + tangent (3)
+                                     // + bitangent (3)
+
+// Call fn with the object-space corners of every triangle of a mesh, in the
+// order they are laid out in the triangle array
+template <typename Fn> void forEachLocalTriangle(RenderableObject &obj, Fn fn)
+{
+    const std::vector<float> &vertices = obj.getVertices();
+    const std::vector<unsigned int> &indices = obj.getIndices();
+
+    auto getVertex = [&](size_t idx) -> glm::vec3 {
+        size_t base = idx * VERTEX_STRIDE;
+        if (base + 2 >= vertices.size()) {
+            return glm::vec3(0.0f);
+        }
+        return glm::vec3(
+            vertices[base], vertices[base + 1], vertices[base + 2]);
+    };
+
+    if (!indices.empty()) {
+        // Use indexed geometry
+        for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+            fn(getVertex(indices[i]), getVertex(indices[i + 1]),
+                getVertex(indices[i + 2]));
+        }
+    } else {
+        // Non-indexed geometry
+        size_t numVertices = vertices.size() / VERTEX_STRIDE;
+        for (size_t i = 0; i + 2 < numVertices; i += 3) {
+            fn(getVertex(i), getVertex(i + 1), getVertex(i + 2));
+        }
+    }
+}
+
+// Hash of a mesh's geometry, to find the objects that may share a BLAS
+uint64_t geometryKey(RenderableObject &obj)
+{
+    const std::vector<float> &vertices = obj.getVertices();
+    const std::vector<unsigned int> &indices = obj.getIndices();
+    const size_t sizes[2] = { vertices.size(), indices.size() };
+    uint64_t key = fnv1aHash(FNV1A_SEED, sizes, sizeof(sizes));
+    key = fnv1aHash(key, vertices.data(), vertices.size() * sizeof(float));
+    return fnv1aHash(
+        key, indices.data(), indices.size() * sizeof(unsigned int));
+}
+
+bool sameGeometry(RenderableObject &a, RenderableObject &b)
+{
+    return a.getVertices() == b.getVertices()
+        && a.getIndices() == b.getIndices();
+}
+
+// Object-space corners and face normal, the instance carries the transform
+Triangle makeTriangle(
+    const glm::vec3 &v0, const glm::vec3 &v1, const glm::vec3 &v2)
+{
+    Triangle t {};
+    t.v0 = v0;
+    t.v1 = v1;
+    t.v2 = v2;
+
+    // Precompute face normal
+    glm::vec3 crossProduct = glm::cross(v0 - v2, v1 - v0);
+    float len = glm::length(crossProduct);
+    if (len > 1e-8f) {
+        t.normal = crossProduct / len;
+    } else {
+        t.normal = glm::vec3(0.0f, 1.0f, 0.0f);
+    }
+    return t;
+}
+
+// Geometry texture: 3 pixels per triangle
+// Pixel 0: [v0.xyz, v1.x], pixel 1: [v1.yz, v2.xy], pixel 2: [v2.z, normal]
+void packTriangle(float *out, const Triangle &t)
+{
+    const glm::vec3 *corners[4] = { &t.v0, &t.v1, &t.v2, &t.normal };
+    for (const glm::vec3 *corner : corners) {
+        *out++ = corner->x;
+        *out++ = corner->y;
+        *out++ = corner->z;
+    }
+}
+
+// Below this many triangles the flattening stays on the calling thread
+constexpr size_t PARALLEL_FLATTEN_CUTOFF = 1 << 16;
+
+// Surface parameters of an editor object as one material table row
+MaterialData materialOf(const RenderableObject &obj)
+{
+    MaterialData m;
+    m.color = obj.getColor();
+    m.emissive = obj.getEmissive();
+    m.percentSpecular = obj.getPercentSpecular();
+    m.roughness = obj.getRoughness();
+    m.specularColor = obj.getSpecularColor();
+    m.indexOfRefraction = obj.getIndexOfRefraction();
+    m.refractionChance = obj.getRefractionChance();
+    return m;
+}
+
+// Spheres and planes keep their material inline, there are few of them
+template <typename T> void applyMaterial(T &primitive, const MaterialData &m)
+{
+    primitive.color = m.color;
+    primitive.emissive = m.emissive;
+    primitive.percentSpecular = m.percentSpecular;
+    primitive.roughness = m.roughness;
+    primitive.specularColor = m.specularColor;
+    primitive.indexOfRefraction = m.indexOfRefraction;
+    primitive.refractionChance = m.refractionChance;
+}
+
+void placeSphere(AnalyticalSphereData &s, const glm::mat4 &transform,
+    const RenderableObject &obj)
+{
+    // Extract sphere center from transform matrix
+    glm::vec4 center4 = transform * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+    s.center = glm::vec3(center4) / center4.w;
+
+    // Extract scale to adjust radius (assuming uniform scale)
+    glm::vec3 scaleVec(glm::length(glm::vec3(transform[0])),
+        glm::length(glm::vec3(transform[1])),
+        glm::length(glm::vec3(transform[2])));
+    float scale = (scaleVec.x + scaleVec.y + scaleVec.z) / 3.0f;
+    s.radius = obj.getSphereRadius() * scale;
+}
+
+void placePlane(AnalyticalPlaneData &p, const glm::mat4 &transform,
+    const RenderableObject &obj)
+{
+    // Extract plane point from transform matrix
+    glm::vec4 point4 = transform * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+    p.point = glm::vec3(point4) / point4.w;
+
+    // Transform the normal by the rotation part of the matrix
+    glm::mat3 rotMat = glm::mat3(transform);
+    p.normal = glm::normalize(rotMat * obj.getPlaneNormal());
+}
+
+// World-to-object transform and world bounds of a mesh instance, from the
+// eight transformed corners of its BLAS root box
+void placeInstance(
+    InstanceData &instance, const glm::mat4 &transform, const BVH &blas)
+{
+    instance.worldToObject = glm::inverse(transform);
+
+    const AABB &local = blas.getNodes()[0].bounds;
+    AABB world;
+    for (int corner = 0; corner < 8; corner++) {
+        glm::vec3 p((corner & 1) ? local.max.x : local.min.x,
+            (corner & 2) ? local.max.y : local.min.y,
+            (corner & 4) ? local.max.z : local.min.z);
+        world.expand(glm::vec3(transform * glm::vec4(p, 1.0f)));
+    }
+    instance.boundsMin = world.min;
+    instance.boundsMax = world.max;
+}
+
+// Texel layout of a scene texture
+struct TexelFormat {
+    GLenum internalFormat;
+    GLenum format;
+    GLenum type;
+    int components;
+};
+
+constexpr TexelFormat RGBA32F { GL_RGBA32F, GL_RGBA, GL_FLOAT, 4 };
+constexpr TexelFormat RGBA32UI { GL_RGBA32UI, GL_RGBA_INTEGER,
+    GL_UNSIGNED_INT, 4 };
+
+// Write texels [begin, end) of a wrapped texture, the rest of the first
+// line, whole lines and the start of the last line taking one call each
+template <typename T>
+void writeTexels(const TexelFormat &texel, int textureWidth, size_t begin,
+    size_t end, const T *data)
+{
+    const size_t width = static_cast<size_t>(textureWidth);
+    size_t t = begin;
+    while (t < end) {
+        const GLint x = static_cast<GLint>(t % width);
+        const GLint y = static_cast<GLint>(t / width);
+        GLsizei count;
+        GLsizei lines = 1;
+        if (x == 0 && end - t >= width) {
+            count = textureWidth;
+            lines = static_cast<GLsizei>((end - t) / width);
+        } else {
+            count = static_cast<GLsizei>(std::min(width - x, end - t));
+        }
+        glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, count, lines, texel.format,
+            texel.type, data + t * texel.components);
+        t += static_cast<size_t>(count) * static_cast<size_t>(lines);
+    }
+}
+
+// Upload rows of rowWidth texels. Rows are stored end to end and wrap at
+// textureWidth, so the row count is not bounded by GL_MAX_TEXTURE_SIZE;
+// the shader addresses them with sceneTexel(). The texture is reallocated
+// only when the row count changed. When rows are given and the size is
+// unchanged, only those rows are rewritten, adjacent ones merged. Returns
+// the bytes sent.
+template <typename T>
+size_t uploadTexture(GLuint texture, const TexelFormat &texel,
+    int textureWidth, int rowWidth, int rowCount, int &lastRowCount,
+    const std::vector<T> &data, std::vector<TextureRowRange> rows = {})
+{
+    glBindTexture(GL_TEXTURE_2D, texture);
+    const size_t texels = data.size() / texel.components;
+    if (rowCount != lastRowCount) {
+        const size_t total = static_cast<size_t>(rowCount) * rowWidth;
+        const size_t lines = (total + textureWidth - 1) / textureWidth;
+        GLint maxSize = 0;
+        glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+        if (lines > static_cast<size_t>(maxSize)) {
+            std::cerr << "[ERROR] Scene data needs " << lines
+                      << " texture lines, the GPU allows " << maxSize
+                      << std::endl;
+            return 0;
+        }
+        glTexImage2D(GL_TEXTURE_2D, 0, texel.internalFormat, textureWidth,
+            static_cast<GLsizei>(std::max<size_t>(1, lines)), 0,
+            texel.format, texel.type, nullptr);
+        lastRowCount = rowCount;
+        rows.clear();
+    }
+    if (data.empty()) {
+        return 0;
+    }
+    if (rows.empty()) {
+        writeTexels(texel, textureWidth, 0, texels, data.data());
+        return data.size() * sizeof(T);
+    }
+
+    std::sort(rows.begin(), rows.end(),
+        [](const TextureRowRange &a, const TextureRowRange &b) {
+            return a.first < b.first;
+        });
+    size_t bytes = 0;
+    size_t i = 0;
+    while (i < rows.size()) {
+        int first = rows[i].first;
+        int end = first + rows[i].count;
+        for (i++; i < rows.size() && rows[i].first <= end; i++) {
+            end = std::max(end, rows[i].first + rows[i].count);
+        }
+        if (end > first) {
+            const size_t begin = static_cast<size_t>(first) * rowWidth;
+            const size_t stop = static_cast<size_t>(end) * rowWidth;
+            writeTexels(texel, textureWidth, begin, stop, data.data());
+            bytes += (stop - begin) * texel.components * sizeof(T);
+        }
+    }
+    return bytes;
+}
+
+// Material rows: [color.xyz, percentSpecular] [emissive.xyz, roughness]
+// [specularColor.xyz, indexOfRefraction] [refractionChance, 0, 0, 0]
+template <typename T> void appendMaterial(std::vector<float> &out, const T &m)
+{
+    out.insert(out.end(),
+        { m.color.x, m.color.y, m.color.z, m.percentSpecular, m.emissive.x,
+            m.emissive.y, m.emissive.z, m.roughness, m.specularColor.x,
+            m.specularColor.y, m.specularColor.z, m.indexOfRefraction,
+            m.refractionChance, 0.0f, 0.0f, 0.0f });
+}
+
+// Stackless leaves pack their primitive count in 8 bits
+constexpr int SKIP_LEAF_MAX_PRIMITIVES = 255;
+
+// One node row: [min.xyz, skip] [max.xyz, primStart | primCount << 24],
+// bounds as float bits
+void appendSkipNodes(std::vector<uint32_t> &out,
+    const std::vector<BVHSkipNode> &nodes, int nodeBase)
+{
+    auto appendBits = [&out](const glm::vec3 &v) {
+        for (int axis = 0; axis < 3; axis++) {
+            uint32_t bits;
+            std::memcpy(&bits, &v[axis], sizeof(uint32_t));
+            out.push_back(bits);
+        }
+    };
+    for (const auto &node : nodes) {
+        appendBits(node.bounds.min);
+        out.push_back(static_cast<uint32_t>(node.skip + nodeBase));
+        appendBits(node.bounds.max);
+        out.push_back(static_cast<uint32_t>(node.primitiveStart)
+            | (static_cast<uint32_t>(node.primitiveCount) << 24));
+    }
+}
+
+// One node row: [origin.xyz, biased exponents] [childBase, primBase, 0, 0]
+// then two children per texel, each as
+// [qlo.xyz | qhi.x << 24, qhi.yz | meta << 16]
+void appendWideNodes(
+    std::vector<uint32_t> &out, const WideBVH &wide, int width, int nodeBase)
+{
+    for (const auto &node : wide.getNodes()) {
+        uint32_t exponents = 0;
+        for (int axis = 0; axis < 3; axis++) {
+            uint32_t origin;
+            std::memcpy(&origin, &node.origin[axis], sizeof(uint32_t));
+            out.push_back(origin);
+            exponents |= static_cast<uint32_t>(node.exponent[axis] + 127)
+                << (8 * axis);
+        }
+        out.push_back(exponents);
+
+        out.push_back(static_cast<uint32_t>(node.childBase + nodeBase));
+        out.push_back(static_cast<uint32_t>(node.primBase));
+        out.push_back(0u);
+        out.push_back(0u);
+
+        for (int slot = 0; slot < width; slot++) {
+            const WideBVHChild &child = node.children[slot];
+            out.push_back(child.qlo[0] | (child.qlo[1] << 8)
+                | (child.qlo[2] << 16)
+                | (static_cast<uint32_t>(child.qhi[0]) << 24));
+            out.push_back(child.qhi[1] | (child.qhi[2] << 8)
+                | (static_cast<uint32_t>(child.meta) << 16));
+        }
+    }
+}
+
+} // namespace
+
 void PathTracingRenderer::rebuildTriangleArray()
 {
-    m_triangles.clear();
     m_spheres.clear();
     m_planes.clear();
-
-    for (auto &objData : m_objects) {
+    m_instances.clear();
+    m_materials.clear();
+    for (auto &mesh : m_meshes) {
+        mesh->placed = false;
+    }
+    std::vector<std::shared_ptr<MeshData>> previousMeshes;
+    previousMeshes.swap(m_meshes);
+
+    // First pass: place every mesh's triangles at a running offset, the
+    // copy itself is done in parallel once the total is known. Objects
+    // sharing a geometry share its rows and BLAS, only their instance is
+    // their own.
+    size_t triangleCount = 0;
+    for (size_t objectId = 0; objectId < m_objects.size(); objectId++) {
+        ObjectData &objData = m_objects[objectId];
+        objData.transformDirty = false;
+        objData.materialDirty = false;
+        objData.sceneIndex = -1;
+        objData.materialIndex = -1;
         if (!objData.renderObject) {
-            objData.triangleStartIndex = 0;
-            objData.triangleCount = 0;
             continue;
         }
 
         PrimitiveType primType = objData.renderObject->getPrimitiveType();
-        glm::vec3 color = objData.renderObject->getColor();
-        glm::vec3 emissive = objData.renderObject->getEmissive();
-        float percentSpecular = objData.renderObject->getPercentSpecular();
-        float roughness = objData.renderObject->getRoughness();
-        glm::vec3 specularColor = objData.renderObject->getSpecularColor();
-        float indexOfRefraction = objData.renderObject->getIndexOfRefraction();
-        float refractionChance = objData.renderObject->getRefractionChance();
+        const MaterialData material = materialOf(*objData.renderObject);
 
         if (primType == PrimitiveType::Sphere) {
-            // Extract sphere center from transform matrix
-            glm::vec4 center4
-                = objData.transform * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
-            glm::vec3 center = glm::vec3(center4) / center4.w;
-
-            // Extract scale to adjust radius (assuming uniform scale)
-            glm::vec3 scaleVec(glm::length(glm::vec3(objData.transform[0])),
-                glm::length(glm::vec3(objData.transform[1])),
-                glm::length(glm::vec3(objData.transform[2])));
-            float scale = (scaleVec.x + scaleVec.y + scaleVec.z) / 3.0f;
-            float radius = objData.renderObject->getSphereRadius() * scale;
-
             AnalyticalSphereData s;
-            s.center = center;
-            s.radius = radius;
-            s.color = color;
-            s.emissive = emissive;
-            s.percentSpecular = percentSpecular;
-            s.roughness = roughness;
-            s.specularColor = specularColor;
-            s.indexOfRefraction = indexOfRefraction;
-            s.refractionChance = refractionChance;
+            placeSphere(s, objData.transform, *objData.renderObject);
+            applyMaterial(s, material);
+            objData.sceneIndex = static_cast<int>(m_spheres.size());
             m_spheres.push_back(s);
+        } else if (primType == PrimitiveType::Plane) {
+            AnalyticalPlaneData p;
+            placePlane(p, objData.transform, *objData.renderObject);
+            applyMaterial(p, material);
+            objData.sceneIndex = static_cast<int>(m_planes.size());
+            m_planes.push_back(p);
+        } else {
+            // Mesh - traced through its object-space BLAS
+            if (!objData.mesh) {
+                objData.mesh = acquireMesh(static_cast<int>(objectId));
+            }
+            MeshData &mesh = *objData.mesh;
+
+            // Rows follow the object order, so they only shift when an
+            // object before this one is added or removed
+            objData.materialIndex = static_cast<int>(m_materials.size());
+            m_materials.push_back(material);
+
+            if (!mesh.placed) {
+                mesh.placed = true;
+                m_meshes.push_back(objData.mesh);
+                if (mesh.blasDirty) {
+                    buildMeshBLAS(mesh, *objData.renderObject);
+                } else if (mesh.wideBlas.getWidth() != m_bvhWidth) {
+                    mesh.wideBlas.build(mesh.blas, m_bvhWidth);
+                    mesh.uploadDirty = true;
+                }
+
+                const int previousStart = mesh.triangleStartIndex;
+                mesh.triangleStartIndex = static_cast<int>(triangleCount);
+                mesh.triangleCount
+                    = static_cast<int>(mesh.blasTriangles.size());
+                triangleCount += mesh.blasTriangles.size();
+                if (mesh.triangleStartIndex != previousStart) {
+                    mesh.uploadDirty = true;
+                }
+            }
+
+            if (mesh.blas.getNodeCount() > 0) {
+                InstanceData instance;
+                instance.objectId = static_cast<int>(objectId);
+                placeInstance(instance, objData.transform, mesh.blas);
+                objData.sceneIndex = static_cast<int>(m_instances.size());
+                m_instances.push_back(instance);
+            }
+        }
+    }
+
+    // Forget the geometries no object uses any more
+    previousMeshes.clear();
+    std::erase_if(m_meshesByGeometry,
+        [](const auto &entry) { return entry.second.expired(); });
+
+    buildTLAS();
+
+    // Meshes whose BLAS and rows did not change are not sent again, the
+    // other scene textures are small enough to go up whole
+    uploadTriangleTextures(triangleCount);
+    uploadMaterialTexture();
+    uploadSphereTextures(true);
+    uploadPlaneTextures(true);
+    uploadBVHTextures(false);
+    uploadInstanceTexture();
+    updateLightTable();
+    for (auto &mesh : m_meshes) {
+        mesh->uploadDirty = false;
+    }
+
+    m_pathTracingShader.use();
+    m_pathTracingShader.setInt("triangleGeomTex", 1);
+    m_pathTracingShader.setInt("materialTex", 2);
+    m_pathTracingShader.setInt("sphereGeomTex", 3);
+    m_pathTracingShader.setInt("sphereMaterialTex", 4);
+    m_pathTracingShader.setInt(
+        "numSpheres", static_cast<int>(m_spheres.size()));
+    m_pathTracingShader.setInt("planeGeomTex", 5);
+    m_pathTracingShader.setInt("planeMaterialTex", 6);
+    m_pathTracingShader.setInt("numPlanes", static_cast<int>(m_planes.size()));
+    m_pathTracingShader.setInt("bvhNodeTex", 7);
+    m_pathTracingShader.setInt("bvhPrimTex", 8);
+    m_pathTracingShader.setInt("numBVHNodes", m_uploadedTLASNodeCount);
+    m_pathTracingShader.setInt("bvhWidth", m_bvhWidth);
+    m_pathTracingShader.setBool("bvhStackless", m_stacklessBVH);
+    m_pathTracingShader.setInt("sceneTextureWidth", m_sceneTextureWidth);
+    m_pathTracingShader.setInt("instanceTex", 9);
+}
+
+void PathTracingRenderer::markMaterialDirty(int objectId)
+{
+    m_objects[objectId].materialDirty = true;
+    m_materialsDirty = true;
+}
+
+void PathTracingRenderer::refreshMaterials()
+{
+    // Only the edited objects' rows go up
+    std::vector<TextureRowRange> tableRows;
+    std::vector<TextureRowRange> sphereRows;
+    std::vector<TextureRowRange> planeRows;
 
-            objData.triangleStartIndex = 0;
-            objData.triangleCount = 0;
+    for (auto &objData : m_objects) {
+        if (!objData.renderObject || !objData.materialDirty) {
+            continue;
+        }
+        objData.materialDirty = false;
+
+        const MaterialData material = materialOf(*objData.renderObject);
+        PrimitiveType primType = objData.renderObject->getPrimitiveType();
+        if (objData.materialIndex >= 0) {
+            m_materials[objData.materialIndex] = material;
+            tableRows.push_back({ objData.materialIndex, 1 });
+        } else if (objData.sceneIndex < 0) {
+            continue;
+        } else if (primType == PrimitiveType::Sphere) {
+            applyMaterial(m_spheres[objData.sceneIndex], material);
+            sphereRows.push_back({ objData.sceneIndex, 1 });
         } else if (primType == PrimitiveType::Plane) {
-            // Extract plane point from transform matrix
-            glm::vec4 point4
-                = objData.transform * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
-            glm::vec3 point = glm::vec3(point4) / point4.w;
+            applyMaterial(m_planes[objData.sceneIndex], material);
+            planeRows.push_back({ objData.sceneIndex, 1 });
+        }
+    }
 
-            // Transform the normal by the rotation part of the matrix
-            glm::mat3 rotMat = glm::mat3(objData.transform);
-            glm::vec3 localNormal = objData.renderObject->getPlaneNormal();
-            glm::vec3 worldNormal = glm::normalize(rotMat * localNormal);
+    if (!tableRows.empty()) {
+        uploadMaterialTexture(tableRows);
+    }
+    if (!sphereRows.empty()) {
+        uploadSphereTextures(true, sphereRows);
+    }
+    if (!planeRows.empty()) {
+        uploadPlaneTextures(true, planeRows);
+    }
+    // Any edit may turn an object into a light or change its power
+    if (!tableRows.empty() || !sphereRows.empty()) {
+        updateLightTable();
+    }
+}
 
-            AnalyticalPlaneData p;
-            p.point = point;
-            p.normal = worldNormal;
-            p.color = color;
-            p.emissive = emissive;
-            p.percentSpecular = percentSpecular;
-            p.roughness = roughness;
-            p.specularColor = specularColor;
-            p.indexOfRefraction = indexOfRefraction;
-            p.refractionChance = refractionChance;
-            m_planes.push_back(p);
+void PathTracingRenderer::refitTriangleArray()
+{
+    std::vector<TextureRowRange> sphereRows;
+    std::vector<TextureRowRange> planeRows;
+    std::vector<TextureRowRange> instanceRows;
+    bool lightsMoved = false;
+
+    for (auto &objData : m_objects) {
+        if (!objData.renderObject || !objData.transformDirty) {
+            continue;
+        }
+        objData.transformDirty = false;
+        if (objData.sceneIndex < 0) {
+            continue;
+        }
+        lightsMoved = lightsMoved
+            || LightTable::luminance(objData.renderObject->getEmissive())
+                > 0.0f;
 
-            objData.triangleStartIndex = 0;
-            objData.triangleCount = 0;
+        PrimitiveType primType = objData.renderObject->getPrimitiveType();
+        if (primType == PrimitiveType::Sphere) {
+            placeSphere(m_spheres[objData.sceneIndex], objData.transform,
+                *objData.renderObject);
+            sphereRows.push_back({ objData.sceneIndex, 1 });
+        } else if (primType == PrimitiveType::Plane) {
+            placePlane(m_planes[objData.sceneIndex], objData.transform,
+                *objData.renderObject);
+            planeRows.push_back({ objData.sceneIndex, 1 });
         } else {
-            // Mesh - convert to triangles as before
-            objData.triangleStartIndex = static_cast<int>(m_triangles.size());
-            std::vector<float> &vertices = objData.renderObject->getVertices();
-            std::vector<unsigned int> &indices
-                = objData.renderObject->getIndices();
-
-            // Vertices are in format: x,y,z, u,v, nx,ny,nz, tx,ty,tz, bx,by,bz
-            // per vertex (14 floats)
-            int stride = 14; // position (3) + texcoord (2) + normal (3)
-                             // + tangent (3) + bitangent (3)
-
-            auto getVertex = [&](size_t idx) -> glm::vec3 {
-                size_t base = idx * stride;
-                if (base + 2 >= vertices.size()) {
-                    return glm::vec3(0.0f);
-                }
-                return glm::vec3(
-                    vertices[base], vertices[base + 1], vertices[base + 2]);
-            };
-
-            if (!indices.empty()) {
-                // Use indexed geometry
-                for (size_t i = 0; i + 2 < indices.size(); i += 3) {
-                    Triangle t;
-
-                    glm::vec3 localV0 = getVertex(indices[i]);
-                    glm::vec3 localV1 = getVertex(indices[i + 1]);
-                    glm::vec3 localV2 = getVertex(indices[i + 2]);
-
-                    glm::vec4 v0
-                        = objData.transform * glm::vec4(localV0, 1.0f);
-                    glm::vec4 v1
-                        = objData.transform * glm::vec4(localV1, 1.0f);
-                    glm::vec4 v2
-                        = objData.transform * glm::vec4(localV2, 1.0f);
-
-                    t.v0 = glm::vec3(v0) / v0.w;
-                    t.v1 = glm::vec3(v1) / v1.w;
-                    t.v2 = glm::vec3(v2) / v2.w;
-
-                    // Precompute face normal
-                    glm::vec3 e0 = t.v1 - t.v0;
-                    glm::vec3 e1 = t.v0 - t.v2;
-                    glm::vec3 crossProduct = glm::cross(e1, e0);
-                    float len = glm::length(crossProduct);
-                    if (len > 1e-8f) {
-                        t.normal = crossProduct / len;
-                    } else {
-                        t.normal = glm::vec3(0.0f, 1.0f, 0.0f);
-                    }
+            // Only the instance moves, its BLAS stays in object space
+            placeInstance(m_instances[objData.sceneIndex], objData.transform,
+                objData.mesh->blas);
+            instanceRows.push_back({ objData.sceneIndex, 1 });
+        }
+    }
 
-                    t.color = color;
-                    t.emissive = emissive;
-                    t.percentSpecular = percentSpecular;
-                    t.roughness = roughness;
-                    t.specularColor = specularColor;
-                    t.indexOfRefraction = indexOfRefraction;
-                    t.refractionChance = refractionChance;
+    const std::vector<Triangle> noTriangles;
+    m_bvh.refit(noTriangles, m_spheres, m_instances);
 
-                    m_triangles.push_back(t);
-                }
-            } else {
-                // Non-indexed geometry
-                size_t numVertices = vertices.size() / stride;
-                for (size_t i = 0; i + 2 < numVertices; i += 3) {
-                    Triangle t;
-
-                    glm::vec3 localV0 = getVertex(i);
-                    glm::vec3 localV1 = getVertex(i + 1);
-                    glm::vec3 localV2 = getVertex(i + 2);
-
-                    glm::vec4 v0
-                        = objData.transform * glm::vec4(localV0, 1.0f);
-                    glm::vec4 v1
-                        = objData.transform * glm::vec4(localV1, 1.0f);
-                    glm::vec4 v2
-                        = objData.transform * glm::vec4(localV2, 1.0f);
-
-                    t.v0 = glm::vec3(v0) / v0.w;
-                    t.v1 = glm::vec3(v1) / v1.w;
-                    t.v2 = glm::vec3(v2) / v2.w;
-
-                    // Precompute face normal
-                    glm::vec3 e0 = t.v1 - t.v0;
-                    glm::vec3 e1 = t.v0 - t.v2;
-                    glm::vec3 crossProduct = glm::cross(e1, e0);
-                    float len = glm::length(crossProduct);
-                    if (len > 1e-8f) {
-                        t.normal = crossProduct / len;
-                    } else {
-                        t.normal = glm::vec3(0.0f, 1.0f, 0.0f);
-                    }
+    // Refitted boxes of objects moved far apart overlap more and more, so
+    // rebuild the top level once it traces noticeably slower than a fresh
+    // one. Bottom-level node offsets may shift, so re-upload all nodes.
+    bool rebuilt = m_bvh.computeSAHCost()
+        > m_bvh.getBuildSAHCost() * BVH_REFIT_MAX_COST_RATIO;
+    if (rebuilt) {
+        buildTLAS();
+    } else {
+        m_wideTLAS.build(m_bvh, m_bvhWidth);
+    }
 
-                    t.color = color;
-                    t.emissive = emissive;
-                    t.percentSpecular = percentSpecular;
-                    t.roughness = roughness;
-                    t.specularColor = specularColor;
-                    t.indexOfRefraction = indexOfRefraction;
-                    t.refractionChance = refractionChance;
+    // A rebuild reorders spheres and instances, otherwise only the moved
+    // rows change
+    if (rebuilt) {
+        uploadSphereTextures(true);
+    } else if (!sphereRows.empty()) {
+        uploadSphereTextures(false, sphereRows);
+    }
+    if (!planeRows.empty()) {
+        uploadPlaneTextures(false, planeRows);
+    }
+    uploadBVHTextures(!rebuilt);
+    if (rebuilt) {
+        uploadInstanceTexture();
+    } else if (!instanceRows.empty()) {
+        uploadInstanceTexture(instanceRows);
+    }
+    if (lightsMoved) {
+        updateLightTable();
+    }
 
-                    m_triangles.push_back(t);
-                }
+    m_pathTracingShader.use();
+    m_pathTracingShader.setInt("numBVHNodes", m_uploadedTLASNodeCount);
+}
+
+std::shared_ptr<PathTracingRenderer::MeshData>
+PathTracingRenderer::acquireMesh(int objectId)
+{
+    auto ownMesh = [objectId]() {
+        auto mesh = std::make_shared<MeshData>();
+        mesh->sourceObject = objectId;
+        return mesh;
+    };
+    RenderableObject &obj = *m_objects[objectId].renderObject;
+    std::weak_ptr<MeshData> &entry = m_meshesByGeometry[geometryKey(obj)];
+    std::shared_ptr<MeshData> mesh = entry.lock();
+    if (!mesh) {
+        mesh = ownMesh();
+        entry = mesh;
+        return mesh;
+    }
+
+    // Keys are hashes, so the geometry is compared with an object already
+    // using the mesh before sharing it
+    auto usesMesh = [&](int id) {
+        return id >= 0 && id < static_cast<int>(m_objects.size())
+            && m_objects[id].renderObject && m_objects[id].mesh == mesh;
+    };
+    if (!usesMesh(mesh->sourceObject)) {
+        mesh->sourceObject = -1;
+        for (int id = 0; id < static_cast<int>(m_objects.size()); id++) {
+            if (usesMesh(id)) {
+                mesh->sourceObject = id;
+                break;
             }
+        }
+    }
+    if (mesh->sourceObject < 0) {
+        // Only kept alive by the rebuild, nothing to compare with
+        mesh = ownMesh();
+        entry = mesh;
+        return mesh;
+    }
+    if (sameGeometry(obj, *m_objects[mesh->sourceObject].renderObject)) {
+        return mesh;
+    }
+    // A collision: the key keeps the other geometry, this one gets a mesh
+    // of its own
+    return ownMesh();
+}
 
-            objData.triangleCount = static_cast<int>(m_triangles.size())
-                - objData.triangleStartIndex;
+void PathTracingRenderer::buildMeshBLAS(MeshData &mesh, RenderableObject &obj)
+{
+    mesh.blasTriangles.clear();
+    const std::vector<unsigned int> &indices = obj.getIndices();
+    mesh.blasTriangles.reserve(indices.empty()
+            ? obj.getVertices().size() / VERTEX_STRIDE / 3
+            : indices.size() / 3);
+    forEachLocalTriangle(obj,
+        [&](const glm::vec3 &localV0, const glm::vec3 &localV1,
+            const glm::vec3 &localV2) {
+            mesh.blasTriangles.push_back(
+                makeTriangle(localV0, localV1, localV2));
+        });
+
+    // Geometry edited while a gizmo is held may be rebuilt every frame, so
+    // trade trace speed for build speed until it is released
+    std::vector<AnalyticalSphereData> noSpheres;
+    mesh.blas.setLBVHSAHLevels(2);
+    mesh.blas.setSpatialSplitBudget(m_spatialSplitBudget);
+    if (ImGuizmo::IsUsing()) {
+        mesh.blas.setBuildMode(BVHBuildMode::LBVH);
+    } else {
+        mesh.blas.setBuildMode(
+            m_spatialSplits ? BVHBuildMode::SBVH : BVHBuildMode::SAH);
+    }
+
+    // Full-quality builds of meshes seen in an earlier session come from
+    // the disk cache, interactive LBVH builds are cheaper than a lookup
+    const bool cacheable = mesh.blas.getBuildMode() != BVHBuildMode::LBVH;
+    uint64_t cacheKey = 0;
+    if (cacheable) {
+        cacheKey = BVHCache::computeKey(
+            mesh.blasTriangles, mesh.blas, m_optimizeBVH);
+    }
+    if (!cacheable
+        || !m_bvhCache.load(cacheKey, mesh.blas, mesh.blasTriangles)) {
+        mesh.blas.build(mesh.blasTriangles, noSpheres);
+        if (m_optimizeBVH && cacheable) {
+            mesh.blas.optimize();
+        }
+        if (cacheable) {
+            m_bvhCache.store(cacheKey, mesh.blas, mesh.blasTriangles);
         }
     }
+    mesh.wideBlas.build(mesh.blas, m_bvhWidth);
+    mesh.blasDirty = false;
+    mesh.uploadDirty = true;
+}
 
-    // Build BVH acceleration structure for triangles AND spheres
-    // This will reorder m_triangles and m_spheres according to BVH leaf order
-    if (!m_triangles.empty() || !m_spheres.empty()) {
-        m_bvh.build(m_triangles, m_spheres);
+void PathTracingRenderer::buildTLAS()
+{
+    std::vector<Triangle> noTriangles;
+    if (!m_spheres.empty() || !m_instances.empty()) {
+        m_bvh.build(noTriangles, m_spheres, m_instances);
     } else {
         m_bvh.clear();
+        m_wideTLAS.clear();
+        return;
     }
+    m_wideTLAS.build(m_bvh, m_bvhWidth);
+
+    // Follow the reordering so every object keeps pointing at its own slot
+    const auto &sphereRemap = m_bvh.getSphereRemap();
+    const auto &instanceRemap = m_bvh.getInstanceRemap();
+    for (auto &objData : m_objects) {
+        if (!objData.renderObject || objData.sceneIndex < 0) {
+            continue;
+        }
+        PrimitiveType primType = objData.renderObject->getPrimitiveType();
+        if (primType == PrimitiveType::Sphere) {
+            objData.sceneIndex = sphereRemap[objData.sceneIndex];
+        } else if (primType != PrimitiveType::Plane) {
+            objData.sceneIndex = instanceRemap[objData.sceneIndex];
+        }
+    }
+}
+
+void PathTracingRenderer::uploadTriangleTextures(size_t triangleCount)
+{
+    std::vector<TextureRowRange> rows;
+    for (const auto &mesh : m_meshes) {
+        if (mesh->uploadDirty && mesh->triangleCount > 0) {
+            rows.push_back({ mesh->triangleStartIndex, mesh->triangleCount });
+        }
+    }
+    int rowCount = std::max(1, static_cast<int>(triangleCount));
+    const bool allRows = rowCount != m_lastTriangleRowCount;
 
-    // Create separate geometry and material texture data
     // Geometry texture (width=3): v0, v1, v2, normal - used for all
-    // intersection tests Material texture (width=4): color, emissive,
-    // specular+ior, refraction - only for closest hit
+    // intersection tests. Materials come from the instance hit.
+    // Every mesh occupies a contiguous range, in object space and BLAS leaf
+    // order. Only the ranges that are sent again get packed.
     std::vector<float> geomData;
-    std::vector<float> materialData;
-    geomData.reserve(m_triangles.size() * 3 * 4);
-    materialData.reserve(m_triangles.size() * 4 * 4);
-
-    for (const auto &t : m_triangles) {
-        // Geometry texture: 3 pixels per triangle
-        // Pixel 0: [v0.xyz, v1.x]
-        geomData.push_back(t.v0.x);
-        geomData.push_back(t.v0.y);
-        geomData.push_back(t.v0.z);
-        geomData.push_back(t.v1.x);
-
-        // Pixel 1: [v1.yz, v2.xy]
-        geomData.push_back(t.v1.y);
-        geomData.push_back(t.v1.z);
-        geomData.push_back(t.v2.x);
-        geomData.push_back(t.v2.y);
-
-        // Pixel 2: [v2.z, normal.xyz]
-        geomData.push_back(t.v2.z);
-        geomData.push_back(t.normal.x);
-        geomData.push_back(t.normal.y);
-        geomData.push_back(t.normal.z);
-
-        // Material texture: 4 pixels per triangle
-        // Pixel 0: [color.xyz, percentSpecular]
-        materialData.push_back(t.color.x);
-        materialData.push_back(t.color.y);
-        materialData.push_back(t.color.z);
-        materialData.push_back(t.percentSpecular);
-
-        // Pixel 1: [emissive.xyz, roughness]
-        materialData.push_back(t.emissive.x);
-        materialData.push_back(t.emissive.y);
-        materialData.push_back(t.emissive.z);
-        materialData.push_back(t.roughness);
-
-        // Pixel 2: [specularColor.xyz, indexOfRefraction]
-        materialData.push_back(t.specularColor.x);
-        materialData.push_back(t.specularColor.y);
-        materialData.push_back(t.specularColor.z);
-        materialData.push_back(t.indexOfRefraction);
-
-        // Pixel 3: [refractionChance, padding, padding, padding]
-        materialData.push_back(t.refractionChance);
-        materialData.push_back(0.0f);
-        materialData.push_back(0.0f);
-        materialData.push_back(0.0f);
-    }
-
-    int height = std::max(1, static_cast<int>(m_triangles.size()));
-    bool needsReallocation = (height != m_lastTriangleTextureHeight);
-
-    // Upload geometry texture
-    glBindTexture(GL_TEXTURE_2D, m_triangleGeomTexture);
-    if (needsReallocation) {
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, 3, height, 0, GL_RGBA,
-            GL_FLOAT, geomData.empty() ? nullptr : geomData.data());
-    } else if (!geomData.empty()) {
-        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 3, height, GL_RGBA, GL_FLOAT,
-            geomData.data());
+    if (allRows || !rows.empty()) {
+        geomData.resize(triangleCount * 3 * 4);
     }
 
-    // Upload material texture (width=4)
-    glBindTexture(GL_TEXTURE_2D, m_triangleMaterialTexture);
-    if (needsReallocation) {
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, 4, height, 0, GL_RGBA,
-            GL_FLOAT, materialData.empty() ? nullptr : materialData.data());
-        m_lastTriangleTextureHeight = height;
-    } else if (!materialData.empty()) {
-        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 4, height, GL_RGBA, GL_FLOAT,
-            materialData.data());
+    if (geomData.empty()) {
+        return;
     }
 
+    // Split the presized array into equal triangle ranges and pack each
+    // range on its own thread
+    unsigned int tasks = triangleCount < PARALLEL_FLATTEN_CUTOFF
+        ? 1u
+        : std::max(1u, std::thread::hardware_concurrency());
+    runTasks(tasks, [&](unsigned int task) {
+        size_t begin = triangleCount * task / tasks;
+        size_t end = triangleCount * (task + 1) / tasks;
+        for (const auto &mesh : m_meshes) {
+            size_t first = static_cast<size_t>(mesh->triangleStartIndex);
+            size_t from = std::max(begin, first);
+            size_t to = std::min(end,
+                first + static_cast<size_t>(mesh->triangleCount));
+            if (!allRows && !mesh->uploadDirty) {
+                continue;
+            }
+            for (size_t i = from; i < to; i++) {
+                packTriangle(
+                    &geomData[i * 3 * 4], mesh->blasTriangles[i - first]);
+            }
+        }
+    });
+
+    m_uploadBytes += uploadTexture(m_triangleGeomTexture, RGBA32F,
+        m_sceneTextureWidth, 3, rowCount, m_lastTriangleRowCount, geomData,
+        rows);
+}
+
+void PathTracingRenderer::uploadMaterialTexture(
+    const std::vector<TextureRowRange> &rows)
+{
+    // Format: 4 pixels per material, same layout as the sphere and plane
+    // materials
+    std::vector<float> materialData;
+    materialData.reserve(m_materials.size() * 4 * 4);
+    for (const auto &m : m_materials) {
+        appendMaterial(materialData, m);
+    }
+
+    int rowCount = std::max(1, static_cast<int>(m_materials.size()));
+    m_uploadBytes += uploadTexture(m_materialTexture, RGBA32F,
+        m_sceneTextureWidth, 4, rowCount, m_lastMaterialRowCount,
+        materialData, rows);
+}
+
+void PathTracingRenderer::uploadSphereTextures(
+    bool withMaterials, const std::vector<TextureRowRange> &rows)
+{
     // Build sphere texture data
     std::vector<float> sphereGeomData;
     std::vector<float> sphereMaterialData;
     sphereGeomData.reserve(m_spheres.size() * 4);
-    sphereMaterialData.reserve(m_spheres.size() * 4 * 4);
+    if (withMaterials) {
+        sphereMaterialData.reserve(m_spheres.size() * 4 * 4);
+    }
 
     for (const auto &s : m_spheres) {
         // Geometry: 1 pixel per sphere [center.xyz, radius]
@@ -1395,62 +2277,33 @@ void PathTracingRenderer::rebuildTriangleArray()
         sphereGeomData.push_back(s.radius);
 
         // Material: 4 pixels per sphere
-        // Pixel 0: [color.xyz, percentSpecular]
-        sphereMaterialData.push_back(s.color.x);
-        sphereMaterialData.push_back(s.color.y);
-        sphereMaterialData.push_back(s.color.z);
-        sphereMaterialData.push_back(s.percentSpecular);
-
-        // Pixel 1: [emissive.xyz, roughness]
-        sphereMaterialData.push_back(s.emissive.x);
-        sphereMaterialData.push_back(s.emissive.y);
-        sphereMaterialData.push_back(s.emissive.z);
-        sphereMaterialData.push_back(s.roughness);
-
-        // Pixel 2: [specularColor.xyz, indexOfRefraction]
-        sphereMaterialData.push_back(s.specularColor.x);
-        sphereMaterialData.push_back(s.specularColor.y);
-        sphereMaterialData.push_back(s.specularColor.z);
-        sphereMaterialData.push_back(s.indexOfRefraction);
-
-        // Pixel 3: [refractionChance, padding, padding, padding]
-        sphereMaterialData.push_back(s.refractionChance);
-        sphereMaterialData.push_back(0.0f);
-        sphereMaterialData.push_back(0.0f);
-        sphereMaterialData.push_back(0.0f);
-    }
-
-    int sphereHeight = std::max(1, static_cast<int>(m_spheres.size()));
-    bool sphereNeedsRealloc = (sphereHeight != m_lastSphereTextureHeight);
-
-    // Upload sphere geometry texture
-    glBindTexture(GL_TEXTURE_2D, m_sphereGeomTexture);
-    if (sphereNeedsRealloc) {
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, 1, sphereHeight, 0, GL_RGBA,
-            GL_FLOAT,
-            sphereGeomData.empty() ? nullptr : sphereGeomData.data());
-    } else if (!sphereGeomData.empty()) {
-        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 1, sphereHeight, GL_RGBA,
-            GL_FLOAT, sphereGeomData.data());
+        if (withMaterials) {
+            appendMaterial(sphereMaterialData, s);
+        }
     }
 
-    // Upload sphere material texture (width=4)
-    glBindTexture(GL_TEXTURE_2D, m_sphereMaterialTexture);
-    if (sphereNeedsRealloc) {
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, 4, sphereHeight, 0, GL_RGBA,
-            GL_FLOAT,
-            sphereMaterialData.empty() ? nullptr : sphereMaterialData.data());
-        m_lastSphereTextureHeight = sphereHeight;
-    } else if (!sphereMaterialData.empty()) {
-        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 4, sphereHeight, GL_RGBA,
-            GL_FLOAT, sphereMaterialData.data());
+    int sphereRowCount = std::max(1, static_cast<int>(m_spheres.size()));
+    int geomRowCount = m_lastSphereRowCount;
+    m_uploadBytes += uploadTexture(m_sphereGeomTexture, RGBA32F,
+        m_sceneTextureWidth, 1, sphereRowCount, geomRowCount, sphereGeomData,
+        rows);
+    if (withMaterials) {
+        m_uploadBytes += uploadTexture(m_sphereMaterialTexture, RGBA32F,
+            m_sceneTextureWidth, 4, sphereRowCount, m_lastSphereRowCount,
+            sphereMaterialData, rows);
     }
+}
 
+void PathTracingRenderer::uploadPlaneTextures(
+    bool withMaterials, const std::vector<TextureRowRange> &rows)
+{
     // Build plane texture data
     std::vector<float> planeGeomData;
     std::vector<float> planeMaterialData;
     planeGeomData.reserve(m_planes.size() * 2 * 4);
-    planeMaterialData.reserve(m_planes.size() * 4 * 4);
+    if (withMaterials) {
+        planeMaterialData.reserve(m_planes.size() * 4 * 4);
+    }
 
     for (const auto &p : m_planes) {
         // Geometry: 2 pixels per plane
@@ -1467,156 +2320,293 @@ void PathTracingRenderer::rebuildTriangleArray()
         planeGeomData.push_back(0.0f);
 
         // Material: 4 pixels per plane
-        // Pixel 0: [color.xyz, percentSpecular]
-        planeMaterialData.push_back(p.color.x);
-        planeMaterialData.push_back(p.color.y);
-        planeMaterialData.push_back(p.color.z);
-        planeMaterialData.push_back(p.percentSpecular);
-
-        // Pixel 1: [emissive.xyz, roughness]
-        planeMaterialData.push_back(p.emissive.x);
-        planeMaterialData.push_back(p.emissive.y);
-        planeMaterialData.push_back(p.emissive.z);
-        planeMaterialData.push_back(p.roughness);
-
-        // Pixel 2: [specularColor.xyz, indexOfRefraction]
-        planeMaterialData.push_back(p.specularColor.x);
-        planeMaterialData.push_back(p.specularColor.y);
-        planeMaterialData.push_back(p.specularColor.z);
-        planeMaterialData.push_back(p.indexOfRefraction);
-
-        // Pixel 3: [refractionChance, padding, padding, padding]
-        planeMaterialData.push_back(p.refractionChance);
-        planeMaterialData.push_back(0.0f);
-        planeMaterialData.push_back(0.0f);
-        planeMaterialData.push_back(0.0f);
-    }
-
-    int planeHeight = std::max(1, static_cast<int>(m_planes.size()));
-    bool planeNeedsRealloc = (planeHeight != m_lastPlaneTextureHeight);
-
-    // Upload plane geometry texture
-    glBindTexture(GL_TEXTURE_2D, m_planeGeomTexture);
-    if (planeNeedsRealloc) {
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, 2, planeHeight, 0, GL_RGBA,
-            GL_FLOAT, planeGeomData.empty() ? nullptr : planeGeomData.data());
-    } else if (!planeGeomData.empty()) {
-        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 2, planeHeight, GL_RGBA,
-            GL_FLOAT, planeGeomData.data());
+        if (withMaterials) {
+            appendMaterial(planeMaterialData, p);
+        }
     }
 
-    // Upload plane material texture (width=4)
-    glBindTexture(GL_TEXTURE_2D, m_planeMaterialTexture);
-    if (planeNeedsRealloc) {
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, 4, planeHeight, 0, GL_RGBA,
-            GL_FLOAT,
-            planeMaterialData.empty() ? nullptr : planeMaterialData.data());
-        m_lastPlaneTextureHeight = planeHeight;
-    } else if (!planeMaterialData.empty()) {
-        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 4, planeHeight, GL_RGBA,
-            GL_FLOAT, planeMaterialData.data());
-    }
-
-    // Build BVH node texture data
-    // Format: 2 pixels per node
-    // Pixel 0: [bounds.min.xyz, intBitsToFloat(leftChild)]
-    // Pixel 1: [bounds.max.xyz, intBitsToFloat(packed_data)]
-    // For leaves: packed_data = primStart | (primCount << 16)
-    // For internal: packed_data = rightChild
-    std::vector<float> bvhData;
-    const auto &bvhNodes = m_bvh.getNodes();
-    bvhData.reserve(bvhNodes.size() * 2 * 4);
-
-    for (const auto &node : bvhNodes) {
-        // Pixel 0: [bounds.min.xyz, leftChild as float bits]
-        bvhData.push_back(node.bounds.min.x);
-        bvhData.push_back(node.bounds.min.y);
-        bvhData.push_back(node.bounds.min.z);
-        float leftChildFloat;
-        std::memcpy(&leftChildFloat, &node.leftChild, sizeof(float));
-        bvhData.push_back(leftChildFloat);
-
-        // Pixel 1: [bounds.max.xyz, packed_data as float bits]
-        bvhData.push_back(node.bounds.max.x);
-        bvhData.push_back(node.bounds.max.y);
-        bvhData.push_back(node.bounds.max.z);
-
-        int packedData;
-        if (node.isLeaf()) {
-            // Pack primStart and primCount: primStart in lower 16 bits,
-            // primCount in upper 16
-            packedData = (node.primitiveStart & 0xFFFF)
-                | ((node.primitiveCount & 0xFFFF) << 16);
-        } else {
-            packedData = node.rightChild;
-        }
-        float packedFloat;
-        std::memcpy(&packedFloat, &packedData, sizeof(float));
-        bvhData.push_back(packedFloat);
+    int planeRowCount = std::max(1, static_cast<int>(m_planes.size()));
+    int geomRowCount = m_lastPlaneRowCount;
+    m_uploadBytes += uploadTexture(m_planeGeomTexture, RGBA32F,
+        m_sceneTextureWidth, 2, planeRowCount, geomRowCount, planeGeomData,
+        rows);
+    if (withMaterials) {
+        m_uploadBytes += uploadTexture(m_planeMaterialTexture, RGBA32F,
+            m_sceneTextureWidth, 4, planeRowCount, m_lastPlaneRowCount,
+            planeMaterialData, rows);
     }
+}
+
+void PathTracingRenderer::uploadInstanceTexture(
+    const std::vector<TextureRowRange> &rows)
+{
+    // Format: 4 pixels per instance
+    // Pixels 0-2: rows of the affine world-to-object matrix
+    // Pixel 3: [intBitsToFloat(blasRoot), intBitsToFloat(blasPrimBase),
+    //           intBitsToFloat(materialRow), 0]
+    // Instances of a shared mesh only differ by their matrix and material
+    std::vector<float> instanceData;
+    instanceData.reserve(m_instances.size() * 4 * 4);
+
+    for (const auto &instance : m_instances) {
+        for (int row = 0; row < 3; row++) {
+            for (int col = 0; col < 4; col++) {
+                instanceData.push_back(instance.worldToObject[col][row]);
+            }
+        }
 
-    int bvhHeight = std::max(1, static_cast<int>(bvhNodes.size()));
-    bool bvhNeedsRealloc = (bvhHeight != m_lastBVHTextureHeight);
+        const ObjectData &objData = m_objects[instance.objectId];
+        float rootFloat;
+        std::memcpy(&rootFloat, &objData.mesh->blasNodeBase, sizeof(float));
+        float primBaseFloat;
+        std::memcpy(
+            &primBaseFloat, &objData.mesh->blasPrimitiveBase, sizeof(float));
+        float materialFloat;
+        std::memcpy(&materialFloat, &objData.materialIndex, sizeof(float));
+        instanceData.push_back(rootFloat);
+        instanceData.push_back(primBaseFloat);
+        instanceData.push_back(materialFloat);
+        instanceData.push_back(0.0f);
+    }
+
+    int instanceRowCount = std::max(1, static_cast<int>(m_instances.size()));
+    m_uploadBytes += uploadTexture(m_instanceTexture, RGBA32F,
+        m_sceneTextureWidth, 4, instanceRowCount, m_lastInstanceRowCount,
+        instanceData, rows);
+}
 
-    // Upload BVH node texture
-    glBindTexture(GL_TEXTURE_2D, m_bvhNodeTexture);
-    if (bvhNeedsRealloc) {
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, 2, bvhHeight, 0, GL_RGBA,
-            GL_FLOAT, bvhData.empty() ? nullptr : bvhData.data());
-        m_lastBVHTextureHeight = bvhHeight;
-    } else if (!bvhData.empty()) {
-        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 2, bvhHeight, GL_RGBA,
-            GL_FLOAT, bvhData.data());
+void PathTracingRenderer::updateLightTable()
+{
+    m_lights.clear();
+    for (const auto &objData : m_objects) {
+        if (!objData.renderObject || !objData.mesh
+            || objData.materialIndex < 0) {
+            continue;
+        }
+        const glm::vec3 &emissive
+            = m_materials[objData.materialIndex].emissive;
+        if (LightTable::luminance(emissive) <= 0.0f) {
+            continue;
+        }
+        // Shared meshes are in object space, lights are sampled in world
+        // space
+        const glm::mat4 &transform = objData.transform;
+        for (const auto &t : objData.mesh->blasTriangles) {
+            m_lights.addTriangle(glm::vec3(transform * glm::vec4(t.v0, 1.0f)),
+                glm::vec3(transform * glm::vec4(t.v1, 1.0f)),
+                glm::vec3(transform * glm::vec4(t.v2, 1.0f)), emissive);
+        }
     }
+    for (const auto &sphere : m_spheres) {
+        m_lights.addSphere(sphere.center, sphere.radius, sphere.emissive);
+    }
+    m_lights.finalize();
+
+    // Format: 4 pixels per light
+    // Pixel 0: [v0.xyz or sphere center, cdf]
+    // Pixel 1: [v1.xyz or (radius, 0, 0), type: 0=triangle, 1=sphere]
+    // Pixel 2: [v2.xyz, 0]
+    // Pixel 3: [emissive.rgb, 0]
+    const std::vector<LightData> &lights = m_lights.getLights();
+    std::vector<float> lightData;
+    lightData.reserve(lights.size() * 4 * 4);
+    for (const auto &light : lights) {
+        const float pixels[16] = { light.v0.x, light.v0.y, light.v0.z,
+            light.cdf, light.v1.x, light.v1.y, light.v1.z,
+            static_cast<float>(light.type), light.v2.x, light.v2.y,
+            light.v2.z, 0.0f, light.emissive.r, light.emissive.g,
+            light.emissive.b, 0.0f };
+        lightData.insert(lightData.end(), pixels, pixels + 16);
+    }
+
+    int lightRowCount = std::max(1, static_cast<int>(lights.size()));
+    m_uploadBytes += uploadTexture(m_lightTexture, RGBA32F,
+        m_sceneTextureWidth, 4, lightRowCount, m_lastLightRowCount, lightData);
+
+    m_pathTracingShader.use();
+    m_pathTracingShader.setInt("numLights", static_cast<int>(lights.size()));
+    m_pathTracingShader.setFloat("lightTotalPower", m_lights.getTotalPower());
+}
+
+void PathTracingRenderer::uploadBVHTextures(bool topLevelOnly)
+{
+    // The top level comes first, then each mesh BLAS with its node links
+    // offset to absolute rows. Leaf primitive starts stay relative to the
+    // BVH's own primitive range, the instance carries that base.
+    const int rowWidth = getBVHNodeRowWidth();
+    std::vector<uint32_t> bvhData;
 
     // Build BVH primitive texture data
-    // Format: 1 pixel per primitive [type, originalIndex, 0, 0]
+    // Format: 1 pixel per primitive [type, index, 0, 0], in leaf order of
+    // the uploaded layout
+    // Triangle indices are absolute rows of the triangle textures
     std::vector<float> bvhPrimData;
-    const auto &bvhPrimitives = m_bvh.getPrimitives();
-    bvhPrimData.reserve(bvhPrimitives.size() * 4);
-
-    for (const auto &prim : bvhPrimitives) {
-        // Pixel: [type as float, originalIndex as float bits, 0, 0]
-        bvhPrimData.push_back(
-            static_cast<float>(static_cast<int>(prim.type))); // 0=triangle,
-                                                              // 1=sphere
+    auto appendPrimitive = [&bvhPrimData](
+                               const BVHPrimitive &prim, int triangleBase) {
+        // Pixel: [type as float, index as float bits, 0, 0]
+        bvhPrimData.push_back(static_cast<float>(
+            static_cast<int>(prim.type))); // 0=triangle, 1=sphere,
+                                           // 2=instance
+        int index = prim.originalIndex;
+        if (prim.type == BVHPrimitiveType::Triangle) {
+            index += triangleBase;
+        }
         float indexFloat;
-        std::memcpy(&indexFloat, &prim.originalIndex, sizeof(float));
+        std::memcpy(&indexFloat, &index, sizeof(float));
         bvhPrimData.push_back(indexFloat);
         bvhPrimData.push_back(0.0f);
         bvhPrimData.push_back(0.0f);
+    };
+
+    // Appends the rows of one BVH, returns how many nodes it took
+    auto appendBVH = [&](const BVH &bvh, const WideBVH &wide, int nodeBase,
+                         int triangleBase) {
+        if (m_stacklessBVH) {
+            auto skipNodes = bvh.buildSkipNodes(SKIP_LEAF_MAX_PRIMITIVES);
+            appendSkipNodes(bvhData, skipNodes, nodeBase);
+            for (const auto &prim : bvh.getPrimitives()) {
+                appendPrimitive(prim, triangleBase);
+            }
+            return static_cast<int>(skipNodes.size());
+        }
+        appendWideNodes(bvhData, wide, m_bvhWidth, nodeBase);
+        for (int order : wide.getPrimitiveOrder()) {
+            appendPrimitive(bvh.getPrimitives()[order], triangleBase);
+        }
+        return wide.getNodeCount();
+    };
+
+    int tlasNodeCount = appendBVH(m_bvh, m_wideTLAS, 0, 0);
+
+    // The top level always goes up. A top-level refit keeps every BLAS at
+    // its rows as long as the layout has as many nodes as before.
+    const int tlasPrimitiveCount = m_bvh.getPrimitiveCount();
+    std::vector<TextureRowRange> nodeRows { { 0, tlasNodeCount } };
+    std::vector<TextureRowRange> primRows { { 0, tlasPrimitiveCount } };
+    if (topLevelOnly && tlasNodeCount == m_uploadedTLASNodeCount) {
+        m_uploadBytes += uploadTexture(m_bvhNodeTexture, RGBA32UI,
+            m_sceneTextureWidth, rowWidth, m_lastBVHRowCount,
+            m_lastBVHRowCount, bvhData, nodeRows);
+        m_uploadBytes += uploadTexture(m_bvhPrimTexture, RGBA32F,
+            m_sceneTextureWidth, 1, m_lastBVHPrimRowCount,
+            m_lastBVHPrimRowCount, bvhPrimData, primRows);
+        return;
     }
 
-    int bvhPrimHeight = std::max(1, static_cast<int>(bvhPrimitives.size()));
-    bool bvhPrimNeedsRealloc = (bvhPrimHeight != m_lastBVHPrimTextureHeight);
+    // Otherwise a BLAS is only sent again when it was rebuilt or has to
+    // move to other rows
+    int nodeBase = tlasNodeCount;
+    int primitiveBase = tlasPrimitiveCount;
+    for (auto &mesh : m_meshes) {
+        if (mesh->blas.getNodeCount() == 0) {
+            continue;
+        }
+        const int nodeCount = appendBVH(
+            mesh->blas, mesh->wideBlas, nodeBase, mesh->triangleStartIndex);
+        const int primitiveCount = mesh->blas.getPrimitiveCount();
+        if (mesh->uploadDirty || mesh->blasNodeBase != nodeBase
+            || mesh->blasPrimitiveBase != primitiveBase) {
+            nodeRows.push_back({ nodeBase, nodeCount });
+            primRows.push_back({ primitiveBase, primitiveCount });
+        }
+        mesh->blasNodeBase = nodeBase;
+        mesh->blasPrimitiveBase = primitiveBase;
+        nodeBase += nodeCount;
+        primitiveBase += primitiveCount;
+    }
+    m_uploadedTLASNodeCount = tlasNodeCount;
+
+    int bvhRowCount = std::max(1, nodeBase);
+    m_uploadBytes += uploadTexture(m_bvhNodeTexture, RGBA32UI,
+        m_sceneTextureWidth, rowWidth, bvhRowCount, m_lastBVHRowCount,
+        bvhData, nodeRows);
+
+    int bvhPrimRowCount = std::max(1, primitiveBase);
+    m_uploadBytes += uploadTexture(m_bvhPrimTexture, RGBA32F,
+        m_sceneTextureWidth, 1, bvhPrimRowCount, m_lastBVHPrimRowCount,
+        bvhPrimData, primRows);
+}
 
-    // Upload BVH primitive texture
-    glBindTexture(GL_TEXTURE_2D, m_bvhPrimTexture);
-    if (bvhPrimNeedsRealloc) {
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, 1, bvhPrimHeight, 0,
-            GL_RGBA, GL_FLOAT,
-            bvhPrimData.empty() ? nullptr : bvhPrimData.data());
-        m_lastBVHPrimTextureHeight = bvhPrimHeight;
-    } else if (!bvhPrimData.empty()) {
-        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 1, bvhPrimHeight, GL_RGBA,
-            GL_FLOAT, bvhPrimData.data());
+bool PathTracingRenderer::getAccelerationSettings(
+    AccelerationSettings &settings) const
+{
+    settings.spatialSplits = m_spatialSplits;
+    settings.spatialSplitBudget = m_spatialSplitBudget;
+    settings.optimize = m_optimizeBVH;
+    settings.stackless = m_stacklessBVH;
+    settings.bvhWidth = m_bvhWidth;
+    return true;
+}
+
+void PathTracingRenderer::setAccelerationSettings(
+    const AccelerationSettings &settings)
+{
+    setSpatialSplits(settings.spatialSplits);
+    setSpatialSplitBudget(settings.spatialSplitBudget);
+    setBVHOptimization(settings.optimize);
+    setStacklessBVH(settings.stackless);
+    setBVHWidth(settings.bvhWidth);
+}
+
+void PathTracingRenderer::setBVHWidth(int width)
+{
+    width = width >= 8 ? 8 : 4;
+    if (width == m_bvhWidth) {
+        return;
     }
+    m_bvhWidth = width;
+    // The node rows change size, force a reallocation
+    m_lastBVHRowCount = 0;
+    m_trianglesDirty = true;
+}
 
-    m_pathTracingShader.use();
-    m_pathTracingShader.setInt("triangleGeomTex", 1);
-    m_pathTracingShader.setInt("triangleMaterialTex", 2);
-    m_pathTracingShader.setInt(
-        "numTriangles", static_cast<int>(m_triangles.size()));
-    m_pathTracingShader.setInt("sphereGeomTex", 3);
-    m_pathTracingShader.setInt("sphereMaterialTex", 4);
-    m_pathTracingShader.setInt(
-        "numSpheres", static_cast<int>(m_spheres.size()));
-    m_pathTracingShader.setInt("planeGeomTex", 5);
-    m_pathTracingShader.setInt("planeMaterialTex", 6);
-    m_pathTracingShader.setInt("numPlanes", static_cast<int>(m_planes.size()));
-    m_pathTracingShader.setInt("bvhNodeTex", 7);
-    m_pathTracingShader.setInt("bvhPrimTex", 8);
-    m_pathTracingShader.setInt("numBVHNodes", m_bvh.getNodeCount());
+void PathTracingRenderer::setStacklessBVH(bool enabled)
+{
+    if (enabled == m_stacklessBVH) {
+        return;
+    }
+    m_stacklessBVH = enabled;
+    m_lastBVHRowCount = 0;
+    m_trianglesDirty = true;
+}
+
+void PathTracingRenderer::setSpatialSplits(bool enabled)
+{
+    if (enabled == m_spatialSplits) {
+        return;
+    }
+    m_spatialSplits = enabled;
+    for (auto &mesh : m_meshes) {
+        mesh->blasDirty = true;
+    }
+    m_trianglesDirty = true;
+}
+
+void PathTracingRenderer::setSpatialSplitBudget(float budget)
+{
+    budget = std::clamp(budget, 0.0f, 1.0f);
+    if (budget == m_spatialSplitBudget) {
+        return;
+    }
+    m_spatialSplitBudget = budget;
+    if (m_spatialSplits) {
+        for (auto &mesh : m_meshes) {
+            mesh->blasDirty = true;
+        }
+        m_trianglesDirty = true;
+    }
+}
+
+void PathTracingRenderer::setBVHOptimization(bool enabled)
+{
+    if (enabled == m_optimizeBVH) {
+        return;
+    }
+    m_optimizeBVH = enabled;
+    for (auto &mesh : m_meshes) {
+        mesh->blasDirty = true;
+    }
+    m_trianglesDirty = true;
 }
 
 void PathTracingRenderer::setToneMappingMode(ToneMappingMode mode)
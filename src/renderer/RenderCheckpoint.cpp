@@ -0,0 +1,133 @@
+#include "renderer/RenderCheckpoint.hpp"
+#include "renderer/Hash.hpp"
+#include <array>
+#include <fstream>
+#include <iostream>
+#include <system_error>
+#include <type_traits>
+
+namespace {
+
+constexpr std::array<char, 8> CHECKPOINT_MAGIC = { 'S', 'L', 'C', 'K', 'P',
+    'T', '\0', '\0' };
+
+static_assert(std::is_trivially_copyable_v<glm::vec3>);
+static_assert(std::is_trivially_copyable_v<SurfaceAOV>);
+// Checksums cover the raw bytes, which must not include padding
+static_assert(sizeof(SurfaceAOV) == 7 * sizeof(float));
+
+// Written as is, followed by the width * height pixels of the image, the
+// AOVs and the moments, one array after the other
+struct CheckpointHeader {
+    std::array<char, 8> magic;
+    uint32_t version;
+    int32_t width;
+    int32_t height;
+    int32_t frameCount;
+    uint64_t key;
+    uint64_t checksum; // Of the three arrays
+};
+
+template <typename T> size_t byteSize(const std::vector<T> &values)
+{
+    return values.size() * sizeof(T);
+}
+
+uint64_t checksum(const std::vector<glm::vec3> &image,
+    const std::vector<SurfaceAOV> &aovs, const std::vector<glm::vec3> &moments)
+{
+    uint64_t hash = fnv1aHash(FNV1A_SEED, image.data(), byteSize(image));
+    hash = fnv1aHash(hash, aovs.data(), byteSize(aovs));
+    return fnv1aHash(hash, moments.data(), byteSize(moments));
+}
+
+template <typename T>
+void writeArray(std::ofstream &file, const std::vector<T> &values)
+{
+    file.write(reinterpret_cast<const char *>(values.data()),
+        static_cast<std::streamsize>(byteSize(values)));
+}
+
+template <typename T>
+bool readArray(std::ifstream &file, std::vector<T> &values)
+{
+    return static_cast<bool>(file.read(reinterpret_cast<char *>(values.data()),
+        static_cast<std::streamsize>(byteSize(values))));
+}
+
+} // namespace
+
+bool RenderCheckpoint::save(const std::filesystem::path &path, uint64_t key,
+    const CPUPathTracer &tracer)
+{
+    const std::vector<glm::vec3> &image = tracer.getImage();
+    const std::vector<SurfaceAOV> &aovs = tracer.getAOVs();
+    const std::vector<glm::vec3> &moments = tracer.getMoments();
+
+    CheckpointHeader header {};
+    header.magic = CHECKPOINT_MAGIC;
+    header.version = FORMAT_VERSION;
+    header.width = tracer.getWidth();
+    header.height = tracer.getHeight();
+    header.frameCount = tracer.getFrameCount();
+    header.key = key;
+    header.checksum = checksum(image, aovs, moments);
+
+    std::filesystem::path tempPath = path;
+    tempPath += ".tmp";
+    {
+        std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        writeArray(file, image);
+        writeArray(file, aovs);
+        writeArray(file, moments);
+        if (!file) {
+            std::cerr << "[ERROR] Failed to write checkpoint: " << tempPath
+                      << std::endl;
+            return false;
+        }
+    }
+
+    std::error_code error;
+    std::filesystem::rename(tempPath, path, error);
+    if (error) {
+        std::cerr << "[ERROR] Failed to write checkpoint: " << path << " ("
+                  << error.message() << ")" << std::endl;
+        std::filesystem::remove(tempPath, error);
+        return false;
+    }
+    return true;
+}
+
+bool RenderCheckpoint::load(const std::filesystem::path &path, uint64_t key,
+    CPUPathTracer &tracer)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        return false;
+    }
+
+    CheckpointHeader header {};
+    if (!file.read(reinterpret_cast<char *>(&header), sizeof(header))
+        || header.magic != CHECKPOINT_MAGIC
+        || header.version != FORMAT_VERSION || header.key != key
+        || header.width != tracer.getWidth()
+        || header.height != tracer.getHeight() || header.frameCount < 0) {
+        return false;
+    }
+
+    const size_t pixels = tracer.getImage().size();
+    std::vector<glm::vec3> image(pixels);
+    std::vector<SurfaceAOV> aovs(pixels);
+    std::vector<glm::vec3> moments(pixels);
+    if (!readArray(file, image) || !readArray(file, aovs)
+        || !readArray(file, moments)
+        || file.peek() != std::ifstream::traits_type::eof()
+        || checksum(image, aovs, moments) != header.checksum) {
+        std::cerr << "[WARN] Ignoring corrupt checkpoint: " << path
+                  << std::endl;
+        return false;
+    }
+    return tracer.restoreAccumulation(std::move(image), std::move(aovs),
+        std::move(moments), header.frameCount);
+}
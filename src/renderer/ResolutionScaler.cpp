@@ -0,0 +1,42 @@
+#include "renderer/ResolutionScaler.hpp"
+#include <algorithm>
+#include <cmath>
+
+ResolutionScaler::ResolutionScaler(const Settings &settings)
+    : m_settings(settings)
+{
+}
+
+float ResolutionScaler::update(bool moving, float frameMs)
+{
+    if (!moving) {
+        m_stillFrames++;
+        if (m_stillFrames >= m_settings.settleFrames) {
+            m_scale = 1.0f;
+        }
+        return m_scale;
+    }
+
+    m_stillFrames = 0;
+    if (frameMs <= 0.0f) {
+        return m_scale;
+    }
+    float ideal = m_scale * std::sqrt(m_settings.frameBudgetMs / frameMs);
+    float scale = std::floor(ideal / m_settings.step) * m_settings.step;
+    // Going up needs some margin, or a frame time right at a step would
+    // flip between the two
+    if (scale > m_scale && ideal < scale + m_settings.step * 0.5f) {
+        scale -= m_settings.step;
+    }
+    m_scale = std::clamp(scale, m_settings.minScale, 1.0f);
+    return m_scale;
+}
+
+glm::ivec2 ResolutionScaler::scaledSize(const glm::ivec2 &size) const
+{
+    auto scaled = [this](int length) {
+        float scaledLength = static_cast<float>(length) * m_scale;
+        return std::max(1, static_cast<int>(std::lround(scaledLength)));
+    };
+    return glm::ivec2(scaled(size.x), scaled(size.y));
+}
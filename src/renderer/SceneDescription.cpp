@@ -0,0 +1,278 @@
+#include "renderer/SceneDescription.hpp"
+#include <cstdlib>
+#include <fstream>
+#include <glm/gtc/matrix_transform.hpp>
+#include <iostream>
+#include <sstream>
+#include <unordered_map>
+
+namespace {
+
+// Defaults match a freshly created editor object
+MaterialData defaultMaterial()
+{
+    MaterialData m;
+    m.color = glm::vec3(0.8f);
+    m.emissive = glm::vec3(0.0f);
+    m.percentSpecular = 0.0f;
+    m.roughness = 0.5f;
+    m.specularColor = glm::vec3(1.0f);
+    m.indexOfRefraction = 1.0f;
+    m.refractionChance = 0.0f;
+    return m;
+}
+
+// Spheres and planes carry their own copy of the material
+template <typename T> void applyMaterial(T &primitive, const MaterialData &m)
+{
+    primitive.color = m.color;
+    primitive.emissive = m.emissive;
+    primitive.percentSpecular = m.percentSpecular;
+    primitive.roughness = m.roughness;
+    primitive.specularColor = m.specularColor;
+    primitive.indexOfRefraction = m.indexOfRefraction;
+    primitive.refractionChance = m.refractionChance;
+}
+
+bool readVec3(std::istream &in, glm::vec3 &v)
+{
+    return static_cast<bool>(in >> v.x >> v.y >> v.z);
+}
+
+bool parseMaterial(std::istream &in, MaterialData &m)
+{
+    std::string key;
+    while (in >> key) {
+        bool ok = false;
+        if (key == "color") {
+            ok = readVec3(in, m.color);
+        } else if (key == "emissive") {
+            ok = readVec3(in, m.emissive);
+        } else if (key == "specular") {
+            ok = static_cast<bool>(in >> m.percentSpecular);
+        } else if (key == "roughness") {
+            ok = static_cast<bool>(in >> m.roughness);
+        } else if (key == "specularColor") {
+            ok = readVec3(in, m.specularColor);
+        } else if (key == "ior") {
+            ok = static_cast<bool>(in >> m.indexOfRefraction);
+        } else if (key == "refraction") {
+            ok = static_cast<bool>(in >> m.refractionChance);
+        }
+        if (!ok) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Object-to-world matrix from the options after a mesh path
+bool parseTransform(std::istream &in, glm::mat4 &transform)
+{
+    glm::vec3 position(0.0f);
+    glm::vec3 rotation(0.0f);
+    glm::vec3 scale(1.0f);
+    std::string key;
+    while (in >> key) {
+        bool ok = false;
+        if (key == "translate") {
+            ok = readVec3(in, position);
+        } else if (key == "rotate") {
+            ok = readVec3(in, rotation);
+        } else if (key == "scale") {
+            ok = static_cast<bool>(in >> scale.x);
+            if (ok && (in >> scale.y)) {
+                ok = static_cast<bool>(in >> scale.z);
+            } else if (ok) {
+                // A single factor scales uniformly
+                in.clear();
+                scale = glm::vec3(scale.x);
+            }
+        }
+        if (!ok) {
+            return false;
+        }
+    }
+
+    rotation = glm::radians(rotation);
+    transform = glm::translate(glm::mat4(1.0f), position);
+    transform = glm::rotate(transform, rotation.z, glm::vec3(0, 0, 1));
+    transform = glm::rotate(transform, rotation.y, glm::vec3(0, 1, 0));
+    transform = glm::rotate(transform, rotation.x, glm::vec3(1, 0, 0));
+    transform = glm::scale(transform, scale);
+    return true;
+}
+
+} // namespace
+
+void setFaceNormal(Triangle &tri)
+{
+    glm::vec3 n = glm::cross(tri.v0 - tri.v2, tri.v1 - tri.v0);
+    float len = glm::length(n);
+    tri.normal = len > 1e-8f ? n / len : glm::vec3(0.0f, 1.0f, 0.0f);
+}
+
+bool loadOBJTriangles(const std::filesystem::path &path,
+    const glm::mat4 &transform, uint32_t materialIndex,
+    std::vector<Triangle> &triangles)
+{
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        std::cerr << "[ERROR] Failed to open OBJ file: " << path.string()
+                  << std::endl;
+        return false;
+    }
+
+    std::vector<glm::vec3> positions;
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream iss(line);
+        std::string prefix;
+        iss >> prefix;
+        if (prefix == "v") {
+            glm::vec3 pos(0.0f);
+            iss >> pos.x >> pos.y >> pos.z;
+            positions.push_back(glm::vec3(transform * glm::vec4(pos, 1.0f)));
+        } else if (prefix == "f") {
+            std::vector<int> face;
+            std::string vertexStr;
+            while (iss >> vertexStr) {
+                int index = std::atoi(vertexStr.c_str());
+                if (index < 0) {
+                    index += static_cast<int>(positions.size()) + 1;
+                }
+                if (index <= 0
+                    || index > static_cast<int>(positions.size())) {
+                    std::cerr << "[ERROR] Bad face index in OBJ file: "
+                              << path.string() << std::endl;
+                    return false;
+                }
+                face.push_back(index - 1);
+            }
+            for (size_t i = 2; i < face.size(); i++) {
+                Triangle tri {};
+                tri.v0 = positions[face[0]];
+                tri.v1 = positions[face[i - 1]];
+                tri.v2 = positions[face[i]];
+                setFaceNormal(tri);
+                tri.materialIndex = materialIndex;
+                triangles.push_back(tri);
+            }
+        }
+    }
+    return true;
+}
+
+bool SceneDescription::load(const std::filesystem::path &path)
+{
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        std::cerr << "[ERROR] Failed to open scene file: " << path.string()
+                  << std::endl;
+        return false;
+    }
+    std::stringstream text;
+    text << file.rdbuf();
+    return parse(text.str(), path.parent_path(), path.string());
+}
+
+bool SceneDescription::parse(const std::string &text,
+    const std::filesystem::path &baseDir, const std::string &sourceName)
+{
+    *this = SceneDescription();
+
+    // Row 0 is the default material, each definition adds a row
+    std::unordered_map<std::string, uint32_t> materialRows;
+    materials.push_back(defaultMaterial());
+    uint32_t current = 0;
+
+    std::istringstream input(text);
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(input, line)) {
+        lineNumber++;
+        if (size_t comment = line.find('#'); comment != std::string::npos) {
+            line.erase(comment);
+        }
+        std::istringstream iss(line);
+        std::string keyword;
+        if (!(iss >> keyword)) {
+            continue;
+        }
+
+        bool ok = false;
+        if (keyword == "camera") {
+            Camera camera;
+            ok = (iss >> camera.name) && readVec3(iss, camera.position)
+                && readVec3(iss, camera.rotation);
+            if (ok && !(iss >> camera.fov)) {
+                iss.clear();
+            }
+            ok = ok && camera.fov > 0.0f && camera.fov < 180.0f;
+            cameras.push_back(camera);
+        } else if (keyword == "material") {
+            std::string name;
+            MaterialData material = defaultMaterial();
+            ok = (iss >> name) && parseMaterial(iss, material);
+            materialRows[name] = static_cast<uint32_t>(materials.size());
+            materials.push_back(material);
+        } else if (keyword == "use") {
+            std::string name;
+            auto it = materialRows.end();
+            ok = (iss >> name)
+                && (it = materialRows.find(name)) != materialRows.end();
+            if (ok) {
+                current = it->second;
+            }
+        } else if (keyword == "sphere") {
+            AnalyticalSphereData sphere {};
+            ok = readVec3(iss, sphere.center) && (iss >> sphere.radius)
+                && sphere.radius > 0.0f;
+            applyMaterial(sphere, materials[current]);
+            spheres.push_back(sphere);
+        } else if (keyword == "plane") {
+            AnalyticalPlaneData plane {};
+            ok = readVec3(iss, plane.point) && readVec3(iss, plane.normal)
+                && glm::length(plane.normal) > 0.0f;
+            if (ok) {
+                plane.normal = glm::normalize(plane.normal);
+            }
+            applyMaterial(plane, materials[current]);
+            planes.push_back(plane);
+        } else if (keyword == "triangle") {
+            Triangle tri {};
+            ok = readVec3(iss, tri.v0) && readVec3(iss, tri.v1)
+                && readVec3(iss, tri.v2);
+            setFaceNormal(tri);
+            tri.materialIndex = current;
+            triangles.push_back(tri);
+        } else if (keyword == "mesh") {
+            std::string file;
+            glm::mat4 transform(1.0f);
+            ok = (iss >> file) && parseTransform(iss, transform)
+                && loadOBJTriangles(
+                    baseDir / file, transform, current, triangles);
+        }
+
+        if (!ok) {
+            std::cerr << "[ERROR] " << sourceName << ":" << lineNumber
+                      << ": invalid statement: " << line << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+const SceneDescription::Camera *SceneDescription::findCamera(
+    const std::string &name) const
+{
+    if (name.empty()) {
+        return cameras.empty() ? nullptr : &cameras.front();
+    }
+    for (const Camera &camera : cameras) {
+        if (camera.name == name) {
+            return &camera;
+        }
+    }
+    return nullptr;
+}
@@ -0,0 +1,70 @@
+#include "renderer/ViewScheduler.hpp"
+#include <algorithm>
+
+namespace {
+
+// Floor on pass costs, so a bogus zero timing cannot ask for endless passes
+constexpr float MIN_PASS_MS = 0.001f;
+
+} // namespace
+
+ViewScheduler::ViewScheduler(const Settings &settings)
+    : m_settings(settings)
+{
+}
+
+std::vector<ViewScheduler::Allocation> ViewScheduler::schedule(
+    const std::vector<ViewState> &views)
+{
+    std::vector<float> weights(views.size(), 0.0f);
+    float weightSum = 0.0f;
+    for (size_t i = 0; i < views.size(); i++) {
+        const ViewState &view = views[i];
+        if (!view.visible || view.pixels <= 0) {
+            continue;
+        }
+        float noisy = 1.0f - std::clamp(view.convergedFraction, 0.0f, 1.0f);
+        float weight = static_cast<float>(view.pixels)
+            * (m_settings.convergedWeight
+                + (1.0f - m_settings.convergedWeight) * noisy);
+        if (view.focused) {
+            weight *= m_settings.focusWeight;
+        }
+        weights[i] = weight;
+        weightSum += weight;
+    }
+
+    // Hidden views lose their savings, they start afresh when shown
+    std::unordered_map<int, float> savedMs;
+    std::vector<Allocation> allocations(views.size());
+    for (size_t i = 0; i < views.size(); i++) {
+        const ViewState &view = views[i];
+        if (weights[i] <= 0.0f) {
+            continue;
+        }
+        Allocation &allocation = allocations[i];
+        allocation.budgetMs
+            = m_settings.frameBudgetMs * weights[i] / weightSum;
+
+        float passMs = view.passMs;
+        if (passMs <= 0.0f) {
+            passMs = static_cast<float>(view.pixels) * 1e-6f
+                * m_settings.defaultMsPerMegapixel;
+        }
+        passMs = std::max(passMs, MIN_PASS_MS);
+        const auto saved = m_savedMs.find(view.id);
+        float availableMs = allocation.budgetMs
+            + (saved != m_savedMs.end() ? saved->second : 0.0f);
+        allocation.passes = std::min(m_settings.maxPassesPerFrame,
+            static_cast<int>(availableMs / passMs));
+        if (view.moving) {
+            allocation.passes = std::max(allocation.passes, 1);
+        }
+        // What is left carries over, at most a pass ahead or behind
+        savedMs[view.id] = std::clamp(
+            availableMs - static_cast<float>(allocation.passes) * passMs,
+            -passMs, passMs);
+    }
+    m_savedMs = std::move(savedMs);
+    return allocations;
+}
@@ -0,0 +1,179 @@
+#include "renderer/WideBVH.hpp"
+#include <algorithm>
+#include <cmath>
+#include <tuple>
+#include <utility>
+
+namespace {
+
+// A leaf child's count shares its field with the internal flag
+constexpr int MAX_CHILD_PRIMITIVES = WIDE_BVH_INTERNAL - 1;
+
+// Smallest grid step 2^e for which 255 steps from lo reach hi
+int quantizationExponent(float lo, float hi)
+{
+    float extent = hi - lo;
+    if (!(extent > 0.0f)) {
+        return 0;
+    }
+    int exponent;
+    std::frexp(extent / 255.0f, &exponent);
+    while (lo + std::ldexp(255.0f, exponent) < hi) {
+        exponent++;
+    }
+    return std::clamp(exponent, -126, 127);
+}
+
+WideBVHChild quantizeChild(
+    const WideBVHNode &node, const AABB &bounds, uint16_t meta)
+{
+    WideBVHChild child;
+    child.meta = meta;
+    for (int axis = 0; axis < 3; axis++) {
+        float origin = node.origin[axis];
+        float step = std::ldexp(1.0f, node.exponent[axis]);
+        int lo = static_cast<int>(
+            std::floor((bounds.min[axis] - origin) / step));
+        int hi = static_cast<int>(
+            std::ceil((bounds.max[axis] - origin) / step));
+        lo = std::clamp(lo, 0, 255);
+        hi = std::clamp(hi, 0, 255);
+
+        // Rounding in the subtraction may leave the box one step short
+        while (lo > 0 && origin + static_cast<float>(lo) * step
+                   > bounds.min[axis]) {
+            lo--;
+        }
+        while (hi < 255
+            && origin + static_cast<float>(hi) * step < bounds.max[axis]) {
+            hi++;
+        }
+        child.qlo[axis] = static_cast<uint8_t>(lo);
+        child.qhi[axis] = static_cast<uint8_t>(hi);
+    }
+    return child;
+}
+
+} // namespace
+
+void WideBVH::build(const BVH &bvh, int width)
+{
+    clear();
+    m_width = std::clamp(width, 2, WIDE_BVH_MAX_WIDTH);
+
+    if (bvh.getNodeCount() == 0) {
+        return;
+    }
+
+    m_nodes.reserve(bvh.getNodeCount() / 2 + 1);
+    m_primitiveOrder.reserve(bvh.getPrimitiveCount());
+    m_nodes.emplace_back();
+    const BVHNode &root = bvh.getNodes()[0];
+    collapse(bvh, Slot { 0, root.primitiveStart, root.primitiveCount }, 0);
+}
+
+void WideBVH::collapse(const BVH &bvh, const Slot &slot, int wideIndex)
+{
+    const auto &nodes = bvh.getNodes();
+    auto slotOf = [&](int index) {
+        const BVHNode &node = nodes[index];
+        return Slot { index, node.primitiveStart, node.primitiveCount };
+    };
+    // Internal nodes open into their children, leaves too large for a
+    // child's count into halves with the leaf's bounds
+    auto canOpen = [](const Slot &s) {
+        return s.primitiveCount == 0
+            || s.primitiveCount > MAX_CHILD_PRIMITIVES;
+    };
+    auto open = [&](const Slot &s) -> std::pair<Slot, Slot> {
+        if (s.primitiveCount == 0) {
+            return { slotOf(nodes[s.node].leftChild),
+                slotOf(nodes[s.node].rightChild) };
+        }
+        int half = s.primitiveCount / 2;
+        return { Slot { s.node, s.primitiveStart, half },
+            Slot { s.node, s.primitiveStart + half,
+                s.primitiveCount - half } };
+    };
+
+    // Gather children by repeatedly opening the child with the largest
+    // surface area, the one most rays would descend into
+    std::array<Slot, WIDE_BVH_MAX_WIDTH> slots {};
+    int count = 0;
+    if (!canOpen(slot)) {
+        slots[count++] = slot;
+    } else {
+        std::tie(slots[0], slots[1]) = open(slot);
+        count = 2;
+        while (count < m_width) {
+            int best = -1;
+            float bestArea = -1.0f;
+            for (int i = 0; i < count; i++) {
+                float area = nodes[slots[i].node].bounds.surfaceArea();
+                if (canOpen(slots[i]) && area > bestArea) {
+                    best = i;
+                    bestArea = area;
+                }
+            }
+            if (best < 0) {
+                break;
+            }
+            std::tie(slots[best], slots[count]) = open(slots[best]);
+            count++;
+        }
+    }
+
+    // Quantization grid spans the node bounds
+    WideBVHNode node;
+    const AABB &bounds = nodes[slot.node].bounds;
+    node.origin = bounds.min;
+    for (int axis = 0; axis < 3; axis++) {
+        node.exponent[axis] = static_cast<int8_t>(
+            quantizationExponent(bounds.min[axis], bounds.max[axis]));
+    }
+
+    // Leaf children keep their primitives next to each other
+    node.primBase = static_cast<int>(m_primitiveOrder.size());
+    int internalCount = 0;
+    for (int i = 0; i < count; i++) {
+        const Slot &child = slots[i];
+        const AABB &childBounds = nodes[child.node].bounds;
+        if (!canOpen(child)) {
+            for (int p = 0; p < child.primitiveCount; p++) {
+                m_primitiveOrder.push_back(child.primitiveStart + p);
+            }
+            node.children[i] = quantizeChild(node, childBounds,
+                static_cast<uint16_t>(child.primitiveCount));
+        } else {
+            node.children[i]
+                = quantizeChild(node, childBounds, WIDE_BVH_INTERNAL);
+            internalCount++;
+        }
+    }
+
+    // Internal children get consecutive node slots
+    node.childBase = static_cast<int>(m_nodes.size());
+    m_nodes.resize(m_nodes.size() + internalCount);
+    m_nodes[wideIndex] = node;
+
+    int rank = 0;
+    for (int i = 0; i < count; i++) {
+        if (canOpen(slots[i])) {
+            collapse(bvh, slots[i], node.childBase + rank++);
+        }
+    }
+}
+
+AABB WideBVH::decodeChildBounds(const WideBVHNode &node, int slot)
+{
+    const WideBVHChild &child = node.children[slot];
+    AABB bounds;
+    for (int axis = 0; axis < 3; axis++) {
+        float step = std::ldexp(1.0f, node.exponent[axis]);
+        bounds.min[axis]
+            = node.origin[axis] + static_cast<float>(child.qlo[axis]) * step;
+        bounds.max[axis]
+            = node.origin[axis] + static_cast<float>(child.qhi[axis]) * step;
+    }
+    return bounds;
+}
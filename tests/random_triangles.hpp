@@ -0,0 +1,34 @@
+/**
+ * @file random_triangles.hpp
+ * @brief Triangles aleatoires partages par les tests du BVH
+ *
+ * Petits triangles repartis uniformement dans un cube de 100 unites de
+ * cote, reproductibles a graine egale.
+ */
+
+#pragma once
+
+#include <glm/glm.hpp>
+#include <random>
+#include <vector>
+
+#include "renderer/PathTracingData.hpp"
+
+// Sommets a au plus size du centre de chaque triangle, sur chaque axe
+inline std::vector<Triangle> makeRandomTriangles(
+    int count, unsigned int seed, float size = 0.5f)
+{
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> position(-50.0f, 50.0f);
+    std::uniform_real_distribution<float> offset(-size, size);
+
+    std::vector<Triangle> triangles(count);
+    for (auto &tri : triangles) {
+        glm::vec3 center(position(rng), position(rng), position(rng));
+        tri.v0 = center + glm::vec3(offset(rng), offset(rng), offset(rng));
+        tri.v1 = center + glm::vec3(offset(rng), offset(rng), offset(rng));
+        tri.v2 = center + glm::vec3(offset(rng), offset(rng), offset(rng));
+        tri.normal = glm::vec3(0.0f, 1.0f, 0.0f);
+    }
+    return triangles;
+}
@@ -0,0 +1,561 @@
+/**
+ * @file test_bvh.cpp
+ * @brief Tests unitaires pour la construction du BVH du path tracer
+ *
+ * Verifie la structure de l'arbre (couverture des primitives, bornes des
+ * noeuds) et que la construction parallele produit exactement le meme
+ * arbre que la construction sequentielle. Couvre aussi le niveau superieur
+ * construit sur des instances de maillage, la construction SBVH avec
+ * decoupes spatiales sur des triangles longs et fins, l'optimisation par
+ * restructuration de treelets et la disposition a liens de saut pour le
+ * parcours sans pile.
+ */
+
+#include <gtest/gtest.h>
+#include <glm/glm.hpp>
+#include <cmath>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include "renderer/BVH.hpp"
+#include "renderer/PathTracingData.hpp"
+
+#include "random_triangles.hpp"
+
+namespace {
+
+std::vector<AnalyticalSphereData> makeSpheres()
+{
+    std::vector<AnalyticalSphereData> spheres(3);
+    for (size_t i = 0; i < spheres.size(); i++) {
+        float x = static_cast<float>(i) * 4.0f;
+        spheres[i].center = glm::vec3(x, 0.0f, 0.0f);
+        spheres[i].radius = 1.0f;
+    }
+    return spheres;
+}
+
+// Long slivers crossing most of the scene, the worst case for object
+// splits
+std::vector<Triangle> makeLongTriangles(int count, unsigned int seed)
+{
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> position(-50.0f, 50.0f);
+    std::uniform_real_distribution<float> direction(-1.0f, 1.0f);
+    std::uniform_real_distribution<float> offset(-0.2f, 0.2f);
+
+    std::vector<Triangle> triangles(count);
+    for (auto &tri : triangles) {
+        tri.v0 = glm::vec3(position(rng), position(rng), position(rng));
+        glm::vec3 length = 60.0f
+            * glm::normalize(
+                glm::vec3(direction(rng), direction(rng), direction(rng)));
+        tri.v1 = tri.v0 + length;
+        tri.v2 = tri.v1 + glm::vec3(offset(rng), offset(rng), offset(rng));
+        tri.normal = glm::vec3(0.0f, 1.0f, 0.0f);
+    }
+    return triangles;
+}
+
+bool contains(const AABB &outer, const AABB &inner)
+{
+    return outer.min.x <= inner.min.x && outer.min.y <= inner.min.y
+        && outer.min.z <= inner.min.z && outer.max.x >= inner.max.x
+        && outer.max.y >= inner.max.y && outer.max.z >= inner.max.z;
+}
+
+// Moller-Trumbore, returns the hit distance or infinity
+float hitTriangle(
+    const glm::vec3 &origin, const glm::vec3 &dir, const Triangle &tri)
+{
+    glm::vec3 e1 = tri.v1 - tri.v0;
+    glm::vec3 e2 = tri.v2 - tri.v0;
+    glm::vec3 p = glm::cross(dir, e2);
+    float det = glm::dot(e1, p);
+    if (std::abs(det) < 1e-9f) {
+        return std::numeric_limits<float>::infinity();
+    }
+    float invDet = 1.0f / det;
+    glm::vec3 s = origin - tri.v0;
+    float u = glm::dot(s, p) * invDet;
+    glm::vec3 q = glm::cross(s, e1);
+    float v = glm::dot(dir, q) * invDet;
+    float t = glm::dot(e2, q) * invDet;
+    if (u < 0.0f || v < 0.0f || u + v > 1.0f || t <= 0.0f) {
+        return std::numeric_limits<float>::infinity();
+    }
+    return t;
+}
+
+bool hitsBox(const glm::vec3 &origin, const glm::vec3 &invDir,
+    const AABB &box, float tMax)
+{
+    glm::vec3 t0 = (box.min - origin) * invDir;
+    glm::vec3 t1 = (box.max - origin) * invDir;
+    glm::vec3 tmin = glm::min(t0, t1);
+    glm::vec3 tmax = glm::max(t0, t1);
+    float enter = std::max(std::max(tmin.x, tmin.y), std::max(tmin.z, 0.0f));
+    float exit = std::min(std::min(tmax.x, tmax.y), std::min(tmax.z, tMax));
+    return enter <= exit;
+}
+
+// Closest hit through the tree, culling with node bounds only
+float traceTriangles(const BVH &bvh, const std::vector<Triangle> &triangles,
+    const glm::vec3 &origin, const glm::vec3 &dir)
+{
+    float closest = std::numeric_limits<float>::infinity();
+    glm::vec3 invDir = 1.0f / dir;
+    std::vector<int> stack { 0 };
+    while (!stack.empty()) {
+        const BVHNode &node = bvh.getNodes()[stack.back()];
+        stack.pop_back();
+        if (!hitsBox(origin, invDir, node.bounds, closest)) {
+            continue;
+        }
+        if (!node.isLeaf()) {
+            stack.push_back(node.rightChild);
+            stack.push_back(node.leftChild);
+            continue;
+        }
+        for (int i = 0; i < node.primitiveCount; i++) {
+            const BVHPrimitive &prim
+                = bvh.getPrimitives()[node.primitiveStart + i];
+            closest = std::min(closest,
+                hitTriangle(origin, dir, triangles[prim.originalIndex]));
+        }
+    }
+    return closest;
+}
+
+} // namespace
+
+TEST(BVHTest, EmptySceneHasNoNodes)
+{
+    std::vector<Triangle> triangles;
+    std::vector<AnalyticalSphereData> spheres;
+    BVH bvh;
+    bvh.build(triangles, spheres);
+
+    EXPECT_EQ(bvh.getNodeCount(), 0);
+    EXPECT_EQ(bvh.getPrimitiveCount(), 0);
+}
+
+TEST(BVHTest, LeavesCoverEveryPrimitiveOnce)
+{
+    auto triangles = makeRandomTriangles(1000, 1);
+    auto spheres = makeSpheres();
+    BVH bvh;
+    bvh.build(triangles, spheres);
+
+    ASSERT_EQ(bvh.getPrimitiveCount(), 1003);
+    std::vector<int> hits(bvh.getPrimitiveCount(), 0);
+    for (const auto &node : bvh.getNodes()) {
+        if (node.isLeaf()) {
+            for (int i = 0; i < node.primitiveCount; i++) {
+                hits[node.primitiveStart + i]++;
+            }
+        }
+    }
+    for (int count : hits) {
+        EXPECT_EQ(count, 1);
+    }
+}
+
+TEST(BVHTest, NodeBoundsContainChildren)
+{
+    auto triangles = makeRandomTriangles(2000, 2);
+    auto spheres = makeSpheres();
+    BVH bvh;
+    bvh.build(triangles, spheres);
+
+    const auto &nodes = bvh.getNodes();
+    const auto &prims = bvh.getPrimitives();
+    for (const auto &node : nodes) {
+        if (node.isLeaf()) {
+            for (int i = 0; i < node.primitiveCount; i++) {
+                EXPECT_TRUE(contains(
+                    node.bounds, prims[node.primitiveStart + i].bounds));
+            }
+        } else {
+            EXPECT_TRUE(contains(node.bounds, nodes[node.leftChild].bounds));
+            EXPECT_TRUE(contains(node.bounds, nodes[node.rightChild].bounds));
+        }
+    }
+}
+
+TEST(BVHTest, ParallelBuildMatchesSerialBuild)
+{
+    // Enough triangles for a few levels of parallel tasks, timings are in
+    // bvh_bench
+    const auto source = makeRandomTriangles(20000, 3);
+
+    auto serialTriangles = source;
+    auto serialSpheres = makeSpheres();
+    BVH serial;
+    serial.setParallelBuild(false);
+    serial.build(serialTriangles, serialSpheres);
+
+    auto parallelTriangles = source;
+    auto parallelSpheres = makeSpheres();
+    BVH parallel;
+    parallel.setParallelBuild(true);
+    parallel.build(parallelTriangles, parallelSpheres);
+
+    const auto &a = serial.getNodes();
+    const auto &b = parallel.getNodes();
+    ASSERT_EQ(a.size(), b.size());
+    for (size_t i = 0; i < a.size(); i++) {
+        EXPECT_EQ(a[i].leftChild, b[i].leftChild) << "node " << i;
+        EXPECT_EQ(a[i].rightChild, b[i].rightChild) << "node " << i;
+        EXPECT_EQ(a[i].primitiveStart, b[i].primitiveStart) << "node " << i;
+        EXPECT_EQ(a[i].primitiveCount, b[i].primitiveCount) << "node " << i;
+        EXPECT_EQ(a[i].bounds.min, b[i].bounds.min) << "node " << i;
+        EXPECT_EQ(a[i].bounds.max, b[i].bounds.max) << "node " << i;
+    }
+
+    ASSERT_EQ(serialTriangles.size(), parallelTriangles.size());
+    for (size_t i = 0; i < serialTriangles.size(); i++) {
+        EXPECT_EQ(serialTriangles[i].v0, parallelTriangles[i].v0);
+    }
+}
+
+TEST(BVHTest, LinearBuildIsValid)
+{
+    for (int sahLevels : { 0, 3 }) {
+        auto triangles = makeRandomTriangles(50000, 4);
+        auto spheres = makeSpheres();
+        BVH bvh;
+        bvh.setBuildMode(BVHBuildMode::LBVH);
+        bvh.setLBVHSAHLevels(sahLevels);
+        bvh.build(triangles, spheres);
+
+        const auto &nodes = bvh.getNodes();
+        const auto &prims = bvh.getPrimitives();
+        std::vector<int> hits(bvh.getPrimitiveCount(), 0);
+        for (const auto &node : nodes) {
+            if (node.isLeaf()) {
+                for (int i = 0; i < node.primitiveCount; i++) {
+                    hits[node.primitiveStart + i]++;
+                    EXPECT_TRUE(contains(
+                        node.bounds, prims[node.primitiveStart + i].bounds));
+                }
+            } else {
+                EXPECT_TRUE(
+                    contains(node.bounds, nodes[node.leftChild].bounds));
+                EXPECT_TRUE(
+                    contains(node.bounds, nodes[node.rightChild].bounds));
+            }
+        }
+        for (int count : hits) {
+            EXPECT_EQ(count, 1);
+        }
+    }
+}
+
+TEST(BVHTest, LinearBuildIsDeterministic)
+{
+    // Enough primitives to use 63-bit codes and several radix sort tasks
+    const auto source = makeRandomTriangles(300000, 5);
+
+    auto serialTriangles = source;
+    auto serialSpheres = makeSpheres();
+    BVH serial;
+    serial.setBuildMode(BVHBuildMode::LBVH);
+    serial.setParallelBuild(false);
+    serial.build(serialTriangles, serialSpheres);
+
+    auto parallelTriangles = source;
+    auto parallelSpheres = makeSpheres();
+    BVH parallel;
+    parallel.setBuildMode(BVHBuildMode::LBVH);
+    parallel.build(parallelTriangles, parallelSpheres);
+
+    const auto &a = serial.getNodes();
+    const auto &b = parallel.getNodes();
+    ASSERT_EQ(a.size(), b.size());
+    for (size_t i = 0; i < a.size(); i++) {
+        EXPECT_EQ(a[i].leftChild, b[i].leftChild) << "node " << i;
+        EXPECT_EQ(a[i].primitiveStart, b[i].primitiveStart) << "node " << i;
+    }
+}
+
+TEST(BVHTest, RefitFollowsMovedPrimitives)
+{
+    auto triangles = makeRandomTriangles(5000, 6);
+    auto spheres = makeSpheres();
+    const auto source = triangles;
+    BVH bvh;
+    bvh.build(triangles, spheres);
+    float buildCost = bvh.getBuildSAHCost();
+    EXPECT_FLOAT_EQ(bvh.computeSAHCost(), buildCost);
+
+    // The remap sends every input triangle to its reordered slot
+    const auto &remap = bvh.getTriangleRemap();
+    ASSERT_EQ(remap.size(), source.size());
+    for (size_t i = 0; i < source.size(); i++) {
+        EXPECT_EQ(triangles[remap[i]].v0, source[i].v0);
+    }
+
+    // A rigid translation keeps the tree quality
+    const glm::vec3 offset(10.0f, -3.0f, 2.0f);
+    for (auto &tri : triangles) {
+        tri.v0 += offset;
+        tri.v1 += offset;
+        tri.v2 += offset;
+    }
+    for (auto &sphere : spheres) {
+        sphere.center += offset;
+    }
+    bvh.refit(triangles, spheres);
+    EXPECT_NEAR(bvh.computeSAHCost(), buildCost, buildCost * 1e-3f);
+
+    // Scattering the first half of the input far away degrades it
+    for (size_t i = 0; i < source.size() / 2; i++) {
+        Triangle &tri = triangles[remap[i]];
+        tri.v0.x += 500.0f;
+        tri.v1.x += 500.0f;
+        tri.v2.x += 500.0f;
+    }
+    bvh.refit(triangles, spheres);
+    EXPECT_GT(bvh.computeSAHCost(), buildCost * 1.5f);
+
+    const auto &nodes = bvh.getNodes();
+    const auto &prims = bvh.getPrimitives();
+    for (const auto &node : nodes) {
+        if (node.isLeaf()) {
+            for (int i = 0; i < node.primitiveCount; i++) {
+                EXPECT_TRUE(contains(
+                    node.bounds, prims[node.primitiveStart + i].bounds));
+            }
+        } else {
+            EXPECT_TRUE(contains(node.bounds, nodes[node.leftChild].bounds));
+            EXPECT_TRUE(contains(node.bounds, nodes[node.rightChild].bounds));
+        }
+    }
+}
+
+TEST(BVHTest, InstancesAreTopLevelPrimitives)
+{
+    std::vector<InstanceData> instances(20);
+    for (size_t i = 0; i < instances.size(); i++) {
+        float x = static_cast<float>(i) * 3.0f;
+        instances[i].boundsMin = glm::vec3(x, -1.0f, -1.0f);
+        instances[i].boundsMax = glm::vec3(x + 2.0f, 1.0f, 1.0f);
+        instances[i].objectId = static_cast<int>(i);
+    }
+    std::vector<Triangle> noTriangles;
+    auto spheres = makeSpheres();
+    BVH tlas;
+    tlas.build(noTriangles, spheres, instances);
+
+    ASSERT_EQ(tlas.getPrimitiveCount(), 23);
+    const auto &remap = tlas.getInstanceRemap();
+    ASSERT_EQ(remap.size(), instances.size());
+    for (size_t i = 0; i < remap.size(); i++) {
+        EXPECT_EQ(instances[remap[i]].objectId, static_cast<int>(i));
+    }
+
+    int instanceCount = 0;
+    for (const auto &prim : tlas.getPrimitives()) {
+        if (prim.type == BVHPrimitiveType::Instance) {
+            const InstanceData &instance = instances[prim.originalIndex];
+            EXPECT_EQ(prim.bounds.min, instance.boundsMin);
+            EXPECT_EQ(prim.bounds.max, instance.boundsMax);
+            instanceCount++;
+        }
+    }
+    EXPECT_EQ(instanceCount, 20);
+
+    // Moving an instance only needs a refit of the top level
+    instances[0].boundsMin.y += 100.0f;
+    instances[0].boundsMax.y += 100.0f;
+    tlas.refit(noTriangles, spheres, instances);
+    EXPECT_GE(tlas.getNodes()[0].bounds.max.y, instances[0].boundsMax.y);
+}
+
+TEST(BVHTest, SpatialSplitsTightenLongTriangles)
+{
+    const auto source = makeLongTriangles(3000, 7);
+    std::vector<AnalyticalSphereData> noSpheres;
+
+    auto sahTriangles = source;
+    BVH sah;
+    sah.build(sahTriangles, noSpheres);
+
+    auto triangles = source;
+    BVH sbvh;
+    sbvh.setBuildMode(BVHBuildMode::SBVH);
+    sbvh.build(triangles, noSpheres);
+
+    EXPECT_LT(sbvh.computeSAHCost(), sah.computeSAHCost());
+    ASSERT_EQ(triangles.size(), source.size());
+    EXPECT_GT(sbvh.getPrimitiveCount(), static_cast<int>(source.size()));
+    EXPECT_LE(sbvh.getPrimitiveCount(),
+        static_cast<int>(source.size() * (1.0f + 0.3f)));
+
+    // Every triangle stays reachable, clipped references inside their leaf
+    const auto &nodes = sbvh.getNodes();
+    const auto &prims = sbvh.getPrimitives();
+    std::vector<int> references(triangles.size(), 0);
+    for (const auto &node : nodes) {
+        if (!node.isLeaf()) {
+            EXPECT_TRUE(contains(node.bounds, nodes[node.leftChild].bounds));
+            EXPECT_TRUE(contains(node.bounds, nodes[node.rightChild].bounds));
+            continue;
+        }
+        for (int i = 0; i < node.primitiveCount; i++) {
+            const BVHPrimitive &prim = prims[node.primitiveStart + i];
+            references[prim.originalIndex]++;
+            EXPECT_TRUE(contains(node.bounds, prim.bounds));
+        }
+    }
+    for (int count : references) {
+        EXPECT_GE(count, 1);
+    }
+
+    // Rays find the same closest hit as a brute force loop
+    std::mt19937 rng(8);
+    std::uniform_real_distribution<float> position(-60.0f, 60.0f);
+    std::uniform_real_distribution<float> direction(-1.0f, 1.0f);
+    int hits = 0;
+    for (int ray = 0; ray < 1000; ray++) {
+        glm::vec3 origin(position(rng), position(rng), position(rng));
+        glm::vec3 dir = glm::normalize(
+            glm::vec3(direction(rng), direction(rng), direction(rng)));
+        float expected = std::numeric_limits<float>::infinity();
+        for (const auto &tri : triangles) {
+            expected = std::min(expected, hitTriangle(origin, dir, tri));
+        }
+        EXPECT_EQ(traceTriangles(sbvh, triangles, origin, dir), expected)
+            << "ray " << ray;
+        hits += std::isinf(expected) ? 0 : 1;
+    }
+    EXPECT_GT(hits, 50);
+}
+
+TEST(BVHTest, SpatialSplitBudgetCapsDuplicates)
+{
+    const auto source = makeLongTriangles(2000, 9);
+    std::vector<AnalyticalSphereData> noSpheres;
+
+    for (float budget : { 0.0f, 0.05f }) {
+        auto triangles = source;
+        BVH sbvh;
+        sbvh.setBuildMode(BVHBuildMode::SBVH);
+        sbvh.setSpatialSplitBudget(budget);
+        sbvh.build(triangles, noSpheres);
+
+        int limit = static_cast<int>(
+            static_cast<float>(source.size()) * (1.0f + budget));
+        EXPECT_LE(sbvh.getPrimitiveCount(), limit);
+        EXPECT_GE(sbvh.getPrimitiveCount(), static_cast<int>(source.size()));
+    }
+}
+
+TEST(BVHTest, TreeletOptimizationLowersCost)
+{
+    // A pure LBVH leaves plenty of room for improvement
+    auto triangles = makeRandomTriangles(20000, 10);
+    std::vector<AnalyticalSphereData> noSpheres;
+    BVH bvh;
+    bvh.setBuildMode(BVHBuildMode::LBVH);
+    bvh.build(triangles, noSpheres);
+    const BVH built = bvh;
+
+    BVHOptimizeResult result = bvh.optimize();
+    EXPECT_FLOAT_EQ(result.costBefore, built.computeSAHCost());
+    EXPECT_LT(result.costAfter, result.costBefore);
+    EXPECT_FLOAT_EQ(result.costAfter, bvh.computeSAHCost());
+    EXPECT_FLOAT_EQ(bvh.getBuildSAHCost(), result.costAfter);
+
+    // Same node count, children after parents, every primitive once
+    const auto &nodes = bvh.getNodes();
+    ASSERT_EQ(nodes.size(), built.getNodes().size());
+    std::vector<int> hits(bvh.getPrimitiveCount(), 0);
+    for (size_t i = 0; i < nodes.size(); i++) {
+        const BVHNode &node = nodes[i];
+        if (node.isLeaf()) {
+            for (int p = 0; p < node.primitiveCount; p++) {
+                hits[node.primitiveStart + p]++;
+            }
+            continue;
+        }
+        EXPECT_GT(node.leftChild, static_cast<int>(i));
+        EXPECT_GT(node.rightChild, static_cast<int>(i));
+        EXPECT_TRUE(contains(node.bounds, nodes[node.leftChild].bounds));
+        EXPECT_TRUE(contains(node.bounds, nodes[node.rightChild].bounds));
+    }
+    for (int count : hits) {
+        EXPECT_EQ(count, 1);
+    }
+
+    std::mt19937 rng(11);
+    std::uniform_real_distribution<float> position(-60.0f, 60.0f);
+    std::uniform_real_distribution<float> direction(-1.0f, 1.0f);
+    for (int ray = 0; ray < 500; ray++) {
+        glm::vec3 origin(position(rng), position(rng), position(rng));
+        glm::vec3 dir = glm::normalize(
+            glm::vec3(direction(rng), direction(rng), direction(rng)));
+        EXPECT_EQ(traceTriangles(bvh, triangles, origin, dir),
+            traceTriangles(built, triangles, origin, dir))
+            << "ray " << ray;
+    }
+}
+
+TEST(BVHTest, SkipLinksTraceLikeTheTree)
+{
+    auto triangles = makeRandomTriangles(5000, 12);
+    std::vector<AnalyticalSphereData> noSpheres;
+    BVH bvh;
+    bvh.build(triangles, noSpheres);
+
+    std::mt19937 rng(13);
+    std::uniform_real_distribution<float> position(-60.0f, 60.0f);
+    std::uniform_real_distribution<float> direction(-1.0f, 1.0f);
+
+    // A cap of 2 forces the larger leaves into chains
+    for (int leafCap : { 255, 2 }) {
+        auto skipNodes = bvh.buildSkipNodes(leafCap);
+        const int count = static_cast<int>(skipNodes.size());
+        ASSERT_GE(count, bvh.getNodeCount());
+        EXPECT_EQ(skipNodes[0].skip, count);
+
+        int referenced = 0;
+        for (int i = 0; i < count; i++) {
+            EXPECT_GT(skipNodes[i].skip, i);
+            EXPECT_LE(skipNodes[i].skip, count);
+            EXPECT_LE(skipNodes[i].primitiveCount, leafCap);
+            referenced += skipNodes[i].primitiveCount;
+        }
+        EXPECT_EQ(referenced, bvh.getPrimitiveCount());
+
+        for (int ray = 0; ray < 500; ray++) {
+            glm::vec3 origin(position(rng), position(rng), position(rng));
+            glm::vec3 dir = glm::normalize(
+                glm::vec3(direction(rng), direction(rng), direction(rng)));
+            glm::vec3 invDir = 1.0f / dir;
+
+            // Stackless: descend to the next node on a hit, else skip
+            float closest = std::numeric_limits<float>::infinity();
+            int index = 0;
+            while (index < count) {
+                const BVHSkipNode &node = skipNodes[index];
+                if (!hitsBox(origin, invDir, node.bounds, closest)) {
+                    index = node.skip;
+                    continue;
+                }
+                for (int i = 0; i < node.primitiveCount; i++) {
+                    const BVHPrimitive &prim
+                        = bvh.getPrimitives()[node.primitiveStart + i];
+                    closest = std::min(closest,
+                        hitTriangle(
+                            origin, dir, triangles[prim.originalIndex]));
+                }
+                index = node.primitiveCount > 0 ? node.skip : index + 1;
+            }
+            EXPECT_EQ(closest, traceTriangles(bvh, triangles, origin, dir))
+                << "ray " << ray;
+        }
+    }
+}
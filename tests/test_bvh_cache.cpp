@@ -0,0 +1,217 @@
+/**
+ * @file test_bvh_cache.cpp
+ * @brief Tests unitaires pour le cache disque des BVH de maillage
+ *
+ * Verifie qu'une entree relue redonne exactement l'arbre et les triangles
+ * ecrits, que la cle change avec la geometrie et les reglages, que les
+ * entrees corrompues, tronquees ou perimees sont ignorees et que le cache
+ * supprime les entrees les moins recemment utilisees au-dela de sa taille.
+ */
+
+#include <gtest/gtest.h>
+#include <glm/glm.hpp>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+#include "renderer/BVH.hpp"
+#include "renderer/BVHCache.hpp"
+#include "renderer/PathTracingData.hpp"
+
+#include "random_triangles.hpp"
+
+namespace {
+
+class BVHCacheTest : public ::testing::Test {
+protected:
+    void SetUp() override
+    {
+        m_directory = std::filesystem::temp_directory_path()
+            / ("scenelab_bvh_cache_test_"
+                + std::string(::testing::UnitTest::GetInstance()
+                        ->current_test_info()
+                        ->name()));
+        std::filesystem::remove_all(m_directory);
+    }
+
+    void TearDown() override { std::filesystem::remove_all(m_directory); }
+
+    // Build a mesh BVH and store it, returns its key
+    uint64_t storeMesh(const BVHCache &cache, unsigned int seed)
+    {
+        m_source = makeRandomTriangles(3000, seed);
+        m_triangles = m_source;
+        std::vector<AnalyticalSphereData> noSpheres;
+        uint64_t key = BVHCache::computeKey(m_triangles, m_bvh, false);
+        m_bvh.build(m_triangles, noSpheres);
+        EXPECT_TRUE(cache.store(key, m_bvh, m_triangles));
+        return key;
+    }
+
+    std::filesystem::path m_directory;
+    std::vector<Triangle> m_source;
+    std::vector<Triangle> m_triangles;
+    BVH m_bvh;
+};
+
+} // namespace
+
+TEST_F(BVHCacheTest, MissingEntryIsAMiss)
+{
+    BVHCache cache(m_directory);
+    BVH bvh;
+    std::vector<Triangle> triangles;
+    EXPECT_FALSE(cache.load(42, bvh, triangles));
+}
+
+TEST_F(BVHCacheTest, RoundTripRestoresTreeAndTriangles)
+{
+    BVHCache cache(m_directory);
+    uint64_t key = storeMesh(cache, 1);
+
+    BVH loaded;
+    std::vector<Triangle> triangles;
+    ASSERT_TRUE(cache.load(key, loaded, triangles));
+
+    ASSERT_EQ(loaded.getNodeCount(), m_bvh.getNodeCount());
+    for (int i = 0; i < loaded.getNodeCount(); i++) {
+        const BVHNode &a = loaded.getNodes()[i];
+        const BVHNode &b = m_bvh.getNodes()[i];
+        EXPECT_EQ(a.leftChild, b.leftChild);
+        EXPECT_EQ(a.rightChild, b.rightChild);
+        EXPECT_EQ(a.primitiveStart, b.primitiveStart);
+        EXPECT_EQ(a.primitiveCount, b.primitiveCount);
+        EXPECT_EQ(a.bounds.min, b.bounds.min);
+        EXPECT_EQ(a.bounds.max, b.bounds.max);
+    }
+    ASSERT_EQ(loaded.getPrimitiveCount(), m_bvh.getPrimitiveCount());
+    for (int i = 0; i < loaded.getPrimitiveCount(); i++) {
+        EXPECT_EQ(loaded.getPrimitives()[i].originalIndex,
+            m_bvh.getPrimitives()[i].originalIndex);
+    }
+    ASSERT_EQ(triangles.size(), m_triangles.size());
+    for (size_t i = 0; i < triangles.size(); i++) {
+        EXPECT_EQ(triangles[i].v0, m_triangles[i].v0);
+        EXPECT_EQ(triangles[i].v2, m_triangles[i].v2);
+    }
+    EXPECT_FLOAT_EQ(loaded.getBuildSAHCost(), m_bvh.getBuildSAHCost());
+}
+
+TEST_F(BVHCacheTest, KeyFollowsGeometryAndSettings)
+{
+    auto triangles = makeRandomTriangles(100, 2);
+    BVH sah;
+    uint64_t key = BVHCache::computeKey(triangles, sah, false);
+    EXPECT_EQ(key, BVHCache::computeKey(triangles, sah, false));
+    EXPECT_NE(key, BVHCache::computeKey(triangles, sah, true));
+
+    BVH sbvh;
+    sbvh.setBuildMode(BVHBuildMode::SBVH);
+    EXPECT_NE(key, BVHCache::computeKey(triangles, sbvh, false));
+
+    triangles[50].v1.x += 1e-3f;
+    EXPECT_NE(key, BVHCache::computeKey(triangles, sah, false));
+}
+
+TEST_F(BVHCacheTest, CorruptEntriesAreRejected)
+{
+    BVHCache cache(m_directory);
+    uint64_t key = storeMesh(cache, 3);
+    std::filesystem::path path = cache.getEntryPath(key);
+    const auto size = std::filesystem::file_size(path);
+
+    BVH untouched;
+    std::vector<Triangle> triangles;
+
+    // Flip one payload byte
+    {
+        std::fstream file(
+            path, std::ios::in | std::ios::out | std::ios::binary);
+        file.seekg(static_cast<std::streamoff>(size / 2));
+        char byte = 0;
+        file.read(&byte, 1);
+        byte = static_cast<char>(byte ^ 0x5A);
+        file.seekp(static_cast<std::streamoff>(size / 2));
+        file.write(&byte, 1);
+    }
+    EXPECT_FALSE(cache.load(key, untouched, triangles));
+    EXPECT_EQ(untouched.getNodeCount(), 0);
+    EXPECT_TRUE(triangles.empty());
+
+    // Truncate the file
+    storeMesh(cache, 3);
+    std::filesystem::resize_file(path, size - 16);
+    EXPECT_FALSE(cache.load(key, untouched, triangles));
+
+    // Entry stored under another key, as after a hash collision on the
+    // file name or a renamed file
+    storeMesh(cache, 3);
+    std::filesystem::path other = cache.getEntryPath(key + 1);
+    std::filesystem::copy_file(path, other);
+    EXPECT_FALSE(cache.load(key + 1, untouched, triangles));
+
+    // Older format version
+    {
+        std::fstream file(
+            path, std::ios::in | std::ios::out | std::ios::binary);
+        uint32_t version = BVHCache::FORMAT_VERSION - 1;
+        file.seekp(8);
+        file.write(reinterpret_cast<const char *>(&version), sizeof(version));
+    }
+    EXPECT_FALSE(cache.load(key, untouched, triangles));
+
+    // A rebuilt entry replaces the bad one
+    storeMesh(cache, 3);
+    EXPECT_TRUE(cache.load(key, untouched, triangles));
+}
+
+TEST_F(BVHCacheTest, LeastRecentlyUsedEntriesAreEvicted)
+{
+    BVHCache unbounded(m_directory);
+    uint64_t first = storeMesh(unbounded, 4);
+    const auto entrySize
+        = std::filesystem::file_size(unbounded.getEntryPath(first));
+
+    // Room for two entries of about the same size
+    BVHCache cache(m_directory, entrySize * 5 / 2);
+    uint64_t second = storeMesh(cache, 5);
+    BVH bvh;
+    std::vector<Triangle> triangles;
+    ASSERT_TRUE(cache.load(first, bvh, triangles));
+
+    uint64_t third = storeMesh(cache, 6);
+    EXPECT_TRUE(std::filesystem::exists(cache.getEntryPath(first)));
+    EXPECT_FALSE(std::filesystem::exists(cache.getEntryPath(second)));
+    EXPECT_TRUE(std::filesystem::exists(cache.getEntryPath(third)));
+}
+
+TEST_F(BVHCacheTest, StoredBytesDoNotDependOnPadding)
+{
+    BVHCache cache(m_directory);
+    uint64_t key = storeMesh(cache, 7);
+    std::ifstream file(cache.getEntryPath(key), std::ios::binary);
+    std::vector<char> written((std::istreambuf_iterator<char>(file)),
+        std::istreambuf_iterator<char>());
+
+    // Same tree from primitives whose padding holds garbage
+    std::vector<BVHPrimitive> primitives = m_bvh.getPrimitives();
+    for (auto &prim : primitives) {
+        BVHPrimitive dirty;
+        std::memset(static_cast<void *>(&dirty), 0xA5, sizeof(dirty));
+        dirty.type = prim.type;
+        dirty.originalIndex = prim.originalIndex;
+        dirty.bounds = prim.bounds;
+        dirty.centroid = prim.centroid;
+        std::memcpy(static_cast<void *>(&prim), &dirty, sizeof(prim));
+    }
+    BVH dirtyBVH;
+    dirtyBVH.restore(m_bvh.getNodes(), std::move(primitives));
+    ASSERT_TRUE(cache.store(key, dirtyBVH, m_triangles));
+
+    std::ifstream rewritten(cache.getEntryPath(key), std::ios::binary);
+    std::vector<char> bytes((std::istreambuf_iterator<char>(rewritten)),
+        std::istreambuf_iterator<char>());
+    EXPECT_EQ(bytes, written);
+}
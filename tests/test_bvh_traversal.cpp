@@ -0,0 +1,291 @@
+/**
+ * @file test_bvh_traversal.cpp
+ * @brief Tests unitaires pour le parcours SIMD du BVH par paquets de rayons
+ *
+ * Un paquet doit trouver, rayon par rayon, la meme primitive et la meme
+ * distance que le parcours d'un rayon seul, y compris pour les voies de
+ * remplissage et les rayons qui ne touchent rien. Verifie aussi qu'un arbre
+ * plus profond que la pile fixe reste parcouru en entier, le test de
+ * coherence et que le path tracer CPU donne la meme image avec ou sans
+ * paquets.
+ */
+
+#include <gtest/gtest.h>
+#include <glm/glm.hpp>
+#include <random>
+#include <vector>
+
+#include "renderer/BVH.hpp"
+#include "renderer/BVHTraversal.hpp"
+#include "renderer/CPUPathTracer.hpp"
+#include "renderer/PathTracingData.hpp"
+
+namespace {
+
+constexpr float T_MIN = 0.1f;
+constexpr float T_MAX = 10000.0f;
+
+struct Scene {
+    std::vector<Triangle> triangles;
+    std::vector<AnalyticalSphereData> spheres;
+    BVH bvh;
+};
+
+Scene makeRandomScene(int triangleCount, int sphereCount, unsigned int seed)
+{
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> position(-20.0f, 20.0f);
+    std::uniform_real_distribution<float> offset(-1.5f, 1.5f);
+    std::uniform_real_distribution<float> radius(0.2f, 1.5f);
+
+    Scene scene;
+    scene.triangles.resize(triangleCount);
+    for (auto &tri : scene.triangles) {
+        glm::vec3 center(position(rng), position(rng), position(rng));
+        tri.v0 = center + glm::vec3(offset(rng), offset(rng), offset(rng));
+        tri.v1 = center + glm::vec3(offset(rng), offset(rng), offset(rng));
+        tri.v2 = center + glm::vec3(offset(rng), offset(rng), offset(rng));
+        tri.normal = glm::normalize(
+            glm::cross(tri.v0 - tri.v2, tri.v1 - tri.v0));
+    }
+    scene.spheres.resize(sphereCount);
+    for (auto &sphere : scene.spheres) {
+        sphere.center = glm::vec3(position(rng), position(rng), position(rng));
+        sphere.radius = radius(rng);
+    }
+    scene.bvh.build(scene.triangles, scene.spheres);
+    return scene;
+}
+
+// Rays from one eye point through a small grid, like a block of pixels
+RayPacket makePrimaryPacket(const glm::vec3 &eye, const glm::vec3 &forward,
+    float spread, int count)
+{
+    glm::vec3 right = glm::normalize(
+        glm::cross(forward, std::abs(forward.y) < 0.9f
+                ? glm::vec3(0.0f, 1.0f, 0.0f)
+                : glm::vec3(1.0f, 0.0f, 0.0f)));
+    glm::vec3 up = glm::cross(right, forward);
+
+    RayPacket packet;
+    packet.count = count;
+    for (int i = 0; i < count; i++) {
+        float u = static_cast<float>(i % 4) - 1.5f;
+        float v = static_cast<float>(i / 4) - 1.5f;
+        packet.origins[i] = eye;
+        packet.directions[i]
+            = glm::normalize(forward + (u * right + v * up) * spread);
+    }
+    return packet;
+}
+
+// Distances may differ in the last bits where the compiler fuses
+// multiply-adds in only one of the two paths
+void expectPacketMatchesSingleRays(const Scene &scene, const RayPacket &packet)
+{
+    std::array<BVHHit, RAY_PACKET_SIZE> hits;
+    BVHTraversal::tracePacket(scene.bvh, scene.triangles, scene.spheres,
+        packet, T_MIN, T_MAX, hits);
+    for (int i = 0; i < packet.count; i++) {
+        BVHHit expected = BVHTraversal::traceRay(scene.bvh, scene.triangles,
+            scene.spheres, packet.origins[i], packet.directions[i], T_MIN,
+            T_MAX);
+        EXPECT_EQ(hits[i].primitive, expected.primitive) << "ray " << i;
+        EXPECT_NEAR(hits[i].dist, expected.dist, expected.dist * 1e-4f)
+            << "ray " << i;
+    }
+}
+
+} // namespace
+
+TEST(BVHTraversalTest, SingleRayFindsTheClosestPrimitive)
+{
+    Scene scene;
+    scene.spheres.resize(2);
+    scene.spheres[0].center = glm::vec3(0.0f, 0.0f, -10.0f);
+    scene.spheres[0].radius = 1.0f;
+    scene.spheres[1].center = glm::vec3(0.0f, 0.0f, -5.0f);
+    scene.spheres[1].radius = 1.0f;
+    scene.bvh.build(scene.triangles, scene.spheres);
+
+    BVHHit hit = BVHTraversal::traceRay(scene.bvh, scene.triangles,
+        scene.spheres, glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f), T_MIN,
+        T_MAX);
+    ASSERT_GE(hit.primitive, 0);
+    const BVHPrimitive &prim = scene.bvh.getPrimitives()[hit.primitive];
+    EXPECT_EQ(prim.type, BVHPrimitiveType::Sphere);
+    EXPECT_EQ(scene.spheres[prim.originalIndex].center.z, -5.0f);
+    EXPECT_NEAR(hit.dist, 4.0f, 1e-5f);
+
+    BVHHit miss = BVHTraversal::traceRay(scene.bvh, scene.triangles,
+        scene.spheres, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f), T_MIN,
+        T_MAX);
+    EXPECT_EQ(miss.primitive, -1);
+    EXPECT_EQ(miss.dist, T_MAX);
+}
+
+TEST(BVHTraversalTest, PacketMatchesSingleRays)
+{
+    Scene scene = makeRandomScene(3000, 100, 11);
+    std::mt19937 rng(3);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    std::uniform_real_distribution<float> spread(0.001f, 0.05f);
+
+    for (int i = 0; i < 300; i++) {
+        glm::vec3 eye(unit(rng) * 40.0f, unit(rng) * 40.0f, unit(rng) * 40.0f);
+        glm::vec3 forward = glm::normalize(-eye
+            + glm::vec3(unit(rng), unit(rng), unit(rng)) * 10.0f);
+        RayPacket packet
+            = makePrimaryPacket(eye, forward, spread(rng), RAY_PACKET_SIZE);
+        expectPacketMatchesSingleRays(scene, packet);
+    }
+}
+
+TEST(BVHTraversalTest, PartialPacketsAndIncoherentRays)
+{
+    // tracePacket stays correct when rays diverge, it is only slower
+    Scene scene = makeRandomScene(1000, 50, 17);
+    std::mt19937 rng(8);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+
+    for (int count = 1; count <= RAY_PACKET_SIZE; count++) {
+        RayPacket packet;
+        packet.count = count;
+        for (int i = 0; i < count; i++) {
+            packet.origins[i]
+                = glm::vec3(unit(rng), unit(rng), unit(rng)) * 30.0f;
+            packet.directions[i] = glm::normalize(
+                glm::vec3(unit(rng), unit(rng), unit(rng)) + 0.01f);
+        }
+        expectPacketMatchesSingleRays(scene, packet);
+    }
+}
+
+TEST(BVHTraversalTest, EmptySceneMissesEverything)
+{
+    Scene scene;
+    scene.bvh.build(scene.triangles, scene.spheres);
+    RayPacket packet = makePrimaryPacket(glm::vec3(0.0f),
+        glm::vec3(0.0f, 0.0f, -1.0f), 0.01f, RAY_PACKET_SIZE);
+
+    std::array<BVHHit, RAY_PACKET_SIZE> hits;
+    BVHTraversal::tracePacket(scene.bvh, scene.triangles, scene.spheres,
+        packet, T_MIN, T_MAX, hits);
+    for (const BVHHit &hit : hits) {
+        EXPECT_EQ(hit.primitive, -1);
+        EXPECT_EQ(hit.dist, T_MAX);
+    }
+}
+
+TEST(BVHTraversalTest, DeepTreesDoNotOverflowTheStack)
+{
+    // A comb of parallel triangles, one per level: a ray along the comb
+    // leaves every level's far child on the stack before its first hit
+    const int depth = 300;
+    Scene scene;
+    std::vector<BVHPrimitive> primitives(depth);
+    for (int i = 0; i < depth; i++) {
+        float x = static_cast<float>(i);
+        Triangle tri {};
+        tri.v0 = glm::vec3(x, -1.0f, -1.0f);
+        tri.v1 = glm::vec3(x, 3.0f, -1.0f);
+        tri.v2 = glm::vec3(x, -1.0f, 3.0f);
+        tri.normal = glm::vec3(1.0f, 0.0f, 0.0f);
+        scene.triangles.push_back(tri);
+
+        primitives[i].type = BVHPrimitiveType::Triangle;
+        primitives[i].originalIndex = i;
+        primitives[i].bounds.expand(tri.v0);
+        primitives[i].bounds.expand(tri.v1);
+        primitives[i].bounds.expand(tri.v2);
+        primitives[i].centroid = primitives[i].bounds.centroid();
+    }
+
+    // Internal node 2i holds leaf 2i + 1 (triangle i) and the rest of the
+    // comb at 2i + 2, the last triangle is the leaf 2 * (depth - 1)
+    std::vector<BVHNode> nodes(2 * depth - 1);
+    AABB rest;
+    for (int i = depth - 1; i >= 0; i--) {
+        rest.expand(primitives[i].bounds);
+        BVHNode leaf;
+        leaf.bounds = primitives[i].bounds;
+        leaf.primitiveStart = i;
+        leaf.primitiveCount = 1;
+        if (i == depth - 1) {
+            nodes[2 * i] = leaf;
+            continue;
+        }
+        nodes[2 * i + 1] = leaf;
+        nodes[2 * i].bounds = rest;
+        nodes[2 * i].leftChild = 2 * i + 1;
+        nodes[2 * i].rightChild = 2 * i + 2;
+    }
+    scene.bvh.restore(std::move(nodes), std::move(primitives));
+
+    glm::vec3 eye(static_cast<float>(depth) + 1.0f, 0.1f, 0.1f);
+    BVHHit hit = BVHTraversal::traceRay(scene.bvh, scene.triangles,
+        scene.spheres, eye, glm::vec3(-1.0f, 0.0f, 0.0f), T_MIN, T_MAX);
+    EXPECT_EQ(hit.primitive, depth - 1);
+    EXPECT_NEAR(hit.dist, 2.0f, 1e-4f);
+
+    expectPacketMatchesSingleRays(scene,
+        makePrimaryPacket(
+            eye, glm::vec3(-1.0f, 0.0f, 0.0f), 0.001f, RAY_PACKET_SIZE));
+}
+
+TEST(BVHTraversalTest, CoherenceOfPrimaryAndScatteredRays)
+{
+    glm::vec3 forward = glm::normalize(glm::vec3(0.3f, -0.2f, -1.0f));
+    EXPECT_TRUE(BVHTraversal::isCoherent(
+        makePrimaryPacket(glm::vec3(0.0f), forward, 0.01f, RAY_PACKET_SIZE)));
+
+    RayPacket scattered
+        = makePrimaryPacket(glm::vec3(0.0f), forward, 0.01f, RAY_PACKET_SIZE);
+    scattered.directions[1] = -scattered.directions[1];
+    EXPECT_FALSE(BVHTraversal::isCoherent(scattered));
+
+    // Same octant but too far apart
+    RayPacket wide
+        = makePrimaryPacket(glm::vec3(0.0f), forward, 0.01f, RAY_PACKET_SIZE);
+    wide.directions[1] = glm::normalize(glm::vec3(1.0f, -0.01f, -0.01f));
+    EXPECT_FALSE(BVHTraversal::isCoherent(wide));
+}
+
+TEST(BVHTraversalTest, PathTracerImageDoesNotDependOnPackets)
+{
+    Scene scene = makeRandomScene(500, 20, 23);
+    MaterialData grey {};
+    grey.color = glm::vec3(0.6f);
+    grey.indexOfRefraction = 1.0f;
+    for (auto &sphere : scene.spheres) {
+        sphere.emissive = glm::vec3(2.0f, 1.5f, 1.0f);
+        sphere.indexOfRefraction = 1.0f;
+    }
+
+    auto render = [&](bool packets) {
+        CPUPathTracer tracer;
+        tracer.setPacketTracing(packets);
+        tracer.setScene(scene.triangles, { grey }, scene.spheres, {});
+        tracer.setCamera(PathTracingCamera::fromAngles(
+            glm::vec3(0.0f, 0.0f, 40.0f), glm::vec3(0.0f), 60.0f));
+        tracer.resize(37, 21);
+        tracer.renderFrame();
+        return tracer.getImage();
+    };
+
+    std::vector<glm::vec3> single = render(false);
+    std::vector<glm::vec3> packet = render(true);
+    ASSERT_EQ(single.size(), packet.size());
+    // Distances may differ in the last bit, which can send a rare bounce
+    // elsewhere, so compare the average instead of every pixel
+    glm::dvec3 singleSum(0.0), packetSum(0.0);
+    int identical = 0;
+    for (size_t i = 0; i < single.size(); i++) {
+        singleSum += glm::dvec3(single[i]);
+        packetSum += glm::dvec3(packet[i]);
+        identical += single[i] == packet[i] ? 1 : 0;
+    }
+    EXPECT_GT(singleSum.r, 0.0);
+    EXPECT_NEAR(packetSum.r, singleSum.r, singleSum.r * 0.02);
+    EXPECT_GT(identical, static_cast<int>(single.size() * 9 / 10));
+}
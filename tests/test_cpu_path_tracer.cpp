@@ -0,0 +1,258 @@
+/**
+ * @file test_cpu_path_tracer.cpp
+ * @brief Tests unitaires pour le path tracer CPU de reference
+ *
+ * Le transport de lumiere est celui de pathtracing.frag : on verifie qu'il
+ * converge vers des resultats analytiques sur de petites scenes (eclairage
+ * direct d'une sphere emissive, miroir parfait, mur emissif en triangles),
+ * que l'echantillonnage des lumieres ne change pas la moyenne, que
+ * l'image ne depend pas du nombre de threads et que la projection de la
+ * camera retrouve le point vu par un rayon primaire.
+ */
+
+#include <gtest/gtest.h>
+#include <glm/glm.hpp>
+#include <random>
+#include <vector>
+
+#include "renderer/CPUPathTracer.hpp"
+#include "renderer/PathTracingData.hpp"
+
+namespace {
+
+AnalyticalPlaneData makeFloor(float albedo)
+{
+    AnalyticalPlaneData floor {};
+    floor.point = glm::vec3(0.0f);
+    floor.normal = glm::vec3(0.0f, 1.0f, 0.0f);
+    floor.color = glm::vec3(albedo);
+    floor.specularColor = glm::vec3(1.0f);
+    floor.indexOfRefraction = 1.0f;
+    return floor;
+}
+
+AnalyticalSphereData makeLight(
+    const glm::vec3 &center, float radius, float radiance)
+{
+    AnalyticalSphereData light {};
+    light.center = center;
+    light.radius = radius;
+    light.emissive = glm::vec3(radiance);
+    light.indexOfRefraction = 1.0f;
+    return light;
+}
+
+Triangle makeTriangle(const glm::vec3 &v0, const glm::vec3 &v1,
+    const glm::vec3 &v2, uint32_t materialIndex)
+{
+    Triangle tri {};
+    tri.v0 = v0;
+    tri.v1 = v1;
+    tri.v2 = v2;
+    tri.normal = glm::normalize(glm::cross(v0 - v2, v1 - v0));
+    tri.materialIndex = materialIndex;
+    return tri;
+}
+
+MaterialData makeMaterial(const glm::vec3 &color, const glm::vec3 &emissive)
+{
+    MaterialData material {};
+    material.color = color;
+    material.emissive = emissive;
+    material.indexOfRefraction = 1.0f;
+    return material;
+}
+
+// Average radiance of many paths along the same ray
+glm::vec3 averageRadiance(const CPUPathTracer &tracer,
+    const glm::vec3 &origin, const glm::vec3 &dir, int samples)
+{
+    glm::dvec3 sum(0.0);
+    for (int i = 0; i < samples; i++) {
+        uint32_t rngState = static_cast<uint32_t>(i) * 26699u | 1u;
+        sum += glm::dvec3(tracer.traceRay(origin, dir, rngState));
+    }
+    return glm::vec3(sum / static_cast<double>(samples));
+}
+
+} // namespace
+
+TEST(CPUPathTracerTest, DirectLightingMatchesAnalyticResult)
+{
+    // A Lambertian floor lit only by a sphere straight above the shaded
+    // point reflects albedo * radiance * sin^2 of the sphere's half-angle
+    const float albedo = 0.5f;
+    const float radiance = 10.0f;
+    const float radius = 1.5f;
+    const float height = 5.0f;
+
+    CPUPathTracer tracer;
+    tracer.setScene({}, {},
+        { makeLight(glm::vec3(0.0f, height, 0.0f), radius, radiance) },
+        { makeFloor(albedo) });
+
+    glm::vec3 origin(4.0f, 1.0f, 0.0f);
+    glm::vec3 dir = glm::normalize(-origin);
+    glm::vec3 result = averageRadiance(tracer, origin, dir, 200000);
+
+    float sinHalfAngle = radius / height;
+    float expected = albedo * radiance * sinHalfAngle * sinHalfAngle;
+    EXPECT_NEAR(result.r, expected, expected * 0.03f);
+    EXPECT_FLOAT_EQ(result.r, result.g);
+    EXPECT_FLOAT_EQ(result.r, result.b);
+}
+
+TEST(CPUPathTracerTest, MirrorReflectsTheLight)
+{
+    AnalyticalPlaneData mirror = makeFloor(0.0f);
+    mirror.percentSpecular = 1.0f;
+    mirror.specularColor = glm::vec3(0.8f, 0.6f, 0.4f);
+
+    CPUPathTracer tracer;
+    tracer.setScene({}, {},
+        { makeLight(glm::vec3(-4.0f, 2.0f, 0.0f), 1.0f, 5.0f) }, { mirror });
+
+    // Hits the floor at the origin and bounces straight into the light
+    glm::vec3 origin(4.0f, 2.0f, 0.0f);
+    glm::vec3 dir = glm::normalize(-origin);
+    glm::vec3 result = averageRadiance(tracer, origin, dir, 16);
+    EXPECT_NEAR(result.r, 4.0f, 1e-4f);
+    EXPECT_NEAR(result.g, 3.0f, 1e-4f);
+    EXPECT_NEAR(result.b, 2.0f, 1e-4f);
+}
+
+TEST(CPUPathTracerTest, TrianglesKeepTheirMaterialsThroughTheBVH)
+{
+    // An emissive wall filling the view in front of a cloud of dark
+    // triangles, the BVH build reorders them all but each keeps its
+    // material row
+    std::vector<Triangle> triangles;
+    std::mt19937 rng(5);
+    std::uniform_real_distribution<float> position(-20.0f, 20.0f);
+    for (int i = 0; i < 500; i++) {
+        glm::vec3 c(position(rng), position(rng), -30.0f + position(rng));
+        triangles.push_back(makeTriangle(c, c + glm::vec3(1.0f, 0.0f, 0.0f),
+            c + glm::vec3(0.0f, 1.0f, 0.0f), 0));
+    }
+    const glm::vec3 emissive(0.25f, 0.5f, 1.0f);
+    triangles.push_back(makeTriangle(glm::vec3(-50.0f, -50.0f, -5.0f),
+        glm::vec3(50.0f, -50.0f, -5.0f), glm::vec3(50.0f, 50.0f, -5.0f), 1));
+    triangles.push_back(makeTriangle(glm::vec3(-50.0f, -50.0f, -5.0f),
+        glm::vec3(50.0f, 50.0f, -5.0f), glm::vec3(-50.0f, 50.0f, -5.0f), 1));
+
+    CPUPathTracer tracer;
+    tracer.setScene(triangles,
+        { makeMaterial(glm::vec3(0.0f), glm::vec3(0.0f)),
+            makeMaterial(glm::vec3(0.0f), emissive) },
+        {}, {});
+    tracer.setCamera(PathTracingCamera::fromAngles(
+        glm::vec3(0.0f), glm::vec3(0.0f), 60.0f));
+    tracer.resize(20, 10);
+    tracer.renderFrame();
+
+    for (const glm::vec3 &pixel : tracer.getImage()) {
+        EXPECT_EQ(pixel, emissive);
+    }
+}
+
+TEST(CPUPathTracerTest, LightSamplingKeepsTheExpectedRadiance)
+{
+    // A floor lit by a small emissive quad and a sphere, one of them
+    // partly hidden by a dark ball
+    std::vector<Triangle> lamp {
+        makeTriangle(glm::vec3(-3.0f, 4.0f, -1.0f),
+            glm::vec3(-2.0f, 4.0f, -1.0f), glm::vec3(-2.0f, 4.0f, 0.0f), 0),
+        makeTriangle(glm::vec3(-3.0f, 4.0f, -1.0f),
+            glm::vec3(-2.0f, 4.0f, 0.0f), glm::vec3(-3.0f, 4.0f, 0.0f), 0),
+    };
+    AnalyticalSphereData ball
+        = makeLight(glm::vec3(1.0f, 1.5f, 0.0f), 0.7f, 0.0f);
+    ball.color = glm::vec3(0.3f);
+
+    CPUPathTracer tracer;
+    tracer.setScene(lamp,
+        { makeMaterial(glm::vec3(0.0f), glm::vec3(20.0f, 15.0f, 10.0f)) },
+        { makeLight(glm::vec3(3.0f, 5.0f, 0.0f), 0.5f, 30.0f), ball },
+        { makeFloor(0.6f) });
+    EXPECT_TRUE(tracer.getLightSampling());
+
+    glm::vec3 origin(0.0f, 2.0f, 6.0f);
+    glm::vec3 dir = glm::normalize(glm::vec3(0.3f, -2.0f, -6.0f));
+    glm::vec3 sampled = averageRadiance(tracer, origin, dir, 100000);
+    tracer.setLightSampling(false);
+    glm::vec3 unsampled = averageRadiance(tracer, origin, dir, 400000);
+
+    for (int i = 0; i < 3; i++) {
+        EXPECT_GT(sampled[i], 0.0f);
+        EXPECT_NEAR(sampled[i], unsampled[i], unsampled[i] * 0.03f);
+    }
+}
+
+TEST(CPUPathTracerTest, ImageDoesNotDependOnThreadCount)
+{
+    AnalyticalSphereData ball
+        = makeLight(glm::vec3(1.0f, 1.0f, -4.0f), 1.0f, 0.0f);
+    ball.color = glm::vec3(0.9f, 0.2f, 0.2f);
+    ball.percentSpecular = 0.3f;
+    ball.roughness = 0.2f;
+    ball.specularColor = glm::vec3(1.0f);
+
+    auto render = [&](int threads) {
+        CPUPathTracer tracer;
+        tracer.setThreadCount(threads);
+        tracer.setScene({}, {},
+            { makeLight(glm::vec3(0.0f, 6.0f, -4.0f), 2.0f, 4.0f), ball },
+            { makeFloor(0.7f) });
+        tracer.setCamera(PathTracingCamera::fromAngles(
+            glm::vec3(0.0f, 2.0f, 2.0f), glm::vec3(-10.0f, 0.0f, 0.0f),
+            60.0f));
+        tracer.resize(45, 30);
+        for (int frame = 0; frame < 3; frame++) {
+            tracer.renderFrame();
+        }
+        EXPECT_EQ(tracer.getFrameCount(), 3);
+        return tracer.getImage();
+    };
+
+    std::vector<glm::vec3> single = render(1);
+    std::vector<glm::vec3> parallel = render(4);
+    ASSERT_EQ(single.size(), parallel.size());
+    bool lit = false;
+    for (size_t i = 0; i < single.size(); i++) {
+        EXPECT_EQ(single[i], parallel[i]);
+        lit = lit || single[i].r > 0.0f;
+    }
+    EXPECT_TRUE(lit);
+}
+
+TEST(CPUPathTracerTest, ProjectionFindsThePointOfAPrimaryRay)
+{
+    // What temporal reprojection relies on: a surface seen through one
+    // camera is found again through another
+    const float aspectRatio = 1.5f;
+    PathTracingCamera current = PathTracingCamera::fromAngles(
+        glm::vec3(1.0f, 2.0f, 3.0f), glm::vec3(20.0f, -35.0f, 5.0f), 60.0f);
+    PathTracingCamera previous = PathTracingCamera::fromAngles(
+        glm::vec3(1.2f, 2.0f, 3.1f), glm::vec3(18.0f, -30.0f, 5.0f), 60.0f);
+
+    for (glm::vec2 point : { glm::vec2(0.0f), glm::vec2(0.5f, -0.25f),
+             glm::vec2(-0.9f, 0.8f) }) {
+        glm::vec3 hit = current.position
+            + current.rayDirection(point, aspectRatio) * 4.0f;
+        glm::vec2 projected;
+        ASSERT_TRUE(current.project(hit, aspectRatio, projected));
+        EXPECT_NEAR(projected.x, point.x, 1e-4f);
+        EXPECT_NEAR(projected.y, point.y, 1e-4f);
+
+        glm::vec2 previousPoint;
+        ASSERT_TRUE(previous.project(hit, aspectRatio, previousPoint));
+        glm::vec3 previousDir = glm::normalize(hit - previous.position);
+        glm::vec3 back = previous.rayDirection(previousPoint, aspectRatio);
+        EXPECT_NEAR(glm::dot(previousDir, back), 1.0f, 1e-5f);
+    }
+
+    glm::vec2 behind;
+    EXPECT_FALSE(current.project(current.position
+            - current.rayDirection(glm::vec2(0.0f), aspectRatio),
+        aspectRatio, behind));
+}
@@ -0,0 +1,155 @@
+/**
+ * @file test_denoiser.cpp
+ * @brief Tests unitaires pour le debruiteur a-trous
+ *
+ * Verifie que le filtre lisse le bruit d'une surface uniforme sans changer
+ * sa moyenne, qu'il s'arrete aux bords (normales differentes, albedo
+ * texture) et qu'un rendu CPU a faible nombre d'echantillons debruite se
+ * rapproche d'une image de reference.
+ */
+
+#include <gtest/gtest.h>
+#include <glm/glm.hpp>
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include "renderer/CPUPathTracer.hpp"
+#include "renderer/Denoiser.hpp"
+#include "renderer/PathTracingData.hpp"
+
+namespace {
+
+constexpr int WIDTH = 32;
+constexpr int HEIGHT = 32;
+
+SurfaceAOV makeSurface(const glm::vec3 &albedo, const glm::vec3 &normal)
+{
+    SurfaceAOV aov;
+    aov.albedo = albedo;
+    aov.normal = normal;
+    aov.depth = 5.0f;
+    return aov;
+}
+
+// Value times a random factor of mean 1
+glm::vec3 noisy(float value, std::mt19937 &rng)
+{
+    std::uniform_real_distribution<float> noise(0.5f, 1.5f);
+    return glm::vec3(value * noise(rng));
+}
+
+double rmse(
+    const std::vector<glm::vec3> &image, const std::vector<glm::vec3> &ref)
+{
+    double sum = 0.0;
+    for (size_t i = 0; i < image.size(); i++) {
+        glm::vec3 d = image[i] - ref[i];
+        sum += glm::dot(d, d);
+    }
+    return std::sqrt(sum / static_cast<double>(image.size() * 3));
+}
+
+} // namespace
+
+TEST(ATrousDenoiserTest, SmoothsAFlatSurfaceAndKeepsItsMean)
+{
+    std::mt19937 rng(7);
+    std::vector<glm::vec3> color(WIDTH * HEIGHT);
+    for (glm::vec3 &pixel : color) {
+        pixel = noisy(0.4f, rng);
+    }
+    std::vector<SurfaceAOV> aovs(WIDTH * HEIGHT,
+        makeSurface(glm::vec3(0.8f), glm::vec3(0.0f, 1.0f, 0.0f)));
+
+    std::vector<glm::vec3> denoised = ATrousDenoiser::denoise(
+        color, {}, aovs, WIDTH, HEIGHT, ATrousDenoiser::Settings());
+
+    const std::vector<glm::vec3> flat(WIDTH * HEIGHT, glm::vec3(0.4f));
+    double mean = 0.0;
+    for (const glm::vec3 &pixel : denoised) {
+        mean += pixel.r;
+    }
+    mean /= static_cast<double>(denoised.size());
+    EXPECT_NEAR(mean, 0.4, 0.01);
+    EXPECT_LT(rmse(denoised, flat), rmse(color, flat) * 0.25);
+}
+
+TEST(ATrousDenoiserTest, StopsAtNormalAndAlbedoEdges)
+{
+    // Two walls meeting in the middle, the right one with a checkered
+    // texture under the same lighting
+    std::mt19937 rng(11);
+    std::vector<glm::vec3> color(WIDTH * HEIGHT);
+    std::vector<SurfaceAOV> aovs(WIDTH * HEIGHT);
+    for (int y = 0; y < HEIGHT; y++) {
+        for (int x = 0; x < WIDTH; x++) {
+            const int i = y * WIDTH + x;
+            if (x < WIDTH / 2) {
+                aovs[i] = makeSurface(
+                    glm::vec3(0.5f), glm::vec3(1.0f, 0.0f, 0.0f));
+                color[i] = noisy(0.1f, rng);
+            } else {
+                float albedo = (x + y) % 2 == 0 ? 0.2f : 0.9f;
+                aovs[i] = makeSurface(
+                    glm::vec3(albedo), glm::vec3(0.0f, 1.0f, 0.0f));
+                color[i] = noisy(albedo, rng);
+            }
+        }
+    }
+
+    std::vector<glm::vec3> denoised = ATrousDenoiser::denoise(
+        color, {}, aovs, WIDTH, HEIGHT, ATrousDenoiser::Settings());
+
+    for (int y = 0; y < HEIGHT; y++) {
+        for (int x = WIDTH / 2 - 2; x < WIDTH / 2 + 2; x++) {
+            const int i = y * WIDTH + x;
+            float expected = x < WIDTH / 2 ? 0.1f : aovs[i].albedo.r;
+            EXPECT_NEAR(denoised[i].r, expected, expected * 0.2f)
+                << "at " << x << ", " << y;
+        }
+    }
+}
+
+TEST(ATrousDenoiserTest, LowSampleRenderGetsCloserToTheReference)
+{
+    // The lamp is above the frame, its bright silhouette would not be
+    // noise the filter could remove
+    AnalyticalSphereData light {};
+    light.center = glm::vec3(0.0f, 6.0f, -4.0f);
+    light.radius = 2.0f;
+    light.emissive = glm::vec3(4.0f);
+    light.indexOfRefraction = 1.0f;
+    AnalyticalSphereData ball {};
+    ball.center = glm::vec3(1.0f, 1.0f, -4.0f);
+    ball.radius = 1.0f;
+    ball.color = glm::vec3(0.9f, 0.2f, 0.2f);
+    ball.indexOfRefraction = 1.0f;
+    AnalyticalPlaneData floor {};
+    floor.normal = glm::vec3(0.0f, 1.0f, 0.0f);
+    floor.color = glm::vec3(0.7f);
+    floor.indexOfRefraction = 1.0f;
+
+    auto render = [&](int samples, CPUPathTracer &tracer) {
+        tracer.setScene({}, {}, { light, ball }, { floor });
+        tracer.setCamera(PathTracingCamera::fromAngles(
+            glm::vec3(0.0f, 2.0f, 2.0f), glm::vec3(30.0f, 0.0f, 0.0f),
+            60.0f));
+        tracer.resize(96, 64);
+        for (int frame = 0; frame < samples; frame++) {
+            tracer.renderFrame();
+        }
+    };
+    CPUPathTracer reference;
+    render(128, reference);
+    CPUPathTracer preview;
+    render(4, preview);
+
+    ASSERT_EQ(preview.getAOVs().size(), preview.getImage().size());
+    std::vector<glm::vec3> denoised = ATrousDenoiser::denoise(
+        preview.getImage(), preview.getMoments(), preview.getAOVs(),
+        preview.getWidth(), preview.getHeight(), ATrousDenoiser::Settings());
+    // About what twice the samples would give
+    EXPECT_LT(rmse(denoised, reference.getImage()),
+        rmse(preview.getImage(), reference.getImage()) * 0.75);
+}
@@ -0,0 +1,139 @@
+/**
+ * @file test_light_table.cpp
+ * @brief Tests unitaires pour la table des lumieres de l'estimation directe
+ *
+ * Verifie que les lumieres sont tirees en proportion de leur puissance, que
+ * la densite d'un echantillon est celle recalculee au point touche, et que
+ * les densites sont normalisees (angle solide d'un triangle, eclairement
+ * d'une sphere).
+ */
+
+#include <gtest/gtest.h>
+#include <glm/glm.hpp>
+#include <cmath>
+
+#include "renderer/LightTable.hpp"
+
+namespace {
+
+constexpr float PI = 3.14159265359f;
+
+// Low-discrepancy point i of n in [0, 1)^3
+glm::vec3 samplePoint(int i, int n)
+{
+    return glm::vec3((static_cast<float>(i) + 0.5f) / static_cast<float>(n),
+        std::fmod(static_cast<float>(i) * 0.6180339887f, 1.0f),
+        std::fmod(static_cast<float>(i) * 0.7548776662f, 1.0f));
+}
+
+} // namespace
+
+TEST(LightTableTest, PicksLightsInProportionToTheirPower)
+{
+    LightTable table;
+    // Areas 0.5 and 1.5, the sphere emits nothing and is left out
+    table.addTriangle(glm::vec3(0.0f), glm::vec3(1.0f, 0.0f, 0.0f),
+        glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(1.0f));
+    table.addSphere(glm::vec3(5.0f), 1.0f, glm::vec3(0.0f));
+    table.addTriangle(glm::vec3(0.0f), glm::vec3(3.0f, 0.0f, 0.0f),
+        glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(1.0f));
+    table.addTriangle(glm::vec3(0.0f), glm::vec3(1.0f, 0.0f, 0.0f),
+        glm::vec3(2.0f, 0.0f, 0.0f), glm::vec3(1.0f));
+    table.finalize();
+
+    ASSERT_EQ(table.getLights().size(), 2u);
+    EXPECT_FLOAT_EQ(table.getTotalPower(), 2.0f);
+    EXPECT_FLOAT_EQ(table.getLights()[0].cdf, 0.25f);
+    EXPECT_FLOAT_EQ(table.getLights()[1].cdf, 1.0f);
+
+    int picks[2] = { 0, 0 };
+    const int n = 1000;
+    for (int i = 0; i < n; i++) {
+        picks[table.pick(samplePoint(i, n).x)]++;
+    }
+    EXPECT_EQ(picks[0], 250);
+    EXPECT_EQ(picks[1], 750);
+    EXPECT_EQ(table.pick(0.9999999f), 1);
+}
+
+TEST(LightTableTest, SamplePdfMatchesThePdfAtTheHitPoint)
+{
+    LightTable table;
+    const glm::vec3 v0(-1.0f, 4.0f, -1.0f);
+    const glm::vec3 v1(2.0f, 4.0f, -1.0f);
+    const glm::vec3 v2(0.0f, 5.0f, 2.0f);
+    const glm::vec3 center(3.0f, 2.0f, 0.0f);
+    table.addTriangle(v0, v1, v2, glm::vec3(2.0f, 1.0f, 0.5f));
+    table.addSphere(center, 0.5f, glm::vec3(4.0f));
+    table.finalize();
+
+    const glm::vec3 position(0.0f, 0.0f, 0.0f);
+    const glm::vec3 normal
+        = glm::normalize(glm::cross(v1 - v0, v2 - v0));
+    int sphereSamples = 0;
+    for (int i = 0; i < 200; i++) {
+        glm::vec3 u = samplePoint(i, 200);
+        LightSample s = table.sample(position, u.x, u.y, u.z);
+        ASSERT_GT(s.pdf, 0.0f);
+        EXPECT_NEAR(glm::length(s.direction), 1.0f, 1e-5f);
+        glm::vec3 point = position + s.direction * s.distance;
+
+        float pdf;
+        if (s.emissive == glm::vec3(4.0f)) {
+            sphereSamples++;
+            EXPECT_NEAR(glm::length(point - center), 0.5f, 1e-4f);
+            pdf = table.spherePdf(s.emissive, center, 0.5f, position);
+        } else {
+            EXPECT_NEAR(glm::dot(point - v0, normal), 0.0f, 1e-4f);
+            pdf = table.trianglePdf(s.emissive, s.distance,
+                std::abs(glm::dot(normal, s.direction)));
+        }
+        EXPECT_NEAR(s.pdf, pdf, pdf * 1e-4f);
+    }
+    EXPECT_GT(sphereSamples, 0);
+    EXPECT_LT(sphereSamples, 200);
+}
+
+TEST(LightTableTest, PdfsIntegrateToTheLightsSolidAngle)
+{
+    const int n = 20000;
+    const glm::vec3 position(0.0f);
+
+    // Solid angle of a triangle, from Van Oosterom and Strackee
+    LightTable triangle;
+    const glm::vec3 a(-1.0f, 2.0f, -1.0f);
+    const glm::vec3 b(1.5f, 2.0f, -1.0f);
+    const glm::vec3 c(0.0f, 3.0f, 1.5f);
+    triangle.addTriangle(a, b, c, glm::vec3(1.0f));
+    triangle.finalize();
+    double sum = 0.0;
+    for (int i = 0; i < n; i++) {
+        glm::vec3 u = samplePoint(i, n);
+        sum += 1.0 / triangle.sample(position, u.x, u.y, u.z).pdf;
+    }
+    float la = glm::length(a), lb = glm::length(b), lc = glm::length(c);
+    float expected = 2.0f
+        * std::atan2(std::abs(glm::dot(a, glm::cross(b, c))),
+            la * lb * lc + glm::dot(a, b) * lc + glm::dot(a, c) * lb
+                + glm::dot(b, c) * la);
+    EXPECT_NEAR(sum / n, expected, expected * 0.01f);
+
+    // Irradiance under a sphere straight above: pi * L * sin^2(half-angle)
+    LightTable sphere;
+    sphere.addSphere(glm::vec3(0.0f, 5.0f, 0.0f), 1.5f, glm::vec3(3.0f));
+    sphere.finalize();
+    sum = 0.0;
+    for (int i = 0; i < n; i++) {
+        glm::vec3 u = samplePoint(i, n);
+        LightSample s = sphere.sample(position, u.x, u.y, u.z);
+        sum += s.emissive.r * s.direction.y / s.pdf;
+    }
+    expected = PI * 3.0f * 0.09f;
+    EXPECT_NEAR(sum / n, expected, expected * 0.01f);
+
+    // Nothing is sampled from inside a sphere
+    EXPECT_EQ(sphere.sample(glm::vec3(0.0f, 5.5f, 0.0f), 0.5f, 0.5f, 0.5f)
+                  .pdf,
+        0.0f);
+    EXPECT_EQ(LightTable().sample(position, 0.5f, 0.5f, 0.5f).pdf, 0.0f);
+}
@@ -0,0 +1,178 @@
+/**
+ * @file test_render_checkpoint.cpp
+ * @brief Tests unitaires pour la reprise des rendus batch
+ *
+ * Verifie qu'un rendu repris depuis un checkpoint donne exactement l'image,
+ * les AOVs et les moments d'un rendu ininterrompu, et que les checkpoints
+ * d'une autre scene, d'une autre taille ou corrompus sont ignores sans
+ * toucher au path tracer.
+ */
+
+#include <gtest/gtest.h>
+#include <glm/glm.hpp>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "renderer/CPUPathTracer.hpp"
+#include "renderer/PathTracingData.hpp"
+#include "renderer/RenderCheckpoint.hpp"
+
+namespace {
+
+constexpr uint64_t KEY = 42;
+
+class RenderCheckpointTest : public ::testing::Test {
+protected:
+    void SetUp() override
+    {
+        m_path = std::filesystem::temp_directory_path()
+            / ("scenelab_checkpoint_test_"
+                + std::string(::testing::UnitTest::GetInstance()
+                        ->current_test_info()
+                        ->name())
+                + ".ckpt");
+        std::filesystem::remove(m_path);
+    }
+
+    void TearDown() override { std::filesystem::remove(m_path); }
+
+    static void setUpTracer(CPUPathTracer &tracer, int width, int height)
+    {
+        AnalyticalSphereData light {};
+        light.center = glm::vec3(0.0f, 6.0f, -4.0f);
+        light.radius = 2.0f;
+        light.emissive = glm::vec3(4.0f);
+        light.indexOfRefraction = 1.0f;
+
+        AnalyticalPlaneData floor {};
+        floor.normal = glm::vec3(0.0f, 1.0f, 0.0f);
+        floor.color = glm::vec3(0.7f);
+        floor.indexOfRefraction = 1.0f;
+
+        tracer.setScene({}, {}, { light }, { floor });
+        tracer.setCamera(PathTracingCamera::fromAngles(
+            glm::vec3(0.0f, 2.0f, 2.0f), glm::vec3(-10.0f, 0.0f, 0.0f),
+            60.0f));
+        tracer.resize(width, height);
+    }
+
+    std::filesystem::path m_path;
+};
+
+} // namespace
+
+TEST_F(RenderCheckpointTest, MissingFileIsIgnored)
+{
+    CPUPathTracer tracer;
+    setUpTracer(tracer, 16, 8);
+    EXPECT_FALSE(RenderCheckpoint::load(m_path, KEY, tracer));
+    EXPECT_EQ(tracer.getFrameCount(), 0);
+}
+
+TEST_F(RenderCheckpointTest, ResumedRenderMatchesUninterruptedRender)
+{
+    CPUPathTracer uninterrupted;
+    setUpTracer(uninterrupted, 24, 16);
+    for (int frame = 0; frame < 4; frame++) {
+        uninterrupted.renderFrame();
+    }
+
+    {
+        CPUPathTracer killed;
+        setUpTracer(killed, 24, 16);
+        killed.renderFrame();
+        killed.renderFrame();
+        ASSERT_TRUE(RenderCheckpoint::save(m_path, KEY, killed));
+    }
+
+    CPUPathTracer resumed;
+    setUpTracer(resumed, 24, 16);
+    ASSERT_TRUE(RenderCheckpoint::load(m_path, KEY, resumed));
+    EXPECT_EQ(resumed.getFrameCount(), 2);
+    resumed.renderFrame();
+    resumed.renderFrame();
+
+    EXPECT_EQ(resumed.getFrameCount(), 4);
+    EXPECT_EQ(resumed.getImage(), uninterrupted.getImage());
+    EXPECT_EQ(resumed.getMoments(), uninterrupted.getMoments());
+    ASSERT_EQ(resumed.getAOVs().size(), uninterrupted.getAOVs().size());
+    for (size_t i = 0; i < resumed.getAOVs().size(); i++) {
+        const SurfaceAOV &a = resumed.getAOVs()[i];
+        const SurfaceAOV &b = uninterrupted.getAOVs()[i];
+        EXPECT_EQ(a.albedo, b.albedo);
+        EXPECT_EQ(a.normal, b.normal);
+        EXPECT_EQ(a.depth, b.depth);
+    }
+}
+
+TEST_F(RenderCheckpointTest, CompleteCheckpointKeepsAOVs)
+{
+    CPUPathTracer source;
+    setUpTracer(source, 16, 8);
+    source.renderFrame();
+    ASSERT_TRUE(RenderCheckpoint::save(m_path, KEY, source));
+
+    // A finished job is denoised straight after loading, without a frame
+    CPUPathTracer resumed;
+    setUpTracer(resumed, 16, 8);
+    ASSERT_TRUE(RenderCheckpoint::load(m_path, KEY, resumed));
+    bool anyHit = false;
+    for (const SurfaceAOV &aov : resumed.getAOVs()) {
+        anyHit = anyHit || aov.depth > 0.0f;
+    }
+    EXPECT_TRUE(anyHit);
+    EXPECT_EQ(resumed.getMoments(), source.getMoments());
+}
+
+TEST_F(RenderCheckpointTest, ForeignCheckpointsAreIgnored)
+{
+    CPUPathTracer source;
+    setUpTracer(source, 16, 8);
+    source.renderFrame();
+    ASSERT_TRUE(RenderCheckpoint::save(m_path, KEY, source));
+
+    CPUPathTracer otherKey;
+    setUpTracer(otherKey, 16, 8);
+    EXPECT_FALSE(RenderCheckpoint::load(m_path, KEY + 1, otherKey));
+    EXPECT_EQ(otherKey.getFrameCount(), 0);
+
+    CPUPathTracer otherSize;
+    setUpTracer(otherSize, 8, 16);
+    EXPECT_FALSE(RenderCheckpoint::load(m_path, KEY, otherSize));
+    EXPECT_EQ(otherSize.getFrameCount(), 0);
+}
+
+TEST_F(RenderCheckpointTest, CorruptCheckpointsAreRejected)
+{
+    CPUPathTracer source;
+    setUpTracer(source, 16, 8);
+    source.renderFrame();
+    ASSERT_TRUE(RenderCheckpoint::save(m_path, KEY, source));
+    const auto size = std::filesystem::file_size(m_path);
+
+    // Flip one byte of the pixels
+    {
+        std::fstream file(m_path, std::ios::binary | std::ios::in
+                | std::ios::out);
+        file.seekg(static_cast<std::streamoff>(size - 5));
+        char byte = 0;
+        file.read(&byte, 1);
+        file.seekp(static_cast<std::streamoff>(size - 5));
+        byte = static_cast<char>(byte ^ 0x10);
+        file.write(&byte, 1);
+    }
+    CPUPathTracer flipped;
+    setUpTracer(flipped, 16, 8);
+    EXPECT_FALSE(RenderCheckpoint::load(m_path, KEY, flipped));
+    EXPECT_EQ(flipped.getFrameCount(), 0);
+
+    // Lose the end of the file
+    ASSERT_TRUE(RenderCheckpoint::save(m_path, KEY, source));
+    std::filesystem::resize_file(m_path, size - 12);
+    CPUPathTracer truncated;
+    setUpTracer(truncated, 16, 8);
+    EXPECT_FALSE(RenderCheckpoint::load(m_path, KEY, truncated));
+    EXPECT_EQ(truncated.getFrameCount(), 0);
+}
@@ -0,0 +1,80 @@
+/**
+ * @file test_resolution_scaler.cpp
+ * @brief Tests unitaires pour la resolution dynamique des vues path tracees
+ *
+ * Verifie que la vue reste en pleine resolution a l'arret, que l'echelle
+ * descend pendant un mouvement jusqu'a tenir le budget de temps par image
+ * sans osciller, et qu'elle revient a la pleine resolution quelques images
+ * apres l'arret.
+ */
+
+#include <gtest/gtest.h>
+#include <glm/glm.hpp>
+
+#include "renderer/ResolutionScaler.hpp"
+
+namespace {
+
+// Frame time of a view that takes fullFrameMs at full resolution
+float frameTime(float fullFrameMs, float scale)
+{
+    return fullFrameMs * scale * scale;
+}
+
+} // namespace
+
+TEST(ResolutionScalerTest, StaysAtFullResolutionWhenStill)
+{
+    ResolutionScaler scaler;
+    for (int frame = 0; frame < 10; frame++) {
+        EXPECT_FLOAT_EQ(scaler.update(false, 100.0f), 1.0f);
+    }
+    EXPECT_EQ(scaler.scaledSize(glm::ivec2(640, 480)), glm::ivec2(640, 480));
+}
+
+TEST(ResolutionScalerTest, MeetsTheBudgetWhileMovingWithoutFlipping)
+{
+    ResolutionScaler scaler;
+    const float budget = scaler.getSettings().frameBudgetMs;
+    float scale = 1.0f;
+    for (int frame = 0; frame < 4; frame++) {
+        scale = scaler.update(true, frameTime(60.0f, scale));
+    }
+    EXPECT_LE(frameTime(60.0f, scale), budget);
+    // Not lower than needed: a step up would break the budget
+    float nextStep = scale + scaler.getSettings().step;
+    EXPECT_GT(frameTime(60.0f, nextStep), budget * 0.9f);
+
+    // A little timing noise keeps the same resolution
+    for (int frame = 0; frame < 20; frame++) {
+        float noise = frame % 2 == 0 ? 1.05f : 0.95f;
+        EXPECT_FLOAT_EQ(
+            scaler.update(true, frameTime(60.0f, scale) * noise), scale);
+    }
+
+    // Unknown frame times keep it too
+    EXPECT_FLOAT_EQ(scaler.update(true, -1.0f), scale);
+}
+
+TEST(ResolutionScalerTest, GoesBackToFullResolutionOnceStill)
+{
+    ResolutionScaler scaler;
+    scaler.update(true, 64.0f);
+    ASSERT_LT(scaler.getScale(), 1.0f);
+
+    const int settleFrames = scaler.getSettings().settleFrames;
+    for (int frame = 1; frame < settleFrames; frame++) {
+        EXPECT_LT(scaler.update(false, -1.0f), 1.0f);
+    }
+    EXPECT_FLOAT_EQ(scaler.update(false, -1.0f), 1.0f);
+}
+
+TEST(ResolutionScalerTest, KeepsAtLeastTheMinimumScale)
+{
+    ResolutionScaler::Settings settings;
+    settings.minScale = 0.5f;
+    ResolutionScaler scaler(settings);
+    scaler.update(true, 10000.0f);
+    EXPECT_FLOAT_EQ(scaler.getScale(), 0.5f);
+    EXPECT_EQ(scaler.scaledSize(glm::ivec2(101, 1)), glm::ivec2(51, 1));
+}
@@ -0,0 +1,106 @@
+/**
+ * @file test_scene_description.cpp
+ * @brief Tests unitaires pour le format de scene des rendus batch
+ *
+ * Verifie la lecture des cameras, materiaux et primitives, le placement
+ * des maillages OBJ et le rejet des lignes mal formees.
+ */
+
+#include <gtest/gtest.h>
+#include <glm/glm.hpp>
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+#include "renderer/SceneDescription.hpp"
+
+TEST(SceneDescriptionTest, ParsesCamerasMaterialsAndPrimitives)
+{
+    const std::string text = "# Test scene\n"
+                             "camera main 0 1 5 -10 0 0 60\n"
+                             "camera top 0 10 0 -90 0 0\n"
+                             "material lamp color 0 0 0 emissive 4 4 4\n"
+                             "material glass specular 0.1 roughness 0 "
+                             "ior 1.5 refraction 0.9\n"
+                             "plane 0 0 0 0 2 0\n"
+                             "use lamp\n"
+                             "sphere 0 5 0 1.5 # light\n"
+                             "use glass\n"
+                             "triangle 0 0 0 1 0 0 0 1 0\n";
+
+    SceneDescription scene;
+    ASSERT_TRUE(scene.parse(text, "."));
+
+    ASSERT_EQ(scene.cameras.size(), 2u);
+    EXPECT_EQ(scene.cameras[0].name, "main");
+    EXPECT_EQ(scene.cameras[0].position, glm::vec3(0.0f, 1.0f, 5.0f));
+    EXPECT_EQ(scene.cameras[0].rotation, glm::vec3(-10.0f, 0.0f, 0.0f));
+    EXPECT_FLOAT_EQ(scene.cameras[0].fov, 60.0f);
+    EXPECT_FLOAT_EQ(scene.cameras[1].fov, 45.0f);
+    EXPECT_EQ(scene.findCamera(""), &scene.cameras[0]);
+    EXPECT_EQ(scene.findCamera("top"), &scene.cameras[1]);
+    EXPECT_EQ(scene.findCamera("missing"), nullptr);
+
+    ASSERT_EQ(scene.planes.size(), 1u);
+    EXPECT_EQ(scene.planes[0].normal, glm::vec3(0.0f, 1.0f, 0.0f));
+    EXPECT_EQ(scene.planes[0].color, glm::vec3(0.8f));
+
+    ASSERT_EQ(scene.spheres.size(), 1u);
+    EXPECT_FLOAT_EQ(scene.spheres[0].radius, 1.5f);
+    EXPECT_EQ(scene.spheres[0].emissive, glm::vec3(4.0f));
+    EXPECT_EQ(scene.spheres[0].color, glm::vec3(0.0f));
+
+    ASSERT_EQ(scene.triangles.size(), 1u);
+    const Triangle &tri = scene.triangles[0];
+    EXPECT_EQ(tri.normal, glm::vec3(0.0f, 0.0f, 1.0f));
+    ASSERT_LT(tri.materialIndex, scene.materials.size());
+    const MaterialData &glass = scene.materials[tri.materialIndex];
+    EXPECT_FLOAT_EQ(glass.indexOfRefraction, 1.5f);
+    EXPECT_FLOAT_EQ(glass.refractionChance, 0.9f);
+    EXPECT_FLOAT_EQ(glass.percentSpecular, 0.1f);
+    EXPECT_FLOAT_EQ(glass.roughness, 0.0f);
+}
+
+TEST(SceneDescriptionTest, PlacesMeshesRelativeToTheScene)
+{
+    const std::filesystem::path dir = std::filesystem::temp_directory_path()
+        / "scenelab_scene_description_test";
+    std::filesystem::create_directories(dir);
+    {
+        std::ofstream obj(dir / "quad.obj");
+        obj << "v 0 0 0\nv 1 0 0\nv 1 1 0\nv 0 1 0\n"
+               "f 1/1/1 2/2/1 3/3/1 4/4/1\n";
+    }
+
+    SceneDescription scene;
+    ASSERT_TRUE(scene.parse(
+        "mesh quad.obj scale 2 translate 10 0 0 rotate 0 0 90\n", dir));
+    std::filesystem::remove_all(dir);
+
+    ASSERT_EQ(scene.triangles.size(), 2u);
+    const Triangle &tri = scene.triangles[0];
+    EXPECT_EQ(tri.materialIndex, 0u);
+    EXPECT_EQ(scene.materials[0].color, glm::vec3(0.8f));
+    // Scaled by 2, turned a quarter around Z, then moved along X
+    EXPECT_NEAR(tri.v0.x, 10.0f, 1e-5f);
+    EXPECT_NEAR(tri.v1.x, 10.0f, 1e-5f);
+    EXPECT_NEAR(tri.v1.y, 2.0f, 1e-5f);
+    EXPECT_NEAR(tri.v2.x, 8.0f, 1e-5f);
+    EXPECT_NEAR(tri.v2.y, 2.0f, 1e-5f);
+    EXPECT_NEAR(tri.normal.z, 1.0f, 1e-5f);
+}
+
+TEST(SceneDescriptionTest, RejectsMalformedStatements)
+{
+    SceneDescription scene;
+    EXPECT_FALSE(scene.parse("sphere 0 0 0\n", "."));
+    EXPECT_FALSE(scene.parse("sphere 0 0 0 -1\n", "."));
+    EXPECT_FALSE(scene.parse("plane 0 0 0 0 0 0\n", "."));
+    EXPECT_FALSE(scene.parse("use unknown\n", "."));
+    EXPECT_FALSE(scene.parse("material m shininess 3\n", "."));
+    EXPECT_FALSE(scene.parse("camera c 0 0 0 0 0 0 180\n", "."));
+    EXPECT_FALSE(scene.parse("mesh missing.obj\n", "."));
+    EXPECT_FALSE(scene.parse("light 0 0 0\n", "."));
+    EXPECT_TRUE(scene.parse("\n# Only a comment\n", "."));
+    EXPECT_TRUE(scene.cameras.empty());
+}
@@ -0,0 +1,118 @@
+/**
+ * @file test_view_scheduler.cpp
+ * @brief Tests unitaires pour la repartition du budget GPU entre les vues
+ *
+ * Verifie que les vues cachees ne recoivent aucune passe, que le temps
+ * depense reste dans le budget par image, que la vue active et les vues
+ * encore bruitees en recoivent davantage, qu'une vue trop couteuse trace
+ * une image sur plusieurs et qu'une vue en mouvement trace a chaque image.
+ */
+
+#include <gtest/gtest.h>
+#include <vector>
+
+#include "renderer/ViewScheduler.hpp"
+
+namespace {
+
+ViewScheduler::ViewState makeView(int id, float passMs)
+{
+    ViewScheduler::ViewState view;
+    view.id = id;
+    view.visible = true;
+    view.pixels = 512 * 512;
+    view.passMs = passMs;
+    return view;
+}
+
+// Passes each view got over frames
+std::vector<int> runFrames(ViewScheduler &scheduler,
+    const std::vector<ViewScheduler::ViewState> &views, int frames)
+{
+    std::vector<int> passes(views.size(), 0);
+    for (int frame = 0; frame < frames; frame++) {
+        auto allocations = scheduler.schedule(views);
+        for (size_t i = 0; i < views.size(); i++) {
+            passes[i] += allocations[i].passes;
+        }
+    }
+    return passes;
+}
+
+} // namespace
+
+TEST(ViewSchedulerTest, HiddenViewsGetNothing)
+{
+    ViewScheduler scheduler;
+    std::vector<ViewScheduler::ViewState> views
+        = { makeView(1, 2.0f), makeView(2, 2.0f) };
+    views[1].visible = false;
+
+    auto allocations = scheduler.schedule(views);
+    EXPECT_GT(allocations[0].passes, 0);
+    EXPECT_FLOAT_EQ(
+        allocations[0].budgetMs, scheduler.getSettings().frameBudgetMs);
+    EXPECT_EQ(allocations[1].passes, 0);
+    EXPECT_FLOAT_EQ(allocations[1].budgetMs, 0.0f);
+}
+
+TEST(ViewSchedulerTest, StaysWithinTheFrameBudget)
+{
+    ViewScheduler scheduler;
+    const float budget = scheduler.getSettings().frameBudgetMs;
+    std::vector<ViewScheduler::ViewState> views
+        = { makeView(1, 3.0f), makeView(2, 5.0f), makeView(3, 1.5f) };
+    views[1].pixels = 256 * 256;
+
+    const int frames = 120;
+    float totalMs = 0.0f;
+    for (int frame = 0; frame < frames; frame++) {
+        auto allocations = scheduler.schedule(views);
+        float frameMs = 0.0f;
+        for (size_t i = 0; i < views.size(); i++) {
+            frameMs += static_cast<float>(allocations[i].passes)
+                * views[i].passMs;
+        }
+        // Savings let a view spend at most one pass ahead
+        EXPECT_LE(frameMs, budget + 3.0f + 5.0f + 1.5f);
+        totalMs += frameMs;
+    }
+    EXPECT_LE(totalMs / frames, budget);
+    EXPECT_GT(totalMs / frames, budget * 0.8f);
+}
+
+TEST(ViewSchedulerTest, FocusedAndNoisyViewsGetMorePasses)
+{
+    ViewScheduler scheduler;
+    std::vector<ViewScheduler::ViewState> views
+        = { makeView(1, 2.0f), makeView(2, 2.0f), makeView(3, 2.0f) };
+    views[0].focused = true;
+    views[2].convergedFraction = 1.0f;
+
+    std::vector<int> passes = runFrames(scheduler, views, 100);
+    EXPECT_GT(passes[0], passes[1] * 3);
+    EXPECT_GT(passes[1], passes[2] * 5);
+    EXPECT_GT(passes[2], 0);
+}
+
+TEST(ViewSchedulerTest, CostlyViewTracesEveryFewFrames)
+{
+    ViewScheduler scheduler;
+    const float budget = scheduler.getSettings().frameBudgetMs;
+    std::vector<ViewScheduler::ViewState> views = { makeView(1, 40.0f) };
+
+    std::vector<int> passes = runFrames(scheduler, views, 100);
+    EXPECT_NEAR(passes[0], 100.0f * budget / 40.0f, 1.0f);
+}
+
+TEST(ViewSchedulerTest, MovingViewTracesEveryFrame)
+{
+    ViewScheduler scheduler;
+    std::vector<ViewScheduler::ViewState> views
+        = { makeView(1, 40.0f), makeView(2, 40.0f) };
+    views[0].moving = true;
+
+    std::vector<int> passes = runFrames(scheduler, views, 20);
+    EXPECT_EQ(passes[0], 20);
+    EXPECT_LT(passes[1], 10);
+}
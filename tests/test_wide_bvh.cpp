@@ -0,0 +1,285 @@
+/**
+ * @file test_wide_bvh.cpp
+ * @brief Tests unitaires pour l'effondrement du BVH binaire en BVH4/BVH8
+ *
+ * Verifie que chaque primitive est referencee une seule fois, meme dans
+ * une feuille trop grande pour un seul enfant, que les bornes quantifiees
+ * restent conservatrices et qu'un parcours du BVH large trouve exactement
+ * les memes intersections que le BVH binaire.
+ */
+
+#include <gtest/gtest.h>
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include "renderer/BVH.hpp"
+#include "renderer/PathTracingData.hpp"
+#include "renderer/WideBVH.hpp"
+
+#include "random_triangles.hpp"
+
+namespace {
+
+bool contains(const AABB &outer, const AABB &inner)
+{
+    return outer.min.x <= inner.min.x && outer.min.y <= inner.min.y
+        && outer.min.z <= inner.min.z && outer.max.x >= inner.max.x
+        && outer.max.y >= inner.max.y && outer.max.z >= inner.max.z;
+}
+
+bool hitsBox(const glm::vec3 &origin, const glm::vec3 &invDir,
+    const AABB &box, float tMax)
+{
+    glm::vec3 t0 = (box.min - origin) * invDir;
+    glm::vec3 t1 = (box.max - origin) * invDir;
+    glm::vec3 tmin = glm::min(t0, t1);
+    glm::vec3 tmax = glm::max(t0, t1);
+    float enter = std::max(std::max(tmin.x, tmin.y), std::max(tmin.z, 0.0f));
+    float exit = std::min(std::min(tmax.x, tmax.y), std::min(tmax.z, tMax));
+    return enter <= exit;
+}
+
+// Moller-Trumbore, returns the hit distance or infinity
+float hitTriangle(
+    const glm::vec3 &origin, const glm::vec3 &dir, const Triangle &tri)
+{
+    glm::vec3 e1 = tri.v1 - tri.v0;
+    glm::vec3 e2 = tri.v2 - tri.v0;
+    glm::vec3 p = glm::cross(dir, e2);
+    float det = glm::dot(e1, p);
+    if (std::abs(det) < 1e-9f) {
+        return std::numeric_limits<float>::infinity();
+    }
+    float invDet = 1.0f / det;
+    glm::vec3 s = origin - tri.v0;
+    float u = glm::dot(s, p) * invDet;
+    glm::vec3 q = glm::cross(s, e1);
+    float v = glm::dot(dir, q) * invDet;
+    float t = glm::dot(e2, q) * invDet;
+    if (u < 0.0f || v < 0.0f || u + v > 1.0f || t <= 0.0f) {
+        return std::numeric_limits<float>::infinity();
+    }
+    return t;
+}
+
+struct Hit {
+    float t = std::numeric_limits<float>::infinity();
+    int triangle = -1;
+};
+
+void testTriangle(const glm::vec3 &origin, const glm::vec3 &dir,
+    const std::vector<Triangle> &triangles, int index, Hit &hit)
+{
+    float t = hitTriangle(origin, dir, triangles[index]);
+    if (t < hit.t || (t == hit.t && index < hit.triangle)) {
+        hit.t = t;
+        hit.triangle = index;
+    }
+}
+
+Hit traceBinary(const BVH &bvh, const std::vector<Triangle> &triangles,
+    const glm::vec3 &origin, const glm::vec3 &dir)
+{
+    Hit hit;
+    glm::vec3 invDir = 1.0f / dir;
+    std::vector<int> stack { 0 };
+    while (!stack.empty()) {
+        const BVHNode &node = bvh.getNodes()[stack.back()];
+        stack.pop_back();
+        if (!hitsBox(origin, invDir, node.bounds, hit.t)) {
+            continue;
+        }
+        if (node.isLeaf()) {
+            for (int i = 0; i < node.primitiveCount; i++) {
+                const BVHPrimitive &prim
+                    = bvh.getPrimitives()[node.primitiveStart + i];
+                testTriangle(
+                    origin, dir, triangles, prim.originalIndex, hit);
+            }
+        } else {
+            stack.push_back(node.rightChild);
+            stack.push_back(node.leftChild);
+        }
+    }
+    return hit;
+}
+
+Hit traceWide(const WideBVH &wide, const BVH &bvh,
+    const std::vector<Triangle> &triangles, const glm::vec3 &origin,
+    const glm::vec3 &dir)
+{
+    Hit hit;
+    glm::vec3 invDir = 1.0f / dir;
+    std::vector<int> stack { 0 };
+    while (!stack.empty()) {
+        const WideBVHNode &node = wide.getNodes()[stack.back()];
+        stack.pop_back();
+        int rank = 0;
+        int prim = node.primBase;
+        for (int slot = 0; slot < WIDE_BVH_MAX_WIDTH; slot++) {
+            const WideBVHChild &child = node.children[slot];
+            if (child.isEmpty()) {
+                continue;
+            }
+            bool inside = hitsBox(origin, invDir,
+                WideBVH::decodeChildBounds(node, slot), hit.t);
+            if (child.isInternal()) {
+                int childNode = node.childBase + rank++;
+                if (inside) {
+                    stack.push_back(childNode);
+                }
+                continue;
+            }
+            for (int i = 0; i < child.meta; i++, prim++) {
+                if (inside) {
+                    int index = wide.getPrimitiveOrder()[prim];
+                    testTriangle(origin, dir, triangles,
+                        bvh.getPrimitives()[index].originalIndex, hit);
+                }
+            }
+        }
+    }
+    return hit;
+}
+
+// Union of the primitive bounds below a wide node, checking on the way that
+// every decoded child box contains what it covers
+AABB checkSubtree(const WideBVH &wide, const BVH &bvh, int nodeIndex,
+    std::vector<int> &references)
+{
+    const WideBVHNode &node = wide.getNodes()[nodeIndex];
+    AABB total;
+    int rank = 0;
+    int prim = node.primBase;
+    for (int slot = 0; slot < WIDE_BVH_MAX_WIDTH; slot++) {
+        const WideBVHChild &child = node.children[slot];
+        if (child.isEmpty()) {
+            continue;
+        }
+        AABB covered;
+        if (child.isInternal()) {
+            covered = checkSubtree(
+                wide, bvh, node.childBase + rank++, references);
+        } else {
+            for (int i = 0; i < child.meta; i++, prim++) {
+                int index = wide.getPrimitiveOrder()[prim];
+                references[index]++;
+                covered.expand(bvh.getPrimitives()[index].bounds);
+            }
+        }
+        EXPECT_TRUE(
+            contains(WideBVH::decodeChildBounds(node, slot), covered));
+        total.expand(covered);
+    }
+    return total;
+}
+
+} // namespace
+
+TEST(WideBVHTest, EmptyBVHCollapsesToNothing)
+{
+    BVH bvh;
+    WideBVH wide;
+    wide.build(bvh, 8);
+    EXPECT_EQ(wide.getNodeCount(), 0);
+}
+
+TEST(WideBVHTest, SingleLeafBecomesOneChild)
+{
+    auto triangles = makeRandomTriangles(2, 1, 1.5f);
+    std::vector<AnalyticalSphereData> spheres;
+    BVH bvh;
+    bvh.build(triangles, spheres);
+    ASSERT_EQ(bvh.getNodeCount(), 1);
+
+    WideBVH wide;
+    wide.build(bvh, 4);
+    ASSERT_EQ(wide.getNodeCount(), 1);
+    EXPECT_EQ(wide.getNodes()[0].children[0].meta, 2);
+    EXPECT_TRUE(wide.getNodes()[0].children[1].isEmpty());
+}
+
+TEST(WideBVHTest, OversizedLeafIsSplitAcrossChildren)
+{
+    // Coincident triangles cannot be split, they all land in one leaf
+    std::vector<Triangle> triangles(70000);
+    for (auto &tri : triangles) {
+        tri.v0 = glm::vec3(0.0f);
+        tri.v1 = glm::vec3(1.0f, 0.0f, 0.0f);
+        tri.v2 = glm::vec3(0.0f, 1.0f, 0.0f);
+    }
+    std::vector<AnalyticalSphereData> spheres;
+    BVH bvh;
+    bvh.build(triangles, spheres);
+    ASSERT_EQ(bvh.getNodeCount(), 1);
+
+    WideBVH wide;
+    wide.build(bvh, 4);
+    std::vector<int> references(bvh.getPrimitiveCount(), 0);
+    checkSubtree(wide, bvh, 0, references);
+    for (int count : references) {
+        EXPECT_EQ(count, 1);
+    }
+}
+
+TEST(WideBVHTest, BoundsAreConservativeAndPrimitivesReferencedOnce)
+{
+    auto triangles = makeRandomTriangles(20000, 2, 1.5f);
+    std::vector<AnalyticalSphereData> spheres;
+    BVH bvh;
+    bvh.build(triangles, spheres);
+
+    for (int width : { 4, 8 }) {
+        WideBVH wide;
+        wide.build(bvh, width);
+        EXPECT_LT(wide.getNodeCount(), bvh.getNodeCount() / 2);
+
+        std::vector<int> references(bvh.getPrimitiveCount(), 0);
+        checkSubtree(wide, bvh, 0, references);
+        for (int count : references) {
+            EXPECT_EQ(count, 1);
+        }
+
+        for (const auto &node : wide.getNodes()) {
+            for (int slot = width; slot < WIDE_BVH_MAX_WIDTH; slot++) {
+                EXPECT_TRUE(node.children[slot].isEmpty());
+            }
+        }
+    }
+}
+
+TEST(WideBVHTest, TraversalMatchesBinaryTree)
+{
+    auto triangles = makeRandomTriangles(20000, 3, 1.5f);
+    std::vector<AnalyticalSphereData> spheres;
+    BVH bvh;
+    bvh.build(triangles, spheres);
+
+    std::mt19937 rng(4);
+    std::uniform_real_distribution<float> position(-60.0f, 60.0f);
+    std::uniform_real_distribution<float> direction(-1.0f, 1.0f);
+
+    for (int width : { 4, 8 }) {
+        WideBVH wide;
+        wide.build(bvh, width);
+
+        int hits = 0;
+        for (int ray = 0; ray < 2000; ray++) {
+            glm::vec3 origin(position(rng), position(rng), position(rng));
+            glm::vec3 dir = glm::normalize(
+                glm::vec3(direction(rng), direction(rng), direction(rng)));
+
+            Hit expected = traceBinary(bvh, triangles, origin, dir);
+            Hit actual = traceWide(wide, bvh, triangles, origin, dir);
+            ASSERT_EQ(actual.triangle, expected.triangle) << "ray " << ray;
+            if (expected.triangle >= 0) {
+                EXPECT_EQ(actual.t, expected.t);
+                hits++;
+            }
+        }
+        EXPECT_GT(hits, 100);
+    }
+}